@@ -0,0 +1,128 @@
+// SPDX-License-Identifier: MIT
+
+/// Throughput of crc32c() on the 1020 bytes of data of each physical page, against the byte-at-a-time table lookup
+/// that computed the page checksums before it (CRCpp's CRC::Calculate with a table).
+///
+/// Usage: Crc32cBenchmark [megabytes]   (default 256)
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#include "CRC32C.h"
+
+namespace
+{
+   /// Bytes of data in a physical page, the rest is the checksum
+   const size_t PageDataSize = 1020;
+
+   /// The CRC-32C table of the byte-at-a-time algorithm
+   struct ByteTable
+   {
+      uint32_t entries[256];
+
+      ByteTable()
+      {
+         for ( uint32_t i = 0; i < 256; ++i )
+         {
+            uint32_t crc = i;
+
+            for ( int bit = 0; bit < 8; ++bit )
+            {
+               crc = ( crc & 1 ) ? ( crc >> 1 ) ^ 0x82F63B78 : crc >> 1;
+            }
+
+            entries[i] = crc;
+         }
+      }
+   };
+
+   uint32_t crc32cByteTable( const void *data, size_t size )
+   {
+      static const ByteTable sTable;
+
+      auto bytes = static_cast<const uint8_t *>( data );
+      uint32_t crc = 0xFFFFFFFF;
+
+      for ( size_t i = 0; i < size; ++i )
+      {
+         crc = sTable.entries[( crc ^ bytes[i] ) & 0xFF] ^ ( crc >> 8 );
+      }
+
+      return ~crc;
+   }
+
+   /// Checksum every page of buffer, enough times to process totalBytes, and print the throughput
+   template <typename Function>
+   uint32_t measure( const char *name, Function function, const std::vector<char> &buffer, size_t totalBytes )
+   {
+      const size_t pages = buffer.size() / PageDataSize;
+      const size_t rounds = std::max<size_t>( 1, totalBytes / buffer.size() );
+
+      /// Combined so the work can't be optimized away
+      uint32_t combined = 0;
+
+      const auto start = std::chrono::steady_clock::now();
+
+      for ( size_t round = 0; round < rounds; ++round )
+      {
+         for ( size_t page = 0; page < pages; ++page )
+         {
+            combined ^= function( buffer.data() + page * PageDataSize, PageDataSize );
+         }
+      }
+
+      const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+      const double bytes = static_cast<double>( rounds * pages * PageDataSize );
+
+      std::cout << "  " << name << ": " << bytes / elapsed.count() / 1e9 << " GB/s" << std::endl;
+
+      return combined;
+   }
+}
+
+int main( int argc, char **argv )
+{
+   const size_t megabytes = ( argc > 1 ) ? static_cast<size_t>( std::atol( argv[1] ) ) : 256;
+
+   /// Check value of the CRC-32C catalogue
+   const char check[] = "123456789";
+
+   if ( ( e57::crc32c( check, 9 ) != 0xE3069283 ) || ( crc32cByteTable( check, 9 ) != 0xE3069283 ) )
+   {
+      std::cerr << "wrong CRC-32C of \"123456789\"" << std::endl;
+      return 1;
+   }
+
+   /// 1 MB of pages, small enough to stay in the cache so we measure the CRC and not the memory
+   std::vector<char> buffer( 1024 * PageDataSize );
+
+   for ( size_t i = 0; i < buffer.size(); ++i )
+   {
+      buffer[i] = static_cast<char>( ( i * 2654435761u ) >> 13 );
+   }
+
+   for ( size_t page = 0; page < 16; ++page )
+   {
+      const char *data = buffer.data() + page * PageDataSize;
+
+      if ( e57::crc32c( data, PageDataSize ) != crc32cByteTable( data, PageDataSize ) )
+      {
+         std::cerr << "crc32c() and the byte table disagree on page " << page << std::endl;
+         return 1;
+      }
+   }
+
+   std::cout << "CRC-32C of " << PageDataSize << "-byte pages, " << megabytes << " MB each:" << std::endl;
+
+   const size_t totalBytes = megabytes * 1024 * 1024;
+   uint32_t combined = 0;
+
+   combined ^= measure( "byte table", crc32cByteTable, buffer, totalBytes );
+   combined ^= measure( "crc32c()  ", e57::crc32c, buffer, totalBytes );
+
+   /// Both combined the same checksums, so this is 0
+   return ( combined == 0 ) ? 0 : 1;
+}
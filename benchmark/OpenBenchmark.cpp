@@ -0,0 +1,139 @@
+// SPDX-License-Identifier: MIT
+
+/// Latency of opening small files for reading, as batch jobs that go through thousands of tiles do: open, look at the
+/// header, close.  Measured with and without XML validation (ImageFile::Options::validateXml), which only makes a difference
+/// with Xerces.  The first pass over the tiles isn't measured, it lets the XML parser set itself up and fills the
+/// page cache.
+///
+/// Usage: OpenBenchmark [tiles] [directory]   (default 2000 tiles in the current directory, removed afterwards)
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "E57Format.h"
+
+using namespace e57;
+
+namespace
+{
+   /// A tile: one scan of a few points with the usual header fields
+   void writeTile( const std::string &fileName, int tile )
+   {
+      ImageFile imf( fileName, "w" );
+      StructureNode root = imf.root();
+
+      root.set( "formatName", StringNode( imf, "ASTM E57 3D Imaging Data File" ) );
+      root.set( "guid", StringNode( imf, "{tile-" + std::to_string( tile ) + "}" ) );
+
+      VectorNode data3D( imf, true );
+      root.set( "data3D", data3D );
+
+      StructureNode scan( imf );
+      data3D.append( scan );
+
+      scan.set( "guid", StringNode( imf, "{scan-" + std::to_string( tile ) + "}" ) );
+      scan.set( "name", StringNode( imf, "tile " + std::to_string( tile ) ) );
+
+      StructureNode prototype( imf );
+      prototype.set( "cartesianX", FloatNode( imf, 0.0, E57_SINGLE ) );
+      prototype.set( "cartesianY", FloatNode( imf, 0.0, E57_SINGLE ) );
+      prototype.set( "cartesianZ", FloatNode( imf, 0.0, E57_SINGLE ) );
+
+      VectorNode codecs( imf, true );
+      CompressedVectorNode points( imf, prototype, codecs );
+      scan.set( "points", points );
+
+      const size_t count = 100;
+      std::vector<float> x( count, 1.0f );
+      std::vector<float> y( count, 2.0f );
+      std::vector<float> z( count, 3.0f );
+
+      std::vector<SourceDestBuffer> buffers{ SourceDestBuffer( imf, "cartesianX", x.data(), count, true ),
+                                             SourceDestBuffer( imf, "cartesianY", y.data(), count, true ),
+                                             SourceDestBuffer( imf, "cartesianZ", z.data(), count, true ) };
+
+      CompressedVectorWriter writer = points.writer( buffers );
+      writer.write( count );
+      writer.close();
+
+      imf.close();
+   }
+
+   /// Open every tile and read a little of its header, and return the mean time per tile in microseconds
+   double openTiles( const std::vector<std::string> &fileNames, bool validateXml )
+   {
+      ImageFile::Options options;
+      options.validateXml = validateXml;
+
+      const auto start = std::chrono::steady_clock::now();
+
+      for ( const auto &fileName : fileNames )
+      {
+         ImageFile imf( fileName, "r", CHECKSUM_POLICY_ALL, options );
+
+         const VectorNode data3D( imf.root().get( "data3D" ) );
+
+         if ( data3D.childCount() != 1 )
+         {
+            throw std::runtime_error( fileName + " has no scan" );
+         }
+
+         imf.close();
+      }
+
+      const std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+
+      return elapsed.count() / static_cast<double>( fileNames.size() );
+   }
+}
+
+int main( int argc, char **argv )
+{
+   const int tiles = ( argc > 1 ) ? std::atoi( argv[1] ) : 2000;
+   const std::string directory = ( argc > 2 ) ? argv[2] : ".";
+
+   std::vector<std::string> fileNames;
+
+   try
+   {
+      for ( int tile = 0; tile < tiles; ++tile )
+      {
+         fileNames.push_back( directory + "/OpenBenchmark-" + std::to_string( tile ) + ".e57" );
+         writeTile( fileNames.back(), tile );
+      }
+
+#ifdef E57_BUILTIN_XML_PARSER
+      std::cout << "Built-in XML parser, ";
+#else
+      std::cout << "Xerces XML parser, ";
+#endif
+      std::cout << tiles << " tiles:" << std::endl;
+
+      openTiles( fileNames, true );
+
+      std::cout << "  validated:     " << openTiles( fileNames, true ) << " us per open" << std::endl;
+      std::cout << "  not validated: " << openTiles( fileNames, false ) << " us per open" << std::endl;
+   }
+   catch ( E57Exception &e )
+   {
+      e.report( __FILE__, __LINE__, static_cast<const char *>( __FUNCTION__ ) );
+      return 1;
+   }
+   catch ( std::exception &e )
+   {
+      std::cerr << e.what() << std::endl;
+      return 1;
+   }
+
+   for ( const auto &fileName : fileNames )
+   {
+      std::remove( fileName.c_str() );
+   }
+
+   return 0;
+}
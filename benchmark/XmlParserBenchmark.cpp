@@ -0,0 +1,175 @@
+// SPDX-License-Identifier: MIT
+
+/// Time to open a file whose XML section describes many scans and images, which is spent almost entirely parsing the
+/// XML and building the node tree.  Compare a build with E57_BUILTIN_XML_PARSER against one with Xerces.
+///
+/// Usage: XmlParserBenchmark [entries] [file]   (default 10000 data3D and 10000 images2D entries, written to
+///        XmlParserBenchmark.e57 in the current directory and removed afterwards)
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+#include "E57Format.h"
+
+using namespace e57;
+
+namespace
+{
+   /// A scan with the usual header fields and no points
+   StructureNode makeScan( ImageFile &imf, int entry )
+   {
+      StructureNode scan( imf );
+
+      scan.set( "guid", StringNode( imf, "{scan-" + std::to_string( entry ) + "}" ) );
+      scan.set( "name", StringNode( imf, "scan " + std::to_string( entry ) ) );
+
+      StructureNode pose( imf );
+      StructureNode rotation( imf );
+      rotation.set( "w", FloatNode( imf, 1.0 ) );
+      rotation.set( "x", FloatNode( imf, 0.0 ) );
+      rotation.set( "y", FloatNode( imf, 0.0 ) );
+      rotation.set( "z", FloatNode( imf, 0.0 ) );
+      pose.set( "rotation", rotation );
+
+      StructureNode translation( imf );
+      translation.set( "x", FloatNode( imf, entry * 10.0 ) );
+      translation.set( "y", FloatNode( imf, 0.0 ) );
+      translation.set( "z", FloatNode( imf, 0.0 ) );
+      pose.set( "translation", translation );
+      scan.set( "pose", pose );
+
+      StructureNode prototype( imf );
+      prototype.set( "cartesianX", ScaledIntegerNode( imf, 0, -100000, 100000, 0.001, 0.0 ) );
+      prototype.set( "cartesianY", ScaledIntegerNode( imf, 0, -100000, 100000, 0.001, 0.0 ) );
+      prototype.set( "cartesianZ", ScaledIntegerNode( imf, 0, -100000, 100000, 0.001, 0.0 ) );
+      prototype.set( "intensity", IntegerNode( imf, 0, 0, 255 ) );
+
+      VectorNode codecs( imf, true );
+      scan.set( "points", CompressedVectorNode( imf, prototype, codecs ) );
+
+      return scan;
+   }
+
+   /// An image with the usual header fields and a small JPEG blob
+   StructureNode makeImage( ImageFile &imf, int entry )
+   {
+      StructureNode image( imf );
+
+      image.set( "guid", StringNode( imf, "{image-" + std::to_string( entry ) + "}" ) );
+      image.set( "associatedData3DGuid", StringNode( imf, "{scan-" + std::to_string( entry ) + "}" ) );
+
+      StructureNode pinhole( imf );
+      pinhole.set( "jpegImage", BlobNode( imf, 16 ) );
+      pinhole.set( "imageWidth", IntegerNode( imf, 640, 0, 65535 ) );
+      pinhole.set( "imageHeight", IntegerNode( imf, 480, 0, 65535 ) );
+      pinhole.set( "focalLength", FloatNode( imf, 0.05 ) );
+      pinhole.set( "pixelWidth", FloatNode( imf, 0.00001 ) );
+      pinhole.set( "pixelHeight", FloatNode( imf, 0.00001 ) );
+      pinhole.set( "principalPointX", FloatNode( imf, 320.0 ) );
+      pinhole.set( "principalPointY", FloatNode( imf, 240.0 ) );
+      image.set( "pinholeRepresentation", pinhole );
+
+      return image;
+   }
+
+   void writeFile( const std::string &fileName, int entries )
+   {
+      ImageFile imf( fileName, "w" );
+      StructureNode root = imf.root();
+
+      root.set( "formatName", StringNode( imf, "ASTM E57 3D Imaging Data File" ) );
+      root.set( "guid", StringNode( imf, "{XmlParserBenchmark}" ) );
+
+      VectorNode data3D( imf, true );
+      root.set( "data3D", data3D );
+
+      VectorNode images2D( imf, true );
+      root.set( "images2D", images2D );
+
+      for ( int entry = 0; entry < entries; ++entry )
+      {
+         data3D.append( makeScan( imf, entry ) );
+         images2D.append( makeImage( imf, entry ) );
+      }
+
+      imf.close();
+   }
+
+   /// Open the file, check it has all its entries, and return the time it took in milliseconds
+   double openFile( const std::string &fileName, int entries, bool validateXml )
+   {
+      ImageFile::Options options;
+      options.validateXml = validateXml;
+
+      const auto start = std::chrono::steady_clock::now();
+
+      ImageFile imf( fileName, "r", CHECKSUM_POLICY_ALL, options );
+
+      const StructureNode root = imf.root();
+
+      if ( ( VectorNode( root.get( "data3D" ) ).childCount() != entries ) ||
+           ( VectorNode( root.get( "images2D" ) ).childCount() != entries ) )
+      {
+         throw std::runtime_error( fileName + " doesn't have all its entries" );
+      }
+
+      imf.close();
+
+      const std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+
+      return elapsed.count();
+   }
+}
+
+int main( int argc, char **argv )
+{
+   const int entries = ( argc > 1 ) ? std::atoi( argv[1] ) : 10000;
+   const std::string fileName = ( argc > 2 ) ? argv[2] : "XmlParserBenchmark.e57";
+
+   /// Best of a few opens, the first one also reads the file into the page cache
+   const int opens = 5;
+
+   try
+   {
+      writeFile( fileName, entries );
+
+#ifdef E57_BUILTIN_XML_PARSER
+      std::cout << "Built-in XML parser, ";
+#else
+      std::cout << "Xerces XML parser, ";
+#endif
+      std::cout << entries << " data3D and " << entries << " images2D entries:" << std::endl;
+
+      for ( bool validateXml : { true, false } )
+      {
+         double best = openFile( fileName, entries, validateXml );
+
+         for ( int open = 1; open < opens; ++open )
+         {
+            best = std::min( best, openFile( fileName, entries, validateXml ) );
+         }
+
+         std::cout << ( validateXml ? "  validated:     " : "  not validated: " ) << best << " ms per open"
+                   << std::endl;
+      }
+   }
+   catch ( E57Exception &e )
+   {
+      e.report( __FILE__, __LINE__, static_cast<const char *>( __FUNCTION__ ) );
+      return 1;
+   }
+   catch ( std::exception &e )
+   {
+      std::cerr << e.what() << std::endl;
+      return 1;
+   }
+
+   std::remove( fileName.c_str() );
+
+   return 0;
+}
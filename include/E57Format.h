@@ -100,6 +100,9 @@ namespace e57
       50; //! Only verify 50% of the checksums. The last block is always verified.
    const ReadChecksumPolicy CHECKSUM_POLICY_ALL = 100; //! Verify all checksums. This is the default. (slow)
 
+   //! @brief Default number of bytes of data packets an ImageFile keeps in memory for its readers (32 packets).
+   const uint64_t PACKET_CACHE_SIZE_DEFAULT = 32 * 64 * 1024;
+
    //! @brief The major version number of the Foundation API
    const int E57_FOUNDATION_API_MAJOR = 0;
 
@@ -175,6 +178,8 @@ protected:
    class IntegerNodeImpl;
    class Node;
    class NodeImpl;
+   class ParsedPathName;
+   class ParsedPathNameImpl;
    class ScaledIntegerNode;
    class ScaledIntegerNodeImpl;
    class SourceDestBuffer;
@@ -217,6 +222,25 @@ protected:
       //! \endcond
    };
 
+   class E57_DLL ParsedPathName
+   {
+   public:
+      ParsedPathName() = delete;
+      ParsedPathName( ImageFile destImageFile, const ustring &pathName );
+
+      ustring pathName() const;
+
+      //! \cond documentNonPublic   The following isn't part of the API, and isn't
+      //! documented.
+   private:
+      friend class StructureNode;
+      friend class VectorNode;
+
+      E57_OBJECT_IMPLEMENTATION( ParsedPathName ) // Internal implementation details, not part of API, must
+                                                  // be last in object
+      //! \endcond
+   };
+
    class E57_DLL StructureNode
    {
    public:
@@ -225,8 +249,10 @@ protected:
 
       int64_t childCount() const;
       bool isDefined( const ustring &pathName ) const;
+      bool isDefined( const ParsedPathName &pathName ) const;
       Node get( int64_t index ) const;
       Node get( const ustring &pathName ) const;
+      Node get( const ParsedPathName &pathName ) const;
       void set( const ustring &pathName, const Node &n );
 
       // Up/Down cast conversion
@@ -268,8 +294,10 @@ protected:
 
       int64_t childCount() const;
       bool isDefined( const ustring &pathName ) const;
+      bool isDefined( const ParsedPathName &pathName ) const;
       Node get( int64_t index ) const;
       Node get( const ustring &pathName ) const;
+      Node get( const ParsedPathName &pathName ) const;
       void append( const Node &n );
 
       // Up/Down cast conversion
@@ -340,6 +368,10 @@ protected:
       //! \cond documentNonPublic   The following isn't part of the API, and isn't
       //! documented.
    private:
+      friend class CompressedVectorReaderImpl;
+
+      SourceDestBuffer( std::shared_ptr<SourceDestBufferImpl> ni ); // internal use only
+
       E57_OBJECT_IMPLEMENTATION( SourceDestBuffer ) // Internal implementation details, not part of
                                                     // API, must be last in object
       //! \endcond
@@ -348,11 +380,25 @@ protected:
    class E57_DLL CompressedVectorReader
    {
    public:
+      //! @brief How a CompressedVectorReader decodes and loads data packets, see CompressedVectorNode::reader().
+      //! The defaults are those of a reader created without Options.
+      struct Options
+      {
+         //! Number of threads used to decode the fields of each data packet. 1 decodes everything on the calling
+         //! thread, 0 uses one thread per processor core.
+         unsigned threadCount = 1;
+
+         //! Number of data packets to load ahead on a background thread while read() decodes the current one. 0
+         //! reads packets only when they are needed.
+         unsigned prefetchDepth = 0;
+      };
+
       CompressedVectorReader() = delete;
 
       unsigned read();
       unsigned read( std::vector<SourceDestBuffer> &dbufs );
-      void seek( int64_t recordNumber ); // !!! not implemented yet
+      unsigned readParallel( unsigned threadCount = 0 );
+      void seek( int64_t recordNumber );
       void close();
       bool isOpen();
       CompressedVectorNode compressedVectorNode() const;
@@ -375,6 +421,19 @@ protected:
    class E57_DLL CompressedVectorWriter
    {
    public:
+      //! @brief How a CompressedVectorWriter encodes and writes data packets, see CompressedVectorNode::writer().
+      //! The defaults are those of a writer created without Options.
+      struct Options
+      {
+         //! Number of threads used to encode the fields of the records written. 1 encodes everything on the calling
+         //! thread, 0 uses one thread per processor core.
+         unsigned threadCount = 1;
+
+         //! Number of data packets that can be waiting to be written to the file by a background thread while the
+         //! next ones are encoded. 0 writes each data packet as soon as it is full.
+         unsigned writeBehindDepth = 0;
+      };
+
       CompressedVectorWriter() = delete;
 
       void write( const size_t recordCount );
@@ -410,7 +469,11 @@ protected:
 
       // Iterators
       CompressedVectorWriter writer( std::vector<SourceDestBuffer> &sbufs );
+      CompressedVectorWriter writer( std::vector<SourceDestBuffer> &sbufs,
+                                     const CompressedVectorWriter::Options &options );
       CompressedVectorReader reader( const std::vector<SourceDestBuffer> &dbufs );
+      CompressedVectorReader reader( const std::vector<SourceDestBuffer> &dbufs,
+                                     const CompressedVectorReader::Options &options );
 
       // Up/Down cast conversion
       operator Node() const;
@@ -644,9 +707,50 @@ protected:
    class E57_DLL ImageFile
    {
    public:
+      //! @brief How an ImageFile keeps data packets and reads its XML section, set when it is opened.
+      //! The defaults are those of the constructors without Options.
+      struct Options
+      {
+         //! Number of bytes of data packets kept in memory once read and verified. The cache is shared by all the
+         //! CompressedVectorReaders of the ImageFile, so readers of the same data don't read it again. 0 keeps only
+         //! the packets being decoded.
+         uint64_t packetCacheSize = PACKET_CACHE_SIZE_DEFAULT;
+
+         //! In read mode, let the XML parser validate the XML section against the schema or DTD it names. Only turn
+         //! this off for files you trust, it makes opening them a little faster. The built-in XML parser (the
+         //! E57_BUILTIN_XML_PARSER build option) never validates.
+         bool validateXml = true;
+
+         //! In read mode, only build the root and its children when the file is opened. The children of the other
+         //! Structure and Vector nodes are found in the XML section but only read the first time they are used, so
+         //! opening the file and the memory it takes depend on how much of the metadata is used rather than on how
+         //! much there is. Errors in the XML of those children are reported when they are first used rather than by
+         //! the constructor. Only the built-in XML parser supports it, Xerces always builds the whole tree.
+         bool lazyMetadata = false;
+
+         //! In read mode, an existing directory where a binary copy of the metadata tree is kept after the XML
+         //! section is parsed. The next opens of the same file build the tree from that copy without parsing any
+         //! XML, as long as the name, size and modification time of the file and the checksum of its XML section
+         //! haven't changed; otherwise the XML is parsed again and the copy replaced. Failing to read or write the
+         //! copy never makes opening fail. A tree read from the copy is always complete, so lazyMetadata is ignored
+         //! when a directory is given. Empty (the default) turns the cache off. Ignored for files read from memory.
+         ustring metadataCacheDirectory;
+
+         //! In read mode, map the whole file into memory and read it from there instead of with a system call per
+         //! read, which is faster for files in the page cache or on a local drive. Off by default: an error reading a
+         //! mapped page isn't reported as an E57Exception but kills the process with SIGBUS. This happens if the file
+         //! is truncated or rewritten by another process while it is open, or if the file system can't deliver the
+         //! page, which network file systems such as NFS or SMB do when the server goes away. Only use it for local
+         //! files that nothing else modifies. Ignored where the platform can't map files (Windows).
+         bool memoryMapped = false;
+      };
+
       ImageFile() = delete;
       ImageFile( const ustring &fname, const ustring &mode, ReadChecksumPolicy checksumPolicy = CHECKSUM_POLICY_ALL );
+      ImageFile( const ustring &fname, const ustring &mode, ReadChecksumPolicy checksumPolicy,
+                 const Options &options );
       ImageFile( const char *input, const uint64_t size, ReadChecksumPolicy checksumPolicy = CHECKSUM_POLICY_ALL );
+      ImageFile( const char *input, const uint64_t size, ReadChecksumPolicy checksumPolicy, const Options &options );
 
       StructureNode root() const;
       void close();
@@ -690,6 +794,7 @@ protected:
       friend class FloatNode;
       friend class StringNode;
       friend class BlobNode;
+      friend class CompressedVectorReaderImpl;
 
       ImageFile( std::shared_ptr<ImageFileImpl> imfi ); // internal use only
 
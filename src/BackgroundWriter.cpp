@@ -0,0 +1,130 @@
+// SPDX-License-Identifier: MIT
+
+#include "BackgroundWriter.h"
+
+using namespace e57;
+
+BackgroundWriter::BackgroundWriter( WriteFunction write, unsigned bufferCount, size_t bufferSize ) :
+   write_( std::move( write ) ), buffers_( bufferCount, std::vector<char>( bufferSize ) ), requests_( bufferCount )
+{
+   worker_ = std::thread( &BackgroundWriter::workerLoop, this );
+}
+
+BackgroundWriter::~BackgroundWriter()
+{
+   {
+      std::lock_guard<std::mutex> lock( mutex_ );
+      stopping_ = true;
+   }
+
+   workReady_.notify_one();
+
+   worker_.join();
+}
+
+char *BackgroundWriter::buffer()
+{
+   std::unique_lock<std::mutex> lock( mutex_ );
+
+   workDone_.wait( lock, [this] { return queued_ < buffers_.size() || error_; } );
+
+   if ( error_ )
+   {
+      std::rethrow_exception( error_ );
+   }
+
+   return buffers_[( first_ + queued_ ) % buffers_.size()].data();
+}
+
+void BackgroundWriter::queue( uint64_t offset, size_t count )
+{
+   {
+      std::lock_guard<std::mutex> lock( mutex_ );
+
+      if ( error_ )
+      {
+         std::rethrow_exception( error_ );
+      }
+
+      requests_[( first_ + queued_ ) % buffers_.size()] = { offset, count };
+      ++queued_;
+   }
+
+   workReady_.notify_one();
+}
+
+void BackgroundWriter::wait()
+{
+   std::unique_lock<std::mutex> lock( mutex_ );
+
+   workDone_.wait( lock, [this] { return queued_ == 0; } );
+
+   if ( error_ )
+   {
+      std::rethrow_exception( error_ );
+   }
+}
+
+void BackgroundWriter::checkError()
+{
+   std::lock_guard<std::mutex> lock( mutex_ );
+
+   if ( error_ )
+   {
+      std::rethrow_exception( error_ );
+   }
+}
+
+void BackgroundWriter::workerLoop()
+{
+   while ( true )
+   {
+      Request request;
+      const char *buf;
+      bool failed;
+
+      {
+         std::unique_lock<std::mutex> lock( mutex_ );
+
+         workReady_.wait( lock, [this] { return stopping_ || queued_ > 0; } );
+
+         /// Only stop once everything queued is written
+         if ( queued_ == 0 )
+         {
+            return;
+         }
+
+         request = requests_[first_];
+         buf = buffers_[first_].data();
+         failed = static_cast<bool>( error_ );
+      }
+
+      std::exception_ptr error;
+
+      if ( !failed )
+      {
+         try
+         {
+            write_( request.offset, buf, request.count );
+         }
+         catch ( ... )
+         {
+            error = std::current_exception();
+         }
+      }
+
+      {
+         std::lock_guard<std::mutex> lock( mutex_ );
+
+         if ( error )
+         {
+            error_ = error;
+         }
+
+         first_ = ( first_ + 1 ) % buffers_.size();
+         --queued_;
+      }
+
+      workDone_.notify_all();
+   }
+}
@@ -0,0 +1,74 @@
+#pragma once
+// SPDX-License-Identifier: MIT
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace e57
+{
+   /// Writes a series of buffers on a worker thread, in the order they were queued.
+   ///
+   /// The caller fills buffer(), hands it over with queue() and goes on filling the next buffer while the previous
+   /// ones are written.  There are bufferCount buffers, so buffer() waits while all of them are queued.  If a write
+   /// throws, the ones queued after it are dropped, and the exception is rethrown by every later call to buffer(),
+   /// queue(), wait(), or checkError().
+   class BackgroundWriter
+   {
+   public:
+      using WriteFunction = std::function<void( uint64_t offset, const char *buf, size_t count )>;
+
+      BackgroundWriter( WriteFunction write, unsigned bufferCount, size_t bufferSize );
+
+      /// Finishes the queued writes, ignoring errors
+      ~BackgroundWriter();
+
+      BackgroundWriter( const BackgroundWriter & ) = delete;
+      BackgroundWriter &operator=( const BackgroundWriter & ) = delete;
+
+      /// Next buffer to fill, bufferSize bytes long
+      char *buffer();
+
+      /// Write count bytes of the buffer returned by buffer() at offset
+      void queue( uint64_t offset, size_t count );
+
+      /// Wait until all queued writes are done
+      void wait();
+
+      void checkError();
+
+      bool isWorkerThread() const
+      {
+         return std::this_thread::get_id() == worker_.get_id();
+      }
+
+   private:
+      struct Request
+      {
+         uint64_t offset;
+         size_t count;
+      };
+
+      void workerLoop();
+
+      WriteFunction write_;
+
+      std::vector<std::vector<char>> buffers_;
+      std::vector<Request> requests_; ///< [buffer]
+      size_t first_ = 0;              ///< buffer of the oldest queued write
+      size_t queued_ = 0;             ///< writes queued or in progress
+
+      std::mutex mutex_;
+      std::condition_variable workReady_;
+      std::condition_variable workDone_;
+      bool stopping_ = false;
+      std::exception_ptr error_;
+
+      std::thread worker_;
+   };
+}
@@ -0,0 +1,311 @@
+// SPDX-License-Identifier: MIT
+
+#include <cstring>
+
+#include "BitUnpack.h"
+#include "CpuFeatures.h"
+
+#if defined( __x86_64__ ) || defined( _M_X64 )
+#define E57_BITUNPACK_X86
+#include <immintrin.h>
+#if defined( _MSC_VER )
+#define E57_TARGET_SSE41
+#define E57_TARGET_AVX2
+#else
+#define E57_TARGET_SSE41 __attribute__( ( target( "ssse3,sse4.1" ) ) )
+#define E57_TARGET_AVX2 __attribute__( ( target( "avx2" ) ) )
+#endif
+#endif
+
+using namespace e57;
+
+namespace
+{
+   /// All kernels get data pointing at the byte holding the first bit of the first value, and the position (0 to 7)
+   /// of that bit in the byte.  Kernels specialized for one width ignore bits.
+   using UnpackFunction = void ( * )( const uint8_t *data, unsigned phase, unsigned bits, size_t count,
+                                      uint32_t *out );
+
+   inline uint64_t load64( const uint8_t *data )
+   {
+      uint64_t word;
+      memcpy( &word, data, sizeof( word ) );
+
+      return word;
+   }
+
+   /// Load the 8 bytes starting with the first byte of each value, shift the value down and mask it.  Works for any
+   /// width up to 57 bits, and the compiler does much better when bits is a constant.
+   inline void unpackShifted( const uint8_t *data, unsigned phase, unsigned bits, size_t count, uint32_t *out )
+   {
+      const uint64_t mask = ( uint64_t( 1 ) << bits ) - 1;
+
+      size_t bit = phase;
+
+      for ( size_t i = 0; i < count; ++i )
+      {
+         out[i] = static_cast<uint32_t>( ( load64( data + bit / 8 ) >> ( bit % 8 ) ) & mask );
+
+         bit += bits;
+      }
+   }
+
+   void unpackGeneric( const uint8_t *data, unsigned phase, unsigned bits, size_t count, uint32_t *out )
+   {
+      unpackShifted( data, phase, bits, count, out );
+   }
+
+   template <unsigned Bits>
+   void unpackScalar( const uint8_t *data, unsigned phase, unsigned /*bits*/, size_t count, uint32_t *out )
+   {
+      if ( ( Bits == 8 || Bits == 16 || Bits == 32 ) && ( phase == 0 ) )
+      {
+         /// Values are whole words, just widen them
+         constexpr size_t Bytes = Bits / 8;
+
+         for ( size_t i = 0; i < count; ++i )
+         {
+            uint32_t value = 0;
+            memcpy( &value, data + i * Bytes, Bytes );
+
+            out[i] = value;
+         }
+         return;
+      }
+
+      unpackShifted( data, phase, Bits, count, out );
+   }
+
+#ifdef E57_BITUNPACK_X86
+   /// The SIMD kernels work on groups of 8 values.  A group takes exactly bits bytes, so every group starts at the
+   /// same bit position (phase) within its first byte, and the same shuffle gathers the values of every group.
+   ///
+   /// Each value is moved into a 32-bit lane with pshufb, then shifted down and masked.  Shifts are at most 7, so a
+   /// value of up to 25 bits is always within the 4 bytes copied into its lane.  Lanes 0-3 are gathered from the 16
+   /// bytes at the start of the group, lanes 4-7 from the 16 bytes starting at byte secondHalf of the group.
+   struct GroupLayout
+   {
+      static constexpr unsigned MaxBits = 25;
+
+      alignas( 32 ) uint8_t shuffle[32];
+      alignas( 32 ) uint32_t shift[8];
+
+      /// 1 << ( 7 - shift ), SSE 4.1 has no per-lane shift so we multiply every value up to bit 7 instead
+      alignas( 32 ) uint32_t multiplier[8];
+
+      unsigned secondHalf;
+
+      GroupLayout( unsigned phase, unsigned bits ) : secondHalf( ( phase + 4 * bits ) / 8 )
+      {
+         for ( unsigned lane = 0; lane < 8; ++lane )
+         {
+            const unsigned bit = phase + lane * bits;
+            const unsigned firstByte = bit / 8 - ( ( lane < 4 ) ? 0 : secondHalf );
+
+            for ( unsigned i = 0; i < 4; ++i )
+            {
+               shuffle[4 * lane + i] = static_cast<uint8_t>( firstByte + i );
+            }
+
+            shift[lane] = bit % 8;
+            multiplier[lane] = 1u << ( 7 - bit % 8 );
+         }
+      }
+   };
+
+   /// Bits is the width the kernel is specialized for, 0 for a kernel using bits
+   template <unsigned Bits>
+   E57_TARGET_SSE41 void unpackSse41( const uint8_t *data, unsigned phase, unsigned bits, size_t count, uint32_t *out )
+   {
+      const unsigned width = ( Bits != 0 ) ? Bits : bits;
+      const size_t groupCount = count / 8;
+
+      if ( ( width % 8 == 0 ) && ( phase == 0 ) && ( width <= 16 ) )
+      {
+         for ( size_t group = 0; group < groupCount; ++group )
+         {
+            __m128i low;
+            __m128i high;
+
+            if ( width == 8 )
+            {
+               const __m128i bytes = _mm_loadl_epi64( reinterpret_cast<const __m128i *>( data ) );
+
+               low = _mm_cvtepu8_epi32( bytes );
+               high = _mm_cvtepu8_epi32( _mm_srli_si128( bytes, 4 ) );
+            }
+            else
+            {
+               const __m128i words = _mm_loadu_si128( reinterpret_cast<const __m128i *>( data ) );
+
+               low = _mm_cvtepu16_epi32( words );
+               high = _mm_cvtepu16_epi32( _mm_srli_si128( words, 8 ) );
+            }
+
+            _mm_storeu_si128( reinterpret_cast<__m128i *>( out ), low );
+            _mm_storeu_si128( reinterpret_cast<__m128i *>( out + 4 ), high );
+
+            data += width;
+            out += 8;
+         }
+      }
+      else
+      {
+         const GroupLayout layout( phase, width );
+
+         const __m128i shuffleLow = _mm_load_si128( reinterpret_cast<const __m128i *>( layout.shuffle ) );
+         const __m128i shuffleHigh = _mm_load_si128( reinterpret_cast<const __m128i *>( layout.shuffle + 16 ) );
+         const __m128i multiplierLow = _mm_load_si128( reinterpret_cast<const __m128i *>( layout.multiplier ) );
+         const __m128i multiplierHigh = _mm_load_si128( reinterpret_cast<const __m128i *>( layout.multiplier + 4 ) );
+         const __m128i mask = _mm_set1_epi32( static_cast<int>( ( 1u << width ) - 1 ) );
+
+         for ( size_t group = 0; group < groupCount; ++group )
+         {
+            __m128i low = _mm_loadu_si128( reinterpret_cast<const __m128i *>( data ) );
+            __m128i high = _mm_loadu_si128( reinterpret_cast<const __m128i *>( data + layout.secondHalf ) );
+
+            low = _mm_mullo_epi32( _mm_shuffle_epi8( low, shuffleLow ), multiplierLow );
+            high = _mm_mullo_epi32( _mm_shuffle_epi8( high, shuffleHigh ), multiplierHigh );
+
+            low = _mm_and_si128( _mm_srli_epi32( low, 7 ), mask );
+            high = _mm_and_si128( _mm_srli_epi32( high, 7 ), mask );
+
+            _mm_storeu_si128( reinterpret_cast<__m128i *>( out ), low );
+            _mm_storeu_si128( reinterpret_cast<__m128i *>( out + 4 ), high );
+
+            data += width;
+            out += 8;
+         }
+      }
+
+      unpackShifted( data, phase, width, count % 8, out );
+   }
+
+   template <unsigned Bits>
+   E57_TARGET_AVX2 void unpackAvx2( const uint8_t *data, unsigned phase, unsigned bits, size_t count, uint32_t *out )
+   {
+      const unsigned width = ( Bits != 0 ) ? Bits : bits;
+      const size_t groupCount = count / 8;
+
+      if ( ( width % 8 == 0 ) && ( phase == 0 ) && ( width <= 16 ) )
+      {
+         for ( size_t group = 0; group < groupCount; ++group )
+         {
+            __m256i values;
+
+            if ( width == 8 )
+            {
+               values = _mm256_cvtepu8_epi32( _mm_loadl_epi64( reinterpret_cast<const __m128i *>( data ) ) );
+            }
+            else
+            {
+               values = _mm256_cvtepu16_epi32( _mm_loadu_si128( reinterpret_cast<const __m128i *>( data ) ) );
+            }
+
+            _mm256_storeu_si256( reinterpret_cast<__m256i *>( out ), values );
+
+            data += width;
+            out += 8;
+         }
+      }
+      else
+      {
+         const GroupLayout layout( phase, width );
+
+         const __m256i shuffle = _mm256_load_si256( reinterpret_cast<const __m256i *>( layout.shuffle ) );
+         const __m256i shift = _mm256_load_si256( reinterpret_cast<const __m256i *>( layout.shift ) );
+         const __m256i mask = _mm256_set1_epi32( static_cast<int>( ( 1u << width ) - 1 ) );
+
+         for ( size_t group = 0; group < groupCount; ++group )
+         {
+            const __m128i low = _mm_loadu_si128( reinterpret_cast<const __m128i *>( data ) );
+            const __m128i high = _mm_loadu_si128( reinterpret_cast<const __m128i *>( data + layout.secondHalf ) );
+
+            __m256i values = _mm256_inserti128_si256( _mm256_castsi128_si256( low ), high, 1 );
+
+            values = _mm256_shuffle_epi8( values, shuffle );
+            values = _mm256_and_si256( _mm256_srlv_epi32( values, shift ), mask );
+
+            _mm256_storeu_si256( reinterpret_cast<__m256i *>( out ), values );
+
+            data += width;
+            out += 8;
+         }
+      }
+
+      unpackShifted( data, phase, width, count % 8, out );
+   }
+#endif
+
+   struct Kernels
+   {
+      UnpackFunction byWidth[33]; ///< [bits per value]
+   };
+
+   /// Pick the fastest kernels this CPU supports
+   Kernels selectKernels()
+   {
+      Kernels kernels = {};
+
+      for ( unsigned bits = 1; bits <= 32; ++bits )
+      {
+         kernels.byWidth[bits] = unpackGeneric;
+      }
+
+      kernels.byWidth[8] = unpackScalar<8>;
+      kernels.byWidth[11] = unpackScalar<11>;
+      kernels.byWidth[12] = unpackScalar<12>;
+      kernels.byWidth[16] = unpackScalar<16>;
+      kernels.byWidth[20] = unpackScalar<20>;
+      kernels.byWidth[24] = unpackScalar<24>;
+      kernels.byWidth[32] = unpackScalar<32>;
+
+      /// 32-bit values are a plain copy, which the scalar kernel already does at memory speed
+#ifdef E57_BITUNPACK_X86
+      if ( cpuFeatures().avx2 )
+      {
+         for ( unsigned bits = 1; bits <= GroupLayout::MaxBits; ++bits )
+         {
+            kernels.byWidth[bits] = unpackAvx2<0>;
+         }
+
+         kernels.byWidth[8] = unpackAvx2<8>;
+         kernels.byWidth[11] = unpackAvx2<11>;
+         kernels.byWidth[12] = unpackAvx2<12>;
+         kernels.byWidth[16] = unpackAvx2<16>;
+         kernels.byWidth[20] = unpackAvx2<20>;
+         kernels.byWidth[24] = unpackAvx2<24>;
+      }
+      else if ( cpuFeatures().sse41 )
+      {
+         for ( unsigned bits = 1; bits <= GroupLayout::MaxBits; ++bits )
+         {
+            kernels.byWidth[bits] = unpackSse41<0>;
+         }
+
+         kernels.byWidth[8] = unpackSse41<8>;
+         kernels.byWidth[11] = unpackSse41<11>;
+         kernels.byWidth[12] = unpackSse41<12>;
+         kernels.byWidth[16] = unpackSse41<16>;
+         kernels.byWidth[20] = unpackSse41<20>;
+         kernels.byWidth[24] = unpackSse41<24>;
+      }
+#endif
+
+      return kernels;
+   }
+
+   const Kernels &kernels()
+   {
+      static const Kernels sKernels = selectKernels();
+
+      return sKernels;
+   }
+}
+
+void e57::unpackBits( const char *data, size_t firstBit, unsigned bitsPerValue, size_t count, uint32_t *out )
+{
+   const auto bytes = reinterpret_cast<const uint8_t *>( data ) + firstBit / 8;
+
+   kernels().byWidth[bitsPerValue]( bytes, static_cast<unsigned>( firstBit % 8 ), bitsPerValue, count, out );
+}
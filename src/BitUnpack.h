@@ -0,0 +1,20 @@
+#pragma once
+// SPDX-License-Identifier: MIT
+
+#include <cstddef>
+#include <cstdint>
+
+namespace e57
+{
+   /// Number of bytes past the last byte holding packed values that unpackBits() may read (but ignores).
+   constexpr size_t BitUnpackPadding = 32;
+
+   /// Unpack count values of bitsPerValue bits (1 to 32) each from a bit-packed stream, as written by the
+   /// BitpackIntegerEncoder: the value starting at bit b of the stream is in byte b / 8, least significant bit first.
+   /// The first value starts at bit firstBit of data.  data must be readable for BitUnpackPadding bytes past the last
+   /// byte containing a value.
+   ///
+   /// The kernels are picked the first time this is called: AVX2 or SSE 4.1 if the CPU has them, plain C++ otherwise.
+   /// Widths 8, 11, 12, 16, 20, 24, and 32 have their own kernels, the other widths go through a generic one.
+   void unpackBits( const char *data, size_t firstBit, unsigned bitsPerValue, size_t count, uint32_t *out );
+}
@@ -0,0 +1,1088 @@
+// SPDX-License-Identifier: MIT
+
+#include <cstring>
+#include <deque>
+#include <limits>
+#include <vector>
+
+#include "CheckedFile.h"
+#include "E57XmlParser.h"
+#include "E57XmlReader.h"
+#include "ImageFileImpl.h"
+#include "StructureNodeImpl.h"
+
+using namespace e57;
+
+namespace
+{
+   const char XmlnsUri[] = "http://www.w3.org/2000/xmlns/";
+   const char XmlUri[] = "http://www.w3.org/XML/1998/namespace";
+
+   /// Lazy reading: children shorter than this are read right away, reading them again later would cost more
+   const size_t MinDeferredLength = 256;
+
+   inline bool isSpace( char c )
+   {
+      return ( c == ' ' ) || ( c == '\t' ) || ( c == '\n' ) || ( c == '\r' );
+   }
+
+   /// End of a name: whitespace or one of the characters that can follow a name in a tag
+   inline bool isNameEnd( char c )
+   {
+      return isSpace( c ) || ( c == '/' ) || ( c == '>' ) || ( c == '=' ) || ( c == '<' ) || ( c == '"' ) ||
+             ( c == '\'' ) || ( c == '?' );
+   }
+
+   bool startsWith( const char *p, const char *end, const char *prefix )
+   {
+      const size_t length = strlen( prefix );
+
+      return ( static_cast<size_t>( end - p ) >= length ) && ( memcmp( p, prefix, length ) == 0 );
+   }
+
+   /// Append code point c as UTF-8
+   void appendUtf8( ustring &s, uint32_t c )
+   {
+      if ( c < 0x80 )
+      {
+         s += static_cast<char>( c );
+      }
+      else if ( c < 0x800 )
+      {
+         s += static_cast<char>( 0xC0 | ( c >> 6 ) );
+         s += static_cast<char>( 0x80 | ( c & 0x3F ) );
+      }
+      else if ( c < 0x10000 )
+      {
+         s += static_cast<char>( 0xE0 | ( c >> 12 ) );
+         s += static_cast<char>( 0x80 | ( ( c >> 6 ) & 0x3F ) );
+         s += static_cast<char>( 0x80 | ( c & 0x3F ) );
+      }
+      else
+      {
+         s += static_cast<char>( 0xF0 | ( c >> 18 ) );
+         s += static_cast<char>( 0x80 | ( ( c >> 12 ) & 0x3F ) );
+         s += static_cast<char>( 0x80 | ( ( c >> 6 ) & 0x3F ) );
+         s += static_cast<char>( 0x80 | ( c & 0x3F ) );
+      }
+   }
+
+   struct Namespace
+   {
+      ustring prefix; ///< empty for the default namespace
+      ustring uri;
+   };
+
+   /// Namespaces in scope at some point of the document, shared by the children put off there
+   using NamespaceScope = std::shared_ptr<const std::vector<Namespace>>;
+
+   /// Children that were skipped at [offset, offset + length) of the XML section, to be parsed when first used
+   class LazyXmlChildren : public LazyChildren
+   {
+   public:
+      LazyXmlChildren( uint64_t sectionStart, uint64_t offset, uint64_t length, NamespaceScope scope ) :
+         sectionStart_( sectionStart ), offset_( offset ), length_( length ), scope_( std::move( scope ) )
+      {
+      }
+
+      void materialize( StructureNodeImpl &container ) override;
+
+   private:
+      uint64_t sectionStart_; ///< logical offset of the XML section in the file
+      uint64_t offset_;
+      uint64_t length_;
+      NamespaceScope scope_;
+   };
+
+   class BuiltinXmlReader;
+
+   /// Attributes of the element being started.  Names always point into the XML buffer, values too unless they
+   /// contain references or line breaks, in which case they are decoded to a string of the reader.
+   class BuiltinAttributes : public E57XmlParser::Attributes
+   {
+   public:
+      struct Attribute
+      {
+         const char *qName;
+         size_t qNameLength;
+         size_t localNameStart; ///< 0 without a prefix, otherwise the length of the prefix plus one for the ':'
+         const char *value;
+         size_t valueLength;
+      };
+
+      explicit BuiltinAttributes( const BuiltinXmlReader &reader ) : reader_( reader )
+      {
+      }
+
+      size_t length() const override
+      {
+         return count;
+      }
+      ustring uri( size_t i ) const override;
+      ustring localName( size_t i ) const override
+      {
+         const Attribute &a = list[i];
+         return ustring( a.qName + a.localNameStart, a.qNameLength - a.localNameStart );
+      }
+      ustring qName( size_t i ) const override
+      {
+         return ustring( list[i].qName, list[i].qNameLength );
+      }
+      ustring value( size_t i ) const override
+      {
+         return ustring( list[i].value, list[i].valueLength );
+      }
+
+      bool find( const char *qName, size_t &index ) const override
+      {
+         const size_t length = strlen( qName );
+
+         for ( size_t i = 0; i < count; ++i )
+         {
+            if ( ( list[i].qNameLength == length ) && ( memcmp( list[i].qName, qName, length ) == 0 ) )
+            {
+               index = i;
+               return true;
+            }
+         }
+
+         return false;
+      }
+
+      std::vector<Attribute> list; ///< first count entries are used, the rest are kept for the next elements
+      size_t count = 0;
+
+   private:
+      const BuiltinXmlReader &reader_;
+   };
+
+   class BuiltinXmlReader : public E57XmlReader
+   {
+   public:
+      explicit BuiltinXmlReader( bool lazy ) : lazy_( lazy ), attributes_( *this )
+      {
+      }
+
+      void parse( E57XmlParser &parser, CheckedFile *cf, uint64_t logicalStart, uint64_t logicalLength ) override;
+
+      /// Parse children that were put off, which are at [offset, offset + length) of the XML section that starts at
+      /// logical offset sectionStart of cf.  parser must have been given their container with beginChildren().
+      void parseFragment( E57XmlParser &parser, CheckedFile *cf, uint64_t sectionStart, uint64_t offset,
+                          uint64_t length, const NamespaceScope &scope );
+
+      /// Index in namespaces_ of the namespace bound to prefix in the current element, NoNamespace if there is none
+      size_t findNamespace( const char *prefix, size_t prefixLength ) const;
+
+      static constexpr size_t NoNamespace = std::numeric_limits<size_t>::max();
+
+      const ustring &namespaceUri( size_t index ) const
+      {
+         return ( index == NoNamespace ) ? emptyUri_ : namespaces_[index].uri;
+      }
+
+   private:
+      /// An open element.  Entries are kept and reused as the depth changes, so their strings keep their memory.
+      struct Element
+      {
+         ustring qName;
+         ustring localName;
+         size_t uri;            ///< index in namespaces_, or NoNamespace
+         size_t namespaceCount; ///< namespaces_ in scope before the element declared its own
+      };
+
+      [[noreturn]] void fail( const char *at, const ustring &message ) const;
+
+      void read( CheckedFile *cf, uint64_t sectionStart, uint64_t offset, uint64_t length );
+      void parseContent();
+
+      void parseDeclaration();
+      void skipMarkup( size_t openerLength, const char *terminator, const char *what );
+      void skipDoctype();
+      void parseStartTag();
+      void parseEndTag();
+      void parseText( const char *textEnd );
+      void parseCData();
+
+      const char *parseName( size_t &localNameStart );
+      void decode( const char *begin, const char *end, bool attributeValue, ustring &out );
+      void endElement();
+
+      void deferContent();
+      void skipContent();
+      bool skipTag();
+      NamespaceScope scope();
+
+      const bool lazy_;
+      E57XmlParser *parser_ = nullptr;
+
+      std::vector<char> buffer_;
+      uint64_t sectionStart_ = 0; ///< logical offset of the XML section in the file
+      uint64_t offset_ = 0;       ///< offset of buffer_ in the XML section
+      const char *begin_ = nullptr;
+      const char *end_ = nullptr;
+      const char *pos_ = nullptr;
+
+      std::vector<Namespace> namespaces_;
+      NamespaceScope scope_; ///< copy of namespaces_ made for the children put off, until namespaces_ changes
+      std::vector<Element> elements_; ///< first depth_ entries are open
+      size_t depth_ = 0;
+      size_t minDepth_ = 0; ///< 1 when parsing children that were put off, their container stays open
+      bool gotRoot_ = false;
+
+      BuiltinAttributes attributes_;
+      std::deque<ustring> decodedValues_; ///< attribute values that had to be decoded, in strings that don't move
+      ustring text_;                      ///< text that had to be decoded
+      const ustring emptyUri_;
+   };
+
+   ustring BuiltinAttributes::uri( size_t i ) const
+   {
+      const Attribute &a = list[i];
+
+      /// Like Xerces, report namespace declarations in the xmlns namespace, but not the default namespace one
+      if ( a.localNameStart == 0 )
+      {
+         return ustring();
+      }
+      if ( ( a.localNameStart == 6 ) && ( memcmp( a.qName, "xmlns", 5 ) == 0 ) )
+      {
+         return XmlnsUri;
+      }
+
+      return reader_.namespaceUri( reader_.findNamespace( a.qName, a.localNameStart - 1 ) );
+   }
+
+   void BuiltinXmlReader::parse( E57XmlParser &parser, CheckedFile *cf, uint64_t logicalStart,
+                                 uint64_t logicalLength )
+   {
+      /// Read the whole section at once, everything is parsed and reported from this buffer
+      read( cf, logicalStart, 0, logicalLength );
+
+      parser_ = &parser;
+
+      namespaces_.clear();
+      namespaces_.push_back( { "xml", XmlUri } );
+      namespaces_.push_back( { "xmlns", XmlnsUri } );
+      scope_.reset();
+      depth_ = 0;
+      minDepth_ = 0;
+      gotRoot_ = false;
+
+      /// Byte order mark, then the XML declaration if there is one
+      if ( startsWith( pos_, end_, "\xEF\xBB\xBF" ) )
+      {
+         pos_ += 3;
+      }
+      if ( startsWith( pos_, end_, "<?xml" ) && ( pos_ + 5 < end_ ) && isSpace( pos_[5] ) )
+      {
+         parseDeclaration();
+      }
+
+      parseContent();
+
+      if ( depth_ > 0 )
+      {
+         fail( end_, "end of document inside element " + elements_[depth_ - 1].qName );
+      }
+      if ( !gotRoot_ )
+      {
+         fail( end_, "no root element" );
+      }
+
+      parser_ = nullptr;
+   }
+
+   void BuiltinXmlReader::parseFragment( E57XmlParser &parser, CheckedFile *cf, uint64_t sectionStart,
+                                         uint64_t offset, uint64_t length, const NamespaceScope &scope )
+   {
+      read( cf, sectionStart, offset, length );
+
+      parser_ = &parser;
+
+      namespaces_ = *scope;
+      scope_ = scope;
+
+      /// The container was checked when its children were skipped, it only has to be there for the end tags
+      if ( elements_.empty() )
+      {
+         elements_.resize( 1 );
+      }
+      elements_[0].qName.clear();
+      elements_[0].localName.clear();
+      elements_[0].uri = NoNamespace;
+      elements_[0].namespaceCount = namespaces_.size();
+      depth_ = 1;
+      minDepth_ = 1;
+      gotRoot_ = true;
+
+      parseContent();
+
+      if ( depth_ > minDepth_ )
+      {
+         fail( end_, "end of children inside element " + elements_[depth_ - 1].qName );
+      }
+
+      parser_ = nullptr;
+   }
+
+   void BuiltinXmlReader::read( CheckedFile *cf, uint64_t sectionStart, uint64_t offset, uint64_t length )
+   {
+      if ( length > std::numeric_limits<size_t>::max() )
+      {
+         throw E57_EXCEPTION2( E57_ERROR_XML_PARSER, "xmlLogicalLength=" + toString( length ) +
+                                                        " parserMessage=too long to read in memory" );
+      }
+
+      buffer_.resize( static_cast<size_t>( length ) );
+      if ( !buffer_.empty() )
+      {
+         cf->readAt( sectionStart + offset, buffer_.data(), buffer_.size() );
+      }
+
+      sectionStart_ = sectionStart;
+      offset_ = offset;
+      begin_ = buffer_.data();
+      end_ = begin_ + buffer_.size();
+      pos_ = begin_;
+   }
+
+   void BuiltinXmlReader::parseContent()
+   {
+      while ( pos_ < end_ )
+      {
+         if ( *pos_ != '<' )
+         {
+            const char *textEnd = static_cast<const char *>( memchr( pos_, '<', end_ - pos_ ) );
+
+            parseText( ( textEnd != nullptr ) ? textEnd : end_ );
+         }
+         else if ( startsWith( pos_, end_, "</" ) )
+         {
+            parseEndTag();
+         }
+         else if ( startsWith( pos_, end_, "<!--" ) )
+         {
+            skipMarkup( 4, "-->", "comment" );
+         }
+         else if ( startsWith( pos_, end_, "<![CDATA[" ) )
+         {
+            parseCData();
+         }
+         else if ( startsWith( pos_, end_, "<!DOCTYPE" ) )
+         {
+            skipDoctype();
+         }
+         else if ( startsWith( pos_, end_, "<?" ) )
+         {
+            if ( startsWith( pos_, end_, "<?xml" ) && ( pos_ + 5 < end_ ) && ( isSpace( pos_[5] ) || pos_[5] == '?' ) )
+            {
+               fail( pos_, "XML declaration not at the start of the document" );
+            }
+
+            skipMarkup( 2, "?>", "processing instruction" );
+         }
+         else
+         {
+            parseStartTag();
+         }
+      }
+   }
+
+   constexpr size_t BuiltinXmlReader::NoNamespace;
+
+   size_t BuiltinXmlReader::findNamespace( const char *prefix, size_t prefixLength ) const
+   {
+      for ( size_t i = namespaces_.size(); i-- > 0; )
+      {
+         const ustring &p = namespaces_[i].prefix;
+
+         if ( ( p.length() == prefixLength ) && ( p.compare( 0, prefixLength, prefix, prefixLength ) == 0 ) )
+         {
+            return i;
+         }
+      }
+
+      return NoNamespace;
+   }
+
+   void BuiltinXmlReader::fail( const char *at, const ustring &message ) const
+   {
+      /// The lines before children that were put off aren't at hand, give the offset in the XML section instead
+      if ( minDepth_ > 0 )
+      {
+         const uint64_t offset = offset_ + static_cast<uint64_t>( at - begin_ );
+
+         throw E57_EXCEPTION2( E57_ERROR_XML_PARSER,
+                               "systemId=E57File xmlOffset=" + toString( offset ) + " parserMessage=" + message );
+      }
+
+      /// Same format as errors from Xerces, with the column counted in bytes
+      size_t line = 1;
+      const char *lineStart = begin_;
+
+      for ( const char *p = begin_; p < at; ++p )
+      {
+         if ( *p == '\n' )
+         {
+            ++line;
+            lineStart = p + 1;
+         }
+      }
+
+      throw E57_EXCEPTION2( E57_ERROR_XML_PARSER, "systemId=E57File xmlLine=" + toString( line ) +
+                                                     " xmlColumn=" + toString( at - lineStart + 1 ) +
+                                                     " parserMessage=" + message );
+   }
+
+   void BuiltinXmlReader::parseDeclaration()
+   {
+      const char *declaration = pos_;
+
+      skipMarkup( 5, "?>", "XML declaration" );
+
+      /// Only UTF-8 (and its ASCII subset) is supported, which is what the standard requires
+      const ustring text( declaration, pos_ - declaration );
+      const size_t encoding = text.find( "encoding" );
+
+      if ( encoding == ustring::npos )
+      {
+         return;
+      }
+
+      const size_t quote = text.find_first_of( "\"'", encoding );
+      const size_t quoteEnd = ( quote == ustring::npos ) ? ustring::npos : text.find( text[quote], quote + 1 );
+
+      if ( quoteEnd == ustring::npos )
+      {
+         fail( declaration + encoding, "bad encoding declaration" );
+      }
+
+      ustring name = text.substr( quote + 1, quoteEnd - quote - 1 );
+
+      for ( auto &c : name )
+      {
+         if ( ( c >= 'a' ) && ( c <= 'z' ) )
+         {
+            c = static_cast<char>( c - 'a' + 'A' );
+         }
+      }
+
+      if ( ( name != "UTF-8" ) && ( name != "UTF8" ) && ( name != "US-ASCII" ) && ( name != "ASCII" ) )
+      {
+         fail( declaration + quote + 1, "encoding " + name + " is not supported by the built-in XML parser" );
+      }
+   }
+
+   void BuiltinXmlReader::skipMarkup( size_t openerLength, const char *terminator, const char *what )
+   {
+      const size_t length = strlen( terminator );
+
+      for ( const char *p = pos_ + openerLength; p + length <= end_; ++p )
+      {
+         if ( memcmp( p, terminator, length ) == 0 )
+         {
+            pos_ = p + length;
+            return;
+         }
+      }
+
+      fail( pos_, ustring( "unterminated " ) + what );
+   }
+
+   void BuiltinXmlReader::skipDoctype()
+   {
+      if ( gotRoot_ )
+      {
+         fail( pos_, "DOCTYPE after the root element" );
+      }
+
+      /// External DTDs aren't read.  An internal subset could declare entities and default attributes, which aren't
+      /// supported, so refuse it rather than giving a different tree than Xerces.
+      char quote = '\0';
+
+      for ( const char *p = pos_ + 9; p < end_; ++p )
+      {
+         if ( quote != '\0' )
+         {
+            if ( *p == quote )
+            {
+               quote = '\0';
+            }
+         }
+         else if ( ( *p == '"' ) || ( *p == '\'' ) )
+         {
+            quote = *p;
+         }
+         else if ( *p == '[' )
+         {
+            fail( p, "DOCTYPE internal subset is not supported by the built-in XML parser" );
+         }
+         else if ( *p == '>' )
+         {
+            pos_ = p + 1;
+            return;
+         }
+      }
+
+      fail( pos_, "unterminated DOCTYPE" );
+   }
+
+   const char *BuiltinXmlReader::parseName( size_t &localNameStart )
+   {
+      const char *name = pos_;
+
+      localNameStart = 0;
+
+      while ( ( pos_ < end_ ) && !isNameEnd( *pos_ ) )
+      {
+         if ( ( *pos_ == ':' ) && ( localNameStart == 0 ) )
+         {
+            localNameStart = pos_ - name + 1;
+         }
+         ++pos_;
+      }
+
+      const size_t length = pos_ - name;
+
+      if ( ( length == 0 ) || ( strchr( "-.0123456789:", *name ) != nullptr ) ||
+           ( ( localNameStart != 0 ) && ( localNameStart == length ) ) )
+      {
+         fail( name, "bad name" );
+      }
+
+      return name;
+   }
+
+   void BuiltinXmlReader::parseStartTag()
+   {
+      const char *tag = pos_;
+
+      if ( gotRoot_ && ( depth_ == 0 ) )
+      {
+         fail( tag, "content after the root element" );
+      }
+
+      ++pos_;
+
+      size_t localNameStart;
+      const char *name = parseName( localNameStart );
+      const size_t nameLength = pos_ - name;
+
+      /// Attributes, with the namespaces they declare
+      const size_t namespaceCount = namespaces_.size();
+      size_t decodedCount = 0;
+      bool empty = false;
+
+      attributes_.count = 0;
+
+      for ( ;; )
+      {
+         const char *beforeSpace = pos_;
+
+         while ( ( pos_ < end_ ) && isSpace( *pos_ ) )
+         {
+            ++pos_;
+         }
+
+         if ( pos_ >= end_ )
+         {
+            fail( tag, "unterminated start tag" );
+         }
+         if ( *pos_ == '>' )
+         {
+            ++pos_;
+            break;
+         }
+         if ( ( *pos_ == '/' ) && ( pos_ + 1 < end_ ) && ( pos_[1] == '>' ) )
+         {
+            pos_ += 2;
+            empty = true;
+            break;
+         }
+         if ( pos_ == beforeSpace )
+         {
+            fail( pos_, "expected whitespace, '>' or '/>'" );
+         }
+
+         BuiltinAttributes::Attribute a;
+
+         a.qName = parseName( a.localNameStart );
+         a.qNameLength = pos_ - a.qName;
+
+         while ( ( pos_ < end_ ) && isSpace( *pos_ ) )
+         {
+            ++pos_;
+         }
+         if ( ( pos_ >= end_ ) || ( *pos_ != '=' ) )
+         {
+            fail( pos_, "expected '=' after attribute name" );
+         }
+         ++pos_;
+         while ( ( pos_ < end_ ) && isSpace( *pos_ ) )
+         {
+            ++pos_;
+         }
+         if ( ( pos_ >= end_ ) || ( ( *pos_ != '"' ) && ( *pos_ != '\'' ) ) )
+         {
+            fail( pos_, "expected quoted attribute value" );
+         }
+
+         const char *valueEnd = static_cast<const char *>( memchr( pos_ + 1, *pos_, end_ - pos_ - 1 ) );
+
+         if ( valueEnd == nullptr )
+         {
+            fail( pos_, "unterminated attribute value" );
+         }
+
+         a.value = pos_ + 1;
+         a.valueLength = valueEnd - a.value;
+         pos_ = valueEnd + 1;
+
+         bool plain = true;
+
+         for ( const char *p = a.value; p < valueEnd; ++p )
+         {
+            if ( *p == '<' )
+            {
+               fail( p, "'<' in attribute value" );
+            }
+            if ( ( *p == '&' ) || ( *p == '\t' ) || ( *p == '\n' ) || ( *p == '\r' ) )
+            {
+               plain = false;
+            }
+         }
+
+         if ( !plain )
+         {
+            if ( decodedValues_.size() <= decodedCount )
+            {
+               decodedValues_.resize( decodedCount + 1 );
+            }
+
+            ustring &decoded = decodedValues_[decodedCount++];
+
+            decode( a.value, valueEnd, true, decoded );
+            a.value = decoded.data();
+            a.valueLength = decoded.length();
+         }
+
+         for ( size_t i = 0; i < attributes_.count; ++i )
+         {
+            const BuiltinAttributes::Attribute &other = attributes_.list[i];
+
+            if ( ( other.qNameLength == a.qNameLength ) && ( memcmp( other.qName, a.qName, a.qNameLength ) == 0 ) )
+            {
+               fail( a.qName, "attribute " + ustring( a.qName, a.qNameLength ) + " given twice" );
+            }
+         }
+
+         if ( ( a.qNameLength == 5 ) && ( memcmp( a.qName, "xmlns", 5 ) == 0 ) )
+         {
+            namespaces_.push_back( { ustring(), ustring( a.value, a.valueLength ) } );
+            scope_.reset();
+         }
+         else if ( ( a.localNameStart == 6 ) && ( memcmp( a.qName, "xmlns", 5 ) == 0 ) )
+         {
+            namespaces_.push_back( { ustring( a.qName + 6, a.qNameLength - 6 ), ustring( a.value, a.valueLength ) } );
+            scope_.reset();
+         }
+
+         if ( attributes_.list.size() <= attributes_.count )
+         {
+            attributes_.list.resize( attributes_.count + 1 );
+         }
+         attributes_.list[attributes_.count++] = a;
+      }
+
+      /// Namespaces of the element and of its prefixed attributes have to be declared
+      const size_t uri = findNamespace( name, ( localNameStart == 0 ) ? 0 : localNameStart - 1 );
+
+      if ( ( uri == NoNamespace ) && ( localNameStart != 0 ) )
+      {
+         fail( name, "prefix of " + ustring( name, nameLength ) + " is not declared" );
+      }
+
+      for ( size_t i = 0; i < attributes_.count; ++i )
+      {
+         const BuiltinAttributes::Attribute &a = attributes_.list[i];
+
+         if ( ( a.localNameStart != 0 ) && ( findNamespace( a.qName, a.localNameStart - 1 ) == NoNamespace ) )
+         {
+            fail( a.qName, "prefix of " + ustring( a.qName, a.qNameLength ) + " is not declared" );
+         }
+      }
+
+      if ( elements_.size() <= depth_ )
+      {
+         elements_.resize( depth_ + 1 );
+      }
+
+      Element &element = elements_[depth_++];
+
+      element.qName.assign( name, nameLength );
+      element.localName.assign( name + localNameStart, nameLength - localNameStart );
+      element.uri = uri;
+      element.namespaceCount = namespaceCount;
+
+      gotRoot_ = true;
+
+      parser_->startElement( namespaceUri( element.uri ), element.localName, element.qName, attributes_ );
+
+      if ( empty )
+      {
+         endElement();
+      }
+      else if ( lazy_ && parser_->canDeferChildren() )
+      {
+         deferContent();
+      }
+   }
+
+   void BuiltinXmlReader::parseEndTag()
+   {
+      const char *tag = pos_;
+
+      pos_ += 2;
+
+      size_t localNameStart;
+      const char *name = parseName( localNameStart );
+      const size_t nameLength = pos_ - name;
+
+      while ( ( pos_ < end_ ) && isSpace( *pos_ ) )
+      {
+         ++pos_;
+      }
+      if ( ( pos_ >= end_ ) || ( *pos_ != '>' ) )
+      {
+         fail( pos_, "expected '>' at the end of end tag" );
+      }
+      ++pos_;
+
+      if ( depth_ == minDepth_ )
+      {
+         fail( tag, "end tag " + ustring( name, nameLength ) + " outside of any element" );
+      }
+
+      const ustring &open = elements_[depth_ - 1].qName;
+
+      if ( ( open.length() != nameLength ) || ( open.compare( 0, nameLength, name, nameLength ) != 0 ) )
+      {
+         fail( tag, "end tag " + ustring( name, nameLength ) + " does not match start tag " + open );
+      }
+
+      endElement();
+   }
+
+   void BuiltinXmlReader::endElement()
+   {
+      /// Keep the element open while it is reported, so its strings and namespace stay valid
+      const Element &element = elements_[depth_ - 1];
+
+      parser_->endElement( namespaceUri( element.uri ), element.localName, element.qName );
+
+      if ( namespaces_.size() != element.namespaceCount )
+      {
+         namespaces_.resize( element.namespaceCount );
+         scope_.reset();
+      }
+      --depth_;
+   }
+
+   /// Lazy reading: leave the children of the element just started for later, if there are enough of them
+   void BuiltinXmlReader::deferContent()
+   {
+      const char *content = pos_;
+
+      skipContent();
+
+      if ( static_cast<size_t>( pos_ - content ) < MinDeferredLength )
+      {
+         pos_ = content;
+         return;
+      }
+
+      parser_->deferChildren( std::unique_ptr<LazyChildren>(
+         new LazyXmlChildren( sectionStart_, offset_ + ( content - begin_ ), pos_ - content, scope() ) ) );
+   }
+
+   /// Move to the end tag of the element just started.  What is in between is only looked at enough to follow the
+   /// nesting, it is checked when it is parsed.
+   void BuiltinXmlReader::skipContent()
+   {
+      size_t depth = 1;
+
+      for ( ;; )
+      {
+         const char *tag = static_cast<const char *>( memchr( pos_, '<', end_ - pos_ ) );
+
+         if ( tag == nullptr )
+         {
+            fail( end_, "end of document inside element " + elements_[depth_ - 1].qName );
+         }
+
+         pos_ = tag;
+
+         if ( startsWith( pos_, end_, "</" ) )
+         {
+            if ( --depth == 0 )
+            {
+               return;
+            }
+            skipTag();
+         }
+         else if ( startsWith( pos_, end_, "<!--" ) )
+         {
+            skipMarkup( 4, "-->", "comment" );
+         }
+         else if ( startsWith( pos_, end_, "<![CDATA[" ) )
+         {
+            skipMarkup( 9, "]]>", "CDATA section" );
+         }
+         else if ( startsWith( pos_, end_, "<?" ) )
+         {
+            skipMarkup( 2, "?>", "processing instruction" );
+         }
+         else if ( !skipTag() )
+         {
+            ++depth;
+         }
+      }
+   }
+
+   /// Move past the tag at pos_.  Returns true if it is an empty-element tag.
+   bool BuiltinXmlReader::skipTag()
+   {
+      char quote = '\0';
+
+      for ( const char *p = pos_ + 1; p < end_; ++p )
+      {
+         if ( quote != '\0' )
+         {
+            if ( *p == quote )
+            {
+               quote = '\0';
+            }
+         }
+         else if ( ( *p == '"' ) || ( *p == '\'' ) )
+         {
+            quote = *p;
+         }
+         else if ( *p == '>' )
+         {
+            pos_ = p + 1;
+            return p[-1] == '/';
+         }
+      }
+
+      fail( pos_, "unterminated tag" );
+   }
+
+   NamespaceScope BuiltinXmlReader::scope()
+   {
+      if ( !scope_ )
+      {
+         scope_ = std::make_shared<const std::vector<Namespace>>( namespaces_ );
+      }
+
+      return scope_;
+   }
+
+   void LazyXmlChildren::materialize( StructureNodeImpl &container )
+   {
+      ImageFileImplSharedPtr imf( container.destImageFile() );
+      E57XmlParser parser( imf );
+      BuiltinXmlReader reader( true );
+
+      parser.beginChildren( container.shared_from_this() );
+      reader.parseFragment( parser, imf->file(), sectionStart_, offset_, length_, scope_ );
+   }
+
+   void BuiltinXmlReader::parseText( const char *textEnd )
+   {
+      const char *text = pos_;
+
+      pos_ = textEnd;
+
+      if ( depth_ == 0 )
+      {
+         for ( const char *p = text; p < textEnd; ++p )
+         {
+            if ( !isSpace( *p ) )
+            {
+               fail( p, "text outside of the root element" );
+            }
+         }
+         return;
+      }
+
+      /// Most text is reported straight from the buffer
+      const size_t length = textEnd - text;
+
+      if ( ( memchr( text, '&', length ) == nullptr ) && ( memchr( text, '\r', length ) == nullptr ) )
+      {
+         parser_->characters( text, length );
+         return;
+      }
+
+      decode( text, textEnd, false, text_ );
+      parser_->characters( text_.data(), text_.length() );
+   }
+
+   void BuiltinXmlReader::parseCData()
+   {
+      if ( depth_ == 0 )
+      {
+         fail( pos_, "CDATA section outside of the root element" );
+      }
+
+      const char *text = pos_ + 9;
+
+      skipMarkup( 9, "]]>", "CDATA section" );
+
+      const char *textEnd = pos_ - 3;
+
+      /// No references in a CDATA section, but line breaks are still normalized
+      if ( memchr( text, '\r', textEnd - text ) == nullptr )
+      {
+         parser_->characters( text, textEnd - text );
+         return;
+      }
+
+      text_.clear();
+      for ( const char *p = text; p < textEnd; ++p )
+      {
+         if ( *p != '\r' )
+         {
+            text_ += *p;
+         }
+         else if ( ( p + 1 == textEnd ) || ( p[1] != '\n' ) )
+         {
+            text_ += '\n';
+         }
+      }
+      parser_->characters( text_.data(), text_.length() );
+   }
+
+   void BuiltinXmlReader::decode( const char *begin, const char *end, bool attributeValue, ustring &out )
+   {
+      out.clear();
+
+      for ( const char *p = begin; p < end; )
+      {
+         const char c = *p;
+
+         if ( c == '\r' )
+         {
+            /// CR LF and lone CR are line breaks, which are spaces in attribute values
+            out += attributeValue ? ' ' : '\n';
+            p += ( ( p + 1 < end ) && ( p[1] == '\n' ) ) ? 2 : 1;
+         }
+         else if ( attributeValue && ( ( c == '\n' ) || ( c == '\t' ) ) )
+         {
+            out += ' ';
+            ++p;
+         }
+         else if ( c != '&' )
+         {
+            out += c;
+            ++p;
+         }
+         else
+         {
+            const char *semicolon = static_cast<const char *>( memchr( p, ';', end - p ) );
+
+            if ( semicolon == nullptr )
+            {
+               fail( p, "unterminated reference" );
+            }
+
+            const ustring name( p + 1, semicolon - p - 1 );
+
+            if ( name == "lt" )
+            {
+               out += '<';
+            }
+            else if ( name == "gt" )
+            {
+               out += '>';
+            }
+            else if ( name == "amp" )
+            {
+               out += '&';
+            }
+            else if ( name == "quot" )
+            {
+               out += '"';
+            }
+            else if ( name == "apos" )
+            {
+               out += '\'';
+            }
+            else if ( ( name.length() > 1 ) && ( name[0] == '#' ) )
+            {
+               const bool hex = ( name[1] == 'x' );
+               const size_t digits = hex ? 2 : 1;
+               uint32_t code = 0;
+
+               if ( name.length() == digits )
+               {
+                  fail( p, "bad character reference &" + name + ";" );
+               }
+
+               for ( size_t i = digits; i < name.length(); ++i )
+               {
+                  const char d = name[i];
+                  uint32_t value;
+
+                  if ( ( d >= '0' ) && ( d <= '9' ) )
+                  {
+                     value = d - '0';
+                  }
+                  else if ( hex && ( d >= 'a' ) && ( d <= 'f' ) )
+                  {
+                     value = d - 'a' + 10;
+                  }
+                  else if ( hex && ( d >= 'A' ) && ( d <= 'F' ) )
+                  {
+                     value = d - 'A' + 10;
+                  }
+                  else
+                  {
+                     fail( p, "bad character reference &" + name + ";" );
+                  }
+
+                  code = code * ( hex ? 16 : 10 ) + value;
+
+                  if ( code > 0x10FFFF )
+                  {
+                     fail( p, "bad character reference &" + name + ";" );
+                  }
+               }
+
+               /// Only characters allowed in XML
+               const bool allowed = ( code == 0x9 ) || ( code == 0xA ) || ( code == 0xD ) ||
+                                    ( ( code >= 0x20 ) && ( code <= 0xD7FF ) ) ||
+                                    ( ( code >= 0xE000 ) && ( code <= 0xFFFD ) ) || ( code >= 0x10000 );
+
+               if ( !allowed )
+               {
+                  fail( p, "bad character reference &" + name + ";" );
+               }
+
+               appendUtf8( out, code );
+            }
+            else
+            {
+               fail( p, "unknown entity &" + name + ";" );
+            }
+
+            p = semicolon + 1;
+         }
+      }
+   }
+}
+
+std::unique_ptr<E57XmlReader> E57XmlReader::create( bool /*validate*/, bool lazy )
+{
+   return std::unique_ptr<E57XmlReader>( new BuiltinXmlReader( lazy ) );
+}
@@ -0,0 +1,177 @@
+// SPDX-License-Identifier: MIT
+
+#include <cstring>
+
+#include "CRC32C.h"
+#include "CpuFeatures.h"
+
+#if defined( __x86_64__ ) || defined( _M_X64 )
+#define E57_CRC32C_SSE42
+#include <nmmintrin.h>
+#if defined( _MSC_VER )
+#define E57_TARGET_SSE42
+#else
+#define E57_TARGET_SSE42 __attribute__( ( target( "sse4.2" ) ) )
+#endif
+#elif defined( __aarch64__ ) && ( defined( __GNUC__ ) || defined( __clang__ ) )
+#define E57_CRC32C_ARMV8
+#include <arm_acle.h>
+#if defined( __ARM_FEATURE_CRC32 )
+#define E57_TARGET_ARMV8_CRC
+#elif defined( __clang__ )
+#define E57_TARGET_ARMV8_CRC __attribute__( ( target( "crc" ) ) )
+#else
+#define E57_TARGET_ARMV8_CRC __attribute__( ( target( "+crc" ) ) )
+#endif
+#endif
+
+using namespace e57;
+
+namespace
+{
+   /// All implementations work on the CRC register before the final inversion
+   using Crc32cFunction = uint32_t ( * )( uint32_t crc, const uint8_t *data, size_t size );
+
+   /// CRC-32C polynomial 0x1EDC6F41, bit-reflected
+   constexpr uint32_t Polynomial = 0x82F63B78;
+
+   /// Lookup tables for slicing-by-8.  table[0] is the usual byte-at-a-time table, table[k] advances a byte through
+   /// k more zero bytes.
+   struct SlicingTables
+   {
+      uint32_t table[8][256];
+
+      SlicingTables()
+      {
+         for ( uint32_t i = 0; i < 256; ++i )
+         {
+            uint32_t crc = i;
+
+            for ( int bit = 0; bit < 8; ++bit )
+            {
+               crc = ( crc >> 1 ) ^ ( ( crc & 1 ) ? Polynomial : 0 );
+            }
+
+            table[0][i] = crc;
+         }
+
+         for ( uint32_t i = 0; i < 256; ++i )
+         {
+            for ( int k = 1; k < 8; ++k )
+            {
+               table[k][i] = ( table[k - 1][i] >> 8 ) ^ table[0][table[k - 1][i] & 0xFF];
+            }
+         }
+      }
+   };
+
+   uint32_t crc32cSlicingBy8( uint32_t crc, const uint8_t *data, size_t size )
+   {
+      static const SlicingTables sTables;
+
+      const auto &t = sTables.table;
+
+      while ( size >= 8 )
+      {
+         const uint32_t low = crc ^ ( static_cast<uint32_t>( data[0] ) | static_cast<uint32_t>( data[1] ) << 8 |
+                                      static_cast<uint32_t>( data[2] ) << 16 | static_cast<uint32_t>( data[3] ) << 24 );
+
+         crc = t[7][low & 0xFF] ^ t[6][( low >> 8 ) & 0xFF] ^ t[5][( low >> 16 ) & 0xFF] ^ t[4][low >> 24] ^
+               t[3][data[4]] ^ t[2][data[5]] ^ t[1][data[6]] ^ t[0][data[7]];
+
+         data += 8;
+         size -= 8;
+      }
+
+      while ( size > 0 )
+      {
+         crc = ( crc >> 8 ) ^ t[0][( crc ^ *data ) & 0xFF];
+
+         ++data;
+         --size;
+      }
+
+      return crc;
+   }
+
+#ifdef E57_CRC32C_SSE42
+   E57_TARGET_SSE42 uint32_t crc32cSse42( uint32_t crc, const uint8_t *data, size_t size )
+   {
+      uint64_t crc64 = crc;
+
+      while ( size >= 8 )
+      {
+         uint64_t word;
+         memcpy( &word, data, sizeof( word ) );
+
+         crc64 = _mm_crc32_u64( crc64, word );
+
+         data += 8;
+         size -= 8;
+      }
+
+      crc = static_cast<uint32_t>( crc64 );
+
+      while ( size > 0 )
+      {
+         crc = _mm_crc32_u8( crc, *data );
+
+         ++data;
+         --size;
+      }
+
+      return crc;
+   }
+#endif
+
+#ifdef E57_CRC32C_ARMV8
+   E57_TARGET_ARMV8_CRC uint32_t crc32cArmv8( uint32_t crc, const uint8_t *data, size_t size )
+   {
+      while ( size >= 8 )
+      {
+         uint64_t word;
+         memcpy( &word, data, sizeof( word ) );
+
+         crc = __crc32cd( crc, word );
+
+         data += 8;
+         size -= 8;
+      }
+
+      while ( size > 0 )
+      {
+         crc = __crc32cb( crc, *data );
+
+         ++data;
+         --size;
+      }
+
+      return crc;
+   }
+#endif
+
+   /// Pick the fastest implementation this CPU supports
+   Crc32cFunction selectImplementation()
+   {
+#ifdef E57_CRC32C_SSE42
+      if ( cpuFeatures().sse42 )
+      {
+         return crc32cSse42;
+      }
+#endif
+#ifdef E57_CRC32C_ARMV8
+      if ( cpuFeatures().armv8Crc )
+      {
+         return crc32cArmv8;
+      }
+#endif
+      return crc32cSlicingBy8;
+   }
+}
+
+uint32_t e57::crc32c( const void *data, size_t size )
+{
+   static const Crc32cFunction sFunction = selectImplementation();
+
+   return ~sFunction( 0xFFFFFFFF, static_cast<const uint8_t *>( data ), size );
+}
@@ -0,0 +1,14 @@
+#pragma once
+// SPDX-License-Identifier: MIT
+
+#include <cstddef>
+#include <cstdint>
+
+namespace e57
+{
+   /// CRC-32C (Castagnoli) of a buffer, as used for the checksum of each physical page.
+   ///
+   /// The implementation is picked the first time this is called: the CRC instructions of SSE 4.2 or ARMv8 if the CPU
+   /// has them, slicing-by-8 otherwise.
+   uint32_t crc32c( const void *data, size_t size );
+}
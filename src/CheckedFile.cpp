@@ -41,12 +41,16 @@
 #elif defined( __linux__ )
 #define _LARGEFILE64_SOURCE
 #define __LARGE64_FILES
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
+#define E57_HAVE_MMAP
 #elif defined( __APPLE__ )
+#include <sys/mman.h>
 #include <sys/types.h>
 #include <unistd.h>
+#define E57_HAVE_MMAP
 #else
 #error "no supported OS platform defined"
 #endif
@@ -54,11 +58,14 @@
 #include <cmath>
 #include <cstdio>
 #include <cstring>
+#include <exception>
 #include <fcntl.h>
+#include <limits>
 
-#include "CRC.h"
-
+#include "BackgroundWriter.h"
+#include "CRC32C.h"
 #include "CheckedFile.h"
+#include "FileIo.h"
 
 //#define E57_CHECK_FILE_DEBUG
 #ifdef E57_CHECK_FILE_DEBUG
@@ -77,6 +84,8 @@ constexpr size_t CheckedFile::physicalPageSizeLog2;
 constexpr size_t CheckedFile::physicalPageSize;
 constexpr uint64_t CheckedFile::physicalPageSizeMask;
 constexpr size_t CheckedFile::logicalPageSize;
+constexpr size_t CheckedFile::maxReadPages;
+constexpr size_t CheckedFile::maxWritePages;
 
 /// Tool class to read buffer efficiently without
 /// multiplying copy operations.
@@ -96,6 +105,12 @@ public:
       return cursorStream_;
    }
 
+   /// Direct access to the buffer, offset must be less than size
+   const char *data( uint64_t offset ) const
+   {
+      return stream_ + offset;
+   }
+
    bool seek( uint64_t offset, int whence )
    {
       if ( whence == SEEK_CUR )
@@ -120,14 +135,10 @@ public:
       return true;
    }
 
-   void read( char *buffer, uint64_t count )
+   /// Doesn't use or move the cursor, offset + count must not be more than size
+   void read( uint64_t offset, char *buffer, uint64_t count ) const
    {
-      const uint64_t start = cursorStream_;
-      for ( uint64_t i = 0; i < count; ++i )
-      {
-         buffer[i] = stream_[start + i];
-         ++cursorStream_;
-      }
+      memcpy( buffer, stream_ + offset, static_cast<size_t>( count ) );
    }
 
 private:
@@ -136,13 +147,14 @@ private:
    const char *stream_;
 };
 
-CheckedFile::CheckedFile( const ustring &fileName, Mode mode, ReadChecksumPolicy policy ) :
+CheckedFile::CheckedFile( const ustring &fileName, Mode mode, ReadChecksumPolicy policy, bool memoryMapped ) :
    fileName_( fileName ), checkSumPolicy_( policy )
 {
    switch ( mode )
    {
       case ReadOnly:
          fd_ = open64( fileName_, O_RDONLY | O_BINARY, 0 );
+         io_.reset( new FileIo( fd_ ) );
 
          readOnly_ = true;
 
@@ -150,17 +162,30 @@ CheckedFile::CheckedFile( const ustring &fileName, Mode mode, ReadChecksumPolicy
          lseek64( 0, SEEK_SET );
 
          logicalLength_ = physicalToLogical( physicalLength_ );
+
+         verifiedPages_.resize( static_cast<size_t>( physicalLength_ / physicalPageSize ) );
+
+         /// Read straight from the page cache if asked to.  Not by default: a page of the mapping that can't be read
+         /// raises SIGBUS instead of failing a read() we can report.
+         if ( memoryMapped )
+         {
+            mapFile();
+         }
          break;
 
       case WriteCreate:
          /// File truncated to zero length if already exists
          fd_ = open64( fileName_, O_RDWR | O_CREAT | O_TRUNC | O_BINARY, S_IWRITE | S_IREAD );
+         io_.reset( new FileIo( fd_ ) );
          break;
 
       case WriteExisting:
          fd_ = open64( fileName_, O_RDWR | O_BINARY, 0 );
+         io_.reset( new FileIo( fd_ ) );
 
-         logicalLength_ = physicalToLogical( length( Physical ) ); //???
+         physicalLength_ = lseek64( 0LL, SEEK_END );
+
+         logicalLength_ = physicalToLogical( physicalLength_ ); //???
          break;
    }
 }
@@ -176,6 +201,8 @@ CheckedFile::CheckedFile( const char *input, uint64_t size, ReadChecksumPolicy p
    lseek64( 0, SEEK_SET );
 
    logicalLength_ = physicalToLogical( physicalLength_ );
+
+   verifiedPages_.resize( static_cast<size_t>( physicalLength_ / physicalPageSize ) );
 }
 
 int CheckedFile::open64( const ustring &fileName, int flags, int mode )
@@ -206,6 +233,38 @@ int CheckedFile::open64( const ustring &fileName, int flags, int mode )
 #endif
 }
 
+/// Replace the file descriptor with a read-only mapping of the whole file and read it through a BufferView.
+/// If the file cannot be mapped, we silently keep using read() on the descriptor.
+void CheckedFile::mapFile()
+{
+#ifdef E57_HAVE_MMAP
+   if ( ( physicalLength_ == 0 ) || ( physicalLength_ > std::numeric_limits<size_t>::max() ) )
+   {
+      return;
+   }
+
+   const auto mapLength = static_cast<size_t>( physicalLength_ );
+
+   void *address = ::mmap( nullptr, mapLength, PROT_READ, MAP_PRIVATE, fd_, 0 );
+
+   if ( address == MAP_FAILED )
+   {
+#ifdef E57_MAX_VERBOSE
+      std::cout << "mmap() failed, falling back to read(), fileName=" << fileName_ << std::endl;
+#endif
+      return;
+   }
+
+   /// The mapping stays valid after the descriptor is closed
+   io_.reset();
+   ::close( fd_ );
+   fd_ = -1;
+
+   mapAddress_ = address;
+   bufView_ = new BufferView( static_cast<const char *>( mapAddress_ ), physicalLength_ );
+#endif
+}
+
 CheckedFile::~CheckedFile()
 {
    try
@@ -220,11 +279,32 @@ CheckedFile::~CheckedFile()
 
 void CheckedFile::read( char *buf, size_t nRead, size_t /*bufSize*/ )
 {
-   //??? what if read past logical end?, or physical end?
-   //??? need to keep track of logical length?
    //??? check bufSize OK
 
-   const uint64_t end = position( Logical ) + nRead;
+   const uint64_t start = position( Logical );
+
+   readAt( start, buf, nRead );
+
+   /// When done, leave cursor just past end of last byte read
+   seek( start + nRead, Logical );
+}
+
+/// Read nRead bytes starting at logicalOffset, without using or moving the file position.  Reading a ReadOnly file
+/// this way is safe from several threads at once.
+void CheckedFile::readAt( uint64_t logicalOffset, char *buf, size_t nRead )
+{
+   readAt( logicalOffset, buf, nRead, nRead, nullptr );
+}
+
+size_t CheckedFile::readAt( uint64_t logicalOffset, char *buf, size_t nRead, size_t headerLength,
+                            const std::function<size_t( const char *header )> &dataLength )
+{
+   syncWriteBehind();
+
+   /// Pages being written must be in the file before we read them back
+   flushPageBuffer();
+
+   const uint64_t end = logicalOffset + nRead;
    const uint64_t logicalLength = length( Logical );
 
    if ( end > logicalLength )
@@ -233,22 +313,54 @@ void CheckedFile::read( char *buf, size_t nRead, size_t /*bufSize*/ )
                                                    " length=" + toString( logicalLength ) );
    }
 
-   uint64_t page = 0;
-   size_t pageOffset = 0;
-
-   getCurrentPageAndOffset( page, pageOffset );
+   uint64_t page = logicalOffset / logicalPageSize;
+   size_t pageOffset = static_cast<size_t>( logicalOffset - page * logicalPageSize );
 
    size_t n = std::min( nRead, logicalPageSize - pageOffset );
 
-   /// Allocate temp page buffer
-   std::vector<char> page_buffer_v( physicalPageSize );
-   char *page_buffer = &page_buffer_v[0];
+   /// Pages [page, lastPage) hold the bytes we want.  If we can't look at them in place, read as many as possible
+   /// into readBuffer at once.
+   const uint64_t lastPage = page + ( pageOffset + nRead + logicalPageSize - 1 ) / logicalPageSize;
+   std::vector<char> readBuffer;
+   uint64_t bufferFirstPage = 0;
+   uint64_t bufferEndPage = 0;
 
    auto checksumMod = static_cast<const unsigned int>( std::nearbyint( 100.0 / checkSumPolicy_ ) );
 
+   /// Pages starting before verifyLength bytes have been copied are verified, the others are only read
+   const char *const start = buf;
+   size_t verifyLength = headerLength;
+   bool lengthKnown = !dataLength;
+
    while ( nRead > 0 )
    {
-      readPhysicalPage( page_buffer, page );
+      const char *page_buffer = nullptr;
+
+      if ( bufView_ != nullptr )
+      {
+         page_buffer = viewPhysicalPage( page );
+      }
+      else
+      {
+         if ( page >= bufferEndPage )
+         {
+            const auto pageCount = static_cast<size_t>( std::min<uint64_t>( lastPage - page, maxReadPages ) );
+
+            if ( readBuffer.size() < pageCount * physicalPageSize )
+            {
+               readBuffer.resize( pageCount * physicalPageSize );
+            }
+
+            readPhysicalPages( readBuffer.data(), page, pageCount );
+
+            bufferFirstPage = page;
+            bufferEndPage = page + pageCount;
+         }
+
+         page_buffer = &readBuffer[( page - bufferFirstPage ) * physicalPageSize];
+      }
+
+      const bool verify = static_cast<size_t>( buf - start ) < verifyLength;
 
       switch ( checkSumPolicy_ )
       {
@@ -256,11 +368,14 @@ void CheckedFile::read( char *buf, size_t nRead, size_t /*bufSize*/ )
             break;
 
          case CHECKSUM_POLICY_ALL:
-            verifyChecksum( page_buffer, page );
+            if ( verify )
+            {
+               verifyChecksum( page_buffer, page );
+            }
             break;
 
          default:
-            if ( !( page % checksumMod ) || ( nRead < physicalPageSize ) )
+            if ( verify && ( !( page % checksumMod ) || ( nRead < physicalPageSize ) ) )
             {
                verifyChecksum( page_buffer, page );
             }
@@ -270,6 +385,13 @@ void CheckedFile::read( char *buf, size_t nRead, size_t /*bufSize*/ )
       memcpy( buf, page_buffer + pageOffset, n );
 
       buf += n;
+
+      if ( !lengthKnown && ( static_cast<size_t>( buf - start ) >= headerLength ) )
+      {
+         verifyLength = dataLength( start );
+         lengthKnown = true;
+      }
+
       nRead -= n;
       pageOffset = 0;
       ++page;
@@ -277,8 +399,7 @@ void CheckedFile::read( char *buf, size_t nRead, size_t /*bufSize*/ )
       n = std::min( nRead, logicalPageSize );
    }
 
-   /// When done, leave cursor just past end of last byte read
-   seek( end, Logical );
+   return verifyLength;
 }
 
 void CheckedFile::write( const char *buf, size_t nWrite )
@@ -292,6 +413,8 @@ void CheckedFile::write( const char *buf, size_t nWrite )
       throw E57_EXCEPTION2( E57_ERROR_FILE_IS_READ_ONLY, "fileName=" + fileName_ );
    }
 
+   syncWriteBehind();
+
    uint64_t end = position( Logical ) + nWrite;
 
    uint64_t page = 0;
@@ -301,19 +424,24 @@ void CheckedFile::write( const char *buf, size_t nWrite )
 
    size_t n = std::min( nWrite, logicalPageSize - pageOffset );
 
-   /// Allocate temp page buffer
-   std::vector<char> page_buffer_v( physicalPageSize );
-   char *page_buffer = &page_buffer_v[0];
-
    while ( nWrite > 0 )
    {
-      const uint64_t physicalLength = length( Physical );
-
-      if ( page * physicalPageSize < physicalLength )
+      /// Whole pages don't need to be gathered, write as many as we can at once
+      if ( ( pageOffset == 0 ) && ( nWrite >= logicalPageSize ) )
       {
-         readPhysicalPage( page_buffer, page );
+         const size_t pageCount = std::min( nWrite / logicalPageSize, maxWritePages );
+
+         writeWholePages( buf, page, pageCount );
+
+         buf += pageCount * logicalPageSize;
+         nWrite -= pageCount * logicalPageSize;
+         page += pageCount;
+         n = std::min( nWrite, logicalPageSize );
+         continue;
       }
 
+      char *page_buffer = bufferPage( page );
+
 #ifdef E57_MAX_VERBOSE
       // cout << "  page_buffer[0] read: '" << page_buffer[0] << "'" << std::endl;
       // cout << "copy " << n << "bytes to page=" << page << " pageOffset=" <<
@@ -321,7 +449,13 @@ void CheckedFile::write( const char *buf, size_t nWrite )
       // buf[i]; cout << "'" << std::endl;
 #endif
       memcpy( page_buffer + pageOffset, buf, n );
-      writePhysicalPage( page_buffer, page );
+      pageBufferDirty_ = true;
+
+      /// Nothing more will go in a full page
+      if ( pageOffset + n == logicalPageSize )
+      {
+         flushPageBuffer();
+      }
 #ifdef E57_MAX_VERBOSE
       // cout << "  page_buffer[0] after write: '" << page_buffer[0] << "'" <<
       // std::endl; //???
@@ -443,14 +577,22 @@ template <class FTYPE> CheckedFile &CheckedFile::writeFloatingPoint( FTYPE value
 
 void CheckedFile::seek( uint64_t offset, OffsetMode omode )
 {
+   syncWriteBehind();
+
    //??? check for seek beyond logicalLength_
-   const auto pos = static_cast<int64_t>( omode == Physical ? offset : logicalToPhysical( offset ) );
+   const uint64_t pos = ( omode == Physical ) ? offset : logicalToPhysical( offset );
 
 #ifdef E57_MAX_VERBOSE
    // cout << "seek offset=" << offset << " omode=" << omode << " pos=" << pos
    // << std::endl; //???
 #endif
-   lseek64( pos, SEEK_SET );
+   /// Files are only read and written at explicit offsets, but a buffer view still checks the position is inside it
+   if ( ( fd_ < 0 ) && ( bufView_ != nullptr ) )
+   {
+      lseek64( static_cast<int64_t>( pos ), SEEK_SET );
+   }
+
+   physicalPosition_ = pos;
 }
 
 uint64_t CheckedFile::lseek64( int64_t offset, int whence )
@@ -501,8 +643,9 @@ uint64_t CheckedFile::lseek64( int64_t offset, int whence )
 
 uint64_t CheckedFile::position( OffsetMode omode )
 {
-   /// Get current file cursor position
-   const uint64_t pos = lseek64( 0LL, SEEK_CUR );
+   syncWriteBehind();
+
+   const uint64_t pos = physicalPosition_;
 
    if ( omode == Physical )
    {
@@ -514,23 +657,13 @@ uint64_t CheckedFile::position( OffsetMode omode )
 
 uint64_t CheckedFile::length( OffsetMode omode )
 {
+   syncWriteBehind();
+
    if ( omode == Physical )
    {
-      if ( readOnly_ )
-      {
-         return physicalLength_;
-      }
-
-      // Current file position
-      uint64_t original_pos = lseek64( 0LL, SEEK_CUR );
-
-      // End file position
-      uint64_t end_pos = lseek64( 0LL, SEEK_END );
+      flushPageBuffer();
 
-      // Restore original position
-      lseek64( original_pos, SEEK_SET );
-
-      return end_pos;
+      return physicalLength_;
    }
 
    return logicalLength_;
@@ -547,6 +680,8 @@ void CheckedFile::extend( uint64_t newLength, OffsetMode omode )
       throw E57_EXCEPTION2( E57_ERROR_FILE_IS_READ_ONLY, "fileName=" + fileName_ );
    }
 
+   syncWriteBehind();
+
    uint64_t newLogicalLength = 0;
 
    if ( omode == Physical )
@@ -591,18 +726,9 @@ void CheckedFile::extend( uint64_t newLength, OffsetMode omode )
       n = logicalPageSize - pageOffset;
    }
 
-   /// Allocate temp page buffer
-   std::vector<char> page_buffer_v( physicalPageSize );
-   char *page_buffer = &page_buffer_v[0];
-
    while ( nWrite > 0 )
    {
-      const uint64_t physicalLength = length( Physical );
-
-      if ( page * physicalPageSize < physicalLength )
-      {
-         readPhysicalPage( page_buffer, page );
-      }
+      char *page_buffer = bufferPage( page );
 
 #ifdef E57_MAX_VERBOSE
       // cout << "extend " << n << "bytes on page=" << page << " pageOffset=" <<
@@ -610,7 +736,12 @@ void CheckedFile::extend( uint64_t newLength, OffsetMode omode )
       // //???
 #endif
       memset( page_buffer + pageOffset, 0, n );
-      writePhysicalPage( page_buffer, page );
+      pageBufferDirty_ = true;
+
+      if ( pageOffset + n == logicalPageSize )
+      {
+         flushPageBuffer();
+      }
 
       nWrite -= n;
       pageOffset = 0;
@@ -633,22 +764,151 @@ void CheckedFile::extend( uint64_t newLength, OffsetMode omode )
    seek( newLogicalLength, Logical );
 }
 
+/// Tell the OS how a range of the file is going to be read.  Only has an effect on memory-mapped files.
+void CheckedFile::advise( uint64_t logicalOffset, uint64_t nBytes, AccessHint hint )
+{
+#ifdef E57_HAVE_MMAP
+   if ( mapAddress_ == nullptr || nBytes == 0 )
+   {
+      return;
+   }
+
+   /// Range must start on a memory page boundary and stay inside the mapping
+   static const auto memoryPageSize = static_cast<uint64_t>( ::sysconf( _SC_PAGESIZE ) );
+
+   uint64_t start = logicalToPhysical( logicalOffset );
+   uint64_t end = std::min( logicalToPhysical( logicalOffset + nBytes ) + physicalPageSize, physicalLength_ );
+
+   start -= start % memoryPageSize;
+
+   if ( start >= end )
+   {
+      return;
+   }
+
+   const int advice = ( hint == Sequential ) ? POSIX_MADV_SEQUENTIAL : POSIX_MADV_WILLNEED;
+
+   /// This is only a hint, so ignore failures
+   ::posix_madvise( static_cast<char *>( mapAddress_ ) + start, static_cast<size_t>( end - start ), advice );
+#else
+   (void)logicalOffset;
+   (void)nBytes;
+   (void)hint;
+#endif
+}
+
+/// Start a thread writing the buffers given to writeBehind(), there are bufferCount buffers of bufferSize bytes.
+void CheckedFile::startWriteBehind( unsigned bufferCount, size_t bufferSize )
+{
+   if ( readOnly_ )
+   {
+      throw E57_EXCEPTION2( E57_ERROR_FILE_IS_READ_ONLY, "fileName=" + fileName_ );
+   }
+
+   stopWriteBehind();
+
+   writeBehind_.reset( new BackgroundWriter(
+      [this]( uint64_t logicalOffset, const char *buf, size_t nWrite ) {
+         seek( logicalOffset );
+         write( buf, nWrite );
+      },
+      bufferCount, bufferSize ) );
+}
+
+/// Buffer to fill before passing it to writeBehind(), waits if all the buffers are still being written
+char *CheckedFile::writeBehindBuffer()
+{
+   return writeBehind_->buffer();
+}
+
+/// Queue the write of the first nWrite bytes of the buffer returned by writeBehindBuffer() at logicalOffset.  Doesn't
+/// move the file position.
+void CheckedFile::writeBehind( uint64_t logicalOffset, size_t nWrite )
+{
+   writeBehind_->queue( logicalOffset, nWrite );
+}
+
+/// Report an error from a write done in the background, without waiting for the others
+void CheckedFile::checkWriteBehind()
+{
+   if ( writeBehind_ )
+   {
+      writeBehind_->checkError();
+   }
+}
+
+/// Wait for the queued writes and stop the background thread
+void CheckedFile::stopWriteBehind()
+{
+   if ( !writeBehind_ )
+   {
+      return;
+   }
+
+   try
+   {
+      writeBehind_->wait();
+   }
+   catch ( ... )
+   {
+      writeBehind_.reset();
+      throw;
+   }
+
+   writeBehind_.reset();
+}
+
+/// Wait for the writes queued with writeBehind() before using the file, except on the thread doing them
+void CheckedFile::syncWriteBehind()
+{
+   if ( writeBehind_ && !writeBehind_->isWorkerThread() )
+   {
+      writeBehind_->wait();
+   }
+}
+
 void CheckedFile::close()
 {
+   /// Finish the writes in progress, the caller has either given up on them or already been told they failed
+   if ( writeBehind_ )
+   {
+      try
+      {
+         writeBehind_->wait();
+      }
+      catch ( ... )
+      {
+      }
+
+      writeBehind_.reset();
+   }
+
+   /// The file is closed even if the last page can't be written, that error is reported once it is
+   std::exception_ptr flushError;
+
+   try
+   {
+      flushPageBuffer();
+   }
+   catch ( ... )
+   {
+      flushError = std::current_exception();
+   }
+
+   io_.reset();
+
+   int closeResult = 0;
+
    if ( fd_ >= 0 )
    {
 #if defined( _MSC_VER )
-      int result = ::_close( fd_ );
+      closeResult = ::_close( fd_ );
 #elif defined( __GNUC__ )
-      int result = ::close( fd_ );
+      closeResult = ::close( fd_ );
 #else
 #error "no supported compiler defined"
 #endif
-      if ( result < 0 )
-      {
-         throw E57_EXCEPTION2( E57_ERROR_CLOSE_FAILED, "fileName=" + fileName_ + " result=" + toString( result ) );
-      }
-
+      /// Retrying close() after a failure isn't safe, the descriptor may already be reused
       fd_ = -1;
    }
 
@@ -660,10 +920,31 @@ void CheckedFile::close()
       // WARNING: do NOT delete buffer of bufView_ because
       // pointer is handled by user !!
    }
+
+#ifdef E57_HAVE_MMAP
+   if ( mapAddress_ != nullptr )
+   {
+      ::munmap( mapAddress_, static_cast<size_t>( physicalLength_ ) );
+      mapAddress_ = nullptr;
+   }
+#endif
+
+   if ( flushError )
+   {
+      std::rethrow_exception( flushError );
+   }
+
+   if ( closeResult < 0 )
+   {
+      throw E57_EXCEPTION2( E57_ERROR_CLOSE_FAILED, "fileName=" + fileName_ + " result=" + toString( closeResult ) );
+   }
 }
 
 void CheckedFile::unlink()
 {
+   /// No point in writing what is left
+   pageBufferDirty_ = false;
+
    close();
 
    /// Try to remove the file, don't report a failure
@@ -685,13 +966,9 @@ inline uint32_t swap_uint32( uint32_t val )
 }
 
 /// Calc CRC32C of given data
-uint32_t CheckedFile::checksum( char *buf, size_t size ) const
+uint32_t CheckedFile::checksum( const char *buf, size_t size ) const
 {
-   static const CRC::Parameters<crcpp_uint32, 32> sCRCParams{ 0x1EDC6F41, 0xFFFFFFFF, 0xFFFFFFFF, true, true };
-
-   static const CRC::Table<crcpp_uint32, 32> sCRCTable = sCRCParams.MakeTable();
-
-   auto crc = CRC::Calculate<crcpp_uint32, 32>( buf, size, sCRCTable );
+   auto crc = crc32c( buf, size );
 
    // (Andy) I don't understand why we need to swap bytes here
    crc = swap_uint32( crc );
@@ -699,10 +976,23 @@ uint32_t CheckedFile::checksum( char *buf, size_t size ) const
    return crc;
 }
 
-void CheckedFile::verifyChecksum( char *page_buffer, size_t page )
+void CheckedFile::verifyChecksum( const char *page_buffer, uint64_t page )
 {
+   /// Only pages we write change while the file is open, and writing one forgets it was verified.  So the others need
+   /// to be checked only once, however many times they are read.
+   {
+      std::lock_guard<std::mutex> lock( verifiedPagesMutex_ );
+
+      if ( ( page < verifiedPages_.size() ) && verifiedPages_[static_cast<size_t>( page )] )
+      {
+         return;
+      }
+   }
+
    const uint32_t check_sum = checksum( page_buffer, logicalPageSize );
-   const uint32_t check_sum_in_page = *reinterpret_cast<uint32_t *>( &page_buffer[logicalPageSize] );
+
+   uint32_t check_sum_in_page = 0;
+   memcpy( &check_sum_in_page, &page_buffer[logicalPageSize], sizeof( check_sum_in_page ) );
 
    if ( check_sum_in_page != check_sum )
    {
@@ -713,6 +1003,15 @@ void CheckedFile::verifyChecksum( char *page_buffer, size_t page )
                                " storedChecksum=" + toString( check_sum_in_page ) + " page=" + toString( page ) +
                                " length=" + toString( physicalLength ) );
    }
+
+   std::lock_guard<std::mutex> lock( verifiedPagesMutex_ );
+
+   if ( page >= verifiedPages_.size() )
+   {
+      verifiedPages_.resize( static_cast<size_t>( page + 1 ) );
+   }
+
+   verifiedPages_[static_cast<size_t>( page )] = true;
 }
 
 void CheckedFile::getCurrentPageAndOffset( uint64_t &page, size_t &pageOffset, OffsetMode omode )
@@ -731,64 +1030,156 @@ void CheckedFile::getCurrentPageAndOffset( uint64_t &page, size_t &pageOffset, O
    }
 }
 
+/// Get the page buffer holding physical page, writing the page it held before if need be
+char *CheckedFile::bufferPage( uint64_t page )
+{
+   if ( pageBufferValid_ && ( pageBufferPage_ == page ) )
+   {
+      return pageBuffer_.data();
+   }
+
+   flushPageBuffer();
+
+   pageBuffer_.resize( physicalPageSize );
+
+   if ( page * physicalPageSize < physicalLength_ )
+   {
+      readPhysicalPage( pageBuffer_.data(), page );
+   }
+   else
+   {
+      std::fill( pageBuffer_.begin(), pageBuffer_.end(), 0 );
+   }
+
+   pageBufferPage_ = page;
+   pageBufferValid_ = true;
+
+   return pageBuffer_.data();
+}
+
+void CheckedFile::flushPageBuffer()
+{
+   if ( pageBufferDirty_ )
+   {
+      /// Don't try again if this fails
+      pageBufferDirty_ = false;
+
+      writePhysicalPage( pageBuffer_.data(), pageBufferPage_ );
+   }
+}
+
 void CheckedFile::readPhysicalPage( char *page_buffer, uint64_t page )
+{
+   readPhysicalPages( page_buffer, page, 1 );
+}
+
+/// Read pageCount consecutive physical pages with as few calls as possible
+void CheckedFile::readPhysicalPages( char *page_buffer, uint64_t page, size_t pageCount )
 {
 #ifdef E57_MAX_VERBOSE
-   // cout << "readPhysicalPage, page:" << page << std::endl;
+   // cout << "readPhysicalPages, page:" << page << " pageCount:" << pageCount << std::endl;
 #endif
 
 #ifdef E57_CHECK_FILE_DEBUG
    const uint64_t physicalLength = length( Physical );
 
-   assert( page * physicalPageSize < physicalLength );
+   assert( ( page + pageCount ) * physicalPageSize <= physicalLength );
 #endif
 
-   /// Seek to start of physical page
-   seek( page * physicalPageSize, Physical );
+   const uint64_t physicalOffset = page * physicalPageSize;
+   const size_t nRead = pageCount * physicalPageSize;
 
    if ( ( fd_ < 0 ) && ( bufView_ != nullptr ) )
    {
-      bufView_->read( page_buffer, physicalPageSize );
+      if ( physicalOffset + nRead > physicalLength_ )
+      {
+         throw E57_EXCEPTION2( E57_ERROR_READ_FAILED, "fileName=" + fileName_ + " page=" + toString( page ) +
+                                                         " pageCount=" + toString( pageCount ) );
+      }
+
+      bufView_->read( physicalOffset, page_buffer, nRead );
       return;
    }
 
-#if defined( _MSC_VER )
-   int result = ::_read( fd_, page_buffer, physicalPageSize );
-#elif defined( __GNUC__ )
-   ssize_t result = ::read( fd_, page_buffer, physicalPageSize );
-#else
-#error "no supported compiler defined"
-#endif
+   if ( !io_->readFully( page_buffer, nRead, physicalOffset ) )
+   {
+      throw E57_EXCEPTION2( E57_ERROR_READ_FAILED, "fileName=" + fileName_ + " page=" + toString( page ) +
+                                                      " pageCount=" + toString( pageCount ) );
+   }
+}
+
+/// Get a pointer to a whole physical page in the buffer view without copying it
+const char *CheckedFile::viewPhysicalPage( uint64_t page )
+{
+   const uint64_t pageStart = page * physicalPageSize;
 
-   if ( result < 0 || static_cast<size_t>( result ) != physicalPageSize )
+   if ( pageStart + physicalPageSize > physicalLength_ )
    {
-      throw E57_EXCEPTION2( E57_ERROR_READ_FAILED, "fileName=" + fileName_ + " result=" + toString( result ) );
+      throw E57_EXCEPTION2( E57_ERROR_READ_FAILED, "fileName=" + fileName_ + " page=" + toString( page ) +
+                                                      " length=" + toString( physicalLength_ ) );
    }
+
+   return bufView_->data( pageStart );
+}
+
+/// Write pageCount whole logical pages from buf, starting at page, without going through the page buffer
+void CheckedFile::writeWholePages( const char *buf, uint64_t page, size_t pageCount )
+{
+   /// Buffered copy of one of them is out of date
+   if ( pageBufferValid_ && ( pageBufferPage_ >= page ) && ( pageBufferPage_ < page + pageCount ) )
+   {
+      pageBufferValid_ = false;
+      pageBufferDirty_ = false;
+   }
+
+   if ( writeBuffer_.size() < pageCount * physicalPageSize )
+   {
+      writeBuffer_.resize( pageCount * physicalPageSize );
+   }
+
+   for ( size_t i = 0; i < pageCount; ++i )
+   {
+      memcpy( &writeBuffer_[i * physicalPageSize], buf + i * logicalPageSize, logicalPageSize );
+   }
+
+   writePhysicalPages( writeBuffer_.data(), page, pageCount );
 }
 
 void CheckedFile::writePhysicalPage( char *page_buffer, uint64_t page )
+{
+   writePhysicalPages( page_buffer, page, 1 );
+}
+
+/// Append the checksums to pageCount consecutive physical pages and write them with as few calls as possible
+void CheckedFile::writePhysicalPages( char *page_buffer, uint64_t page, size_t pageCount )
 {
 #ifdef E57_MAX_VERBOSE
-   // cout << "writePhysicalPage, page:" << page << std::endl;
+   // cout << "writePhysicalPages, page:" << page << " pageCount:" << pageCount << std::endl;
 #endif
 
-   /// Append checksum
-   uint32_t check_sum = checksum( page_buffer, logicalPageSize );
-   *reinterpret_cast<uint32_t *>( &page_buffer[logicalPageSize] ) = check_sum; //??? little endian dependency
+   for ( size_t i = 0; i < pageCount; ++i )
+   {
+      /// Contents changed, verify them again when read back
+      if ( page + i < verifiedPages_.size() )
+      {
+         verifiedPages_[static_cast<size_t>( page + i )] = false;
+      }
 
-   /// Seek to start of physical page
-   seek( page * physicalPageSize, Physical );
+      /// Append checksum
+      char *physicalPage = page_buffer + i * physicalPageSize;
 
-#if defined( _MSC_VER )
-   int result = ::_write( fd_, page_buffer, physicalPageSize );
-#elif defined( __GNUC__ )
-   ssize_t result = ::write( fd_, page_buffer, physicalPageSize );
-#else
-#error "no supported compiler defined"
-#endif
+      uint32_t check_sum = checksum( physicalPage, logicalPageSize );
+      *reinterpret_cast<uint32_t *>( &physicalPage[logicalPageSize] ) = check_sum; //??? little endian dependency
+   }
 
-   if ( result < 0 )
+   const uint64_t physicalOffset = page * physicalPageSize;
+   const size_t nWrite = pageCount * physicalPageSize;
+
+   if ( !io_->writeFully( page_buffer, nWrite, physicalOffset ) )
    {
-      throw E57_EXCEPTION2( E57_ERROR_WRITE_FAILED, "fileName=" + fileName_ + " result=" + toString( result ) );
+      throw E57_EXCEPTION2( E57_ERROR_WRITE_FAILED, "fileName=" + fileName_ + " page=" + toString( page ) +
+                                                       " pageCount=" + toString( pageCount ) );
    }
+
+   physicalLength_ = std::max( physicalLength_, physicalOffset + nWrite );
 }
@@ -28,6 +28,9 @@
 #pragma once
 
 #include <algorithm>
+#include <functional>
+#include <memory>
+#include <mutex>
 
 #include "Common.h"
 
@@ -39,6 +42,9 @@ namespace e57
    /// WARNING: pointer input is handled by user!
    class BufferView;
 
+   class BackgroundWriter;
+   class FileIo;
+
    class CheckedFile
    {
    public:
@@ -46,6 +52,8 @@ namespace e57
       static constexpr size_t physicalPageSize = 1 << physicalPageSizeLog2;
       static constexpr uint64_t physicalPageSizeMask = physicalPageSize - 1;
       static constexpr size_t logicalPageSize = physicalPageSize - 4;
+      static constexpr size_t maxReadPages = 256;  // most physical pages read() fetches in one call
+      static constexpr size_t maxWritePages = 256; // most whole physical pages write() writes in one call
 
    public:
       enum Mode
@@ -61,11 +69,26 @@ namespace e57
          Physical
       };
 
-      CheckedFile( const e57::ustring &fileName, Mode mode, ReadChecksumPolicy policy );
+      enum AccessHint
+      {
+         Sequential, ///< range will be read from start to end
+         WillNeed    ///< range will be read soon, start loading it now
+      };
+
+      /// memoryMapped: read a ReadOnly file through a mapping of the whole file instead of with pread(), see
+      /// ImageFile::Options::memoryMapped for what it costs.
+      CheckedFile( const e57::ustring &fileName, Mode mode, ReadChecksumPolicy policy, bool memoryMapped = false );
       CheckedFile( const char *input, uint64_t size, ReadChecksumPolicy policy );
       ~CheckedFile();
 
       void read( char *buf, size_t nRead, size_t bufSize = 0 );
+      void readAt( uint64_t logicalOffset, char *buf, size_t nRead );
+
+      /// Like readAt(), for data whose length is only known once its header has been read, such as a packet.  All
+      /// nRead bytes are read, but only the pages holding the first dataLength( buf ) bytes have their checksums
+      /// verified.  dataLength is called once the first headerLength bytes are in buf.  Returns what it returned.
+      size_t readAt( uint64_t logicalOffset, char *buf, size_t nRead, size_t headerLength,
+                     const std::function<size_t( const char *header )> &dataLength );
       void write( const char *buf, size_t nWrite );
       CheckedFile &operator<<( const e57::ustring &s );
       CheckedFile &operator<<( int64_t i );
@@ -76,6 +99,22 @@ namespace e57
       uint64_t position( OffsetMode omode = Logical );
       uint64_t length( OffsetMode omode = Logical );
       void extend( uint64_t newLength, OffsetMode omode = Logical );
+      void advise( uint64_t logicalOffset, uint64_t nBytes, AccessHint hint );
+
+      /// Write-behind: writes queued with writeBehind() are done in order on a background thread, while the caller
+      /// fills the next buffer.  Any other use of the file waits for them first.  Errors are reported by the next
+      /// call to writeBehindBuffer(), writeBehind(), checkWriteBehind(), stopWriteBehind(), or to any function
+      /// using the file.
+      void startWriteBehind( unsigned bufferCount, size_t bufferSize );
+      char *writeBehindBuffer();
+      void writeBehind( uint64_t logicalOffset, size_t nWrite );
+      void checkWriteBehind();
+      void stopWriteBehind();
+      bool isWritingBehind() const
+      {
+         return static_cast<bool>( writeBehind_ );
+      }
+
       e57::ustring fileName() const
       {
          return fileName_;
@@ -87,26 +126,52 @@ namespace e57
       static inline uint64_t physicalToLogical( uint64_t physicalOffset );
 
    private:
-      uint32_t checksum( char *buf, size_t size ) const;
-      void verifyChecksum( char *page_buffer, size_t page );
+      uint32_t checksum( const char *buf, size_t size ) const;
+      void verifyChecksum( const char *page_buffer, uint64_t page );
 
       template <class FTYPE> CheckedFile &writeFloatingPoint( FTYPE value, int precision );
 
       void getCurrentPageAndOffset( uint64_t &page, size_t &pageOffset, OffsetMode omode = Logical );
+      char *bufferPage( uint64_t page );
+      void flushPageBuffer();
       void readPhysicalPage( char *page_buffer, uint64_t page );
+      void readPhysicalPages( char *page_buffer, uint64_t page, size_t pageCount );
+      const char *viewPhysicalPage( uint64_t page );
+      void writeWholePages( const char *buf, uint64_t page, size_t pageCount );
       void writePhysicalPage( char *page_buffer, uint64_t page );
+      void writePhysicalPages( char *page_buffer, uint64_t page, size_t pageCount );
+      void syncWriteBehind();
       int open64( const e57::ustring &fileName, int flags, int mode );
+      void mapFile();
       uint64_t lseek64( int64_t offset, int whence );
 
       e57::ustring fileName_;
       uint64_t logicalLength_ = 0;
-      uint64_t physicalLength_ = 0;
+      uint64_t physicalLength_ = 0;   ///< not counting a page only in pageBuffer_
+      uint64_t physicalPosition_ = 0; ///< set by seek(), all reads and writes of the file itself are positioned
+
+      /// Writes are gathered in this copy of physical page pageBufferPage_, which is only written to the file when
+      /// it is full, when a write moves on to another page, or before the file is read or closed.
+      std::vector<char> pageBuffer_;
+      uint64_t pageBufferPage_ = 0;
+      bool pageBufferValid_ = false;
+      bool pageBufferDirty_ = false;
+
+      std::vector<char> writeBuffer_; ///< whole pages written by write() get their checksums here
 
       ReadChecksumPolicy checkSumPolicy_ = CHECKSUM_POLICY_ALL;
 
       int fd_ = -1;
+      std::unique_ptr<FileIo> io_; ///< reads and writes fd_
       BufferView *bufView_ = nullptr;
+      void *mapAddress_ = nullptr; ///< set when a ReadOnly file is memory-mapped, bufView_ then points into it
+
+      /// [physical page] = its checksum has been verified since the file was opened, so it isn't verified again
+      std::vector<bool> verifiedPages_;
+      std::mutex verifiedPagesMutex_;
       bool readOnly_ = false;
+
+      std::unique_ptr<BackgroundWriter> writeBehind_; ///< null unless between startWriteBehind() and stopWriteBehind()
    };
 
    inline uint64_t CheckedFile::logicalToPhysical( uint64_t logicalOffset )
@@ -0,0 +1,94 @@
+// SPDX-License-Identifier: MIT
+
+#include "CpuFeatures.h"
+
+#if defined( __x86_64__ ) || defined( _M_X64 )
+#define E57_CPU_X86_64
+#if defined( _MSC_VER )
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#elif defined( __aarch64__ ) && defined( __linux__ )
+#include <sys/auxv.h>
+#endif
+
+using namespace e57;
+
+namespace
+{
+#ifdef E57_CPU_X86_64
+   void cpuid( unsigned leaf, unsigned subleaf, unsigned regs[4] )
+   {
+#if defined( _MSC_VER )
+      int info[4] = {};
+      __cpuidex( info, static_cast<int>( leaf ), static_cast<int>( subleaf ) );
+
+      for ( int i = 0; i < 4; ++i )
+      {
+         regs[i] = static_cast<unsigned>( info[i] );
+      }
+#else
+      __cpuid_count( leaf, subleaf, regs[0], regs[1], regs[2], regs[3] );
+#endif
+   }
+
+   /// Check that the OS saves the SSE and AVX registers on context switches
+   bool osSavesYmm()
+   {
+#if defined( _MSC_VER )
+      return ( _xgetbv( 0 ) & 0x6 ) == 0x6;
+#else
+      unsigned eax = 0;
+      unsigned edx = 0;
+
+      __asm__( "xgetbv" : "=a"( eax ), "=d"( edx ) : "c"( 0 ) );
+
+      return ( eax & 0x6 ) == 0x6;
+#endif
+   }
+#endif
+
+   CpuFeatures detect()
+   {
+      CpuFeatures features;
+
+#ifdef E57_CPU_X86_64
+      unsigned regs[4] = {};
+
+      cpuid( 0, 0, regs );
+      const unsigned maxLeaf = regs[0];
+
+      cpuid( 1, 0, regs );
+      const bool ssse3 = ( regs[2] & ( 1u << 9 ) ) != 0;
+      const bool osxsave = ( regs[2] & ( 1u << 27 ) ) != 0;
+
+      features.sse41 = ssse3 && ( ( regs[2] & ( 1u << 19 ) ) != 0 );
+      features.sse42 = ( regs[2] & ( 1u << 20 ) ) != 0;
+
+      if ( ( maxLeaf >= 7 ) && osxsave && osSavesYmm() )
+      {
+         cpuid( 7, 0, regs );
+         features.avx2 = ( regs[1] & ( 1u << 5 ) ) != 0;
+      }
+#elif defined( __aarch64__ )
+#if defined( __ARM_FEATURE_CRC32 ) || defined( __APPLE__ )
+      features.armv8Crc = true;
+#elif defined( __linux__ )
+#ifndef HWCAP_CRC32
+#define HWCAP_CRC32 ( 1 << 7 )
+#endif
+      features.armv8Crc = ( getauxval( AT_HWCAP ) & HWCAP_CRC32 ) != 0;
+#endif
+#endif
+
+      return features;
+   }
+}
+
+const CpuFeatures &e57::cpuFeatures()
+{
+   static const CpuFeatures sFeatures = detect();
+
+   return sFeatures;
+}
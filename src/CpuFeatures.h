@@ -0,0 +1,17 @@
+#pragma once
+// SPDX-License-Identifier: MIT
+
+namespace e57
+{
+   /// Instruction set extensions of the CPU we are running on, that we have optimized code for
+   struct CpuFeatures
+   {
+      bool sse41 = false;    ///< x86: SSE 4.1 (and SSSE3)
+      bool sse42 = false;    ///< x86: SSE 4.2 crc32 instruction
+      bool avx2 = false;     ///< x86: AVX2, and the OS saves the YMM registers
+      bool armv8Crc = false; ///< AArch64: CRC32 instructions
+   };
+
+   /// Features are detected on the first call
+   const CpuFeatures &cpuFeatures();
+}
@@ -28,6 +28,7 @@
 #include <algorithm>
 #include <cstring>
 
+#include "BitUnpack.h"
 #include "Decoder.h"
 #include "E57FormatImpl.h"
 #include "ImageFileImpl.h"
@@ -35,6 +36,12 @@
 
 using namespace e57;
 
+namespace
+{
+   /// Number of records BitpackIntegerDecoder unpacks at a time, small enough to stay in the L1 cache
+   constexpr size_t LaneBlockSize = 1024;
+}
+
 std::shared_ptr<Decoder> Decoder::DecoderFactory( unsigned bytestreamNumber, //!!! name ok?
                                                   const CompressedVectorNodeImpl *cVector,
                                                   std::vector<SourceDestBuffer> &dbufs, const ustring & /*codecPath*/ )
@@ -67,7 +74,6 @@ std::shared_ptr<Decoder> Decoder::DecoderFactory( unsigned bytestreamNumber, //!
 
          unsigned bitsPerRecord = imf->bitsNeeded( ini->minimum(), ini->maximum() );
 
-         //!!! need to pick smarter channel buffer sizes, here and elsewhere
          /// Constuct Integer decoder with appropriate register size, based on
          /// number of bits stored.
          if ( bitsPerRecord == 0 )
@@ -115,7 +121,6 @@ std::shared_ptr<Decoder> Decoder::DecoderFactory( unsigned bytestreamNumber, //!
 
          unsigned bitsPerRecord = imf->bitsNeeded( sini->minimum(), sini->maximum() );
 
-         //!!! need to pick smarter channel buffer sizes, here and elsewhere
          /// Constuct ScaledInteger dencoder with appropriate register size,
          /// based on number of bits stored.
          if ( bitsPerRecord == 0 )
@@ -189,11 +194,19 @@ BitpackDecoder::BitpackDecoder( unsigned bytestreamNumber, SourceDestBuffer &dbu
                                 uint64_t maxRecordCount ) :
    Decoder( bytestreamNumber ),
    maxRecordCount_( maxRecordCount ), destBuffer_( dbuf.impl() ),
-   inBuffer_( 1024 ), //!!! need to pick smarter channel buffer sizes
-   inBufferAlignmentSize_( alignmentSize ), bitsPerWord_( 8 * alignmentSize ), bytesPerWord_( alignmentSize )
+   inBuffer_( inBufferCapacity( alignmentSize ) + BitUnpackPadding ), inBufferAlignmentSize_( alignmentSize ),
+   bitsPerWord_( 8 * alignmentSize ), bytesPerWord_( alignmentSize )
 {
 }
 
+/// inBuffer_ only holds the bytes at the end of a bytestream buffer that can't be decoded in place: the
+/// BitUnpackPadding bytes decoders may read past their input, the start of a record straddling two buffers, and the
+/// word it starts in.  A record is never wider than a word.
+size_t BitpackDecoder::inBufferCapacity( unsigned alignmentSize )
+{
+   return BitUnpackPadding + 4 * alignmentSize;
+}
+
 void BitpackDecoder::destBufferSetNew( std::vector<SourceDestBuffer> &dbufs )
 {
    if ( dbufs.size() != 1 )
@@ -210,80 +223,108 @@ size_t BitpackDecoder::inputProcess( const char *source, const size_t availableB
    std::cout << "BitpackDecoder::inputprocess() called, source=" << ( source ? source : "none" )
              << " availableByteCount=" << availableByteCount << std::endl;
 #endif
-   size_t bytesUnsaved = availableByteCount;
-   size_t bitsEaten = 0;
-   do
+   const size_t capacity = inBuffer_.size() - BitUnpackPadding;
+
+   /// Number of bytes of source decoded or saved in inBuffer_.  Unless inBuffer_ holds something, inBufferFirstBit_
+   /// counts from source[sourceByte].
+   size_t sourceByte = 0;
+
+   /// Finish the records left over from the previous bytestream buffer first
+   if ( inBufferEndByte_ > 0 )
    {
-      size_t byteCount = std::min( bytesUnsaved, inBuffer_.size() - static_cast<size_t>( inBufferEndByte_ ) );
+      const size_t carriedByteCount = inBufferEndByte_;
+      const size_t byteCount = std::min( availableByteCount, capacity - inBufferEndByte_ );
 
-      /// Copy input bytes from caller, if any
       if ( byteCount > 0 )
       {
          memcpy( &inBuffer_[inBufferEndByte_], source, byteCount );
-
-         /// Advance tail pointer.
          inBufferEndByte_ += byteCount;
-
-         /// Update amount available from caller
-         bytesUnsaved -= byteCount;
-         source += byteCount;
       }
-#ifdef E57_MAX_VERBOSE
+
+      inBufferProcess();
+
+      const size_t firstByte = inBufferFirstBit_ / 8;
+
+      /// Still not past the old bytes: the output is full, or we need more input to complete a record
+      if ( ( firstByte < carriedByteCount ) || ( inBufferFirstBit_ > inBufferEndByte_ * 8 ) )
       {
-         unsigned i;
-         unsigned firstByte = inBufferFirstBit_ / 8;
-         for ( i = 0; i < byteCount && i < 20; i++ )
-         {
-            std::cout << "  inBuffer[" << firstByte + i << "]=" << (unsigned)(unsigned char)( inBuffer_[firstByte + i] )
-                      << std::endl;
-         }
-         if ( i < byteCount )
-         {
-            std::cout << "  " << byteCount - i << "source bytes unprinted..." << std::endl;
-         }
+         inBufferShiftDown();
+
+         return byteCount;
       }
-#endif
 
-      /// ??? fix doc for new bit interface
-      /// Now that we have input stored in an aligned buffer, call derived class
-      /// to try to eat some Note that end of filled buffer may not be at a
-      /// natural boundary. The subclass may transfer this partial word in a
-      /// full word transfer, but it must be carefull to only use the defined
-      /// bits. inBuffer_ is a multiple of largest word size, so this full word
-      /// transfer off the end will always be in defined memory.
-
-      size_t firstWord = inBufferFirstBit_ / bitsPerWord_;
-      size_t firstNaturalBit = firstWord * bitsPerWord_;
-      size_t endBit = inBufferEndByte_ * 8;
+      /// Forget the copies of source bytes in inBuffer_, carry on from the original
+      sourceByte = firstByte - carriedByteCount;
+      inBufferFirstBit_ %= 8;
+      inBufferEndByte_ = 0;
+   }
+
+   /// Decode in place all we can without reading past the end of source
+   const size_t inPlaceEndByte = ( availableByteCount > BitUnpackPadding ) ? availableByteCount - BitUnpackPadding : 0;
+
+   if ( inPlaceEndByte * 8 > sourceByte * 8 + inBufferFirstBit_ )
+   {
 #ifdef E57_MAX_VERBOSE
-      std::cout << "  feeding aligned decoder " << endBit - inBufferFirstBit_ << " bits." << std::endl;
+      std::cout << "  feeding aligned decoder " << ( inPlaceEndByte - sourceByte ) * 8 - inBufferFirstBit_
+                << " bits in place." << std::endl;
 #endif
-      bitsEaten = inputProcessAligned( &inBuffer_[firstWord * bytesPerWord_], inBufferFirstBit_ - firstNaturalBit,
-                                       endBit - firstNaturalBit );
+      const size_t bitsEaten =
+         inputProcessAligned( source + sourceByte, inBufferFirstBit_, ( inPlaceEndByte - sourceByte ) * 8 );
+
+      const size_t endBit = inBufferFirstBit_ + bitsEaten;
+
+      sourceByte += endBit / 8;
+      inBufferFirstBit_ = endBit % 8;
+   }
+
+   /// Save what's left in inBuffer_, unless decoding stopped because the output is full
+   const size_t byteCount = availableByteCount - sourceByte;
+
+   if ( byteCount > capacity )
+   {
+      return sourceByte;
+   }
+
+   if ( byteCount > 0 )
+   {
+      memcpy( &inBuffer_[0], source + sourceByte, byteCount );
+      inBufferEndByte_ = byteCount;
+   }
+
+   inBufferProcess();
+   inBufferShiftDown();
+
+   return availableByteCount;
+}
+
+/// Decode what we can from inBuffer_.  It has BitUnpackPadding bytes after the end of the input, so decoders reading
+/// a whole word (or more) past the last bit stay in defined memory.
+void BitpackDecoder::inBufferProcess()
+{
+   const size_t firstWord = inBufferFirstBit_ / bitsPerWord_;
+   const size_t firstNaturalBit = firstWord * bitsPerWord_;
+   const size_t endBit = inBufferEndByte_ * 8;
+
+   /// After a seek, the first bit may be past the end of the input we have so far.
+   if ( endBit <= inBufferFirstBit_ )
+   {
+      return;
+   }
+
 #ifdef E57_MAX_VERBOSE
-      std::cout << "  bitsEaten=" << bitsEaten << " firstWord=" << firstWord << " firstNaturalBit=" << firstNaturalBit
-                << " endBit=" << endBit << std::endl;
+   std::cout << "  feeding aligned decoder " << endBit - inBufferFirstBit_ << " bits." << std::endl;
 #endif
+
+   const size_t bitsEaten = inputProcessAligned( &inBuffer_[firstWord * bytesPerWord_],
+                                                 inBufferFirstBit_ - firstNaturalBit, endBit - firstNaturalBit );
 #ifdef E57_DEBUG
-      if ( bitsEaten > endBit - inBufferFirstBit_ )
-      {
-         throw E57_EXCEPTION2( E57_ERROR_INTERNAL, "bitsEaten=" + toString( bitsEaten ) +
-                                                      " endBit=" + toString( endBit ) +
-                                                      " inBufferFirstBit=" + toString( inBufferFirstBit_ ) );
-      }
+   if ( bitsEaten > endBit - inBufferFirstBit_ )
+   {
+      throw E57_EXCEPTION2( E57_ERROR_INTERNAL, "bitsEaten=" + toString( bitsEaten ) + " endBit=" + toString( endBit ) +
+                                                   " inBufferFirstBit=" + toString( inBufferFirstBit_ ) );
+   }
 #endif
-      inBufferFirstBit_ += bitsEaten;
-
-      /// Shift uneaten data to beginning of inBuffer_, keep on natural word
-      /// boundaries.
-      inBufferShiftDown();
-
-      /// If the lower level processing didn't eat anything on this iteration,
-      /// stop looping and tell caller how much we ate or stored.
-   } while ( bytesUnsaved > 0 && bitsEaten > 0 );
-
-   /// Return the number of bytes we ate/saved.
-   return ( availableByteCount - bytesUnsaved );
+   inBufferFirstBit_ += bitsEaten;
 }
 
 void BitpackDecoder::stateReset()
@@ -292,6 +333,32 @@ void BitpackDecoder::stateReset()
    inBufferEndByte_ = 0;
 }
 
+bool BitpackDecoder::seekRecord( uint64_t chunkRecordNumber, uint64_t recordNumber, uint64_t &byteOffset )
+{
+   stateReset();
+
+   const unsigned recordBits = bitsPerRecord();
+
+   /// Can't calculate where a variable length record starts, so go back to the
+   /// beginning of the chunk and let caller decode up to recordNumber.
+   if ( recordBits == 0 )
+   {
+      currentRecordIndex_ = chunkRecordNumber;
+      byteOffset = 0;
+      return false;
+   }
+
+   /// Start reading at the word containing the first bit of the record, and
+   /// skip the bits before it in that word.
+   const uint64_t bitOffset = ( recordNumber - chunkRecordNumber ) * recordBits;
+
+   byteOffset = ( bitOffset / bitsPerWord_ ) * bytesPerWord_;
+   inBufferFirstBit_ = static_cast<size_t>( bitOffset % bitsPerWord_ );
+   currentRecordIndex_ = recordNumber;
+
+   return true;
+}
+
 void BitpackDecoder::inBufferShiftDown()
 {
    /// Move uneaten data down to beginning of inBuffer_.
@@ -404,39 +471,38 @@ size_t BitpackFloatDecoder::inputProcessAligned( const char *inbuf, const size_t
    std::cout << "  n:" << n << std::endl; //???
 #endif
 
-   if ( precision_ == E57_SINGLE )
+   /// Values are decoded where they are in the packet, which isn't necessarily aligned for a float or double.  Those
+   /// that aren't go through alignedValues_ a block at a time.
+   const bool aligned = ( reinterpret_cast<uintptr_t>( inbuf ) % typeSize ) == 0;
+
+   if ( !aligned && alignedValues_.empty() )
    {
-      /// Form the starting address for first data location in inBuffer
-      auto inp = reinterpret_cast<const float *>( inbuf );
+      alignedValues_.resize( LaneBlockSize );
+   }
 
-      /// Copy floats from inbuf to destBuffer_
-      for ( unsigned i = 0; i < n; i++ )
-      {
-         float value = *inp;
+   for ( size_t done = 0; done < n; )
+   {
+      const size_t blockCount = aligned ? n : std::min( n - done, alignedValues_.size() );
+      const char *values = inbuf + done * typeSize;
 
-#ifdef E57_MAX_VERBOSE
-         std::cout << "  got float value=" << value << std::endl;
-#endif
-         destBuffer_->setNextFloat( value );
-         inp++;
+      if ( !aligned )
+      {
+         memcpy( alignedValues_.data(), values, blockCount * typeSize );
+         values = reinterpret_cast<const char *>( alignedValues_.data() );
       }
-   }
-   else
-   { /// E57_DOUBLE precision
-      /// Form the starting address for first data location in inBuffer
-      auto inp = reinterpret_cast<const double *>( inbuf );
 
-      /// Copy doubles from inbuf to destBuffer_
-      for ( unsigned i = 0; i < n; i++ )
+      if ( precision_ == E57_SINGLE )
       {
-         double value = *inp;
-
-#ifdef E57_MAX_VERBOSE
-         std::cout << "  got double value=" << value << std::endl;
-#endif
-         destBuffer_->setNextDouble( value );
-         inp++;
+         /// Copy floats from inbuf to destBuffer_
+         destBuffer_->setNextFloatBlock( reinterpret_cast<const float *>( values ), blockCount );
+      }
+      else
+      { /// E57_DOUBLE precision
+         /// Copy doubles from inbuf to destBuffer_
+         destBuffer_->setNextDoubleBlock( reinterpret_cast<const double *>( values ), blockCount );
       }
+
+      done += blockCount;
    }
 
    /// Update counts of records processed
@@ -446,6 +512,11 @@ size_t BitpackFloatDecoder::inputProcessAligned( const char *inbuf, const size_t
    return ( n * 8 * typeSize );
 }
 
+unsigned BitpackFloatDecoder::bitsPerRecord() const
+{
+   return ( precision_ == E57_SINGLE ) ? 8 * sizeof( float ) : 8 * sizeof( double );
+}
+
 #ifdef E57_DEBUG
 void BitpackFloatDecoder::dump( int indent, std::ostream &os )
 {
@@ -490,9 +561,10 @@ size_t BitpackStringDecoder::inputProcessAligned( const char *inbuf, const size_
    size_t nBytesAvailable = ( endBit - firstBit ) >> 3;
    size_t nBytesRead = 0;
 
-   /// Loop until we've finished all the records, or ran out of input currently
-   /// available
-   while ( currentRecordIndex_ < maxRecordCount_ && nBytesRead < nBytesAvailable )
+   /// Loop until we've finished all the records, filled the dest buffer, or ran
+   /// out of input currently available
+   while ( currentRecordIndex_ < maxRecordCount_ && destBuffer_->nextIndex() < destBuffer_->capacity() &&
+           nBytesRead < nBytesAvailable )
    {
 #ifdef E57_MAX_VERBOSE
       std::cout << "read string loop1: readingPrefix=" << readingPrefix_ << " prefixLength=" << prefixLength_
@@ -611,6 +683,26 @@ size_t BitpackStringDecoder::inputProcessAligned( const char *inbuf, const size_
    return ( nBytesRead * 8 );
 }
 
+void BitpackStringDecoder::stateReset()
+{
+   BitpackDecoder::stateReset();
+
+   /// Forget any partially read string
+   readingPrefix_ = true;
+   prefixLength_ = 1;
+   memset( prefixBytes_, 0, sizeof( prefixBytes_ ) );
+   nBytesPrefixRead_ = 0;
+   stringLength_ = 0;
+   currentString_ = "";
+   nBytesStringRead_ = 0;
+}
+
+unsigned BitpackStringDecoder::bitsPerRecord() const
+{
+   /// Strings are variable length
+   return 0;
+}
+
 #ifdef E57_DEBUG
 void BitpackStringDecoder::dump( int indent, std::ostream &os )
 {
@@ -650,6 +742,11 @@ BitpackIntegerDecoder<RegisterT>::BitpackIntegerDecoder( bool isScaledInteger, u
 
    bitsPerRecord_ = imf->bitsNeeded( minimum_, maximum_ );
    destBitMask_ = ( bitsPerRecord_ == 64 ) ? ~0 : static_cast<RegisterT>( 1ULL << bitsPerRecord_ ) - 1;
+
+   if ( bitsPerRecord_ <= 32 )
+   {
+      lanes_.resize( LaneBlockSize );
+   }
 }
 
 template <typename RegisterT>
@@ -700,7 +797,40 @@ size_t BitpackIntegerDecoder<RegisterT>::inputProcessAligned( const char *inbuf,
    std::cout << "  recordCount=" << recordCount << std::endl;
 #endif
 
-   auto inp = reinterpret_cast<const RegisterT *>( inbuf );
+   /// Unpack records of up to 32 bits a block at a time with the vectorized kernels
+   if ( !lanes_.empty() )
+   {
+      for ( size_t done = 0; done < recordCount; )
+      {
+         const size_t blockCount = std::min( recordCount - done, lanes_.size() );
+
+         unpackBits( inbuf, firstBit + done * bitsPerRecord_, bitsPerRecord_, blockCount, lanes_.data() );
+
+         /// Add minimum_ to values to get back what writer originally sent
+         if ( isScaledInteger_ )
+         {
+            destBuffer_->setNextInt64Block( lanes_.data(), minimum_, blockCount, scale_, offset_ );
+         }
+         else
+         {
+            destBuffer_->setNextInt64Block( lanes_.data(), minimum_, blockCount );
+         }
+
+         done += blockCount;
+      }
+
+      currentRecordIndex_ += recordCount;
+
+      return ( recordCount * bitsPerRecord_ );
+   }
+
+   /// inbuf points into the packet, so words are loaded with memcpy rather than assuming it is aligned
+   const auto loadWord = [inbuf]( unsigned wordPosition ) {
+      RegisterT word;
+      memcpy( &word, inbuf + wordPosition * sizeof( RegisterT ), sizeof( RegisterT ) );
+      return word;
+   };
+
    unsigned wordPosition = 0; /// The index in inbuf of the word we are currently working on.
 
    ///  For example on little endian machine:
@@ -720,7 +850,7 @@ size_t BitpackIntegerDecoder<RegisterT>::inputProcessAligned( const char *inbuf,
    for ( size_t i = 0; i < recordCount; i++ )
    {
       /// Get lower word (contains at least the LSbit of the value),
-      RegisterT low = inp[wordPosition];
+      RegisterT low = loadWord( wordPosition );
 
 #ifdef E57_MAX_VERBOSE
       std::cout << "  bitOffset: " << bitOffset << std::endl;
@@ -731,7 +861,7 @@ size_t BitpackIntegerDecoder<RegisterT>::inputProcessAligned( const char *inbuf,
       if ( bitOffset > 0 )
       {
          /// Get upper word (may or may not contain interesting bits),
-         RegisterT high = inp[wordPosition + 1];
+         RegisterT high = loadWord( wordPosition + 1 );
 
 #ifdef E57_MAX_VERBOSE
          std::cout << "  high:" << binaryString( high ) << std::endl;
@@ -796,6 +926,11 @@ size_t BitpackIntegerDecoder<RegisterT>::inputProcessAligned( const char *inbuf,
    return ( recordCount * bitsPerRecord_ );
 }
 
+template <typename RegisterT> unsigned BitpackIntegerDecoder<RegisterT>::bitsPerRecord() const
+{
+   return bitsPerRecord_;
+}
+
 #ifdef E57_DEBUG
 template <typename RegisterT> void BitpackIntegerDecoder<RegisterT>::dump( int indent, std::ostream &os )
 {
@@ -872,6 +1007,16 @@ void ConstantIntegerDecoder::stateReset()
 {
 }
 
+bool ConstantIntegerDecoder::seekRecord( uint64_t /*chunkRecordNumber*/, uint64_t recordNumber,
+                                         uint64_t &byteOffset )
+{
+   /// No bytes in the bytestream, so can jump straight to any record
+   currentRecordIndex_ = recordNumber;
+   byteOffset = 0;
+
+   return true;
+}
+
 #ifdef E57_DEBUG
 void ConstantIntegerDecoder::dump( int indent, std::ostream &os )
 {
@@ -44,6 +44,19 @@ namespace e57
       virtual uint64_t totalRecordsCompleted() = 0;
       virtual size_t inputProcess( const char *source, const size_t count ) = 0;
       virtual void stateReset() = 0;
+
+      /// Reset state so that the next record produced is recordNumber.  The bytestream is counted from the start of
+      /// the chunk beginning with chunkRecordNumber.  On success, byteOffset is set to the offset from there of the
+      /// next byte to feed to the decoder.  Returns false if the records are variable length, in which case the decoder
+      /// is left at chunkRecordNumber (byteOffset = 0) and the caller must skip records by decoding.
+      virtual bool seekRecord( uint64_t chunkRecordNumber, uint64_t recordNumber, uint64_t &byteOffset ) = 0;
+
+      /// False if the records take no room in the bytestream, which is then always empty
+      virtual bool readsBytestream() const
+      {
+         return true;
+      }
+
       unsigned bytestreamNumber() const
       {
          return bytestreamNumber_;
@@ -72,6 +85,10 @@ namespace e57
       virtual size_t inputProcessAligned( const char *inbuf, const size_t firstBit, const size_t endBit ) = 0;
 
       void stateReset() override;
+      bool seekRecord( uint64_t chunkRecordNumber, uint64_t recordNumber, uint64_t &byteOffset ) override;
+
+      /// Number of bits each record takes in the bytestream, 0 if variable length
+      virtual unsigned bitsPerRecord() const = 0;
 
 #ifdef E57_DEBUG
       void dump( int indent = 0, std::ostream &os = std::cout ) override;
@@ -80,6 +97,8 @@ namespace e57
       BitpackDecoder( unsigned bytestreamNumber, SourceDestBuffer &dbuf, unsigned alignmentSize,
                       uint64_t maxRecordCount );
 
+      static size_t inBufferCapacity( unsigned alignmentSize );
+      void inBufferProcess();
       void inBufferShiftDown();
 
       uint64_t currentRecordIndex_ = 0;
@@ -87,6 +106,8 @@ namespace e57
 
       std::shared_ptr<SourceDestBufferImpl> destBuffer_;
 
+      /// Bytestream input is decoded where the caller has it, only the few bytes at the end of each buffer that can't
+      /// be are kept here until the next one comes.
       std::vector<char> inBuffer_;
       size_t inBufferFirstBit_ = 0;
       size_t inBufferEndByte_ = 0;
@@ -103,11 +124,16 @@ namespace e57
 
       size_t inputProcessAligned( const char *inbuf, const size_t firstBit, const size_t endBit ) override;
 
+      unsigned bitsPerRecord() const override;
+
 #ifdef E57_DEBUG
       void dump( int indent = 0, std::ostream &os = std::cout ) override;
 #endif
    protected:
       FloatPrecision precision_ = E57_SINGLE;
+
+      /// Misaligned values are copied a block at a time into here, before they are stored in destBuffer_
+      std::vector<double> alignedValues_;
    };
 
    class BitpackStringDecoder : public BitpackDecoder
@@ -117,6 +143,9 @@ namespace e57
 
       size_t inputProcessAligned( const char *inbuf, const size_t firstBit, const size_t endBit ) override;
 
+      void stateReset() override;
+      unsigned bitsPerRecord() const override;
+
 #ifdef E57_DEBUG
       void dump( int indent = 0, std::ostream &os = std::cout ) override;
 #endif
@@ -138,6 +167,8 @@ namespace e57
 
       size_t inputProcessAligned( const char *inbuf, const size_t firstBit, const size_t endBit ) override;
 
+      unsigned bitsPerRecord() const override;
+
 #ifdef E57_DEBUG
       void dump( int indent = 0, std::ostream &os = std::cout ) override;
 #endif
@@ -149,6 +180,9 @@ namespace e57
       double offset_;
       unsigned bitsPerRecord_;
       RegisterT destBitMask_;
+
+      /// Records of up to 32 bits are unpacked a block at a time into here, before they are stored in destBuffer_
+      std::vector<uint32_t> lanes_;
    };
 
    class ConstantIntegerDecoder : public Decoder
@@ -163,6 +197,11 @@ namespace e57
       }
       size_t inputProcess( const char *source, const size_t availableByteCount ) override;
       void stateReset() override;
+      bool seekRecord( uint64_t chunkRecordNumber, uint64_t recordNumber, uint64_t &byteOffset ) override;
+      bool readsBytestream() const override
+      {
+         return false;
+      }
 #ifdef E57_DEBUG
       void dump( int indent = 0, std::ostream &os = std::cout ) override;
 #endif
@@ -246,6 +246,7 @@ DEALINGS IN THE SOFTWARE.
 #include "E57FormatImpl.h"
 
 #include "ImageFileImpl.h"
+#include "ParsedPathNameImpl.h"
 #include "SourceDestBufferImpl.h"
 
 using namespace e57;
@@ -2369,6 +2370,52 @@ Node::Node( NodeImplSharedPtr ni ) : impl_( ni )
 }
 //! @endcond
 
+//=====================================================================================
+/*!
+@class ParsedPathName
+@brief   A path name that has been checked and split into element names once.
+@details
+StructureNode::get and VectorNode::get split their string @a pathName into
+element names and check them on every call. When the same path name is looked
+up in many nodes, for example "pose/translation/x" in each of thousands of
+data3D entries, a ParsedPathName made once can be passed instead, which saves
+that work and the string allocations it takes.
+@see     StructureNode::get(const ParsedPathName&) const,
+VectorNode::get(const ParsedPathName&) const
+*/
+
+/*!
+@brief   Check and split a path name.
+@param   [in] destImageFile   The ImageFile whose registered extensions the
+prefixes of the element names in @a pathName are checked against.
+@param   [in] pathName        The absolute pathname, or relative pathname.
+@details
+Whether a relative path name is defined is decided when it is used, relative to
+the node it is used with. An absolute path name starts at the root of the tree
+that contains that node.
+@pre     The @a destImageFile must be open (i.e. destImageFile.isOpen()).
+@return  A smart ParsedPathName handle referencing the underlying object.
+@throw   ::E57_ERROR_BAD_PATH_NAME
+@throw   ::E57_ERROR_IMAGEFILE_NOT_OPEN
+@throw   ::E57_ERROR_INTERNAL           All objects in undocumented state
+@see     StructureNode::isDefined(const ParsedPathName&) const
+*/
+ParsedPathName::ParsedPathName( ImageFile destImageFile, const ustring &pathName ) :
+   impl_( new ParsedPathNameImpl( destImageFile.impl(), pathName ) )
+{
+}
+
+/*!
+@brief   Get the path name this object was made from.
+@post    No visible state is modified.
+@return  The path name given to the constructor.
+@throw   No E57Exceptions.
+*/
+ustring ParsedPathName::pathName() const
+{
+   return impl_->pathName_;
+}
+
 //=====================================================================================
 /*!
 @class StructureNode
@@ -2501,6 +2548,25 @@ bool StructureNode::isDefined( const ustring &pathName ) const
    return impl_->isDefined( pathName );
 }
 
+/*!
+@brief   Is the given already parsed pathName defined relative to this node.
+@param   [in] pathName   The absolute pathname, or pathname relative to this
+object, to check.
+@details
+Same as StructureNode::isDefined(const ustring&) const, without parsing the path name
+again.
+@pre     The destination ImageFile must be open (i.e. destImageFile().isOpen()).
+@post    No visible state is modified.
+@return  true if pathName is currently defined.
+@throw   ::E57_ERROR_IMAGEFILE_NOT_OPEN
+@throw   ::E57_ERROR_INTERNAL           All objects in undocumented state
+@see     ParsedPathName
+*/
+bool StructureNode::isDefined( const ParsedPathName &pathName ) const
+{
+   return impl_->isDefined( *pathName.impl_ );
+}
+
 /*!
 @brief   Get a child element by positional index.
 @param   [in] index   The index of child element to get, starting at 0.
@@ -2546,6 +2612,26 @@ Node StructureNode::get( const ustring &pathName ) const
    return Node( impl_->get( pathName ) );
 }
 
+/*!
+@brief   Get a child by already parsed path name.
+@param   [in] pathName   The absolute pathname, or pathname relative to this
+object, of the object to get.
+@details
+Same as StructureNode::get(const ustring&) const, without parsing the path name again.
+@pre     The destination ImageFile must be open (i.e. destImageFile().isOpen()).
+@pre     The @a pathName must be defined (i.e. isDefined(pathName)).
+@post    No visible state is modified.
+@return  A smart Node handle referencing the child node.
+@throw   ::E57_ERROR_PATH_UNDEFINED
+@throw   ::E57_ERROR_IMAGEFILE_NOT_OPEN
+@throw   ::E57_ERROR_INTERNAL           All objects in undocumented state
+@see     ParsedPathName
+*/
+Node StructureNode::get( const ParsedPathName &pathName ) const
+{
+   return Node( impl_->get( *pathName.impl_ ) );
+}
+
 /*!
 @brief   Add a new child at a given path
     @param   [in] pathName  The absolute pathname, or pathname relative to this
@@ -2832,6 +2918,25 @@ bool VectorNode::isDefined( const ustring &pathName ) const
    return impl_->isDefined( pathName );
 }
 
+/*!
+@brief   Is the given already parsed pathName defined relative to this node.
+@param   [in] pathName   The absolute pathname, or pathname relative to this
+object, to check.
+@details
+Same as VectorNode::isDefined(const ustring&) const, without parsing the path name
+again.
+@pre     The destination ImageFile must be open (i.e. destImageFile().isOpen()).
+@post    No visible state is modified.
+@return  true if pathName is currently defined.
+@throw   ::E57_ERROR_IMAGEFILE_NOT_OPEN
+@throw   ::E57_ERROR_INTERNAL           All objects in undocumented state
+@see     ParsedPathName
+*/
+bool VectorNode::isDefined( const ParsedPathName &pathName ) const
+{
+   return impl_->isDefined( *pathName.impl_ );
+}
+
 /*!
 @brief   Get a child element by positional index.
 @param   [in] index   The index of child element to get, starting at 0.
@@ -2878,6 +2983,26 @@ Node VectorNode::get( const ustring &pathName ) const
    return Node( impl_->get( pathName ) );
 }
 
+/*!
+@brief   Get a child by already parsed path name.
+@param   [in] pathName   The absolute pathname, or pathname relative to this
+object, of the object to get.
+@details
+Same as VectorNode::get(const ustring&) const, without parsing the path name again.
+@pre     The destination ImageFile must be open (i.e. destImageFile().isOpen()).
+@pre     The @a pathName must be defined (i.e. isDefined(pathName)).
+@post    No visible state is modified.
+@return  A smart Node handle referencing the child node.
+@throw   ::E57_ERROR_PATH_UNDEFINED
+@throw   ::E57_ERROR_IMAGEFILE_NOT_OPEN
+@throw   ::E57_ERROR_INTERNAL           All objects in undocumented state
+@see     ParsedPathName
+*/
+Node VectorNode::get( const ParsedPathName &pathName ) const
+{
+   return Node( impl_->get( *pathName.impl_ ) );
+}
+
 /*!
 @brief   Append a child element to end of VectorNode.
 @param   [in] n   The node to be added as a child at end of the VectorNode.
@@ -3223,6 +3348,13 @@ SourceDestBuffer::SourceDestBuffer( ImageFile destImageFile, const ustring &path
 {
 }
 
+//! @cond documentNonPublic   The following isn't part of the API, and isn't
+//! documented.
+SourceDestBuffer::SourceDestBuffer( std::shared_ptr<SourceDestBufferImpl> ni ) : impl_( ni )
+{
+}
+//! @endcond
+
 /*!
 @brief   Get path name in prototype that this SourceDestBuffer will transfer
 data to/from.
@@ -3579,6 +3711,63 @@ unsigned CompressedVectorReader::read( std::vector<SourceDestBuffer> &dbufs )
    return impl_->read( dbufs );
 }
 
+/*!
+@brief   Request transfer of blocks of data from CompressedVectorNode into
+previously designated destination buffers, decoding several ranges of records
+at once.
+@param   [in] threadCount   Number of threads to use. 0 (the default) uses one
+thread per processor core.
+@details
+Does the same as CompressedVectorReader::read(): the records following the last
+ones read (or the record given to the last CompressedVectorReader::seek) are
+stored in order at the beginning of the SourceDestBuffers, and the number of
+records read is returned.
+
+The records requested are split into @a threadCount contiguous ranges, each
+decoded on its own thread straight into its part of the SourceDestBuffers. Each
+range starts decoding at the data packet holding its first record, the way
+CompressedVectorReader::seek does, so this pays off when the SourceDestBuffers
+hold many records (hundreds of thousands or more). Fewer threads are used if
+the buffers are too small to be worth splitting, down to a plain
+CompressedVectorReader::read().
+
+The ImageFile must not be used by other threads while this is running, unless
+it was opened in read mode.
+
+@pre     The associated ImageFile must be open.
+@pre     This CompressedVectorReader must be open (i.e isOpen())
+@return  The number of records read.
+@throw   ::E57_ERROR_IMAGEFILE_NOT_OPEN
+@throw   ::E57_ERROR_READER_NOT_OPEN
+@throw   ::E57_ERROR_CONVERSION_REQUIRED            This CompressedVectorReader
+in undocumented state
+@throw   ::E57_ERROR_VALUE_NOT_REPRESENTABLE        This CompressedVectorReader
+in undocumented state
+@throw   ::E57_ERROR_SCALED_VALUE_NOT_REPRESENTABLE This CompressedVectorReader
+in undocumented state
+@throw   ::E57_ERROR_REAL64_TOO_LARGE               This CompressedVectorReader
+in undocumented state
+@throw   ::E57_ERROR_EXPECTING_NUMERIC              This CompressedVectorReader
+in undocumented state
+@throw   ::E57_ERROR_EXPECTING_USTRING              This CompressedVectorReader
+in undocumented state
+@throw   ::E57_ERROR_BAD_CV_PACKET      This CompressedVectorReader, associated
+ImageFile in undocumented state
+@throw   ::E57_ERROR_LSEEK_FAILED       This CompressedVectorReader, associated
+ImageFile in undocumented state
+@throw   ::E57_ERROR_READ_FAILED        This CompressedVectorReader, associated
+ImageFile in undocumented state
+@throw   ::E57_ERROR_BAD_CHECKSUM       This CompressedVectorReader, associated
+ImageFile in undocumented state
+@throw   ::E57_ERROR_INTERNAL           All objects in undocumented state
+@see     CompressedVectorReader::read(), CompressedVectorReader::seek,
+CompressedVectorNode::reader
+*/
+unsigned CompressedVectorReader::readParallel( unsigned threadCount )
+{
+   return impl_->readParallel( threadCount );
+}
+
 /*!
 @brief   Set record number of CompressedVectorNode where next read will start.
 @param   [in] recordNumber   The index of record in ComressedVectorNode where
@@ -3589,6 +3778,11 @@ CompressedVectorReader are open). The next read will start at the given
 recordNumber. It is not an error to seek to recordNumber = childCount() (i.e. to
 one record past end of CompressedVectorNode).
 
+The first seek scans the packet headers of the binary section to locate each
+bytestream. Fields with a fixed number of bits per record (integer, scaled
+integer, float) are then positioned directly. String fields have variable length
+records, so they are decoded from the start of the section up to recordNumber.
+
 @pre     @a recordNumber <= childCount() of CompressedVectorNode.
 @pre     The associated ImageFile must be open.
 @pre     This CompressedVectorReader must be open (i.e isOpen())
@@ -4234,7 +4428,6 @@ FloatNode, StringNode) in this CompressedVectorNode's prototype. It is an error
 for two SourceDestBuffers in @a dbufs to identify the same terminal node in the
 prototype.
 
-
 It is an error to call this function if the CompressedVectorNode already has any
 records (i.e. a CompressedVectorNode cannot be set twice).
 
@@ -4267,7 +4460,37 @@ CompressedVectorNode::prototype
 */
 CompressedVectorWriter CompressedVectorNode::writer( std::vector<SourceDestBuffer> &sbufs )
 {
-   return CompressedVectorWriter( impl_->writer( sbufs ) );
+   return writer( sbufs, CompressedVectorWriter::Options() );
+}
+
+/*!
+@brief   Create an iterator object for writing a series of blocks of data to a
+CompressedVectorNode, encoding on several threads or writing in the background.
+@param   [in] sbufs         Vector of memory buffers that will hold data to be
+written to a CompressedVectorNode.
+@param   [in] options       Number of encoding threads and of data packets
+written behind, see CompressedVectorWriter::Options.
+@details
+Otherwise the same as writer(std::vector<SourceDestBuffer>&).
+
+Each SourceDestBuffer is encoded into its own bytestream, so with a threadCount
+greater than 1 the buffers are encoded concurrently during
+CompressedVectorWriter::write(). The file written is the same whatever the
+number of threads, which is never more than the number of @a sbufs. A prototype
+containing a StringNode is always encoded on the calling thread.
+
+With a writeBehindDepth greater than 0, checksumming and writing data packets
+to the file overlaps with encoding. When more than writeBehindDepth packets
+are waiting, CompressedVectorWriter::write() waits for the oldest one. A failure
+to write a packet is reported by the next call to CompressedVectorWriter::write()
+or CompressedVectorWriter::close() (or by the next use of the ImageFile), and
+leaves the file in an undocumented state.
+@see     CompressedVectorWriter::Options
+*/
+CompressedVectorWriter CompressedVectorNode::writer( std::vector<SourceDestBuffer> &sbufs,
+                                                    const CompressedVectorWriter::Options &options )
+{
+   return CompressedVectorWriter( impl_->writer( sbufs, options.threadCount, options.writeBehindDepth ) );
 }
 
 /*!
@@ -4282,6 +4505,9 @@ CompressedVectorNode's prototype. It is an error for two SourceDestBuffers in @a
 dbufs to identify the same terminal node in the prototype. It is not an error to
 create a CompressedVectorReader for an empty CompressedVectorNode.
 
+An ImageFile opened in read mode can have any number of readers open at once,
+for instance one per thread. An ImageFile opened in write mode can only have one.
+
 @pre     @a dbufs can't be empty
 @pre     The destination ImageFile must be open (i.e. destImageFile().isOpen()).
 @pre     The destination ImageFile can't have any writers open
@@ -4292,6 +4518,7 @@ iterator object.
 @throw   ::E57_ERROR_BAD_API_ARGUMENT
 @throw   ::E57_ERROR_IMAGEFILE_NOT_OPEN
 @throw   ::E57_ERROR_TOO_MANY_WRITERS
+@throw   ::E57_ERROR_TOO_MANY_READERS
 @throw   ::E57_ERROR_NODE_UNATTACHED
 @throw   ::E57_ERROR_PATH_UNDEFINED
 @throw   ::E57_ERROR_BUFFER_SIZE_MISMATCH
@@ -4304,7 +4531,32 @@ CompressedVectorNode::prototype
 */
 CompressedVectorReader CompressedVectorNode::reader( const std::vector<SourceDestBuffer> &dbufs )
 {
-   return CompressedVectorReader( impl_->reader( dbufs ) );
+   return reader( dbufs, CompressedVectorReader::Options() );
+}
+
+/*!
+@brief   Create an iterator object for reading a series of blocks of data from a
+CompressedVectorNode, decoding on several threads or loading packets ahead.
+@param   [in] dbufs     Vector of memory buffers that will receive data read
+from a CompressedVectorNode.
+@param   [in] options   Number of decoding threads and of data packets loaded
+ahead, see CompressedVectorReader::Options.
+@details
+Otherwise the same as reader(const std::vector<SourceDestBuffer>&).
+
+Each SourceDestBuffer is filled from its own bytestream, so with a threadCount
+greater than 1 the buffers are filled concurrently. The data read is the same
+whatever the number of threads, which is never more than the number of @a dbufs.
+
+With a prefetchDepth greater than 0, reading from the file overlaps with
+decoding. Prefetching only happens during CompressedVectorReader::read(), so the
+ImageFile can be used normally between reads.
+@see     CompressedVectorReader::Options
+*/
+CompressedVectorReader CompressedVectorNode::reader( const std::vector<SourceDestBuffer> &dbufs,
+                                                    const CompressedVectorReader::Options &options )
+{
+   return CompressedVectorReader( impl_->reader( dbufs, options.threadCount, options.prefetchDepth ) );
 }
 
 //=====================================================================================
@@ -5728,6 +5980,14 @@ Write API operations are not legal for an ImageFile opened in read mode (i.e.
 the ImageFile is read-only). There is no API support for appending data onto an
 existing E57 data file.
 
+The XML parser is set up once and reused by the ImageFiles opened afterwards,
+from any thread, so opening many small files doesn't pay for it each time.
+
+A read mode ImageFile can be used from several threads at once: its nodes can be
+looked up and read concurrently, and each thread can have its own
+CompressedVectorReader, of the same or of different CompressedVectorNodes. A
+single CompressedVectorReader must still be used by one thread at a time.
+
 @post    Resulting ImageFile is in @c open state if constructor succeeds (no
 exception thrown).
 @return  A smart ImageFile handle referencing the underlying object.
@@ -5750,14 +6010,37 @@ StringNode, BlobNode, StructureNode, VectorNode, CompressedVectorNode,
 E57Exception, E57Utilities::E57Utilities
 */
 ImageFile::ImageFile( const ustring &fname, const ustring &mode, ReadChecksumPolicy checksumPolicy ) :
-   impl_( new ImageFileImpl( checksumPolicy ) )
+   ImageFile( fname, mode, checksumPolicy, Options() )
+{
+}
+
+/*!
+@brief   Open an ASTM E57 imaging data file for reading/writing, with packet cache and XML settings.
+@param   [in] fname File name to open.
+@param   [in] mode Either "w" for writing or "r" for reading.
+@param   [in] checksumPolicy The percentage of checksums we compute and verify
+as an int. Clamped to 0-100.
+@param   [in] options Size of the packet cache, XML validation, lazy reading of
+the metadata and where to cache it, see ImageFile::Options.
+@details Otherwise the same as ImageFile(const ustring &, const ustring &, ReadChecksumPolicy).
+@see     ImageFile::Options
+*/
+ImageFile::ImageFile( const ustring &fname, const ustring &mode, ReadChecksumPolicy checksumPolicy,
+                      const Options &options ) :
+   impl_( new ImageFileImpl( checksumPolicy, options ) )
 {
    /// Do second phase of construction, now that ImageFile object is complete.
    impl_->construct2( fname, mode );
 }
 
 ImageFile::ImageFile( const char *input, const uint64_t size, ReadChecksumPolicy checksumPolicy ) :
-   impl_( new ImageFileImpl( checksumPolicy ) )
+   ImageFile( input, size, checksumPolicy, Options() )
+{
+}
+
+ImageFile::ImageFile( const char *input, const uint64_t size, ReadChecksumPolicy checksumPolicy,
+                      const Options &options ) :
+   impl_( new ImageFileImpl( checksumPolicy, options ) )
 {
    impl_->construct2( input, size );
 }
@@ -27,8 +27,10 @@
  * DEALINGS IN THE SOFTWARE.
  */
 
+#include <algorithm>
 #include <cmath>
 #include <cstring>
+#include <new>
 
 #include "E57FormatImpl.h"
 
@@ -37,6 +39,7 @@
 #include "Encoder.h"
 #include "ImageFileImpl.h"
 #include "SourceDestBufferImpl.h"
+#include "ThreadPool.h"
 
 using namespace e57;
 
@@ -138,6 +141,7 @@ bool VectorNodeImpl::allowHeteroChildren() const
 void VectorNodeImpl::set( int64_t index64, NodeImplSharedPtr ni )
 {
    checkImageFileOpen( __FILE__, __LINE__, static_cast<const char *>( __FUNCTION__ ) );
+   materialize();
    if ( !allowHeteroChildren_ )
    {
       /// New node type must match all existing children
@@ -157,6 +161,7 @@ void VectorNodeImpl::set( int64_t index64, NodeImplSharedPtr ni )
 void VectorNodeImpl::writeXml( ImageFileImplSharedPtr imf, CheckedFile &cf, int indent, const char *forcedFieldName )
 {
    /// don't checkImageFileOpen
+   materialize();
 
    ustring fieldName;
    if ( forcedFieldName != nullptr )
@@ -181,6 +186,7 @@ void VectorNodeImpl::writeXml( ImageFileImplSharedPtr imf, CheckedFile &cf, int
 void VectorNodeImpl::dump( int indent, std::ostream &os ) const
 {
    /// don't checkImageFileOpen
+   materialize();
    os << space( indent ) << "type:        Vector"
       << " (" << type() << ")" << std::endl;
    NodeImpl::dump( indent, os );
@@ -416,7 +422,9 @@ void CompressedVectorNodeImpl::dump( int indent, std::ostream &os ) const
 }
 #endif
 
-std::shared_ptr<CompressedVectorWriterImpl> CompressedVectorNodeImpl::writer( std::vector<SourceDestBuffer> sbufs )
+std::shared_ptr<CompressedVectorWriterImpl> CompressedVectorNodeImpl::writer( std::vector<SourceDestBuffer> sbufs,
+                                                                              unsigned threadCount,
+                                                                              unsigned writeBehindDepth )
 {
    checkImageFileOpen( __FILE__, __LINE__, static_cast<const char *>( __FUNCTION__ ) );
 
@@ -459,24 +467,28 @@ std::shared_ptr<CompressedVectorWriterImpl> CompressedVectorNodeImpl::writer( st
    std::shared_ptr<CompressedVectorNodeImpl> cai( std::static_pointer_cast<CompressedVectorNodeImpl>( ni ) );
 
    /// Return a shared_ptr to new object
-   std::shared_ptr<CompressedVectorWriterImpl> cvwi( new CompressedVectorWriterImpl( cai, sbufs ) );
+   std::shared_ptr<CompressedVectorWriterImpl> cvwi(
+      new CompressedVectorWriterImpl( cai, sbufs, threadCount, writeBehindDepth ) );
    return ( cvwi );
 }
 
-std::shared_ptr<CompressedVectorReaderImpl> CompressedVectorNodeImpl::reader( std::vector<SourceDestBuffer> dbufs )
+std::shared_ptr<CompressedVectorReaderImpl> CompressedVectorNodeImpl::reader( std::vector<SourceDestBuffer> dbufs,
+                                                                              unsigned threadCount,
+                                                                              unsigned prefetchDepth )
 {
    checkImageFileOpen( __FILE__, __LINE__, static_cast<const char *>( __FUNCTION__ ) );
 
    ImageFileImplSharedPtr destImageFile( destImageFile_ );
 
-   /// Check don't have any writers/readers open for this ImageFile
+   /// Check don't have any writers open for this ImageFile.  A read-only file can have any number of readers, each
+   /// used by its own thread if need be, but a file being written keeps to one.
    if ( destImageFile->writerCount() > 0 )
    {
       throw E57_EXCEPTION2( E57_ERROR_TOO_MANY_WRITERS, "fileName=" + destImageFile->fileName() +
                                                            " writerCount=" + toString( destImageFile->writerCount() ) +
                                                            " readerCount=" + toString( destImageFile->readerCount() ) );
    }
-   if ( destImageFile->readerCount() > 0 )
+   if ( destImageFile->isWriter() && ( destImageFile->readerCount() > 0 ) )
    {
       throw E57_EXCEPTION2( E57_ERROR_TOO_MANY_READERS, "fileName=" + destImageFile->fileName() +
                                                            " writerCount=" + toString( destImageFile->writerCount() ) +
@@ -509,7 +521,8 @@ std::shared_ptr<CompressedVectorReaderImpl> CompressedVectorNodeImpl::reader( st
    // cai->dump(4);
 #endif
    /// Return a shared_ptr to new object
-   std::shared_ptr<CompressedVectorReaderImpl> cvri( new CompressedVectorReaderImpl( cai, dbufs ) );
+   std::shared_ptr<CompressedVectorReaderImpl> cvri(
+      new CompressedVectorReaderImpl( cai, dbufs, threadCount, prefetchDepth ) );
    return ( cvri );
 }
 
@@ -1284,9 +1297,8 @@ void BlobNodeImpl::read( uint8_t *buf, int64_t start, size_t count )
    }
 
    ImageFileImplSharedPtr imf( destImageFile_ );
-   imf->file_->seek( binarySectionLogicalStart_ + sizeof( BlobSectionHeader ) + start );
-   imf->file_->read( reinterpret_cast<char *>( buf ),
-                     static_cast<size_t>( count ) ); //??? arg1 void* ?
+   imf->file_->readAt( binarySectionLogicalStart_ + sizeof( BlobSectionHeader ) + start,
+                       reinterpret_cast<char *>( buf ), static_cast<size_t>( count ) ); //??? arg1 void* ?
 }
 
 void BlobNodeImpl::write( uint8_t *buf, int64_t start, size_t count )
@@ -1449,8 +1461,17 @@ struct SortByBytestreamNumber
    }
 };
 
+/// Encoders stop on multiples of this record number between data packets, see write()
+#define E57_CHUNK_RECORD_ALIGNMENT UINT64_C( 64 )
+
+/// Number of records each encoder runs ahead of packet assembly when encoding in parallel, and the largest number of
+/// bytes an encoder can output per record (a 64 bit integer or double).
+static const uint64_t ParallelEncodeRecords = 16384;
+static const size_t MaxEncodedRecordSize = 8;
+
 CompressedVectorWriterImpl::CompressedVectorWriterImpl( std::shared_ptr<CompressedVectorNodeImpl> ni,
-                                                        std::vector<SourceDestBuffer> &sbufs ) :
+                                                        std::vector<SourceDestBuffer> &sbufs, unsigned threadCount,
+                                                        unsigned writeBehindDepth ) :
    cVector_( ni ),
    isOpen_( false ) // set to true when succeed below
 {
@@ -1470,6 +1491,9 @@ CompressedVectorWriterImpl::CompressedVectorWriterImpl( std::shared_ptr<Compress
    /// Check sbufs well formed (matches proto exactly)
    setBuffers( sbufs ); //??? copy code here?
 
+   /// String encoders stop when their output is full, so they can't run ahead of packet assembly
+   bool hasStrings = false;
+
    /// For each individual sbuf, create an appropriate Encoder based on the
    /// cVector_ attributes
    for ( unsigned i = 0; i < sbufs_.size(); i++ )
@@ -1489,6 +1513,11 @@ CompressedVectorWriterImpl::CompressedVectorWriterImpl( std::shared_ptr<Compress
          throw E57_EXCEPTION2( E57_ERROR_INTERNAL, "sbufIndex=" + toString( i ) );
       }
 
+      if ( readNode->type() == E57_STRING )
+      {
+         hasStrings = true;
+      }
+
       /// EncoderFactory picks the appropriate encoder to match type declared in
       /// prototype
       bytestreams_.push_back(
@@ -1510,6 +1539,28 @@ CompressedVectorWriterImpl::CompressedVectorWriterImpl( std::shared_ptr<Compress
    }
 #endif
 
+   /// Bytestreams are independent, so they can be encoded in parallel.  No point in having more threads than
+   /// bytestreams.
+   if ( threadCount == 0 )
+   {
+      threadCount = std::max( std::thread::hardware_concurrency(), 1U );
+   }
+
+   threadCount = static_cast<unsigned>( std::min<size_t>( threadCount, bytestreams_.size() ) );
+
+   if ( threadCount > 1 && !hasStrings )
+   {
+      encodePool_.reset( new ThreadPool( threadCount ) );
+
+      /// Make room for the records encoded ahead, on top of what can be left over from the previous packet
+      for ( auto &bytestream : bytestreams_ )
+      {
+         bytestream->outputSetMaxSize(
+            static_cast<unsigned>( DATA_PACKET_MAX + ( ParallelEncodeRecords + E57_CHUNK_RECORD_ALIGNMENT ) *
+                                                        MaxEncodedRecordSize ) );
+      }
+   }
+
    ImageFileImplSharedPtr imf( ni->destImageFile_ );
 
    /// Reserve space for CompressedVector binary section header, record location
@@ -1524,6 +1575,17 @@ CompressedVectorWriterImpl::CompressedVectorWriterImpl( std::shared_ptr<Compress
    dataPacketsCount_ = 0;
    indexPacketsCount_ = 0;
 
+   /// First data packet always starts a chunk
+   chunkStartPending_ = true;
+   chunkStartRecordNumber_ = 0;
+
+   /// Data packets are assembled in a buffer of the background writer while
+   /// writeBehindDepth packets before it are being written.
+   if ( writeBehindDepth > 0 )
+   {
+      imf->file_->startWriteBehind( writeBehindDepth + 1, sizeof( DataPacket ) );
+   }
+
    /// Just before return (and can't throw) increment writer count  ??? safer
    /// way to assure don't miss close?
    imf->incrWriterCount();
@@ -1584,6 +1646,12 @@ void CompressedVectorWriterImpl::close()
       flush();
    }
 
+   /// Wait for the data packets still being written, and report if one failed
+   imf->file_->stopWriteBehind();
+
+   /// Write index packets after the data, sets topIndexPhysicalOffset_
+   writeIndexPackets();
+
    /// Compute length of whole section we just wrote (from section start to
    /// current start of free space).
    sectionLogicalLength_ = imf->unusedLogicalStart_ - sectionHeaderLogicalStart_;
@@ -1684,6 +1752,10 @@ void CompressedVectorWriterImpl::write( const size_t requestedRecordCount )
    checkImageFileOpen( __FILE__, __LINE__, static_cast<const char *>( __FUNCTION__ ) );
    checkWriterOpen( __FILE__, __LINE__, static_cast<const char *>( __FUNCTION__ ) );
 
+   /// Report a failure to write one of the previous data packets
+   ImageFileImplSharedPtr imf( cVector_->destImageFile_ );
+   imf->file_->checkWriteBehind();
+
    /// Check that requestedRecordCount is not larger than the sbufs
    if ( requestedRecordCount > sbufs_.at( 0 ).impl()->capacity() )
    {
@@ -1765,16 +1837,26 @@ void CompressedVectorWriterImpl::write( const size_t requestedRecordCount )
       /// Don't allow a single channel to get too far ahead ???
       /// Process channels that are furthest behind first. ???
 
+      if ( encodePool_ )
+      {
+         encodeParallel( endRecordIndex );
+         continue;
+      }
+
       ///!!!! For now just process one record per loop until packet is full
       /// enough, or completed
       /// request
       for ( auto &bytestream : bytestreams_ )
       {
-         if ( bytestream->currentRecordIndex() < endRecordIndex )
+         const uint64_t currentRecordIndex = bytestream->currentRecordIndex();
+         if ( currentRecordIndex < endRecordIndex )
          {
-            //!!! For now, process up to 50 records at a time
-            uint64_t recordCount = endRecordIndex - bytestream->currentRecordIndex();
-            recordCount = ( recordCount < 50ULL ) ? recordCount : 50ULL; // min(recordCount, 50ULL);
+            /// Process up to the next multiple of E57_CHUNK_RECORD_ALIGNMENT records. Stopping every bitpack
+            /// encoder on a record number that is a multiple of 64 leaves it on a word boundary, so a packet
+            /// written here can be the start of a chunk in the index.
+            uint64_t recordCount = endRecordIndex - currentRecordIndex;
+            recordCount =
+               std::min( recordCount, E57_CHUNK_RECORD_ALIGNMENT - currentRecordIndex % E57_CHUNK_RECORD_ALIGNMENT );
             bytestream->processRecords( static_cast<unsigned>( recordCount ) );
          }
       }
@@ -1786,6 +1868,81 @@ void CompressedVectorWriterImpl::write( const size_t requestedRecordCount )
    /// ioBuffers as well as partial words in Encoder registers.
 }
 
+/// Does the work of many iterations of the loop in write() at once: runs all the encoders in parallel through the
+/// next rounds of records, then writes the data packets the loop would have written between those rounds.  The
+/// encoders end up ahead of the packets, but a packet only takes bytes from the front of their output, and the
+/// amount taken from each is computed from what the encoder had output at the time, so the file is the same.
+void CompressedVectorWriterImpl::encodeParallel( const uint64_t endRecordIndex )
+{
+   /// Split the records into the same rounds as write(), each ending on a multiple of E57_CHUNK_RECORD_ALIGNMENT
+   const uint64_t startRecordIndex = bytestreams_.at( 0 )->currentRecordIndex();
+
+   std::vector<uint64_t> roundEnd;
+   for ( uint64_t recordIndex = startRecordIndex;
+         recordIndex < endRecordIndex && recordIndex - startRecordIndex < ParallelEncodeRecords; )
+   {
+      recordIndex = std::min( endRecordIndex,
+                              recordIndex + E57_CHUNK_RECORD_ALIGNMENT - recordIndex % E57_CHUNK_RECORD_ALIGNMENT );
+      roundEnd.push_back( recordIndex );
+   }
+
+   const size_t bytestreamCount = bytestreams_.size();
+   const size_t roundCount = roundEnd.size();
+
+   roundOutput_.resize( bytestreamCount * roundCount );
+   roundRegisterEmpty_.resize( bytestreamCount * roundCount );
+
+   encodePool_->run( bytestreamCount, [&]( size_t i ) {
+      Encoder &bytestream = *bytestreams_[i];
+
+      for ( size_t round = 0; round < roundCount; ++round )
+      {
+         bytestream.processRecords( static_cast<size_t>( roundEnd[round] - bytestream.currentRecordIndex() ) );
+
+         /// Output buffers were made large enough for all the rounds in the constructor
+         if ( bytestream.currentRecordIndex() != roundEnd[round] )
+         {
+            throw E57_EXCEPTION2( E57_ERROR_INTERNAL,
+                                  "currentRecordIndex=" + toString( bytestream.currentRecordIndex() ) +
+                                     " roundEnd=" + toString( roundEnd[round] ) );
+         }
+
+         roundOutput_[i * roundCount + round] = bytestream.outputAvailable();
+         roundRegisterEmpty_[i * roundCount + round] = bytestream.registerEmpty();
+      }
+   } );
+
+   /// Replay the packet writes, except after the last round: that one is left to write(), where the encoders are no
+   /// longer ahead.
+   std::vector<size_t> consumed( bytestreamCount, 0 );
+   std::vector<size_t> available( bytestreamCount );
+
+   for ( size_t round = 0; round + 1 < roundCount; ++round )
+   {
+      size_t packetSize = sizeof( DataPacketHeader ) + bytestreamCount * sizeof( uint16_t );
+      bool registersEmpty = true;
+
+      for ( size_t i = 0; i < bytestreamCount; ++i )
+      {
+         available[i] = roundOutput_[i * roundCount + round] - consumed[i];
+         packetSize += available[i];
+         registersEmpty = registersEmpty && roundRegisterEmpty_[i * roundCount + round];
+      }
+
+      while ( packetSize >= E57_TARGET_PACKET_SIZE )
+      {
+         packetWrite( available, roundEnd[round], registersEmpty );
+
+         packetSize = sizeof( DataPacketHeader ) + bytestreamCount * sizeof( uint16_t );
+         for ( size_t i = 0; i < bytestreamCount; ++i )
+         {
+            consumed[i] = roundOutput_[i * roundCount + round] - available[i];
+            packetSize += available[i];
+         }
+      }
+   }
+}
+
 size_t CompressedVectorWriterImpl::totalOutputAvailable() const
 {
    size_t total = 0;
@@ -1805,13 +1962,42 @@ size_t CompressedVectorWriterImpl::currentPacketSize() const
 }
 
 uint64_t CompressedVectorWriterImpl::packetWrite()
+{
+   std::vector<size_t> available( bytestreams_.size() );
+
+   /// If every bytestream stopped at the same record with nothing left in its
+   /// register, the data after this packet starts with that record.
+   const uint64_t recordIndex = bytestreams_.at( 0 )->currentRecordIndex();
+   bool atRecordBoundary = true;
+
+   for ( size_t i = 0; i < bytestreams_.size(); i++ )
+   {
+      available.at( i ) = bytestreams_.at( i )->outputAvailable();
+
+      if ( bytestreams_.at( i )->currentRecordIndex() != recordIndex || !bytestreams_.at( i )->registerEmpty() )
+      {
+         atRecordBoundary = false;
+      }
+   }
+
+   return packetWrite( available, recordIndex, atRecordBoundary );
+}
+
+/// Write a data packet from the first available[i] bytes of output of each bytestream, and take what was written off
+/// available.  recordIndex and atRecordBoundary describe the state of the bytestreams at the end of that output.
+uint64_t CompressedVectorWriterImpl::packetWrite( std::vector<size_t> &available, uint64_t recordIndex,
+                                                  bool atRecordBoundary )
 {
 #ifdef E57_MAX_VERBOSE
    std::cout << "CompressedVectorWriterImpl::packetWrite() called" << std::endl; //???
 #endif
 
    /// Double check that we have work to do
-   size_t totalOutput = totalOutputAvailable();
+   size_t totalOutput = 0;
+   for ( size_t n : available )
+   {
+      totalOutput += n;
+   }
    if ( totalOutput == 0 )
    {
       return ( 0 );
@@ -1837,7 +2023,7 @@ uint64_t CompressedVectorWriterImpl::packetWrite()
       /// We can fit everything in one packet
       for ( unsigned i = 0; i < bytestreams_.size(); i++ )
       {
-         count.at( i ) = bytestreams_.at( i )->outputAvailable();
+         count.at( i ) = available.at( i );
       }
    }
    else
@@ -1849,7 +2035,7 @@ uint64_t CompressedVectorWriterImpl::packetWrite()
       for ( unsigned i = 0; i < bytestreams_.size(); i++ )
       {
          /// Round down here so sum <= packetMaxPayloadBytes
-         count.at( i ) = static_cast<unsigned>( floor( fractionToSend * bytestreams_.at( i )->outputAvailable() ) );
+         count.at( i ) = static_cast<unsigned>( floor( fractionToSend * available.at( i ) ) );
       }
    }
 #ifdef E57_MAX_VERBOSE
@@ -1877,14 +2063,19 @@ uint64_t CompressedVectorWriterImpl::packetWrite()
    ImageFileImplSharedPtr imf( cVector_->destImageFile_ );
 
    /// Use temp buf in object (is 64KBytes long) instead of allocating each time
-   /// here
-   char *packet = reinterpret_cast<char *>( &dataPacket_ );
+   /// here, or the next free buffer of the background writer
+   DataPacket *dataPacket = &dataPacket_;
+   if ( imf->file_->isWritingBehind() )
+   {
+      dataPacket = new ( imf->file_->writeBehindBuffer() ) DataPacket;
+   }
+   char *packet = reinterpret_cast<char *>( dataPacket );
 #ifdef E57_MAX_VERBOSE
    std::cout << "  packet=" << packet << std::endl; //???
 #endif
 
    /// To be safe, clear header part of packet
-   dataPacket_.header.reset();
+   dataPacket->header.reset();
 
    /// Write bytestreamBufferLength[bytestreamCount] after header, in
    /// dataPacket_
@@ -1922,6 +2113,7 @@ uint64_t CompressedVectorWriterImpl::packetWrite()
 
       /// Read from encoder output into packet
       bytestreams_.at( i )->outputRead( p, n );
+      available.at( i ) -= n;
 
       /// Move pointer to end of current data
       p += n;
@@ -1959,19 +2151,27 @@ uint64_t CompressedVectorWriterImpl::packetWrite()
 #endif
    }
 
-   /// Prepare header in dataPacket_, now that we are sure of packetLength
-   dataPacket_.header.packetLogicalLengthMinus1 = static_cast<uint16_t>( packetLength - 1 ); // %%% Truncation
-   dataPacket_.header.bytestreamCount = static_cast<uint16_t>( bytestreams_.size() );        // %%% Truncation
+   /// Prepare header in dataPacket, now that we are sure of packetLength
+   dataPacket->header.packetLogicalLengthMinus1 = static_cast<uint16_t>( packetLength - 1 ); // %%% Truncation
+   dataPacket->header.bytestreamCount = static_cast<uint16_t>( bytestreams_.size() );        // %%% Truncation
 
    /// Double check that data packet is well formed
-   dataPacket_.verify( packetLength );
+   dataPacket->verify( packetLength );
 
    /// Write whole data packet at beginning of free space in file
    uint64_t packetLogicalOffset = imf->allocateSpace( packetLength, false );
    uint64_t packetPhysicalOffset = imf->file_->logicalToPhysical( packetLogicalOffset );
-   imf->file_->seek( packetLogicalOffset ); //??? have seekLogical and seekPhysical instead?
-                                            // more explicit
-   imf->file_->write( packet, packetLength );
+   if ( imf->file_->isWritingBehind() )
+   {
+      /// Checksums are computed and the packet written while we go on encoding
+      imf->file_->writeBehind( packetLogicalOffset, packetLength );
+   }
+   else
+   {
+      imf->file_->seek( packetLogicalOffset ); //??? have seekLogical and seekPhysical instead?
+                                               // more explicit
+      imf->file_->write( packet, packetLength );
+   }
 
 #ifdef E57_MAX_VERBOSE
 //  std::cout << "data packet:" << std::endl;
@@ -1990,12 +2190,111 @@ uint64_t CompressedVectorWriterImpl::packetWrite()
    }
    dataPacketsCount_++;
 
-   ///!!! update seekIndex here? if started new chunk?
+   /// Add to index if this packet started a chunk
+   if ( chunkStartPending_ )
+   {
+      IndexPacket::IndexPacketEntry entry;
+      entry.chunkRecordNumber = chunkStartRecordNumber_;
+      entry.chunkPhysicalOffset = packetPhysicalOffset;
+      chunkIndex_.push_back( entry );
+
+      chunkStartPending_ = false;
+   }
+
+   /// If all output has been written and the bytestreams are at a record
+   /// boundary, the next data packet will start with that record in every
+   /// bytestream, so it can start a new chunk.
+   if ( atRecordBoundary && recordIndex > chunkIndex_.back().chunkRecordNumber )
+   {
+      bool allWritten = true;
+      for ( size_t n : available )
+      {
+         allWritten = allWritten && ( n == 0 );
+      }
+
+      if ( allWritten )
+      {
+         chunkStartPending_ = true;
+         chunkStartRecordNumber_ = recordIndex;
+      }
+   }
 
    /// Return physical offset of data packet for potential use in seekIndex
    return ( packetPhysicalOffset ); //??? needed
 }
 
+void CompressedVectorWriterImpl::writeIndexPackets()
+{
+   /// Don't need an index if there is only one chunk, reader can start at
+   /// dataPhysicalOffset_.
+   if ( chunkIndex_.size() < 2 )
+   {
+      return;
+   }
+
+   ImageFileImplSharedPtr imf( cVector_->destImageFile_ );
+
+   /// Use a heap buffer, IndexPacket is 32KBytes long
+   std::unique_ptr<IndexPacket> packet( new IndexPacket );
+
+   /// Level 0 entries point at chunks (data packets). Each level above points
+   /// at the index packets of the level below, until a single packet covers
+   /// everything.
+   std::vector<IndexPacket::IndexPacketEntry> entries = chunkIndex_;
+   uint8_t indexLevel = 0;
+
+   for ( ;; )
+   {
+      /// Spread entries evenly over packets, so every packet above level 0 has
+      /// at least two entries.
+      const size_t packetCount = ( entries.size() + IndexPacket::MAX_ENTRIES - 1 ) / IndexPacket::MAX_ENTRIES;
+      const size_t entriesPerPacket = ( entries.size() + packetCount - 1 ) / packetCount;
+
+      std::vector<IndexPacket::IndexPacketEntry> parentEntries;
+
+      for ( size_t first = 0; first < entries.size(); first += entriesPerPacket )
+      {
+         const size_t entryCount = std::min( entriesPerPacket, entries.size() - first );
+
+         /// Always write full length packets. Older readers reject index
+         /// packets shorter than sizeof(IndexPacket).
+         const unsigned packetLength = sizeof( IndexPacket );
+
+         std::fill( packet->entries, packet->entries + IndexPacket::MAX_ENTRIES, IndexPacket::IndexPacketEntry() );
+         std::copy( &entries[first], &entries[first] + entryCount, packet->entries );
+
+         packet->packetLogicalLengthMinus1 = static_cast<uint16_t>( packetLength - 1 );
+         packet->entryCount = static_cast<uint16_t>( entryCount );
+         packet->indexLevel = indexLevel;
+
+         /// Double check that index packet is well formed
+         packet->verify( packetLength, recordCount_ );
+
+         /// Write index packet at beginning of free space in file
+         uint64_t packetLogicalOffset = imf->allocateSpace( packetLength, false );
+         uint64_t packetPhysicalOffset = imf->file_->logicalToPhysical( packetLogicalOffset );
+         imf->file_->seek( packetLogicalOffset );
+         imf->file_->write( reinterpret_cast<char *>( packet.get() ), packetLength );
+
+         indexPacketsCount_++;
+
+         IndexPacket::IndexPacketEntry parentEntry;
+         parentEntry.chunkRecordNumber = entries[first].chunkRecordNumber;
+         parentEntry.chunkPhysicalOffset = packetPhysicalOffset;
+         parentEntries.push_back( parentEntry );
+      }
+
+      if ( parentEntries.size() == 1 )
+      {
+         topIndexPhysicalOffset_ = parentEntries[0].chunkPhysicalOffset;
+         break;
+      }
+
+      entries.swap( parentEntries );
+      indexLevel++;
+   }
+}
+
 void CompressedVectorWriterImpl::flush()
 {
    for ( auto &bytestream : bytestreams_ )
@@ -2068,7 +2367,8 @@ void CompressedVectorWriterImpl::dump( int indent, std::ostream &os )
 ///================================================================
 
 CompressedVectorReaderImpl::CompressedVectorReaderImpl( std::shared_ptr<CompressedVectorNodeImpl> cvi,
-                                                        std::vector<SourceDestBuffer> &dbufs ) :
+                                                        std::vector<SourceDestBuffer> &dbufs, unsigned threadCount,
+                                                        unsigned prefetchDepth ) :
    isOpen_( false ), // set to true when succeed below
    cVector_( cvi )
 {
@@ -2127,7 +2427,8 @@ CompressedVectorReaderImpl::CompressedVectorReaderImpl( std::shared_ptr<Compress
    ImageFileImplSharedPtr imf( cVector_->destImageFile_ );
 
    //??? what if fault in this constructor?
-   cache_ = new PacketReadCache( imf->file_, 32 );
+   cache_ = imf->packetCache_.get();
+   prefetcher_.reset( new PacketPrefetcher( cache_, prefetchDepth ) );
 
    /// Read CompressedVector section header
    CompressedVectorSectionHeader sectionHeader;
@@ -2140,8 +2441,7 @@ CompressedVectorReaderImpl::CompressedVectorReaderImpl( std::shared_ptr<Compress
       throw E57_EXCEPTION2( E57_ERROR_INTERNAL,
                             "imageFileName=" + cVector_->imageFileName() + " cvPathName=" + cVector_->pathName() );
    }
-   imf->file_->seek( sectionLogicalStart, CheckedFile::Logical );
-   imf->file_->read( reinterpret_cast<char *>( &sectionHeader ), sizeof( sectionHeader ) );
+   imf->file_->readAt( sectionLogicalStart, reinterpret_cast<char *>( &sectionHeader ), sizeof( sectionHeader ) );
 
 #ifdef E57_DEBUG
    sectionHeader.verify( imf->file_->length( CheckedFile::Physical ) );
@@ -2151,13 +2451,23 @@ CompressedVectorReaderImpl::CompressedVectorReaderImpl( std::shared_ptr<Compress
    sectionEndLogicalOffset_ = sectionLogicalStart + sectionHeader.sectionLogicalLength;
 
    /// Convert physical offset to first data packet to logical
-   uint64_t dataLogicalOffset = imf->file_->physicalToLogical( sectionHeader.dataPhysicalOffset );
+   dataLogicalOffset_ = imf->file_->physicalToLogical( sectionHeader.dataPhysicalOffset );
+
+   /// Packets are mostly read in order, from the first data packet to the end of the section
+   imf->file_->advise( dataLogicalOffset_, sectionEndLogicalOffset_ - dataLogicalOffset_, CheckedFile::Sequential );
+
+   /// Index is optional
+   indexLogicalOffset_ = 0;
+   if ( sectionHeader.indexPhysicalOffset != 0 )
+   {
+      indexLogicalOffset_ = imf->file_->physicalToLogical( sectionHeader.indexPhysicalOffset );
+   }
 
    /// Verify that packet given by dataPhysicalOffset is actually a data packet,
    /// init channels
    {
       char *anyPacket = nullptr;
-      std::unique_ptr<PacketLock> packetLock = cache_->lock( dataLogicalOffset, anyPacket );
+      std::unique_ptr<PacketLock> packetLock = cache_->lock( dataLogicalOffset_, anyPacket );
 
       auto dpkt = reinterpret_cast<DataPacket *>( anyPacket );
 
@@ -2170,12 +2480,27 @@ CompressedVectorReaderImpl::CompressedVectorReaderImpl( std::shared_ptr<Compress
       /// Have good packet, initialize channels
       for ( auto &channel : channels_ )
       {
-         channel.currentPacketLogicalOffset = dataLogicalOffset;
+         channel.currentPacketLogicalOffset = dataLogicalOffset_;
          channel.currentBytestreamBufferIndex = 0;
          channel.currentBytestreamBufferLength = dpkt->getBytestreamBufferLength( channel.bytestreamNumber );
       }
    }
 
+   /// Channels are independent, so they can be decoded in parallel.  No point in having more threads than channels.
+   if ( threadCount == 0 )
+   {
+      threadCount = std::max( std::thread::hardware_concurrency(), 1U );
+   }
+
+   threadCount = static_cast<unsigned>( std::min<size_t>( threadCount, channels_.size() ) );
+
+   if ( threadCount > 1 )
+   {
+      decodePool_.reset( new ThreadPool( threadCount ) );
+   }
+
+   packetChannels_.reserve( channels_.size() );
+
    /// Just before return (and can't throw) increment reader count  ??? safer
    /// way to assure don't miss close?
    imf->incrReaderCount();
@@ -2271,23 +2596,34 @@ unsigned CompressedVectorReaderImpl::read()
 
    /// Loop until every dbuf is full or we have reached end of the binary
    /// section.
-   while ( true )
+   try
    {
-      /// Find the earliest packet position for channels that are still hungry
-      /// It's important to call inputProcess of the decoders before this call,
-      /// so current hungriness level is reflected.
-      uint64_t earliestPacketLogicalOffset = earliestPacketNeededForInput();
-
-      /// If nobody's hungry, we are done with the read
-      if ( earliestPacketLogicalOffset == E57_UINT64_MAX )
+      while ( true )
       {
-         break;
-      }
+         /// Find the earliest packet position for channels that are still hungry
+         /// It's important to call inputProcess of the decoders before this call,
+         /// so current hungriness level is reflected.
+         uint64_t earliestPacketLogicalOffset = earliestPacketNeededForInput();
+
+         /// If nobody's hungry, we are done with the read
+         if ( earliestPacketLogicalOffset == E57_UINT64_MAX )
+         {
+            break;
+         }
 
-      /// Feed packet to the hungry decoders
-      feedPacketToDecoders( earliestPacketLogicalOffset );
+         /// Feed packet to the hungry decoders
+         feedPacketToDecoders( earliestPacketLogicalOffset );
+      }
+   }
+   catch ( ... )
+   {
+      prefetcher_->stop();
+      throw;
    }
 
+   /// The file may be used by others until the next read()
+   prefetcher_->stop();
+
    /// Verify that each channel produced the same number of records
    unsigned outputCount = 0;
    for ( unsigned i = 0; i < channels_.size(); i++ )
@@ -2311,6 +2647,90 @@ unsigned CompressedVectorReaderImpl::read()
    return outputCount;
 }
 
+unsigned CompressedVectorReaderImpl::readParallel( unsigned threadCount )
+{
+   checkImageFileOpen( __FILE__, __LINE__, static_cast<const char *>( __FUNCTION__ ) );
+   checkReaderOpen( __FILE__, __LINE__, static_cast<const char *>( __FUNCTION__ ) );
+
+   /// Below this many records per slice, seeking to the start of each slice costs more than decoding in parallel saves
+   const uint64_t minSliceRecordCount = 64 * 1024;
+
+   /// All channels are at the same record between reads
+   const uint64_t firstRecord = channels_.at( 0 ).decoder->totalRecordsCompleted();
+   const uint64_t recordCount = std::min<uint64_t>( dbufs_.at( 0 ).capacity(), maxRecordCount_ - firstRecord );
+
+   if ( threadCount == 0 )
+   {
+      threadCount = std::max( std::thread::hardware_concurrency(), 1U );
+   }
+
+   const auto sliceCount =
+      static_cast<unsigned>( std::min<uint64_t>( threadCount, recordCount / minSliceRecordCount ) );
+
+   if ( sliceCount <= 1 )
+   {
+      return read();
+   }
+
+   /// Without an index, every slice would scan the whole section for its seek table, so build it once here and
+   /// hand it over
+   const bool shareSeekTable = ( indexLogicalOffset_ == 0 );
+
+   if ( shareSeekTable && ( seekTableLogicalOffset_ != dataLogicalOffset_ || !seekTableComplete_ ) )
+   {
+      buildSeekTable( dataLogicalOffset_, nullptr );
+   }
+
+   if ( !slicePool_ || slicePool_->threadCount() != sliceCount )
+   {
+      slicePool_.reset( new ThreadPool( sliceCount ) );
+   }
+
+   /// Each slice has its own reader, positioned at the slice's first record, filling its part of dbufs_
+   slicePool_->run( sliceCount, [&]( size_t slice ) {
+      const uint64_t sliceStart = recordCount * slice / sliceCount;
+      const uint64_t sliceEnd = recordCount * ( slice + 1 ) / sliceCount;
+      const auto sliceLength = static_cast<size_t>( sliceEnd - sliceStart );
+
+      std::vector<SourceDestBuffer> sliceBufs;
+      sliceBufs.reserve( dbufs_.size() );
+
+      for ( auto &dbuf : dbufs_ )
+      {
+         sliceBufs.push_back(
+            SourceDestBuffer( dbuf.impl()->slice( static_cast<size_t>( sliceStart ), sliceLength ) ) );
+      }
+
+      CompressedVectorReaderImpl sliceReader( cVector_, sliceBufs );
+
+      if ( shareSeekTable )
+      {
+         sliceReader.seekTableLogicalOffset_ = seekTableLogicalOffset_;
+         sliceReader.seekTableComplete_ = seekTableComplete_;
+         sliceReader.seekPacketOffsets_ = seekPacketOffsets_;
+         sliceReader.seekStreamEnds_ = seekStreamEnds_;
+      }
+
+      sliceReader.seek( firstRecord + sliceStart );
+
+      const unsigned sliceRead = sliceReader.read();
+
+      if ( sliceRead != sliceLength )
+      {
+         throw E57_EXCEPTION2( E57_ERROR_INTERNAL, "sliceStart=" + toString( firstRecord + sliceStart ) +
+                                                      " sliceLength=" + toString( sliceLength ) +
+                                                      " sliceRead=" + toString( sliceRead ) );
+      }
+
+      sliceReader.close();
+   } );
+
+   /// Carry on after the last record read, as read() would have
+   seek( firstRecord + recordCount );
+
+   return static_cast<unsigned>( recordCount );
+}
+
 uint64_t CompressedVectorReaderImpl::earliestPacketNeededForInput() const
 {
    uint64_t earliestPacketLogicalOffset = E57_UINT64_MAX;
@@ -2350,11 +2770,14 @@ uint64_t CompressedVectorReaderImpl::earliestPacketNeededForInput() const
    return earliestPacketLogicalOffset;
 }
 
-DataPacket *CompressedVectorReaderImpl::dataPacket( uint64_t inLogicalOffset ) const
+/// The packet stays in the cache while packetLock is held, other readers and the prefetch thread may reuse its buffer
+/// as soon as it is released.
+DataPacket *CompressedVectorReaderImpl::dataPacket( uint64_t inLogicalOffset,
+                                                    std::unique_ptr<PacketLock> &packetLock ) const
 {
    char *packet = nullptr;
 
-   std::unique_ptr<PacketLock> packetLock = cache_->lock( inLogicalOffset, packet );
+   packetLock = cache_->lock( inLogicalOffset, packet );
 
    return reinterpret_cast<DataPacket *>( packet );
 }
@@ -2367,7 +2790,8 @@ void CompressedVectorReaderImpl::feedPacketToDecoders( uint64_t currentPacketLog
    uint64_t nextPacketLogicalOffset = E57_UINT64_MAX;
 
    /// Get packet at currentPacketLogicalOffset into memory.
-   auto dpkt = dataPacket( currentPacketLogicalOffset );
+   std::unique_ptr<PacketLock> packetLock;
+   auto dpkt = dataPacket( currentPacketLogicalOffset, packetLock );
 
    /// Double check that have a data packet.  Should have already determined
    /// this.
@@ -2376,16 +2800,26 @@ void CompressedVectorReaderImpl::feedPacketToDecoders( uint64_t currentPacketLog
       throw E57_EXCEPTION2( E57_ERROR_INTERNAL, "packetType=" + toString( dpkt->header.packetType ) );
    }
 
-   /// Feed bytestreams to channels with unblocked output that are reading from
-   /// this packet
+   /// Have the following packets loaded while we decode this one
+   const uint64_t followingLogicalOffset = currentPacketLogicalOffset + dpkt->header.packetLogicalLengthMinus1 + 1;
+
+   prefetcher_->prefetch( followingLogicalOffset, sectionEndLogicalOffset_ );
+
+   /// Find channels with unblocked output that are reading from this packet.
+   /// Skip channels that have already read this packet.
+   packetChannels_.clear();
+
    for ( DecodeChannel &channel : channels_ )
    {
-      /// Skip channels that have already read this packet.
-      if ( channel.currentPacketLogicalOffset != currentPacketLogicalOffset || channel.isOutputBlocked() )
+      if ( channel.currentPacketLogicalOffset == currentPacketLogicalOffset && !channel.isOutputBlocked() )
       {
-         continue;
+         packetChannels_.push_back( &channel );
       }
+   }
 
+   /// Feed bytestreams to these channels.  Each channel only touches its own decoder and dbuf, so this can be spread
+   /// over the decode threads.  The result is the same as decoding them one after the other.
+   auto feedChannel = [dpkt]( DecodeChannel &channel ) {
       /// Get bytestream buffer for this channel from packet
       unsigned int bsbLength = 0;
       const char *bsbStart = dpkt->getBytestream( channel.bytestreamNumber, bsbLength );
@@ -2424,6 +2858,24 @@ void CompressedVectorReaderImpl::feedPacketToDecoders( uint64_t currentPacketLog
 
       /// Adjust counts of bytestream location
       channel.currentBytestreamBufferIndex += bytesProcessed;
+   };
+
+   if ( decodePool_ )
+   {
+      decodePool_->run( packetChannels_.size(),
+                        [this, &feedChannel]( size_t i ) { feedChannel( *packetChannels_[i] ); } );
+   }
+   else
+   {
+      for ( DecodeChannel *channel : packetChannels_ )
+      {
+         feedChannel( *channel );
+      }
+   }
+
+   for ( DecodeChannel *channelPtr : packetChannels_ )
+   {
+      DecodeChannel &channel = *channelPtr;
 
       /// Check if this channel has exhausted its bytestream buffer in this
       /// packet
@@ -2448,7 +2900,7 @@ void CompressedVectorReaderImpl::feedPacketToDecoders( uint64_t currentPacketLog
       if ( nextPacketLogicalOffset < E57_UINT64_MAX )
       { //??? huh?
          /// Get packet at nextPacketLogicalOffset into memory.
-         dpkt = dataPacket( nextPacketLogicalOffset );
+         dpkt = dataPacket( nextPacketLogicalOffset, packetLock );
 
          /// Got a data packet, update the channels with exhausted input
          for ( DecodeChannel &channel : channels_ )
@@ -2529,12 +2981,338 @@ uint64_t CompressedVectorReaderImpl::findNextDataPacket( uint64_t nextPacketLogi
    return E57_UINT64_MAX;
 }
 
-void CompressedVectorReaderImpl::seek( uint64_t /*recordNumber*/ )
+void CompressedVectorReaderImpl::seek( uint64_t recordNumber )
 {
    checkImageFileOpen( __FILE__, __LINE__, static_cast<const char *>( __FUNCTION__ ) );
+   checkReaderOpen( __FILE__, __LINE__, static_cast<const char *>( __FUNCTION__ ) );
+
+   /// It is ok to seek to one past the last record
+   if ( recordNumber > maxRecordCount_ )
+   {
+      throw E57_EXCEPTION2( E57_ERROR_BAD_API_ARGUMENT, "recordNumber=" + toString( recordNumber ) +
+                                                           " maxRecordCount=" + toString( maxRecordCount_ ) );
+   }
+
+   /// Find the chunk holding recordNumber, where every bytestream starts
+   /// fresh. If there is no index, the whole section is one chunk.
+   uint64_t chunkRecordNumber = 0;
+   uint64_t chunkLogicalOffset = dataLogicalOffset_;
+   const bool haveChunk =
+      ( indexLogicalOffset_ != 0 ) && findChunk( recordNumber, chunkRecordNumber, chunkLogicalOffset );
+
+   /// Have decoders calculate where recordNumber starts in their bytestream.
+   std::vector<uint64_t> byteOffsets( channels_.size(), 0 );
+   std::vector<bool> positioned( channels_.size(), false );
+
+   for ( unsigned i = 0; i < channels_.size(); i++ )
+   {
+      uint64_t byteOffset = 0;
+      positioned[i] = channels_[i].decoder->seekRecord( chunkRecordNumber, recordNumber, byteOffset );
+      byteOffsets[i] = byteOffset;
+   }
+
+   /// Need to know where each channel's bytestream buffers are.  Inside an
+   /// indexed chunk, only need to scan until we get to the bytes we want.
+   if ( haveChunk )
+   {
+      buildSeekTable( chunkLogicalOffset, &byteOffsets );
+   }
+   else if ( seekTableLogicalOffset_ != dataLogicalOffset_ || !seekTableComplete_ )
+   {
+      buildSeekTable( dataLogicalOffset_, nullptr );
+   }
+
+   for ( unsigned i = 0; i < channels_.size(); i++ )
+   {
+      /// Point channel at the packet holding its next byte
+      seekChannelToByte( i, byteOffsets[i] );
+
+      /// Variable length records have to be decoded from the start of the
+      /// chunk to find where recordNumber begins.
+      if ( !positioned[i] )
+      {
+         skipRecords( channels_[i], recordNumber );
+      }
+   }
+}
+
+bool CompressedVectorReaderImpl::findChunk( uint64_t recordNumber, uint64_t &chunkRecordNumber,
+                                            uint64_t &chunkLogicalOffset )
+{
+   ImageFileImplSharedPtr imf( cVector_->destImageFile_ );
+
+   /// Walk down from the top index packet, at each level taking the last entry
+   /// that starts at or before recordNumber.
+   uint64_t packetLogicalOffset = indexLogicalOffset_;
+
+   /// Index level can't be more than 5, so protect against loops
+   for ( unsigned levelsVisited = 0; levelsVisited <= 5; levelsVisited++ )
+   {
+      uint64_t entryRecordNumber = 0;
+      uint64_t entryPhysicalOffset = 0;
+      unsigned indexLevel = 0;
+      {
+         char *anyPacket = nullptr;
+         std::unique_ptr<PacketLock> packetLock = cache_->lock( packetLogicalOffset, anyPacket );
+
+         auto ipkt = reinterpret_cast<const IndexPacket *>( anyPacket );
+         if ( ipkt->packetType != INDEX_PACKET )
+         {
+            throw E57_EXCEPTION2( E57_ERROR_BAD_CV_PACKET, "packetType=" + toString( ipkt->packetType ) );
+         }
+
+         /// Binary search for last entry with chunkRecordNumber <= recordNumber
+         const IndexPacket::IndexPacketEntry *begin = ipkt->entries;
+         const IndexPacket::IndexPacketEntry *end = ipkt->entries + ipkt->entryCount;
+         const IndexPacket::IndexPacketEntry *entry =
+            std::upper_bound( begin, end, recordNumber,
+                              []( uint64_t value, const IndexPacket::IndexPacketEntry &e ) {
+                                 return value < e.chunkRecordNumber;
+                              } );
+
+         /// Record is before the first indexed chunk, can't use index
+         if ( entry == begin )
+         {
+            return false;
+         }
+         --entry;
+
+         entryRecordNumber = entry->chunkRecordNumber;
+         entryPhysicalOffset = entry->chunkPhysicalOffset;
+         indexLevel = ipkt->indexLevel;
+      }
+
+      packetLogicalOffset = imf->file_->physicalToLogical( entryPhysicalOffset );
+
+      /// Entry must point inside this section
+      if ( packetLogicalOffset < dataLogicalOffset_ || packetLogicalOffset >= sectionEndLogicalOffset_ )
+      {
+         throw E57_EXCEPTION2( E57_ERROR_BAD_CV_PACKET, "chunkPhysicalOffset=" + toString( entryPhysicalOffset ) );
+      }
+
+      /// Level 0 entries point at the first data packet of a chunk
+      if ( indexLevel == 0 )
+      {
+         chunkRecordNumber = entryRecordNumber;
+         chunkLogicalOffset = packetLogicalOffset;
+         return true;
+      }
+   }
+
+   throw E57_EXCEPTION2( E57_ERROR_BAD_CV_PACKET, "indexLogicalOffset=" + toString( indexLogicalOffset_ ) );
+}
+
+void CompressedVectorReaderImpl::buildSeekTable( uint64_t chunkLogicalOffset,
+                                                 const std::vector<uint64_t> *stopByteOffsets )
+{
+   /// Walk the packet headers (without reading the bytestream buffers) from
+   /// chunkLogicalOffset, recording where each data packet is and how much of
+   /// each channel's bytestream it holds. Stop at end of section, or when
+   /// every channel has reached its byte in stopByteOffsets.
+   ImageFileImplSharedPtr imf( cVector_->destImageFile_ );
+
+   const size_t channelCount = channels_.size();
+   std::vector<uint64_t> streamTotals( channelCount, 0 );
+   std::vector<uint16_t> bsbLength;
+
+   seekTableLogicalOffset_ = chunkLogicalOffset;
+   seekTableComplete_ = false;
+   seekPacketOffsets_.clear();
+   seekStreamEnds_.clear();
+
+   uint64_t packetLogicalOffset = chunkLogicalOffset;
+
+   while ( packetLogicalOffset < sectionEndLogicalOffset_ )
+   {
+      /// The first 4 bytes (type and length) are common to all packet types,
+      /// the rest of the data packet header follows.
+      const size_t commonHeaderSize = 4;
+      char headerBuffer[sizeof( DataPacketHeader )] = {};
+
+      imf->file_->readAt( packetLogicalOffset, headerBuffer, commonHeaderSize );
+
+      auto header = reinterpret_cast<const DataPacketHeader *>( headerBuffer );
+      const unsigned packetLength = header->packetLogicalLengthMinus1 + 1U;
+
+      if ( header->packetType == DATA_PACKET )
+      {
+         imf->file_->readAt( packetLogicalOffset + commonHeaderSize, &headerBuffer[commonHeaderSize],
+                             sizeof( headerBuffer ) - commonHeaderSize );
+         header->verify();
+
+         bsbLength.resize( header->bytestreamCount );
+         imf->file_->readAt( packetLogicalOffset + sizeof( headerBuffer ), reinterpret_cast<char *>( bsbLength.data() ),
+                             2 * bsbLength.size() );
+
+         seekPacketOffsets_.push_back( packetLogicalOffset );
+
+         for ( size_t i = 0; i < channelCount; i++ )
+         {
+            const unsigned bytestreamNumber = channels_[i].bytestreamNumber;
+            if ( bytestreamNumber >= bsbLength.size() )
+            {
+               throw E57_EXCEPTION2( E57_ERROR_BAD_CV_PACKET,
+                                     "bytestreamNumber=" + toString( bytestreamNumber ) +
+                                        " bytestreamCount=" + toString( header->bytestreamCount ) );
+            }
+
+            streamTotals[i] += bsbLength[bytestreamNumber];
+            seekStreamEnds_.push_back( streamTotals[i] );
+         }
+
+         /// See if have got far enough.  Channels whose bytestream stays empty (constant integers) have no byte to
+         /// reach.
+         if ( stopByteOffsets != nullptr )
+         {
+            bool reachedAll = true;
+            for ( size_t i = 0; i < channelCount; i++ )
+            {
+               if ( channels_[i].decoder->readsBytestream() && ( streamTotals[i] <= stopByteOffsets->at( i ) ) )
+               {
+                  reachedAll = false;
+                  break;
+               }
+            }
+
+            if ( reachedAll )
+            {
+               return;
+            }
+         }
+      }
+      else if ( header->packetType != INDEX_PACKET && header->packetType != EMPTY_PACKET )
+      {
+         throw E57_EXCEPTION2( E57_ERROR_BAD_CV_PACKET, "packetType=" + toString( header->packetType ) );
+      }
+
+      packetLogicalOffset += packetLength;
+   }
+
+   seekTableComplete_ = true;
+
+#ifdef E57_MAX_VERBOSE
+   std::cout << "  seek table has " << seekPacketOffsets_.size() << " data packets" << std::endl;
+#endif
+}
+
+void CompressedVectorReaderImpl::seekChannelToByte( unsigned channelIndex, uint64_t byteOffset )
+{
+   DecodeChannel &channel = channels_[channelIndex];
+   const size_t channelCount = channels_.size();
+   const size_t packetCount = seekPacketOffsets_.size();
+
+   if ( packetCount == 0 )
+   {
+      throw E57_EXCEPTION2( E57_ERROR_INTERNAL, "seekTableLogicalOffset=" + toString( seekTableLogicalOffset_ ) );
+   }
+
+   /// Binary search for first packet whose bytestream buffer ends after
+   /// byteOffset.
+   size_t low = 0;
+   size_t high = packetCount;
+   while ( low < high )
+   {
+      size_t mid = low + ( high - low ) / 2;
+      if ( seekStreamEnds_[mid * channelCount + channelIndex] <= byteOffset )
+      {
+         low = mid + 1;
+      }
+      else
+      {
+         high = mid;
+      }
+   }
+
+   /// If byteOffset is past the end of the bytestream, this channel won't get
+   /// any more input.
+   if ( low == packetCount )
+   {
+      const uint64_t streamEnd = seekStreamEnds_[( packetCount - 1 ) * channelCount + channelIndex];
+
+      channel.currentPacketLogicalOffset = seekPacketOffsets_[packetCount - 1];
+      channel.currentBytestreamBufferLength = static_cast<size_t>(
+         streamEnd - ( packetCount > 1 ? seekStreamEnds_[( packetCount - 2 ) * channelCount + channelIndex] : 0 ) );
+      channel.currentBytestreamBufferIndex = channel.currentBytestreamBufferLength;
+      channel.inputFinished = true;
+      return;
+   }
+
+   const uint64_t packetStreamStart = ( low > 0 ) ? seekStreamEnds_[( low - 1 ) * channelCount + channelIndex] : 0;
+
+   channel.currentPacketLogicalOffset = seekPacketOffsets_[low];
+   channel.currentBytestreamBufferLength =
+      static_cast<size_t>( seekStreamEnds_[low * channelCount + channelIndex] - packetStreamStart );
+   channel.currentBytestreamBufferIndex = static_cast<size_t>( byteOffset - packetStreamStart );
+   channel.inputFinished = false;
+}
+
+void CompressedVectorReaderImpl::skipRecords( DecodeChannel &channel, uint64_t recordNumber )
+{
+   /// Decode records for this channel into a scratch buffer until we reach
+   /// recordNumber. Only needed for variable length records (strings).
+   ImageFileImplSharedPtr imf( cVector_->destImageFile_ );
+
+   const size_t scratchSize = 1024;
+   std::vector<ustring> scratchStrings;
+
+   while ( channel.decoder->totalRecordsCompleted() < recordNumber )
+   {
+      const uint64_t remaining = recordNumber - channel.decoder->totalRecordsCompleted();
+      scratchStrings.resize( static_cast<size_t>( std::min<uint64_t>( remaining, scratchSize ) ) );
+
+      std::vector<SourceDestBuffer> scratch;
+      scratch.emplace_back( ImageFile( imf ), channel.dbuf.pathName(), &scratchStrings );
+      channel.decoder->destBufferSetNew( scratch );
+
+      std::shared_ptr<SourceDestBufferImpl> scratchImpl = scratch[0].impl();
+
+      /// Use any input decoder already has
+      channel.decoder->inputProcess( nullptr, 0 );
+
+      while ( scratchImpl->nextIndex() < scratchImpl->capacity() )
+      {
+         if ( channel.isInputBlocked() )
+         {
+            /// Move on to next data packet
+            std::unique_ptr<PacketLock> packetLock;
+            uint64_t nextPacketLogicalOffset = E57_UINT64_MAX;
+            if ( !channel.inputFinished )
+            {
+               DataPacket *dpkt = dataPacket( channel.currentPacketLogicalOffset, packetLock );
+               nextPacketLogicalOffset = findNextDataPacket( channel.currentPacketLogicalOffset +
+                                                             dpkt->header.packetLogicalLengthMinus1 + 1 );
+            }
+
+            if ( nextPacketLogicalOffset == E57_UINT64_MAX )
+            {
+               throw E57_EXCEPTION2( E57_ERROR_BAD_CV_PACKET,
+                                     "recordNumber=" + toString( recordNumber ) + " recordsCompleted=" +
+                                        toString( channel.decoder->totalRecordsCompleted() ) );
+            }
+
+            channel.currentPacketLogicalOffset = nextPacketLogicalOffset;
+            channel.currentBytestreamBufferIndex = 0;
+            channel.currentBytestreamBufferLength =
+               dataPacket( nextPacketLogicalOffset, packetLock )->getBytestreamBufferLength( channel.bytestreamNumber );
+            continue;
+         }
+
+         /// Feed rest of this packet's bytestream buffer into decoder
+         std::unique_ptr<PacketLock> packetLock;
+         unsigned int bsbLength = 0;
+         const char *bsbStart = dataPacket( channel.currentPacketLogicalOffset, packetLock )
+                                   ->getBytestream( channel.bytestreamNumber, bsbLength );
+
+         size_t bytesProcessed = channel.decoder->inputProcess( &bsbStart[channel.currentBytestreamBufferIndex],
+                                                                bsbLength - channel.currentBytestreamBufferIndex );
+
+         channel.currentBytestreamBufferIndex += bytesProcessed;
+      }
+   }
 
-   ///!!! implement
-   throw E57_EXCEPTION1( E57_ERROR_NOT_IMPLEMENTED );
+   /// Put back the user's buffer
+   std::vector<SourceDestBuffer> dest( 1, channel.dbuf );
+   channel.decoder->destBufferSetNew( dest );
 }
 
 bool CompressedVectorReaderImpl::isOpen() const
@@ -2566,7 +3344,7 @@ void CompressedVectorReaderImpl::close()
    /// Destroy decoders
    channels_.clear();
 
-   delete cache_;
+   prefetcher_.reset();
    cache_ = nullptr;
 
    isOpen_ = false;
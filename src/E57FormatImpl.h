@@ -37,6 +37,7 @@ namespace e57
    class E57XmlParser;
    class Decoder;
    class Encoder;
+   class ThreadPool;
 
    //================================================================
 
@@ -96,8 +97,10 @@ namespace e57
                      const char *forcedFieldName = nullptr ) override;
 
       /// Iterator constructors
-      std::shared_ptr<CompressedVectorWriterImpl> writer( std::vector<SourceDestBuffer> sbufs );
-      std::shared_ptr<CompressedVectorReaderImpl> reader( std::vector<SourceDestBuffer> dbufs );
+      std::shared_ptr<CompressedVectorWriterImpl> writer( std::vector<SourceDestBuffer> sbufs,
+                                                          unsigned threadCount = 1, unsigned writeBehindDepth = 0 );
+      std::shared_ptr<CompressedVectorReaderImpl> reader( std::vector<SourceDestBuffer> dbufs,
+                                                          unsigned threadCount = 1, unsigned prefetchDepth = 0 );
 
       int64_t getRecordCount() const
       {
@@ -288,6 +291,11 @@ namespace e57
       void read( uint8_t *buf, int64_t start, size_t count );
       void write( uint8_t *buf, int64_t start, size_t count );
 
+      uint64_t getBinarySectionLogicalStart() const
+      {
+         return ( binarySectionLogicalStart_ );
+      }
+
       void checkLeavesInSet( const StringSet &pathNames, NodeImplSharedPtr origin ) override;
 
       void writeXml( ImageFileImplSharedPtr imf, CheckedFile &cf, int indent,
@@ -331,10 +339,12 @@ namespace e57
    class CompressedVectorReaderImpl
    {
    public:
-      CompressedVectorReaderImpl( std::shared_ptr<CompressedVectorNodeImpl> ni, std::vector<SourceDestBuffer> &dbufs );
+      CompressedVectorReaderImpl( std::shared_ptr<CompressedVectorNodeImpl> ni, std::vector<SourceDestBuffer> &dbufs,
+                                  unsigned threadCount = 1, unsigned prefetchDepth = 0 );
       ~CompressedVectorReaderImpl();
       unsigned read();
       unsigned read( std::vector<SourceDestBuffer> &dbufs );
+      unsigned readParallel( unsigned threadCount );
       void seek( uint64_t recordNumber );
       bool isOpen() const;
       std::shared_ptr<CompressedVectorNodeImpl> compressedVectorNode() const;
@@ -350,10 +360,15 @@ namespace e57
       void setBuffers( std::vector<SourceDestBuffer> &dbufs ); //???needed?
       uint64_t earliestPacketNeededForInput() const;
 
-      DataPacket *dataPacket( uint64_t inLogicalOffset ) const;
+      DataPacket *dataPacket( uint64_t inLogicalOffset, std::unique_ptr<PacketLock> &packetLock ) const;
       void feedPacketToDecoders( uint64_t currentPacketLogicalOffset );
       uint64_t findNextDataPacket( uint64_t nextPacketLogicalOffset );
 
+      bool findChunk( uint64_t recordNumber, uint64_t &chunkRecordNumber, uint64_t &chunkLogicalOffset );
+      void buildSeekTable( uint64_t chunkLogicalOffset, const std::vector<uint64_t> *stopByteOffsets );
+      void seekChannelToByte( unsigned channelIndex, uint64_t byteOffset );
+      void skipRecords( DecodeChannel &channel, uint64_t recordNumber );
+
       //??? no default ctor, copy, assignment?
 
       bool isOpen_;
@@ -361,11 +376,27 @@ namespace e57
       std::shared_ptr<CompressedVectorNodeImpl> cVector_;
       NodeImplSharedPtr proto_;
       std::vector<DecodeChannel> channels_;
-      PacketReadCache *cache_;
+      PacketReadCache *cache_;                    /// shared with the other readers of the ImageFile
+      std::unique_ptr<PacketPrefetcher> prefetcher_;
+
+      std::unique_ptr<ThreadPool> decodePool_;      /// decodes channels in parallel, null if single threaded
+      std::unique_ptr<ThreadPool> slicePool_;       /// decodes ranges of records in readParallel()
+      std::vector<DecodeChannel *> packetChannels_; /// channels being fed by feedPacketToDecoders()
 
       uint64_t recordCount_; /// number of records written so far
       uint64_t maxRecordCount_;
+      uint64_t dataLogicalOffset_;  /// logical offset of first data packet in section
+      uint64_t indexLogicalOffset_; /// logical offset of top index packet, 0 if section has no index
       uint64_t sectionEndLogicalOffset_;
+
+      /// Seek table. Without an index, covers the whole section and is built on
+      /// first call to seek(). With an index, covers the start of the chunk
+      /// being sought.
+      uint64_t seekTableLogicalOffset_ = 0;     /// first data packet in table, 0 if no table
+      bool seekTableComplete_ = false;          /// table goes to end of section
+      std::vector<uint64_t> seekPacketOffsets_; /// logical offset of each data packet in table
+      std::vector<uint64_t> seekStreamEnds_;    /// [packet * channels_.size() + channel] = bytes of channel's
+                                                /// bytestream from start of table to end of packet
    };
 
    //================================================================
@@ -373,7 +404,8 @@ namespace e57
    class CompressedVectorWriterImpl
    {
    public:
-      CompressedVectorWriterImpl( std::shared_ptr<CompressedVectorNodeImpl> ni, std::vector<SourceDestBuffer> &sbufs );
+      CompressedVectorWriterImpl( std::shared_ptr<CompressedVectorNodeImpl> ni, std::vector<SourceDestBuffer> &sbufs,
+                                  unsigned threadCount = 1, unsigned writeBehindDepth = 0 );
       ~CompressedVectorWriterImpl();
       void write( const size_t requestedRecordCount );
       void write( std::vector<SourceDestBuffer> &sbufs, const size_t requestedRecordCount );
@@ -391,8 +423,11 @@ namespace e57
       void setBuffers( std::vector<SourceDestBuffer> &sbufs ); //???needed?
       size_t totalOutputAvailable() const;
       size_t currentPacketSize() const;
+      void encodeParallel( uint64_t endRecordIndex );
       uint64_t packetWrite();
+      uint64_t packetWrite( std::vector<size_t> &available, uint64_t recordIndex, bool atRecordBoundary );
       void flush();
+      void writeIndexPackets();
 
       //??? no default ctor, copy, assignment?
 
@@ -403,6 +438,10 @@ namespace e57
       std::vector<std::shared_ptr<Encoder>> bytestreams_;
       DataPacket dataPacket_;
 
+      std::unique_ptr<ThreadPool> encodePool_;  /// encodes bytestreams in parallel, null if single threaded
+      std::vector<size_t> roundOutput_;         /// [bytestream][round] outputAvailable() in encodeParallel()
+      std::vector<uint8_t> roundRegisterEmpty_; /// [bytestream][round] registerEmpty() in encodeParallel()
+
       bool isOpen_;
       uint64_t sectionHeaderLogicalStart_; /// start of CompressedVector binary section
       uint64_t sectionLogicalLength_;      /// total length of CompressedVector binary section
@@ -411,5 +450,9 @@ namespace e57
       uint64_t recordCount_;               /// number of records written so far
       uint64_t dataPacketsCount_;          /// number of data packets written so far
       uint64_t indexPacketsCount_;         /// number of index packets written so far
+
+      std::vector<IndexPacket::IndexPacketEntry> chunkIndex_; /// first record and offset of each chunk written
+      bool chunkStartPending_;                                /// next data packet starts a new chunk
+      uint64_t chunkStartRecordNumber_;                       /// first record of that chunk
    };
 }
@@ -25,43 +25,13 @@
  * DEALINGS IN THE SOFTWARE.
  */
 
-#include <xercesc/sax2/Attributes.hpp>
-#include <xercesc/sax2/XMLReaderFactory.hpp>
-
-#include <xercesc/util/BinInputStream.hpp>
-#include <xercesc/util/TransService.hpp>
-
 #include "CheckedFile.h"
 #include "E57FormatImpl.h"
 #include "E57XmlParser.h"
+#include "E57XmlReader.h"
 #include "ImageFileImpl.h"
 
 using namespace e57;
-using namespace XERCES_CPP_NAMESPACE;
-
-// define convenient constants for the attribute names
-static const XMLCh att_minimum[] = {
-   chLatin_m, chLatin_i, chLatin_n, chLatin_i, chLatin_m, chLatin_u, chLatin_m, chNull
-};
-static const XMLCh att_maximum[] = {
-   chLatin_m, chLatin_a, chLatin_x, chLatin_i, chLatin_m, chLatin_u, chLatin_m, chNull
-};
-static const XMLCh att_scale[] = { chLatin_s, chLatin_c, chLatin_a, chLatin_l, chLatin_e, chNull };
-static const XMLCh att_offset[] = { chLatin_o, chLatin_f, chLatin_f, chLatin_s, chLatin_e, chLatin_t, chNull };
-static const XMLCh att_precision[] = { chLatin_p, chLatin_r, chLatin_e, chLatin_c, chLatin_i,
-                                       chLatin_s, chLatin_i, chLatin_o, chLatin_n, chNull };
-static const XMLCh att_allowHeterogeneousChildren[] = {
-   chLatin_a, chLatin_l, chLatin_l, chLatin_o, chLatin_w, chLatin_H, chLatin_e, chLatin_t, chLatin_e,
-   chLatin_r, chLatin_o, chLatin_g, chLatin_e, chLatin_n, chLatin_e, chLatin_o, chLatin_u, chLatin_s,
-   chLatin_C, chLatin_h, chLatin_i, chLatin_l, chLatin_d, chLatin_r, chLatin_e, chLatin_n, chNull
-};
-static const XMLCh att_fileOffset[] = { chLatin_f, chLatin_i, chLatin_l, chLatin_e, chLatin_O, chLatin_f,
-                                        chLatin_f, chLatin_s, chLatin_e, chLatin_t, chNull };
-
-static const XMLCh att_type[] = { chLatin_t, chLatin_y, chLatin_p, chLatin_e, chNull };
-static const XMLCh att_length[] = { chLatin_l, chLatin_e, chLatin_n, chLatin_g, chLatin_t, chLatin_h, chNull };
-static const XMLCh att_recordCount[] = { chLatin_r, chLatin_e, chLatin_c, chLatin_o, chLatin_r, chLatin_d,
-                                         chLatin_C, chLatin_o, chLatin_u, chLatin_n, chLatin_t, chNull };
 
 inline int64_t convertStrToLL( const std::string &inStr )
 {
@@ -74,112 +44,13 @@ inline int64_t convertStrToLL( const std::string &inStr )
 #endif
 }
 
-//=============================================================================
-// E57FileInputStream
-
-class E57FileInputStream : public BinInputStream
-{
-public:
-   E57FileInputStream( CheckedFile *cf, uint64_t logicalStart, uint64_t logicalLength );
-   ~E57FileInputStream() override = default;
-
-   E57FileInputStream( const E57FileInputStream & ) = delete;
-   E57FileInputStream &operator=( const E57FileInputStream & ) = delete;
-
-   XMLFilePos curPos() const override
-   {
-      return ( logicalPosition_ );
-   }
-   XMLSize_t readBytes( XMLByte *const toFill, const XMLSize_t maxToRead ) override;
-   const XMLCh *getContentType() const override
-   {
-      return nullptr;
-   }
-
-private:
-   //??? lifetime of cf_ must be longer than this object!
-   CheckedFile *cf_;
-   uint64_t logicalStart_;
-   uint64_t logicalLength_;
-   uint64_t logicalPosition_;
-};
-
-E57FileInputStream::E57FileInputStream( CheckedFile *cf, uint64_t logicalStart, uint64_t logicalLength ) :
-   cf_( cf ), logicalStart_( logicalStart ), logicalLength_( logicalLength ), logicalPosition_( logicalStart )
-{
-}
-
-XMLSize_t E57FileInputStream::readBytes( XMLByte *const toFill, const XMLSize_t maxToRead )
-{
-   if ( logicalPosition_ > logicalStart_ + logicalLength_ )
-      return ( 0 );
-
-   int64_t available = logicalStart_ + logicalLength_ - logicalPosition_;
-   if ( available <= 0 )
-   {
-      return ( 0 );
-   }
-
-   /// size_t and XMLSize_t should be compatible, should get compiler warning
-   /// here if not
-   size_t maxToRead_size = maxToRead;
-
-   /// Be careful if size_t is smaller than int64_t
-   size_t available_size;
-   if ( sizeof( size_t ) >= sizeof( int64_t ) )
-   {
-      /// size_t is at least as big as int64_t
-      available_size = static_cast<size_t>( available );
-   }
-   else
-   {
-      /// size_t is smaller than int64_t, Calc max that size_t can hold
-      const int64_t size_max = std::numeric_limits<size_t>::max();
-
-      /// read smaller of size_max, available
-      ///??? redo
-      if ( size_max < available )
-      {
-         available_size = static_cast<size_t>( size_max );
-      }
-      else
-      {
-         available_size = static_cast<size_t>( available );
-      }
-   }
-
-   size_t readCount = std::min( maxToRead_size, available_size );
-
-   cf_->seek( logicalPosition_ );
-   cf_->read( reinterpret_cast<char *>( toFill ), readCount ); //??? cast ok?
-   logicalPosition_ += readCount;
-   return ( readCount );
-}
-
-//=============================================================================
-// E57XmlFileInputSource
-
-E57XmlFileInputSource::E57XmlFileInputSource( CheckedFile *cf, uint64_t logicalStart, uint64_t logicalLength ) :
-   InputSource( "E57File",
-                XMLPlatformUtils::fgMemoryManager ), //??? what if want to use our own
-                                                     // memory
-                                                     // manager?, what bufid is good?
-   cf_( cf ), logicalStart_( logicalStart ), logicalLength_( logicalLength )
-{
-}
-
-BinInputStream *E57XmlFileInputSource::makeStream() const
-{
-   return new E57FileInputStream( cf_, logicalStart_, logicalLength_ );
-}
-
 //=============================================================================
 // E57XmlParser::ParseInfo
 
 E57XmlParser::ParseInfo::ParseInfo() :
    nodeType( static_cast<NodeType>( 0 ) ), minimum( 0 ), maximum( 0 ), scale( 0 ), offset( 0 ),
    precision( static_cast<FloatPrecision>( 0 ) ), floatMinimum( 0 ), floatMaximum( 0 ), fileOffset( 0 ), length( 0 ),
-   allowHeterogeneousChildren( false ), recordCount( 0 )
+   allowHeterogeneousChildren( false ), recordCount( 0 ), canDeferChildren( false )
 {
 }
 
@@ -197,6 +68,7 @@ void E57XmlParser::ParseInfo::dump( int indent, std::ostream &os ) const
    os << space( indent ) << "length:         " << length << std::endl;
    os << space( indent ) << "allowHeterogeneousChildren: " << allowHeterogeneousChildren << std::endl;
    os << space( indent ) << "recordCount:    " << recordCount << std::endl;
+   os << space( indent ) << "canDeferChildren: " << canDeferChildren << std::endl;
    if ( container_ni )
    {
       os << space( indent ) << "container_ni:   <defined>" << std::endl;
@@ -211,77 +83,42 @@ void E57XmlParser::ParseInfo::dump( int indent, std::ostream &os ) const
 //=============================================================================
 // E57XmlParser
 
-E57XmlParser::E57XmlParser( ImageFileImplSharedPtr imf ) : imf_( imf ), xmlReader( nullptr )
+E57XmlParser::E57XmlParser( ImageFileImplSharedPtr imf ) : imf_( imf ), eagerDepth_( 0 )
 {
 }
 
-E57XmlParser::~E57XmlParser()
-{
-   delete xmlReader;
-
-   xmlReader = nullptr;
-
-   XMLPlatformUtils::Terminate();
-}
+E57XmlParser::~E57XmlParser() = default;
 
-void E57XmlParser::init()
+void E57XmlParser::init( bool validate, bool lazy )
 {
-   // Initialize the XML4C2 system
-   try
-   {
-      XMLPlatformUtils::Initialize();
-   }
-   catch ( const XMLException &ex )
-   {
-      /// Turn parser exception into E57Exception
-      throw E57_EXCEPTION2( E57_ERROR_XML_PARSER_INIT,
-                            "parserMessage=" + ustring( XMLString::transcode( ex.getMessage() ) ) );
-   }
-
-   xmlReader = XMLReaderFactory::createXMLReader(); //??? auto_ptr?
-
-   if ( xmlReader == nullptr )
-   {
-      throw E57_EXCEPTION2( E57_ERROR_XML_PARSER_INIT, "could not create the xml reader" );
-   }
-
-   //??? check these are right
-   xmlReader->setFeature( XMLUni::fgSAX2CoreValidation, true );
-   xmlReader->setFeature( XMLUni::fgXercesDynamic, true );
-   xmlReader->setFeature( XMLUni::fgSAX2CoreNameSpaces, true );
-   xmlReader->setFeature( XMLUni::fgXercesSchema, true );
-   xmlReader->setFeature( XMLUni::fgXercesSchemaFullChecking, true );
-   xmlReader->setFeature( XMLUni::fgSAX2CoreNameSpacePrefixes, true );
-
-   xmlReader->setContentHandler( this );
-   xmlReader->setErrorHandler( this );
+   reader_ = E57XmlReader::create( validate, lazy );
 }
 
-void E57XmlParser::parse( InputSource &inputSource )
+void E57XmlParser::parse( CheckedFile *cf, uint64_t logicalStart, uint64_t logicalLength )
 {
-   xmlReader->parse( inputSource );
+   reader_->parse( *this, cf, logicalStart, logicalLength );
 }
 
-void E57XmlParser::startElement( const XMLCh *const uri, const XMLCh *const localName, const XMLCh *const qName,
+void E57XmlParser::startElement( const ustring &uri, const ustring &localName, const ustring &qName,
                                  const Attributes &attributes )
 {
 #ifdef E57_MAX_VERBOSE
    std::cout << "startElement" << std::endl;
-   std::cout << space( 2 ) << "URI:       " << toUString( uri ) << std::endl;
-   std::cout << space( 2 ) << "localName: " << toUString( localName ) << std::endl;
-   std::cout << space( 2 ) << "qName:     " << toUString( qName ) << std::endl;
+   std::cout << space( 2 ) << "URI:       " << uri << std::endl;
+   std::cout << space( 2 ) << "localName: " << localName << std::endl;
+   std::cout << space( 2 ) << "qName:     " << qName << std::endl;
 
-   for ( size_t i = 0; i < attributes.getLength(); i++ )
+   for ( size_t i = 0; i < attributes.length(); i++ )
    {
       std::cout << space( 2 ) << "Attribute[" << i << "]" << std::endl;
-      std::cout << space( 4 ) << "URI:       " << toUString( attributes.getURI( i ) ) << std::endl;
-      std::cout << space( 4 ) << "localName: " << toUString( attributes.getLocalName( i ) ) << std::endl;
-      std::cout << space( 4 ) << "qName:     " << toUString( attributes.getQName( i ) ) << std::endl;
-      std::cout << space( 4 ) << "value:     " << toUString( attributes.getValue( i ) ) << std::endl;
+      std::cout << space( 4 ) << "URI:       " << attributes.uri( i ) << std::endl;
+      std::cout << space( 4 ) << "localName: " << attributes.localName( i ) << std::endl;
+      std::cout << space( 4 ) << "qName:     " << attributes.qName( i ) << std::endl;
+      std::cout << space( 4 ) << "value:     " << attributes.value( i ) << std::endl;
    }
 #endif
    /// Get Type attribute
-   ustring node_type = lookupAttribute( attributes, att_type );
+   ustring node_type = lookupAttribute( attributes, "type" );
 
    //??? check to make sure not in primitive type (can only nest inside compound
    // types).
@@ -296,9 +133,9 @@ void E57XmlParser::startElement( const XMLCh *const uri, const XMLCh *const loca
       //??? check validity of numeric strings
       pi.nodeType = E57_INTEGER;
 
-      if ( isAttributeDefined( attributes, att_minimum ) )
+      if ( isAttributeDefined( attributes, "minimum" ) )
       {
-         ustring minimum_str = lookupAttribute( attributes, att_minimum );
+         ustring minimum_str = lookupAttribute( attributes, "minimum" );
 
          pi.minimum = convertStrToLL( minimum_str );
       }
@@ -308,9 +145,9 @@ void E57XmlParser::startElement( const XMLCh *const uri, const XMLCh *const loca
          pi.minimum = E57_INT64_MIN;
       }
 
-      if ( isAttributeDefined( attributes, att_maximum ) )
+      if ( isAttributeDefined( attributes, "maximum" ) )
       {
-         ustring maximum_str = lookupAttribute( attributes, att_maximum );
+         ustring maximum_str = lookupAttribute( attributes, "maximum" );
 
          pi.maximum = convertStrToLL( maximum_str );
       }
@@ -331,9 +168,9 @@ void E57XmlParser::startElement( const XMLCh *const uri, const XMLCh *const loca
       pi.nodeType = E57_SCALED_INTEGER;
 
       //??? check validity of numeric strings
-      if ( isAttributeDefined( attributes, att_minimum ) )
+      if ( isAttributeDefined( attributes, "minimum" ) )
       {
-         ustring minimum_str = lookupAttribute( attributes, att_minimum );
+         ustring minimum_str = lookupAttribute( attributes, "minimum" );
 
          pi.minimum = convertStrToLL( minimum_str );
       }
@@ -343,9 +180,9 @@ void E57XmlParser::startElement( const XMLCh *const uri, const XMLCh *const loca
          pi.minimum = E57_INT64_MIN;
       }
 
-      if ( isAttributeDefined( attributes, att_maximum ) )
+      if ( isAttributeDefined( attributes, "maximum" ) )
       {
-         ustring maximum_str = lookupAttribute( attributes, att_maximum );
+         ustring maximum_str = lookupAttribute( attributes, "maximum" );
 
          pi.maximum = convertStrToLL( maximum_str );
       }
@@ -355,9 +192,9 @@ void E57XmlParser::startElement( const XMLCh *const uri, const XMLCh *const loca
          pi.maximum = E57_INT64_MAX;
       }
 
-      if ( isAttributeDefined( attributes, att_scale ) )
+      if ( isAttributeDefined( attributes, "scale" ) )
       {
-         ustring scale_str = lookupAttribute( attributes, att_scale );
+         ustring scale_str = lookupAttribute( attributes, "scale" );
          pi.scale = atof( scale_str.c_str() ); //??? use exact rounding library
       }
       else
@@ -366,9 +203,9 @@ void E57XmlParser::startElement( const XMLCh *const uri, const XMLCh *const loca
          pi.scale = 1.0;
       }
 
-      if ( isAttributeDefined( attributes, att_offset ) )
+      if ( isAttributeDefined( attributes, "offset" ) )
       {
-         ustring offset_str = lookupAttribute( attributes, att_offset );
+         ustring offset_str = lookupAttribute( attributes, "offset" );
          pi.offset = atof( offset_str.c_str() ); //??? use exact rounding library
       }
       else
@@ -387,9 +224,9 @@ void E57XmlParser::startElement( const XMLCh *const uri, const XMLCh *const loca
 #endif
       pi.nodeType = E57_FLOAT;
 
-      if ( isAttributeDefined( attributes, att_precision ) )
+      if ( isAttributeDefined( attributes, "precision" ) )
       {
-         ustring precision_str = lookupAttribute( attributes, att_precision );
+         ustring precision_str = lookupAttribute( attributes, "precision" );
          if ( precision_str == "single" )
             pi.precision = E57_SINGLE;
          else if ( precision_str == "double" )
@@ -400,8 +237,7 @@ void E57XmlParser::startElement( const XMLCh *const uri, const XMLCh *const loca
          {
             throw E57_EXCEPTION2( E57_ERROR_BAD_XML_FORMAT,
                                   "precisionString=" + precision_str + " fileName=" + imf_->fileName() +
-                                     " uri=" + toUString( uri ) + " localName=" + toUString( localName ) +
-                                     " qName=" + toUString( qName ) );
+                                     " uri=" + uri + " localName=" + localName + " qName=" + qName );
          }
       }
       else
@@ -410,9 +246,9 @@ void E57XmlParser::startElement( const XMLCh *const uri, const XMLCh *const loca
          pi.precision = E57_DOUBLE;
       }
 
-      if ( isAttributeDefined( attributes, att_minimum ) )
+      if ( isAttributeDefined( attributes, "minimum" ) )
       {
-         ustring minimum_str = lookupAttribute( attributes, att_minimum );
+         ustring minimum_str = lookupAttribute( attributes, "minimum" );
          pi.floatMinimum = atof( minimum_str.c_str() ); //??? use exact rounding library
       }
       else
@@ -429,9 +265,9 @@ void E57XmlParser::startElement( const XMLCh *const uri, const XMLCh *const loca
          }
       }
 
-      if ( isAttributeDefined( attributes, att_maximum ) )
+      if ( isAttributeDefined( attributes, "maximum" ) )
       {
-         ustring maximum_str = lookupAttribute( attributes, att_maximum );
+         ustring maximum_str = lookupAttribute( attributes, "maximum" );
          pi.floatMaximum = atof( maximum_str.c_str() ); //??? use exact rounding library
       }
       else
@@ -468,12 +304,12 @@ void E57XmlParser::startElement( const XMLCh *const uri, const XMLCh *const loca
       //??? check validity of numeric strings
 
       /// fileOffset is required to be defined
-      ustring fileOffset_str = lookupAttribute( attributes, att_fileOffset );
+      ustring fileOffset_str = lookupAttribute( attributes, "fileOffset" );
 
       pi.fileOffset = convertStrToLL( fileOffset_str );
 
       /// length is required to be defined
-      ustring length_str = lookupAttribute( attributes, att_length );
+      ustring length_str = lookupAttribute( attributes, "length" );
 
       pi.length = convertStrToLL( length_str );
 
@@ -488,31 +324,31 @@ void E57XmlParser::startElement( const XMLCh *const uri, const XMLCh *const loca
       pi.nodeType = E57_STRUCTURE;
 
       /// Read name space decls, if e57Root element
-      if ( toUString( localName ) == "e57Root" )
+      if ( localName == "e57Root" )
       {
          /// Search attributes for namespace declarations (only allowed in
          /// E57Root structure)
          bool gotDefault = false;
-         for ( size_t i = 0; i < attributes.getLength(); i++ )
+         for ( size_t i = 0; i < attributes.length(); i++ )
          {
             /// Check if declaring the default namespace
-            if ( toUString( attributes.getQName( i ) ) == "xmlns" )
+            if ( attributes.qName( i ) == "xmlns" )
             {
 #ifdef E57_VERBOSE
-               std::cout << "declared default namespace, URI=" << toUString( attributes.getValue( i ) ) << std::endl;
+               std::cout << "declared default namespace, URI=" << attributes.value( i ) << std::endl;
 #endif
-               imf_->extensionsAdd( "", toUString( attributes.getValue( i ) ) );
+               imf_->extensionsAdd( "", attributes.value( i ) );
                gotDefault = true;
             }
 
             /// Check if declaring a namespace
-            if ( toUString( attributes.getURI( i ) ) == "http://www.w3.org/2000/xmlns/" )
+            if ( attributes.uri( i ) == "http://www.w3.org/2000/xmlns/" )
             {
 #ifdef E57_VERBOSE
-               cout << "declared extension, prefix=" << toUString( attributes.getLocalName( i ) )
-                    << " URI=" << toUString( attributes.getValue( i ) ) << std::endl;
+               cout << "declared extension, prefix=" << attributes.localName( i ) << " URI=" << attributes.value( i )
+                    << std::endl;
 #endif
-               imf_->extensionsAdd( toUString( attributes.getLocalName( i ) ), toUString( attributes.getValue( i ) ) );
+               imf_->extensionsAdd( attributes.localName( i ), attributes.value( i ) );
             }
          }
 
@@ -520,8 +356,8 @@ void E57XmlParser::startElement( const XMLCh *const uri, const XMLCh *const loca
          if ( !gotDefault )
          {
             throw E57_EXCEPTION2( E57_ERROR_BAD_XML_FORMAT,
-                                  "fileName=" + imf_->fileName() + " uri=" + toUString( uri ) +
-                                     " localName=" + toUString( localName ) + " qName=" + toUString( qName ) );
+                                  "fileName=" + imf_->fileName() + " uri=" + uri +
+                                     " localName=" + localName + " qName=" + qName );
          }
       }
 
@@ -531,11 +367,13 @@ void E57XmlParser::startElement( const XMLCh *const uri, const XMLCh *const loca
 
       /// After have Structure, check again if E57Root, if so mark attached so
       /// all children will be attached when added
-      if ( toUString( localName ) == "e57Root" )
+      if ( localName == "e57Root" )
       {
          s_ni->setAttachedRecursive();
       }
 
+      pi.canDeferChildren = !stack_.empty() && ( eagerDepth_ == 0 );
+
       /// Push info so far onto stack
       stack_.push( pi );
    }
@@ -546,9 +384,9 @@ void E57XmlParser::startElement( const XMLCh *const uri, const XMLCh *const loca
 #endif
       pi.nodeType = E57_VECTOR;
 
-      if ( isAttributeDefined( attributes, att_allowHeterogeneousChildren ) )
+      if ( isAttributeDefined( attributes, "allowHeterogeneousChildren" ) )
       {
-         ustring allowHetero_str = lookupAttribute( attributes, att_allowHeterogeneousChildren );
+         ustring allowHetero_str = lookupAttribute( attributes, "allowHeterogeneousChildren" );
 
          int64_t i64 = convertStrToLL( allowHetero_str );
 
@@ -564,8 +402,7 @@ void E57XmlParser::startElement( const XMLCh *const uri, const XMLCh *const loca
          {
             throw E57_EXCEPTION2( E57_ERROR_BAD_XML_FORMAT,
                                   "allowHeterogeneousChildren=" + toString( i64 ) + "fileName=" + imf_->fileName() +
-                                     " uri=" + toUString( uri ) + " localName=" + toUString( localName ) +
-                                     " qName=" + toUString( qName ) );
+                                     " uri=" + uri + " localName=" + localName + " qName=" + qName );
          }
       }
       else
@@ -578,6 +415,12 @@ void E57XmlParser::startElement( const XMLCh *const uri, const XMLCh *const loca
       std::shared_ptr<VectorNodeImpl> v_ni( new VectorNodeImpl( imf_, pi.allowHeterogeneousChildren ) );
       pi.container_ni = v_ni;
 
+      pi.canDeferChildren = !stack_.empty() && ( eagerDepth_ == 0 );
+      if ( !pi.allowHeterogeneousChildren )
+      {
+         ++eagerDepth_;
+      }
+
       /// Push info so far onto stack
       stack_.push( pi );
    }
@@ -589,12 +432,12 @@ void E57XmlParser::startElement( const XMLCh *const uri, const XMLCh *const loca
       pi.nodeType = E57_COMPRESSED_VECTOR;
 
       /// fileOffset is required to be defined
-      ustring fileOffset_str = lookupAttribute( attributes, att_fileOffset );
+      ustring fileOffset_str = lookupAttribute( attributes, "fileOffset" );
 
       pi.fileOffset = convertStrToLL( fileOffset_str );
 
       /// recordCount is required to be defined
-      ustring recordCount_str = lookupAttribute( attributes, att_recordCount );
+      ustring recordCount_str = lookupAttribute( attributes, "recordCount" );
 
       pi.recordCount = convertStrToLL( recordCount_str );
 
@@ -605,21 +448,23 @@ void E57XmlParser::startElement( const XMLCh *const uri, const XMLCh *const loca
          imf_->file_->physicalToLogical( pi.fileOffset ) ); //??? what if file_ is NULL?
       pi.container_ni = cv_ni;
 
+      ++eagerDepth_;
+
       /// Push info so far onto stack
       stack_.push( pi );
    }
    else
    {
       throw E57_EXCEPTION2( E57_ERROR_BAD_XML_FORMAT,
-                            "nodeType=" + node_type + " fileName=" + imf_->fileName() + " uri=" + toUString( uri ) +
-                               " localName=" + toUString( localName ) + " qName=" + toUString( qName ) );
+                            "nodeType=" + node_type + " fileName=" + imf_->fileName() + " uri=" + uri +
+                               " localName=" + localName + " qName=" + qName );
    }
 #ifdef E57_MAX_VERBOSE
    pi.dump( 4 );
 #endif
 }
 
-void E57XmlParser::endElement( const XMLCh *const uri, const XMLCh *const localName, const XMLCh *const qName )
+void E57XmlParser::endElement( const ustring &uri, const ustring &localName, const ustring &qName )
 {
 #ifdef E57_MAX_VERBOSE
    std::cout << "endElement" << std::endl;
@@ -638,14 +483,21 @@ void E57XmlParser::endElement( const XMLCh *const uri, const XMLCh *const localN
    switch ( pi.nodeType )
    {
       case E57_STRUCTURE:
+         current_ni = pi.container_ni;
+         break;
       case E57_VECTOR:
          current_ni = pi.container_ni;
+         if ( !pi.allowHeterogeneousChildren )
+         {
+            --eagerDepth_;
+         }
          break;
       case E57_COMPRESSED_VECTOR:
       {
          /// Verify that both prototype and codecs child elements were defined
          /// ???
          current_ni = pi.container_ni;
+         --eagerDepth_;
       }
       break;
       case E57_INTEGER:
@@ -708,9 +560,8 @@ void E57XmlParser::endElement( const XMLCh *const uri, const XMLCh *const localN
       break;
       default:
          throw E57_EXCEPTION2( E57_ERROR_INTERNAL, "nodeType=" + toString( pi.nodeType ) +
-                                                      " fileName=" + imf_->fileName() + " uri=" + toUString( uri ) +
-                                                      " localName=" + toUString( localName ) +
-                                                      " qName=" + toUString( qName ) );
+                                                      " fileName=" + imf_->fileName() + " uri=" + uri +
+                                                      " localName=" + localName + " qName=" + qName );
    }
 #ifdef E57_MAX_VERBOSE
    current_ni->dump( 4 );
@@ -724,8 +575,7 @@ void E57XmlParser::endElement( const XMLCh *const uri, const XMLCh *const localN
       {
          throw E57_EXCEPTION2( E57_ERROR_BAD_XML_FORMAT,
                                "currentType=" + toString( current_ni->type() ) + " fileName=" + imf_->fileName() +
-                                  " uri=" + toUString( uri ) + " localName=" + toUString( localName ) +
-                                  " qName=" + toUString( qName ) );
+                                  " uri=" + uri + " localName=" + localName + " qName=" + qName );
       }
       imf_->root_ = std::static_pointer_cast<StructureNodeImpl>( current_ni );
       return;
@@ -737,9 +587,8 @@ void E57XmlParser::endElement( const XMLCh *const uri, const XMLCh *const localN
 
    if ( !parent_ni )
    {
-      throw E57_EXCEPTION2( E57_ERROR_BAD_XML_FORMAT, "fileName=" + imf_->fileName() + " uri=" + toUString( uri ) +
-                                                         " localName=" + toUString( localName ) +
-                                                         " qName=" + toUString( qName ) );
+      throw E57_EXCEPTION2( E57_ERROR_BAD_XML_FORMAT, "fileName=" + imf_->fileName() + " uri=" + uri +
+                                                         " localName=" + localName + " qName=" + qName );
    }
 
    /// Add current node into parent at top of stack
@@ -750,7 +599,7 @@ void E57XmlParser::endElement( const XMLCh *const uri, const XMLCh *const localN
          std::shared_ptr<StructureNodeImpl> struct_ni = std::static_pointer_cast<StructureNodeImpl>( parent_ni );
 
          /// Add named child to structure
-         struct_ni->set( toUString( qName ), current_ni );
+         struct_ni->set( qName, current_ni );
       }
       break;
       case E57_VECTOR:
@@ -765,21 +614,19 @@ void E57XmlParser::endElement( const XMLCh *const uri, const XMLCh *const localN
       {
          std::shared_ptr<CompressedVectorNodeImpl> cv_ni =
             std::static_pointer_cast<CompressedVectorNodeImpl>( parent_ni );
-         ustring uQName = toUString( qName );
 
          /// n can be either prototype or codecs
-         if ( uQName == "prototype" )
+         if ( qName == "prototype" )
          {
             cv_ni->setPrototype( current_ni );
          }
-         else if ( uQName == "codecs" )
+         else if ( qName == "codecs" )
          {
             if ( current_ni->type() != E57_VECTOR )
             {
                throw E57_EXCEPTION2( E57_ERROR_BAD_XML_FORMAT,
                                      "currentType=" + toString( current_ni->type() ) + " fileName=" + imf_->fileName() +
-                                        " uri=" + toUString( uri ) + " localName=" + toUString( localName ) +
-                                        " qName=" + toUString( qName ) );
+                                        " uri=" + uri + " localName=" + localName + " qName=" + qName );
             }
             std::shared_ptr<VectorNodeImpl> vi = std::static_pointer_cast<VectorNodeImpl>( current_ni );
 
@@ -788,8 +635,7 @@ void E57XmlParser::endElement( const XMLCh *const uri, const XMLCh *const localN
             {
                throw E57_EXCEPTION2( E57_ERROR_BAD_XML_FORMAT,
                                      "currentType=" + toString( current_ni->type() ) + " fileName=" + imf_->fileName() +
-                                        " uri=" + toUString( uri ) + " localName=" + toUString( localName ) +
-                                        " qName=" + toUString( qName ) );
+                                        " uri=" + uri + " localName=" + localName + " qName=" + qName );
             }
 
             cv_ni->setCodecs( vi );
@@ -799,8 +645,8 @@ void E57XmlParser::endElement( const XMLCh *const uri, const XMLCh *const localN
             /// Found unknown XML child element of CompressedVector, not
             /// prototype or codecs
             throw E57_EXCEPTION2( E57_ERROR_BAD_XML_FORMAT,
-                                  +"fileName=" + imf_->fileName() + " uri=" + toUString( uri ) +
-                                     " localName=" + toUString( localName ) + " qName=" + toUString( qName ) );
+                                  +"fileName=" + imf_->fileName() + " uri=" + uri +
+                                     " localName=" + localName + " qName=" + qName );
          }
       }
       break;
@@ -808,16 +654,14 @@ void E57XmlParser::endElement( const XMLCh *const uri, const XMLCh *const localN
          /// Have bad XML nesting, parent should have been a container.
          throw E57_EXCEPTION2( E57_ERROR_BAD_XML_FORMAT,
                                "parentType=" + toString( parent_ni->type() ) + " fileName=" + imf_->fileName() +
-                                  " uri=" + toUString( uri ) + " localName=" + toUString( localName ) +
-                                  " qName=" + toUString( qName ) );
+                                  " uri=" + uri + " localName=" + localName + " qName=" + qName );
    }
 }
 
-void E57XmlParser::characters( const XMLCh *const chars, const XMLSize_t length )
+void E57XmlParser::characters( const char *chars, size_t length )
 {
-//??? use length to make ustring
 #ifdef E57_MAX_VERBOSE
-   std::cout << "characters, chars=\"" << toUString( chars ) << "\" length=" << length << std::endl;
+   std::cout << "characters, chars=\"" << ustring( chars, length ) << "\" length=" << length << std::endl;
 #endif
    /// Get active element
    ParseInfo &pi = stack_.top();
@@ -831,68 +675,63 @@ void E57XmlParser::characters( const XMLCh *const chars, const XMLSize_t length
       case E57_BLOB:
       {
          /// If characters aren't whitespace, have an error, else ignore
-         ustring s = toUString( chars );
-         if ( s.find_first_not_of( " \t\n\r" ) != std::string::npos )
+         for ( size_t i = 0; i < length; ++i )
          {
-            throw E57_EXCEPTION2( E57_ERROR_BAD_XML_FORMAT, "chars=" + toUString( chars ) );
+            if ( ( chars[i] != ' ' ) && ( chars[i] != '\t' ) && ( chars[i] != '\n' ) && ( chars[i] != '\r' ) )
+            {
+               throw E57_EXCEPTION2( E57_ERROR_BAD_XML_FORMAT, "chars=" + ustring( chars, length ) );
+            }
          }
       }
       break;
       default:
          /// Append to any previous characters
-         pi.childText += toUString( chars );
+         pi.childText.append( chars, length );
    }
 }
 
-void E57XmlParser::error( const SAXParseException &ex )
+bool E57XmlParser::canDeferChildren() const
 {
-   throw E57_EXCEPTION2( E57_ERROR_XML_PARSER, "systemId=" + ustring( XMLString::transcode( ex.getSystemId() ) ) +
-                                                  " xmlLine=" + toString( ex.getLineNumber() ) +
-                                                  " xmlColumn=" + toString( ex.getColumnNumber() ) + " parserMessage=" +
-                                                  ustring( XMLString::transcode( ex.getMessage() ) ) );
+   return !stack_.empty() && stack_.top().canDeferChildren;
 }
 
-void E57XmlParser::fatalError( const SAXParseException &ex )
+void E57XmlParser::deferChildren( std::unique_ptr<LazyChildren> children )
 {
-   throw E57_EXCEPTION2( E57_ERROR_XML_PARSER, "systemId=" + ustring( XMLString::transcode( ex.getSystemId() ) ) +
-                                                  " xmlLine=" + toString( ex.getLineNumber() ) +
-                                                  " xmlColumn=" + toString( ex.getColumnNumber() ) + " parserMessage=" +
-                                                  ustring( XMLString::transcode( ex.getMessage() ) ) );
+   std::static_pointer_cast<StructureNodeImpl>( stack_.top().container_ni )->setLazyChildren( std::move( children ) );
 }
 
-void E57XmlParser::warning( const SAXParseException &ex )
+void E57XmlParser::beginChildren( NodeImplSharedPtr container )
 {
-   /// Don't take any action on warning from parser, just report
-   std::cerr << "**** XML parser warning: " << ustring( XMLString::transcode( ex.getMessage() ) ) << std::endl;
-   std::cerr << "  Debug info:" << std::endl;
-   std::cerr << "    systemId=" << XMLString::transcode( ex.getSystemId() ) << std::endl;
-   std::cerr << ",   xmlLine=" << ex.getLineNumber() << std::endl;
-   std::cerr << ",   xmlColumn=" << ex.getColumnNumber() << std::endl;
-}
+   /// Stands for the element of container, which is never ended
+   ParseInfo pi;
 
-ustring E57XmlParser::toUString( const XMLCh *const xml_str )
-{
-   ustring u_str;
-   if ( xml_str && *xml_str )
+   pi.nodeType = container->type();
+   pi.container_ni = container;
+
+   if ( pi.nodeType == E57_VECTOR )
    {
-      TranscodeToStr UTF8Transcoder( xml_str, "UTF-8" );
-      u_str = ustring( reinterpret_cast<const char *>( UTF8Transcoder.str() ) );
+      pi.allowHeterogeneousChildren = std::static_pointer_cast<VectorNodeImpl>( container )->allowHeteroChildren();
+      if ( !pi.allowHeterogeneousChildren )
+      {
+         ++eagerDepth_;
+      }
    }
-   return ( u_str );
+
+   stack_.push( pi );
 }
 
-ustring E57XmlParser::lookupAttribute( const Attributes &attributes, const XMLCh *attribute_name )
+ustring E57XmlParser::lookupAttribute( const Attributes &attributes, const char *attribute_name )
 {
-   XMLSize_t attr_index;
-   if ( !attributes.getIndex( attribute_name, attr_index ) )
+   size_t attr_index;
+   if ( !attributes.find( attribute_name, attr_index ) )
    {
-      throw E57_EXCEPTION2( E57_ERROR_BAD_XML_FORMAT, "attributeName=" + toUString( attribute_name ) );
+      throw E57_EXCEPTION2( E57_ERROR_BAD_XML_FORMAT, "attributeName=" + ustring( attribute_name ) );
    }
-   return ( toUString( attributes.getValue( attr_index ) ) );
+   return ( attributes.value( attr_index ) );
 }
 
-bool E57XmlParser::isAttributeDefined( const Attributes &attributes, const XMLCh *attribute_name )
+bool E57XmlParser::isAttributeDefined( const Attributes &attributes, const char *attribute_name )
 {
-   XMLSize_t attr_index;
-   return ( attributes.getIndex( attribute_name, attr_index ) );
+   size_t attr_index;
+   return ( attributes.find( attribute_name, attr_index ) );
 }
@@ -27,49 +27,70 @@
 
 #pragma once
 
+#include <memory>
 #include <stack>
 
-#include <xercesc/sax/InputSource.hpp>
-#include <xercesc/sax2/DefaultHandler.hpp>
-
 #include "Common.h"
 
-using namespace XERCES_CPP_NAMESPACE;
-
-namespace XERCES_CPP_NAMESPACE
-{
-   class SAX2XMLReader;
-}
-
 namespace e57
 {
    class CheckedFile;
+   class E57XmlReader;
+   class LazyChildren;
 
-   class E57XmlParser : public DefaultHandler
+   /// Builds the node tree of an image file from the elements of its XML section, as reported by an E57XmlReader.
+   /// All the strings it is given are UTF-8.
+   class E57XmlParser
    {
    public:
+      /// Attributes of the element being started
+      class Attributes
+      {
+      public:
+         virtual ~Attributes() = default;
+
+         virtual size_t length() const = 0;
+         virtual ustring uri( size_t i ) const = 0;
+         virtual ustring localName( size_t i ) const = 0;
+         virtual ustring qName( size_t i ) const = 0;
+         virtual ustring value( size_t i ) const = 0;
+
+         /// Find the attribute with qualified name qName, which is plain ASCII.  Returns false if there is none.
+         virtual bool find( const char *qName, size_t &index ) const = 0;
+      };
+
       E57XmlParser( ImageFileImplSharedPtr imf );
-      ~E57XmlParser() override;
+      ~E57XmlParser();
 
-      void init();
+      /// Get a reader for the XML.  With validate false, the XML isn't checked against a schema or DTD even if it
+      /// names one, which is only safe for files we trust.  With lazy true, the reader may put off reading the
+      /// children of containers until they are used.
+      void init( bool validate = true, bool lazy = false );
 
-      void parse( InputSource &inputSource );
+      /// Parse the XML section at [logicalStart, logicalStart + logicalLength) of cf
+      void parse( CheckedFile *cf, uint64_t logicalStart, uint64_t logicalLength );
 
-   private:
-      /// SAX interface
-      void startElement( const XMLCh *const uri, const XMLCh *const localName, const XMLCh *const qName,
-                         const Attributes &attributes ) override;
-      void endElement( const XMLCh *const uri, const XMLCh *const localName, const XMLCh *const qName ) override;
-      void characters( const XMLCh *const chars, const XMLSize_t length ) override;
+      /// Reader interface
+      void startElement( const ustring &uri, const ustring &localName, const ustring &qName,
+                         const Attributes &attributes );
+      void endElement( const ustring &uri, const ustring &localName, const ustring &qName );
+      void characters( const char *chars, size_t length );
 
-      /// SAX error interface
-      void warning( const SAXParseException &ex ) override;
-      void error( const SAXParseException &ex ) override;
-      void fatalError( const SAXParseException &ex ) override;
+      /// Lazy reading: true if the element just started is a Structure or Vector whose children may be read later.
+      /// That is anywhere but at the root and inside a CompressedVector or a homogeneous Vector, where the children
+      /// are needed to check the types.
+      bool canDeferChildren() const;
 
-      ustring toUString( const XMLCh *const xml_str );
-      ustring lookupAttribute( const Attributes &attributes, const XMLCh *attribute_name );
-      bool isAttributeDefined( const Attributes &attributes, const XMLCh *attribute_name );
+      /// Have the children of the element just started added by children the first time they are used.  The reader
+      /// skips them and goes on with the end of the element.
+      void deferChildren( std::unique_ptr<LazyChildren> children );
+
+      /// Get ready to parse the children of container, which were put off, instead of a whole document
+      void beginChildren( NodeImplSharedPtr container );
+
+   private:
+      ustring lookupAttribute( const Attributes &attributes, const char *attribute_name );
+      bool isAttributeDefined( const Attributes &attributes, const char *attribute_name );
 
       ImageFileImplSharedPtr imf_; /// Image file we are reading
 
@@ -91,6 +112,7 @@ namespace e57
          int64_t length;                  // used in E57_BLOB
          bool allowHeterogeneousChildren; // used in E57_VECTOR
          int64_t recordCount;             // used in E57_COMPRESSED_VECTOR
+         bool canDeferChildren;           // used in E57_STRUCTURE, E57_VECTOR
          ustring childText;               // used by all types, accumlates all child text between tags
 
          /// Holds node for Structure, Vector, and CompressedVector so can append
@@ -102,24 +124,9 @@ namespace e57
       };
       std::stack<ParseInfo> stack_; /// Stores the current path in tree we are reading
 
-      SAX2XMLReader *xmlReader;
-   };
-
-   class E57XmlFileInputSource : public InputSource
-   {
-   public:
-      E57XmlFileInputSource( CheckedFile *cf, uint64_t logicalStart, uint64_t logicalLength );
-      ~E57XmlFileInputSource() override = default;
-
-      E57XmlFileInputSource( const E57XmlFileInputSource & ) = delete;
-      E57XmlFileInputSource &operator=( const E57XmlFileInputSource & ) = delete;
+      /// Number of open CompressedVector and homogeneous Vector elements, whose children are never put off
+      int eagerDepth_;
 
-      BinInputStream *makeStream() const override;
-
-   private:
-      //??? lifetime of cf_ must be longer than this object!
-      CheckedFile *cf_;
-      uint64_t logicalStart_;
-      uint64_t logicalLength_;
+      std::unique_ptr<E57XmlReader> reader_;
    };
 }
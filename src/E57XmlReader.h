@@ -0,0 +1,35 @@
+#pragma once
+// SPDX-License-Identifier: MIT
+
+#include <cstdint>
+#include <memory>
+
+namespace e57
+{
+   class CheckedFile;
+   class E57XmlParser;
+
+   /// Reads the XML section of a file and reports its elements, attributes and text to an E57XmlParser, which builds
+   /// the node tree.  Which one is built is chosen with the E57_BUILTIN_XML_PARSER CMake option.
+   ///
+   /// Xerces (default): a SAX2 reader from a pool shared by all files.  It reads the section a buffer at a time and
+   /// everything it reports is transcoded from UTF-16.
+   ///
+   /// Built-in: the whole section is read at once and parsed in place, so names, attribute values and text are
+   /// reported straight from the buffer.  It handles what E57 files contain -- UTF-8 XML without a DTD -- and never
+   /// validates.  It can also leave the children of containers for later, see E57XmlParser::canDeferChildren().
+   class E57XmlReader
+   {
+   public:
+      /// With validate false, the XML isn't checked against a schema or DTD even if it names one.  With lazy true,
+      /// the reader may put off reading the children of containers, if it supports that.
+      static std::unique_ptr<E57XmlReader> create( bool validate, bool lazy );
+
+      virtual ~E57XmlReader() = default;
+
+      virtual void parse( E57XmlParser &parser, CheckedFile *cf, uint64_t logicalStart, uint64_t logicalLength ) = 0;
+
+   protected:
+      E57XmlReader() = default;
+   };
+}
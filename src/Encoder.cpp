@@ -35,6 +35,12 @@
 
 using namespace e57;
 
+namespace
+{
+   /// Number of records BitpackIntegerEncoder fetches at a time from the source buffer
+   constexpr size_t ValueBlockSize = 256;
+}
+
 std::shared_ptr<Encoder> Encoder::EncoderFactory( unsigned bytestreamNumber,
                                                   std::shared_ptr<CompressedVectorNodeImpl> cVector,
                                                   std::vector<SourceDestBuffer> &sbufs, ustring & /*codecPath*/ )
@@ -317,6 +323,13 @@ void BitpackEncoder::outBufferShiftDown()
    size_t newFirst = outBufferFirst_ - ( outBufferEnd_ - newEnd );
    size_t byteCount = outBufferEnd_ - outBufferFirst_;
 
+   /// Nothing to do if already there, which is the usual case for a writer
+   /// encoding ahead of its packets
+   if ( newFirst == outBufferFirst_ )
+   {
+      return;
+   }
+
    /// Double check round up worked
    if ( newEnd % outBufferAlignmentSize_ )
    {
@@ -407,31 +420,13 @@ uint64_t BitpackFloatEncoder::processRecords( size_t recordCount )
 
    if ( precision_ == E57_SINGLE )
    {
-      /// Form the starting address for next available location in outBuffer
-      auto outp = reinterpret_cast<float *>( &outBuffer_[outBufferEnd_] );
-
-      /// Copy floats from sourceBuffer_ to outBuffer_
-      for ( unsigned i = 0; i < recordCount; i++ )
-      {
-         outp[i] = sourceBuffer_->getNextFloat();
-#ifdef E57_MAX_VERBOSE
-         std::cout << "encoding float: " << outp[i] << std::endl;
-#endif
-      }
+      /// Copy floats from sourceBuffer_ to next available location in outBuffer_
+      sourceBuffer_->getNextFloatBlock( reinterpret_cast<float *>( &outBuffer_[outBufferEnd_] ), recordCount );
    }
    else
    { /// E57_DOUBLE precision
-      /// Form the starting address for next available location in outBuffer
-      auto outp = reinterpret_cast<double *>( &outBuffer_[outBufferEnd_] );
-
-      /// Copy doubles from sourceBuffer_ to outBuffer_
-      for ( unsigned i = 0; i < recordCount; i++ )
-      {
-         outp[i] = sourceBuffer_->getNextDouble();
-#ifdef E57_MAX_VERBOSE
-         std::cout << "encoding double: " << outp[i] << std::endl;
-#endif
-      }
+      /// Copy doubles from sourceBuffer_ to next available location in outBuffer_
+      sourceBuffer_->getNextDoubleBlock( reinterpret_cast<double *>( &outBuffer_[outBufferEnd_] ), recordCount );
    }
 
    /// Update end of outBuffer
@@ -449,6 +444,12 @@ bool BitpackFloatEncoder::registerFlushToOutput()
    return ( true );
 }
 
+bool BitpackFloatEncoder::registerEmpty()
+{
+   /// Floats go straight to output
+   return true;
+}
+
 float BitpackFloatEncoder::bitsPerRecord()
 {
    return ( ( precision_ == E57_SINGLE ) ? 32.0F : 64.0F );
@@ -603,6 +604,12 @@ bool BitpackStringEncoder::registerFlushToOutput()
    return ( true );
 }
 
+bool BitpackStringEncoder::registerEmpty()
+{
+   /// Empty unless part way through a string
+   return !isStringActive_;
+}
+
 float BitpackStringEncoder::bitsPerRecord()
 {
    /// Return average number of bits in strings + 8 bits for prefix
@@ -699,19 +706,29 @@ template <typename RegisterT> uint64_t BitpackIntegerEncoder<RegisterT>::process
    auto outp = reinterpret_cast<RegisterT *>( &outBuffer_[outBufferEnd_] );
    unsigned outTransferred = 0;
 
+   int64_t values[ValueBlockSize];
+
    /// Copy bits from sourceBuffer_ to outBuffer_
    for ( unsigned i = 0; i < recordCount; i++ )
    {
-      int64_t rawValue;
-
-      /// The parameter isScaledInteger_ determines which version of
-      /// getNextInt64 gets called
-      if ( isScaledInteger_ )
+      /// Fetch values from sourceBuffer_ a block at a time. The parameter
+      /// isScaledInteger_ determines which version of getNextInt64Block gets
+      /// called.
+      if ( i % ValueBlockSize == 0 )
       {
-         rawValue = sourceBuffer_->getNextInt64( scale_, offset_ );
+         const size_t blockCount = std::min( recordCount - i, ValueBlockSize );
+
+         if ( isScaledInteger_ )
+         {
+            sourceBuffer_->getNextInt64Block( values, blockCount, scale_, offset_ );
+         }
+         else
+         {
+            sourceBuffer_->getNextInt64Block( values, blockCount );
+         }
       }
-      else
-         rawValue = sourceBuffer_->getNextInt64();
+
+      int64_t rawValue = values[i % ValueBlockSize];
 
       /// Enforce min/max specification on value
       if ( rawValue < minimum_ || maximum_ < rawValue )
@@ -841,6 +858,11 @@ template <typename RegisterT> bool BitpackIntegerEncoder<RegisterT>::registerFlu
    return true;
 }
 
+template <typename RegisterT> bool BitpackIntegerEncoder<RegisterT>::registerEmpty()
+{
+   return registerBitsUsed_ == 0;
+}
+
 template <typename RegisterT> float BitpackIntegerEncoder<RegisterT>::bitsPerRecord()
 {
    return ( static_cast<float>( bitsPerRecord_ ) );
@@ -916,6 +938,12 @@ bool ConstantIntegerEncoder::registerFlushToOutput()
    return ( true );
 }
 
+bool ConstantIntegerEncoder::registerEmpty()
+{
+   /// We don't produce any output
+   return true;
+}
+
 size_t ConstantIntegerEncoder::outputAvailable()
 {
    /// We don't produce any output
@@ -45,6 +45,7 @@ namespace e57
       virtual uint64_t currentRecordIndex() = 0;
       virtual float bitsPerRecord() = 0;
       virtual bool registerFlushToOutput() = 0;
+      virtual bool registerEmpty() = 0; /// no partial word or record waiting to go to output
 
       virtual size_t outputAvailable() = 0;                              /// number of bytes that can be read
       virtual void outputRead( char *dest, const size_t byteCount ) = 0; /// get data from encoder
@@ -113,6 +114,7 @@ namespace e57
 
       uint64_t processRecords( size_t recordCount ) override;
       bool registerFlushToOutput() override;
+      bool registerEmpty() override;
       float bitsPerRecord() override;
 
 #ifdef E57_DEBUG
@@ -129,6 +131,7 @@ namespace e57
 
       uint64_t processRecords( size_t recordCount ) override;
       bool registerFlushToOutput() override;
+      bool registerEmpty() override;
       float bitsPerRecord() override;
 
 #ifdef E57_DEBUG
@@ -150,6 +153,7 @@ namespace e57
 
       uint64_t processRecords( size_t recordCount ) override;
       bool registerFlushToOutput() override;
+      bool registerEmpty() override;
       float bitsPerRecord() override;
 
 #ifdef E57_DEBUG
@@ -176,6 +180,7 @@ namespace e57
       uint64_t currentRecordIndex() override;
       float bitsPerRecord() override;
       bool registerFlushToOutput() override;
+      bool registerEmpty() override;
 
       size_t outputAvailable() override; /// number of bytes that can be read
       void outputRead( char *dest,
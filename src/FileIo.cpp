@@ -0,0 +1,119 @@
+// SPDX-License-Identifier: MIT
+
+#if defined( _WIN32 )
+#if defined( _MSC_VER )
+#include <io.h>
+#elif defined( __GNUC__ )
+#include <sys/types.h>
+#include <unistd.h>
+#else
+#error "no supported compiler defined"
+#endif
+#elif defined( __linux__ )
+#ifndef _LARGEFILE64_SOURCE
+#define _LARGEFILE64_SOURCE
+#endif
+#include <sys/types.h>
+#include <unistd.h>
+#define E57_PREAD ::pread64
+#define E57_PWRITE ::pwrite64
+#elif defined( __APPLE__ )
+#include <sys/types.h>
+#include <unistd.h>
+#define E57_PREAD ::pread
+#define E57_PWRITE ::pwrite
+#else
+#error "no supported OS platform defined"
+#endif
+
+#include "FileIo.h"
+
+using namespace e57;
+
+int64_t FileIo::read( char *buf, size_t count, uint64_t offset )
+{
+#ifdef E57_PREAD
+   return E57_PREAD( fd_, buf, count, static_cast<int64_t>( offset ) );
+#else
+   std::lock_guard<std::mutex> lock( positionMutex_ );
+
+#if defined( _MSC_VER )
+   if ( _lseeki64( fd_, static_cast<__int64>( offset ), SEEK_SET ) < 0 )
+   {
+      return -1;
+   }
+
+   return ::_read( fd_, buf, static_cast<unsigned int>( count ) );
+#else
+   if ( ::lseek( fd_, static_cast<off_t>( offset ), SEEK_SET ) < 0 )
+   {
+      return -1;
+   }
+
+   return ::read( fd_, buf, count );
+#endif
+#endif
+}
+
+int64_t FileIo::write( const char *buf, size_t count, uint64_t offset )
+{
+#ifdef E57_PWRITE
+   return E57_PWRITE( fd_, buf, count, static_cast<int64_t>( offset ) );
+#else
+   std::lock_guard<std::mutex> lock( positionMutex_ );
+
+#if defined( _MSC_VER )
+   if ( _lseeki64( fd_, static_cast<__int64>( offset ), SEEK_SET ) < 0 )
+   {
+      return -1;
+   }
+
+   return ::_write( fd_, buf, static_cast<unsigned int>( count ) );
+#else
+   if ( ::lseek( fd_, static_cast<off_t>( offset ), SEEK_SET ) < 0 )
+   {
+      return -1;
+   }
+
+   return ::write( fd_, buf, count );
+#endif
+#endif
+}
+
+bool FileIo::readFully( char *buf, size_t count, uint64_t offset )
+{
+   while ( count > 0 )
+   {
+      const int64_t result = read( buf, count, offset );
+
+      if ( result <= 0 )
+      {
+         return false;
+      }
+
+      buf += result;
+      count -= static_cast<size_t>( result );
+      offset += static_cast<uint64_t>( result );
+   }
+
+   return true;
+}
+
+bool FileIo::writeFully( const char *buf, size_t count, uint64_t offset )
+{
+   while ( count > 0 )
+   {
+      const int64_t result = write( buf, count, offset );
+
+      if ( result <= 0 )
+      {
+         return false;
+      }
+
+      buf += result;
+      count -= static_cast<size_t>( result );
+      offset += static_cast<uint64_t>( result );
+   }
+
+   return true;
+}
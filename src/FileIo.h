@@ -0,0 +1,41 @@
+#pragma once
+// SPDX-License-Identifier: MIT
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+namespace e57
+{
+   /// Reads and writes of an open file at explicit offsets, used by CheckedFile for everything but opening, closing
+   /// and finding the length of the file: pread()/pwrite(), or a seek and a read or write under a lock where those
+   /// don't exist.  None of the functions use or move the file position of other callers, so they can be called from
+   /// several threads at once.
+   class FileIo
+   {
+   public:
+      /// fd stays owned by the caller and must stay open as long as the FileIo is used
+      explicit FileIo( int fd ) : fd_( fd )
+      {
+      }
+
+      FileIo( const FileIo & ) = delete;
+      FileIo &operator=( const FileIo & ) = delete;
+
+      /// Transfer up to count bytes at offset, like pread() and pwrite().  Returns the number of bytes transferred (0
+      /// at the end of the file) or -1 with errno set.
+      int64_t read( char *buf, size_t count, uint64_t offset );
+      int64_t write( const char *buf, size_t count, uint64_t offset );
+
+      /// Transfer all count bytes at offset.  Returns false if an error or the end of the file stops the transfer, in
+      /// which case it is undefined how much of it was done.
+      bool readFully( char *buf, size_t count, uint64_t offset );
+      bool writeFully( const char *buf, size_t count, uint64_t offset );
+
+   private:
+      int fd_ = -1;
+
+      /// Held while moving the file position and reading or writing at it, where there is no pread()/pwrite()
+      std::mutex positionMutex_;
+   };
+}
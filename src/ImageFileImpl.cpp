@@ -25,11 +25,14 @@
  * DEALINGS IN THE SOFTWARE.
  */
 
+#include <cstring>
+
 #include "ImageFileImpl.h"
 #include "CheckedFile.h"
 #include "E57FormatImpl.h"
 #include "E57Version.h"
 #include "E57XmlParser.h"
+#include "MetadataCache.h"
 
 namespace e57
 {
@@ -74,10 +77,12 @@ namespace e57
    }
 #endif
 
-   ImageFileImpl::ImageFileImpl( ReadChecksumPolicy policy ) :
+   ImageFileImpl::ImageFileImpl( ReadChecksumPolicy policy, const ImageFile::Options &options ) :
       isWriter_( false ), writerCount_( 0 ), readerCount_( 0 ),
-      checksumPolicy( std::max( 0, std::min( policy, 100 ) ) ), file_( nullptr ), xmlLogicalOffset_( 0 ),
-      xmlLogicalLength_( 0 ), unusedLogicalStart_( 0 )
+      checksumPolicy( std::max( 0, std::min( policy, 100 ) ) ), validateXml_( options.validateXml ),
+      lazyMetadata_( options.lazyMetadata ), metadataCacheDirectory_( options.metadataCacheDirectory ),
+      memoryMapped_( options.memoryMapped ), file_( nullptr ), packetCacheSize_( options.packetCacheSize ),
+      xmlLogicalOffset_( 0 ), xmlLogicalLength_( 0 ), unusedLogicalStart_( 0 )
    {
       /// First phase of construction, can't do much until have the ImageFile
       /// object. See ImageFileImpl::construct2() for second phase.
@@ -113,6 +118,7 @@ namespace e57
          {
             /// Open file for writing, truncate if already exists.
             file_ = new CheckedFile( fileName_, CheckedFile::WriteCreate, checksumPolicy );
+            packetCache_.reset( new PacketReadCache( file_, packetCacheSize_ ) );
 
             std::shared_ptr<StructureNodeImpl> root( new StructureNodeImpl( imf ) );
             root_ = root;
@@ -137,7 +143,8 @@ namespace e57
       try
       {
          /// Open file for reading.
-         file_ = new CheckedFile( fileName_, CheckedFile::ReadOnly, checksumPolicy );
+         file_ = new CheckedFile( fileName_, CheckedFile::ReadOnly, checksumPolicy, memoryMapped_ );
+         packetCache_.reset( new PacketReadCache( file_, packetCacheSize_ ) );
 
          std::shared_ptr<StructureNodeImpl> root( new StructureNodeImpl( imf ) );
          root_ = root;
@@ -159,18 +166,34 @@ namespace e57
 
       try
       {
-         /// Create parser state, attach its event handers to the SAX2 reader
-         E57XmlParser parser( imf );
+         unusedLogicalStart_ = sizeof( E57FileHeader );
 
-         parser.init();
+         /// Use the copy of the tree made by an earlier open if the file hasn't changed since
+         std::unique_ptr<MetadataCache> cache;
 
-         /// Create input source (XML section of E57 file turned into a stream).
-         E57XmlFileInputSource xmlSection( file_, xmlLogicalOffset_, xmlLogicalLength_ );
+         if ( !metadataCacheDirectory_.empty() )
+         {
+            cache.reset(
+               new MetadataCache( metadataCacheDirectory_, fileName_, file_, xmlLogicalOffset_, xmlLogicalLength_ ) );
 
-         unusedLogicalStart_ = sizeof( E57FileHeader );
+            if ( cache->load( imf ) )
+            {
+               return;
+            }
+         }
+
+         /// Create parser state and the reader that feeds it.  A cached tree must be complete, so it isn't read lazily.
+         E57XmlParser parser( imf );
 
-         /// Do the parse, building up the node tree
-         parser.parse( xmlSection );
+         parser.init( validateXml_, lazyMetadata_ && !cache );
+
+         /// Do the parse of the XML section, building up the node tree
+         parser.parse( file_, xmlLogicalOffset_, xmlLogicalLength_ );
+
+         if ( cache )
+         {
+            cache->store( imf );
+         }
       }
       catch ( ... )
       {
@@ -201,6 +224,7 @@ namespace e57
       {
          /// Open file for reading.
          file_ = new CheckedFile( input, size, checksumPolicy );
+         packetCache_.reset( new PacketReadCache( file_, packetCacheSize_ ) );
 
          std::shared_ptr<StructureNodeImpl> root( new StructureNodeImpl( imf ) );
          root_ = root;
@@ -222,18 +246,15 @@ namespace e57
 
       try
       {
-         /// Create parser state, attach its event handers to the SAX2 reader
+         /// Create parser state and the reader that feeds it
          E57XmlParser parser( imf );
 
-         parser.init();
-
-         /// Create input source (XML section of E57 file turned into a stream).
-         E57XmlFileInputSource xmlSection( file_, xmlLogicalOffset_, xmlLogicalLength_ );
+         parser.init( validateXml_, lazyMetadata_ );
 
          unusedLogicalStart_ = sizeof( E57FileHeader );
 
-         /// Do the parse, building up the node tree
-         parser.parse( xmlSection );
+         /// Do the parse of the XML section, building up the node tree
+         parser.parse( file_, xmlLogicalOffset_, xmlLogicalLength_ );
       }
       catch ( ... )
       {
@@ -256,8 +277,8 @@ namespace e57
       if ( writerCount_ < 0 )
       {
          throw E57_EXCEPTION2( E57_ERROR_INTERNAL, "fileName=" + fileName_ +
-                                                      " writerCount=" + toString( writerCount_ ) +
-                                                      " readerCount=" + toString( readerCount_ ) );
+                                                      " writerCount=" + toString( writerCount_.load() ) +
+                                                      " readerCount=" + toString( readerCount_.load() ) );
       }
 #endif
    }
@@ -274,8 +295,8 @@ namespace e57
       if ( readerCount_ < 0 )
       {
          throw E57_EXCEPTION2( E57_ERROR_INTERNAL, "fileName=" + fileName_ +
-                                                      " writerCount=" + toString( writerCount_ ) +
-                                                      " readerCount=" + toString( readerCount_ ) );
+                                                      " writerCount=" + toString( writerCount_.load() ) +
+                                                      " readerCount=" + toString( readerCount_.load() ) );
       }
 #endif
    }
@@ -342,6 +363,8 @@ namespace e57
          file_->close();
       }
 
+      packetCache_.reset();
+
       delete file_;
       file_ = nullptr;
    }
@@ -365,6 +388,8 @@ namespace e57
          file_->close();
       }
 
+      packetCache_.reset();
+
       delete file_;
       file_ = nullptr;
    }
@@ -435,6 +460,11 @@ namespace e57
       return fileName_;
    }
 
+   std::recursive_mutex &ImageFileImpl::lazyChildrenMutex()
+   {
+      return lazyChildrenMutex_;
+   }
+
    void ImageFileImpl::extensionsAdd( const ustring &prefix, const ustring &uri )
    {
       checkImageFileOpen( __FILE__, __LINE__, static_cast<const char *>( __FUNCTION__ ) );
@@ -27,13 +27,16 @@
 
 #pragma once
 
+#include <atomic>
 #include <memory>
+#include <mutex>
 
 #include "Common.h"
 
 namespace e57
 {
    class CheckedFile;
+   class PacketReadCache;
 
    struct E57FileHeader;
    struct NameSpace;
@@ -41,7 +44,7 @@ namespace e57
    class ImageFileImpl : public std::enable_shared_from_this<ImageFileImpl>
    {
    public:
-      ImageFileImpl( ReadChecksumPolicy policy );
+      ImageFileImpl( ReadChecksumPolicy policy, const ImageFile::Options &options );
       void construct2( const ustring &fileName, const ustring &mode );
       void construct2( const char *input, const uint64_t size );
       std::shared_ptr<StructureNodeImpl> root();
@@ -57,6 +60,9 @@ namespace e57
       CheckedFile *file() const;
       ustring fileName() const;
 
+      /// Held while children whose reading was put off by lazyMetadata are added to their node
+      std::recursive_mutex &lazyChildrenMutex();
+
       /// Manipulate registered extensions in the file
       void extensionsAdd( const ustring &prefix, const ustring &uri );
       bool extensionsLookupPrefix( const ustring &prefix, ustring &uri ) const;
@@ -89,6 +95,8 @@ namespace e57
 
    private:
       friend class E57XmlParser;
+      friend class MetadataCache;
+      friend class ParsedPathNameImpl;
       friend class BlobNodeImpl;
       friend class CompressedVectorWriterImpl;
       friend class CompressedVectorReaderImpl; //??? add file() instead of
@@ -101,13 +109,24 @@ namespace e57
 
       ustring fileName_;
       bool isWriter_;
-      int writerCount_;
-      int readerCount_;
+
+      /// Readers of a read-only file may be opened and closed from several threads at once
+      std::atomic<int> writerCount_;
+      std::atomic<int> readerCount_;
 
       ReadChecksumPolicy checksumPolicy;
+      bool validateXml_;
+      bool lazyMetadata_;
+      std::recursive_mutex lazyChildrenMutex_;
+      ustring metadataCacheDirectory_; ///< empty if the tree isn't cached
+      bool memoryMapped_;
 
       CheckedFile *file_;
 
+      /// Data packets read by the CompressedVectorReaders of this file
+      uint64_t packetCacheSize_;
+      std::unique_ptr<PacketReadCache> packetCache_;
+
       /// Read file attributes
       uint64_t xmlLogicalOffset_;
       uint64_t xmlLogicalLength_;
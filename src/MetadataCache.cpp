@@ -0,0 +1,684 @@
+// SPDX-License-Identifier: MIT
+
+#if defined( _WIN32 )
+#include <process.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#elif defined( __linux__ ) || defined( __APPLE__ )
+#include <climits>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#define E57_HAVE_MMAP
+#else
+#error "no supported OS platform defined"
+#endif
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+#include "CRC32C.h"
+#include "CheckedFile.h"
+#include "E57FormatImpl.h"
+#include "ImageFileImpl.h"
+#include "MetadataCache.h"
+
+using namespace e57;
+
+namespace
+{
+   /// Start of a cache entry, followed by payloadLength bytes of payload: the name of the file, the extensions and
+   /// the tree.  Numbers are in the byte order of the machine, which byteOrder checks.
+   struct EntryHeader
+   {
+      char signature[8];
+      uint32_t version;
+      uint32_t byteOrder;
+      MetadataCache::Key key;
+      uint64_t payloadLength;
+      uint32_t payloadChecksum;
+      uint32_t reserved;
+   };
+
+   const char EntrySignature[8] = { 'E', '5', '7', 'C', 'A', 'C', 'H', 'E' };
+   const uint32_t EntryVersion = 1;
+   const uint32_t EntryByteOrder = 0x01020304;
+
+   const char EntryExtension[] = ".e57cache";
+
+   /// Trees are written and read recursively, deeper ones aren't cached.  E57 files need about ten levels.
+   const unsigned MaxNodeDepth = 256;
+
+   bool operator==( const MetadataCache::Key &a, const MetadataCache::Key &b )
+   {
+      return ( a.fileSize == b.fileSize ) && ( a.modifiedSeconds == b.modifiedSeconds ) &&
+             ( a.modifiedNanoseconds == b.modifiedNanoseconds ) && ( a.device == b.device ) &&
+             ( a.inode == b.inode ) && ( a.xmlLogicalOffset == b.xmlLogicalOffset ) &&
+             ( a.xmlLogicalLength == b.xmlLogicalLength ) && ( a.xmlChecksum == b.xmlChecksum );
+   }
+
+   /// Absolute name of fileName and what stat() says about it.  Returns false if either isn't available.
+   bool identifyFile( const ustring &fileName, ustring &absoluteName, MetadataCache::Key &key )
+   {
+#if defined( _WIN32 )
+      char absolute[_MAX_PATH];
+      struct _stat64 st;
+
+      if ( ( _fullpath( absolute, fileName.c_str(), _MAX_PATH ) == nullptr ) ||
+           ( _stat64( fileName.c_str(), &st ) != 0 ) )
+      {
+         return false;
+      }
+
+      absoluteName = absolute;
+      key.fileSize = static_cast<uint64_t>( st.st_size );
+      key.modifiedSeconds = static_cast<int64_t>( st.st_mtime );
+#else
+      char absolute[PATH_MAX];
+      struct stat st;
+
+      if ( ( realpath( fileName.c_str(), absolute ) == nullptr ) || ( stat( absolute, &st ) != 0 ) )
+      {
+         return false;
+      }
+
+      absoluteName = absolute;
+      key.fileSize = static_cast<uint64_t>( st.st_size );
+#if defined( __APPLE__ )
+      key.modifiedSeconds = static_cast<int64_t>( st.st_mtimespec.tv_sec );
+      key.modifiedNanoseconds = static_cast<int64_t>( st.st_mtimespec.tv_nsec );
+#else
+      key.modifiedSeconds = static_cast<int64_t>( st.st_mtim.tv_sec );
+      key.modifiedNanoseconds = static_cast<int64_t>( st.st_mtim.tv_nsec );
+#endif
+      key.device = static_cast<uint64_t>( st.st_dev );
+      key.inode = static_cast<uint64_t>( st.st_ino );
+#endif
+
+      return true;
+   }
+
+   /// FNV-1a, to name entries after the absolute name of their file
+   uint64_t nameHash( const ustring &name )
+   {
+      uint64_t hash = 14695981039346656037ULL;
+
+      for ( char c : name )
+      {
+         hash = ( hash ^ static_cast<uint8_t>( c ) ) * 1099511628211ULL;
+      }
+
+      return hash;
+   }
+
+   /// crc32c() can't be continued, so checksum the section a chunk at a time, then the list of chunk checksums
+   uint32_t sectionChecksum( CheckedFile *file, uint64_t logicalOffset, uint64_t logicalLength )
+   {
+      const size_t chunkSize = 1 << 20;
+      std::vector<char> chunk( static_cast<size_t>( std::min<uint64_t>( logicalLength, chunkSize ) ) );
+      std::vector<uint32_t> checksums;
+
+      for ( uint64_t done = 0; done < logicalLength; )
+      {
+         const auto n = static_cast<size_t>( std::min<uint64_t>( logicalLength - done, chunkSize ) );
+
+         file->readAt( logicalOffset + done, chunk.data(), n );
+         checksums.push_back( crc32c( chunk.data(), n ) );
+         done += n;
+      }
+
+      return crc32c( checksums.data(), checksums.size() * sizeof( uint32_t ) );
+   }
+
+   /// Read-only view of a whole cache entry: memory-mapped where we can, read in memory otherwise
+   class EntryView
+   {
+   public:
+      explicit EntryView( const ustring &fileName )
+      {
+#ifdef E57_HAVE_MMAP
+         const int fd = ::open( fileName.c_str(), O_RDONLY );
+
+         if ( fd < 0 )
+         {
+            return;
+         }
+
+         struct stat st;
+
+         if ( ( fstat( fd, &st ) == 0 ) && ( st.st_size > 0 ) )
+         {
+            void *address = ::mmap( nullptr, static_cast<size_t>( st.st_size ), PROT_READ, MAP_PRIVATE, fd, 0 );
+
+            if ( address != MAP_FAILED )
+            {
+               mapAddress_ = address;
+               data_ = static_cast<const char *>( address );
+               size_ = static_cast<size_t>( st.st_size );
+            }
+         }
+
+         /// The mapping stays valid after the descriptor is closed
+         ::close( fd );
+#else
+         std::ifstream in( fileName, std::ios::binary | std::ios::ate );
+
+         if ( !in )
+         {
+            return;
+         }
+
+         buffer_.resize( static_cast<size_t>( in.tellg() ) );
+         in.seekg( 0 );
+         if ( !in.read( buffer_.data(), static_cast<std::streamsize>( buffer_.size() ) ) )
+         {
+            return;
+         }
+
+         data_ = buffer_.data();
+         size_ = buffer_.size();
+#endif
+      }
+
+      ~EntryView()
+      {
+#ifdef E57_HAVE_MMAP
+         if ( mapAddress_ != nullptr )
+         {
+            ::munmap( mapAddress_, size_ );
+         }
+#endif
+      }
+
+      EntryView( const EntryView & ) = delete;
+      EntryView &operator=( const EntryView & ) = delete;
+
+      const char *data() const
+      {
+         return data_;
+      }
+      size_t size() const
+      {
+         return size_;
+      }
+
+   private:
+      const char *data_ = nullptr;
+      size_t size_ = 0;
+      void *mapAddress_ = nullptr;
+      std::vector<char> buffer_;
+   };
+
+   /// Appends the payload of an entry
+   class PayloadWriter
+   {
+   public:
+      explicit PayloadWriter( std::vector<char> &out ) : out_( out )
+      {
+      }
+
+      template <typename T> void put( T value )
+      {
+         const char *bytes = reinterpret_cast<const char *>( &value );
+         out_.insert( out_.end(), bytes, bytes + sizeof( T ) );
+      }
+
+      void putString( const ustring &s )
+      {
+         put( static_cast<uint64_t>( s.length() ) );
+         out_.insert( out_.end(), s.begin(), s.end() );
+      }
+
+      void putNode( const NodeImplSharedPtr &ni, unsigned depth = 0 );
+
+   private:
+      std::vector<char> &out_;
+   };
+
+   void PayloadWriter::putNode( const NodeImplSharedPtr &ni, unsigned depth )
+   {
+      if ( depth > MaxNodeDepth )
+      {
+         throw E57_EXCEPTION2( E57_ERROR_INTERNAL, "depth=" + toString( depth ) + " tree too deep to cache" );
+      }
+
+      const NodeType type = ni->type();
+
+      put( static_cast<uint8_t>( type ) );
+
+      switch ( type )
+      {
+         case E57_STRUCTURE:
+         {
+            auto s = std::static_pointer_cast<StructureNodeImpl>( ni );
+            const int64_t count = s->childCount();
+
+            put( static_cast<uint64_t>( count ) );
+            for ( int64_t i = 0; i < count; ++i )
+            {
+               NodeImplSharedPtr child( s->get( i ) );
+
+               putString( child->elementName() );
+               putNode( child, depth + 1 );
+            }
+         }
+         break;
+
+         case E57_VECTOR:
+         {
+            /// Children are named after their index
+            auto v = std::static_pointer_cast<VectorNodeImpl>( ni );
+            const int64_t count = v->childCount();
+
+            put( static_cast<uint8_t>( v->allowHeteroChildren() ) );
+            put( static_cast<uint64_t>( count ) );
+            for ( int64_t i = 0; i < count; ++i )
+            {
+               putNode( v->get( i ), depth + 1 );
+            }
+         }
+         break;
+
+         case E57_COMPRESSED_VECTOR:
+         {
+            auto cv = std::static_pointer_cast<CompressedVectorNodeImpl>( ni );
+
+            put( cv->getRecordCount() );
+            put( cv->getBinarySectionLogicalStart() );
+            putNode( cv->getPrototype(), depth + 1 );
+            putNode( cv->getCodecs(), depth + 1 );
+         }
+         break;
+
+         case E57_INTEGER:
+         {
+            auto i = std::static_pointer_cast<IntegerNodeImpl>( ni );
+
+            put( i->value() );
+            put( i->minimum() );
+            put( i->maximum() );
+         }
+         break;
+
+         case E57_SCALED_INTEGER:
+         {
+            auto si = std::static_pointer_cast<ScaledIntegerNodeImpl>( ni );
+
+            put( si->rawValue() );
+            put( si->minimum() );
+            put( si->maximum() );
+            put( si->scale() );
+            put( si->offset() );
+         }
+         break;
+
+         case E57_FLOAT:
+         {
+            auto f = std::static_pointer_cast<FloatNodeImpl>( ni );
+
+            put( static_cast<uint8_t>( f->precision() ) );
+            put( f->value() );
+            put( f->minimum() );
+            put( f->maximum() );
+         }
+         break;
+
+         case E57_STRING:
+            putString( std::static_pointer_cast<StringNodeImpl>( ni )->value() );
+            break;
+
+         case E57_BLOB:
+         {
+            auto b = std::static_pointer_cast<BlobNodeImpl>( ni );
+
+            put( b->byteCount() );
+            put( b->getBinarySectionLogicalStart() );
+         }
+         break;
+      }
+   }
+
+   /// Reads the payload of an entry.  Its checksum was right, but it is still checked as it is read so a bad entry
+   /// can't make us read past its end.
+   class PayloadReader
+   {
+   public:
+      PayloadReader( const char *begin, const char *end, ImageFileImplSharedPtr imf ) :
+         pos_( begin ), end_( end ), imf_( std::move( imf ) )
+      {
+      }
+
+      template <typename T> T get()
+      {
+         need( sizeof( T ) );
+
+         T value;
+         memcpy( &value, pos_, sizeof( T ) );
+         pos_ += sizeof( T );
+         return value;
+      }
+
+      ustring getString()
+      {
+         const auto length = get<uint64_t>();
+
+         need( length );
+
+         ustring s( pos_, static_cast<size_t>( length ) );
+         pos_ += length;
+         return s;
+      }
+
+      /// Number of items that follow, each at least one byte long
+      uint64_t getCount()
+      {
+         const auto count = get<uint64_t>();
+
+         need( count );
+         return count;
+      }
+
+      NodeImplSharedPtr getNode( unsigned depth = 0 );
+
+      bool atEnd() const
+      {
+         return pos_ == end_;
+      }
+
+   private:
+      void need( uint64_t length ) const
+      {
+         if ( length > static_cast<uint64_t>( end_ - pos_ ) )
+         {
+            throw E57_EXCEPTION2( E57_ERROR_INTERNAL, "fileName=" + imf_->fileName() + " cache entry is truncated" );
+         }
+      }
+
+      const char *pos_;
+      const char *end_;
+      ImageFileImplSharedPtr imf_;
+   };
+
+   NodeImplSharedPtr PayloadReader::getNode( unsigned depth )
+   {
+      /// store() doesn't write deeper trees, but don't let a bad entry overflow the stack
+      if ( depth > MaxNodeDepth )
+      {
+         throw E57_EXCEPTION2( E57_ERROR_INTERNAL, "fileName=" + imf_->fileName() + " cache entry too deep" );
+      }
+
+      const auto type = static_cast<NodeType>( get<uint8_t>() );
+
+      switch ( type )
+      {
+         case E57_STRUCTURE:
+         {
+            std::shared_ptr<StructureNodeImpl> s( new StructureNodeImpl( imf_ ) );
+
+            for ( uint64_t i = 0, count = getCount(); i < count; ++i )
+            {
+               const ustring name = getString();
+
+               s->appendUnchecked( name, getNode( depth + 1 ) );
+            }
+
+            return s;
+         }
+
+         case E57_VECTOR:
+         {
+            const bool allowHeteroChildren = ( get<uint8_t>() != 0 );
+            std::shared_ptr<VectorNodeImpl> v( new VectorNodeImpl( imf_, allowHeteroChildren ) );
+
+            for ( uint64_t i = 0, count = getCount(); i < count; ++i )
+            {
+               v->appendUnchecked( toString( i ), getNode( depth + 1 ) );
+            }
+
+            return v;
+         }
+
+         case E57_COMPRESSED_VECTOR:
+         {
+            std::shared_ptr<CompressedVectorNodeImpl> cv( new CompressedVectorNodeImpl( imf_ ) );
+
+            cv->setRecordCount( get<int64_t>() );
+            cv->setBinarySectionLogicalStart( get<uint64_t>() );
+            cv->setPrototype( getNode( depth + 1 ) );
+
+            NodeImplSharedPtr codecs( getNode( depth + 1 ) );
+
+            if ( codecs->type() != E57_VECTOR )
+            {
+               throw E57_EXCEPTION2( E57_ERROR_INTERNAL, "fileName=" + imf_->fileName() + " bad cache entry" );
+            }
+            cv->setCodecs( std::static_pointer_cast<VectorNodeImpl>( codecs ) );
+
+            return cv;
+         }
+
+         case E57_INTEGER:
+         {
+            const auto value = get<int64_t>();
+            const auto minimum = get<int64_t>();
+            const auto maximum = get<int64_t>();
+
+            return NodeImplSharedPtr( new IntegerNodeImpl( imf_, value, minimum, maximum ) );
+         }
+
+         case E57_SCALED_INTEGER:
+         {
+            const auto value = get<int64_t>();
+            const auto minimum = get<int64_t>();
+            const auto maximum = get<int64_t>();
+            const auto scale = get<double>();
+            const auto offset = get<double>();
+
+            return NodeImplSharedPtr( new ScaledIntegerNodeImpl( imf_, value, minimum, maximum, scale, offset ) );
+         }
+
+         case E57_FLOAT:
+         {
+            const auto precision = static_cast<FloatPrecision>( get<uint8_t>() );
+            const auto value = get<double>();
+            const auto minimum = get<double>();
+            const auto maximum = get<double>();
+
+            return NodeImplSharedPtr( new FloatNodeImpl( imf_, value, precision, minimum, maximum ) );
+         }
+
+         case E57_STRING:
+            return NodeImplSharedPtr( new StringNodeImpl( imf_, getString() ) );
+
+         case E57_BLOB:
+         {
+            const auto length = get<int64_t>();
+            const auto logicalStart = get<uint64_t>();
+
+            return NodeImplSharedPtr(
+               new BlobNodeImpl( imf_, static_cast<int64_t>( CheckedFile::logicalToPhysical( logicalStart ) ), length ) );
+         }
+      }
+
+      throw E57_EXCEPTION2( E57_ERROR_INTERNAL,
+                            "fileName=" + imf_->fileName() + " nodeType=" + toString( type ) + " bad cache entry" );
+   }
+}
+
+MetadataCache::MetadataCache( const ustring &directory, const ustring &fileName, CheckedFile *file,
+                              uint64_t xmlLogicalOffset, uint64_t xmlLogicalLength )
+{
+   if ( directory.empty() || !identifyFile( fileName, fileName_, key_ ) )
+   {
+      return;
+   }
+
+   key_.xmlLogicalOffset = xmlLogicalOffset;
+   key_.xmlLogicalLength = xmlLogicalLength;
+   key_.xmlChecksum = sectionChecksum( file, xmlLogicalOffset, xmlLogicalLength );
+
+   const char last = directory.back();
+   const bool separated = ( last == '/' ) || ( last == '\\' );
+
+   entryName_ = directory + ( separated ? "" : "/" ) + hexString( nameHash( fileName_ ) ).substr( 2 ) + EntryExtension;
+}
+
+bool MetadataCache::load( const ImageFileImplSharedPtr &imf )
+{
+   if ( entryName_.empty() )
+   {
+      return false;
+   }
+
+   EntryView entry( entryName_ );
+   EntryHeader header;
+
+   if ( entry.size() < sizeof( header ) )
+   {
+      return false;
+   }
+
+   memcpy( &header, entry.data(), sizeof( header ) );
+
+   if ( ( memcmp( header.signature, EntrySignature, sizeof( EntrySignature ) ) != 0 ) ||
+        ( header.version != EntryVersion ) || ( header.byteOrder != EntryByteOrder ) || !( header.key == key_ ) ||
+        ( header.payloadLength != entry.size() - sizeof( header ) ) || ( header.key.reserved != 0 ) ||
+        ( header.reserved != 0 ) )
+   {
+      return false;
+   }
+
+   const char *payload = entry.data() + sizeof( header );
+
+   if ( crc32c( payload, static_cast<size_t>( header.payloadLength ) ) != header.payloadChecksum )
+   {
+      return false;
+   }
+
+   try
+   {
+      PayloadReader reader( payload, payload + header.payloadLength, imf );
+
+      /// Entries of different files could have the same name
+      if ( reader.getString() != fileName_ )
+      {
+         return false;
+      }
+
+      /// imf is only changed once the whole entry has been read
+      std::vector<std::pair<ustring, ustring>> extensions;
+
+      for ( uint64_t i = 0, count = reader.getCount(); i < count; ++i )
+      {
+         const ustring prefix = reader.getString();
+         const ustring uri = reader.getString();
+
+         extensions.emplace_back( prefix, uri );
+      }
+
+      NodeImplSharedPtr root( reader.getNode() );
+
+      if ( ( root->type() != E57_STRUCTURE ) || !reader.atEnd() )
+      {
+         throw E57_EXCEPTION2( E57_ERROR_INTERNAL, "fileName=" + imf->fileName() + " bad cache entry" );
+      }
+
+      for ( const auto &extension : extensions )
+      {
+         imf->extensionsAdd( extension.first, extension.second );
+      }
+
+      imf->root_ = std::static_pointer_cast<StructureNodeImpl>( root );
+      imf->root_->setAttachedRecursive();
+   }
+   catch ( E57Exception & )
+   {
+#ifdef E57_MAX_VERBOSE
+      std::cout << "ignoring bad metadata cache entry " << entryName_ << std::endl;
+#endif
+      return false;
+   }
+
+   return true;
+}
+
+void MetadataCache::store( const ImageFileImplSharedPtr &imf )
+{
+   if ( entryName_.empty() )
+   {
+      return;
+   }
+
+   EntryHeader header;
+   std::vector<char> payload;
+
+   try
+   {
+      PayloadWriter writer( payload );
+
+      writer.putString( fileName_ );
+
+      writer.put( static_cast<uint64_t>( imf->extensionsCount() ) );
+      for ( size_t i = 0; i < imf->extensionsCount(); ++i )
+      {
+         writer.putString( imf->extensionsPrefix( i ) );
+         writer.putString( imf->extensionsUri( i ) );
+      }
+
+      writer.putNode( imf->root() );
+   }
+   catch ( E57Exception & )
+   {
+      /// The tree is too deep, or the file was closed meanwhile: nothing to cache
+      return;
+   }
+
+   memcpy( header.signature, EntrySignature, sizeof( EntrySignature ) );
+   header.version = EntryVersion;
+   header.byteOrder = EntryByteOrder;
+   header.key = key_;
+   header.payloadLength = payload.size();
+   header.payloadChecksum = crc32c( payload.data(), payload.size() );
+   header.reserved = 0;
+
+   /// Each writer has its own temporary file, the last rename wins
+   static std::atomic<unsigned> temporaryCount( 0 );
+#if defined( _WIN32 )
+   const int pid = _getpid();
+#else
+   const int pid = static_cast<int>( getpid() );
+#endif
+   const ustring temporaryName = entryName_ + "." + toString( pid ) + "." + toString( temporaryCount++ ) + ".tmp";
+
+   {
+      std::ofstream out( temporaryName, std::ios::binary | std::ios::trunc );
+
+      out.write( reinterpret_cast<const char *>( &header ), sizeof( header ) );
+      out.write( payload.data(), static_cast<std::streamsize>( payload.size() ) );
+      out.close();
+
+      if ( !out )
+      {
+#ifdef E57_MAX_VERBOSE
+         std::cout << "can't write metadata cache entry " << temporaryName << std::endl;
+#endif
+         std::remove( temporaryName.c_str() );
+         return;
+      }
+   }
+
+#if defined( _WIN32 )
+   /// rename() doesn't replace an existing file here
+   std::remove( entryName_.c_str() );
+#endif
+   if ( std::rename( temporaryName.c_str(), entryName_.c_str() ) != 0 )
+   {
+      std::remove( temporaryName.c_str() );
+   }
+}
@@ -0,0 +1,61 @@
+#pragma once
+// SPDX-License-Identifier: MIT
+
+#include "Common.h"
+
+namespace e57
+{
+   class CheckedFile;
+
+   /// Binary copy of the node tree of a file opened for reading, kept in a cache directory so the next opens of the
+   /// same file rebuild the tree from it instead of parsing the XML section.
+   ///
+   /// An entry is named after the absolute name of the file.  It is only used if the name, size, modification time
+   /// and (where there is one) inode of the file, and the checksum of its XML section, are the ones it was made
+   /// from, and if its own checksum is right.  Otherwise the XML is parsed and the entry replaced.  Entries are
+   /// written to a temporary file which is then renamed, so a reader never sees half an entry, and when several
+   /// processes store the same entry one of them ends up in the cache whole.
+   ///
+   /// Everything in an entry comes from the XML section, so its CRC-32C, computed at every open, is what tells a
+   /// rewritten file from the one cached.  The size, modification time and inode are checked too, so a checksum
+   /// collision alone can't make a changed file use the entry.  On Windows they are weaker: the modification time
+   /// has whole seconds and there is no inode, so a file rewritten in place within a second with the same size is
+   /// only told apart by the checksum.
+   ///
+   /// Trees are written and read recursively, so trees far deeper than E57 files need aren't cached, and such an
+   /// entry counts as a miss.
+   class MetadataCache
+   {
+   public:
+      /// The XML section is read to compute its checksum
+      MetadataCache( const ustring &directory, const ustring &fileName, CheckedFile *file, uint64_t xmlLogicalOffset,
+                     uint64_t xmlLogicalLength );
+
+      /// Build the extensions and the tree of imf from the entry of the file.  Returns false, leaving imf as it was,
+      /// if there is no usable entry.
+      bool load( const ImageFileImplSharedPtr &imf );
+
+      /// Replace the entry of the file by a copy of the extensions and the tree of imf.  The cache only makes opening
+      /// faster, so if that fails the file is opened all the same.
+      void store( const ImageFileImplSharedPtr &imf );
+
+      /// Identity of the file and of its XML section, at the start of an entry
+      struct Key
+      {
+         uint64_t fileSize = 0;
+         int64_t modifiedSeconds = 0;
+         int64_t modifiedNanoseconds = 0;
+         uint64_t device = 0;
+         uint64_t inode = 0;
+         uint64_t xmlLogicalOffset = 0;
+         uint64_t xmlLogicalLength = 0;
+         uint32_t xmlChecksum = 0;
+         uint32_t reserved = 0;
+      };
+
+   private:
+      ustring fileName_;  ///< absolute name of the file
+      ustring entryName_; ///< name of its entry in the cache directory, empty if the file can't be cached
+      Key key_;
+   };
+}
@@ -89,6 +89,10 @@ namespace e57
       {
          return NodeImplSharedPtr();
       }
+      virtual NodeImplSharedPtr lookup( const StringList & /*fields*/, unsigned /*level*/ )
+      {
+         return NodeImplSharedPtr();
+      }
       NodeImplSharedPtr getRoot();
 
       ImageFileImplWeakPtr destImageFile_;
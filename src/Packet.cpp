@@ -25,6 +25,7 @@
  * DEALINGS IN THE SOFTWARE.
  */
 
+#include <algorithm>
 #include <cstring>
 
 #include "CheckedFile.h"
@@ -32,31 +33,6 @@
 
 using namespace e57;
 
-struct IndexPacket
-{
-   static constexpr unsigned MAX_ENTRIES = 2048;
-
-   const uint8_t packetType = INDEX_PACKET;
-
-   uint8_t packetFlags = 0; // flag bitfields
-   uint16_t packetLogicalLengthMinus1 = 0;
-   uint16_t entryCount = 0;
-   uint8_t indexLevel = 0;
-   uint8_t reserved1[9] = {}; // must be zero
-
-   struct IndexPacketEntry
-   {
-      uint64_t chunkRecordNumber = 0;
-      uint64_t chunkPhysicalOffset = 0;
-   } entries[MAX_ENTRIES];
-
-   void verify( unsigned bufferLength = 0, uint64_t totalRecordCount = 0, uint64_t fileSize = 0 ) const;
-
-#ifdef E57_DEBUG
-   void dump( int indent = 0, std::ostream &os = std::cout ) const;
-#endif
-};
-
 struct EmptyPacketHeader
 {
    const uint8_t packetType = EMPTY_PACKET;
@@ -74,12 +50,9 @@ struct EmptyPacketHeader
 //=============================================================================
 // PacketReadCache
 
-PacketReadCache::PacketReadCache( CheckedFile *cFile, unsigned packetCount ) : cFile_( cFile ), entries_( packetCount )
+PacketReadCache::PacketReadCache( CheckedFile *cFile, uint64_t byteBudget ) :
+   cFile_( cFile ), capacity_( static_cast<size_t>( byteBudget / DATA_PACKET_MAX ) )
 {
-   if ( packetCount == 0 )
-   {
-      throw E57_EXCEPTION2( E57_ERROR_INTERNAL, "packetCount=" + toString( packetCount ) );
-   }
 }
 
 std::unique_ptr<PacketLock> PacketReadCache::lock( uint64_t packetLogicalOffset, char *&pkt )
@@ -88,130 +61,208 @@ std::unique_ptr<PacketLock> PacketReadCache::lock( uint64_t packetLogicalOffset,
    std::cout << "PacketReadCache::lock() called, packetLogicalOffset=" << packetLogicalOffset << std::endl;
 #endif
 
-   /// Only allow one locked packet at a time.
-   if ( lockCount_ > 0 )
-   {
-      throw E57_EXCEPTION2( E57_ERROR_INTERNAL, "lockCount=" + toString( lockCount_ ) );
-   }
-
    /// Offset can't be 0
    if ( packetLogicalOffset == 0 )
    {
       throw E57_EXCEPTION2( E57_ERROR_INTERNAL, "packetLogicalOffset=" + toString( packetLogicalOffset ) );
    }
 
-   /// Linear scan for matching packet offset in cache
-   for ( unsigned i = 0; i < entries_.size(); ++i )
+   CacheEntry &entry = acquire( packetLogicalOffset );
+
+   /// Publish buffer address to caller
+   pkt = entry.buffer_.data();
+
+   /// Create lock so we are sure we will be unlocked when use is finished.
+   return std::unique_ptr<PacketLock>( new PacketLock( this, &entry ) );
+}
+
+unsigned PacketReadCache::preload( uint64_t packetLogicalOffset )
+{
+   unsigned packetLength = 0;
+
+   try
+   {
+      CacheEntry &entry = acquire( packetLogicalOffset );
+
+      packetLength = entry.length_;
+
+      unlock( &entry );
+   }
+   catch ( ... )
+   {
+      /// Leave it to the reader to run into the error and report it
+   }
+
+   return packetLength;
+}
+
+/// Find the packet at packetLogicalOffset, reading it if nobody has, and return it locked
+PacketReadCache::CacheEntry &PacketReadCache::acquire( uint64_t packetLogicalOffset )
+{
+   std::unique_lock<std::mutex> lock( mutex_ );
+
+   while ( true )
    {
-      auto &entry = entries_[i];
+      auto found = index_.find( packetLogicalOffset );
 
-      if ( packetLogicalOffset == entry.logicalOffset_ )
+      if ( found == index_.end() )
       {
-         /// Found a match, so don't have to read anything
-#ifdef E57_MAX_VERBOSE
-         std::cout << "  Found matching cache entry, index=" << i << std::endl;
-#endif
-         /// Mark entry with current useCount (keeps track of age of entry).
-         entry.lastUsed_ = ++useCount_;
+         break;
+      }
 
-         /// Publish buffer address to caller
-         pkt = entry.buffer_;
+      auto entry = found->second;
 
-         /// Create lock so we are sure that we will be unlocked when use is
-         /// finished.
-         std::unique_ptr<PacketLock> plock( new PacketLock( this, i ) );
+      if ( entry->loaded_ )
+      {
+#ifdef E57_MAX_VERBOSE
+         std::cout << "  Found matching cache entry" << std::endl;
+#endif
+         /// Move it to the front of the LRU list
+         entries_.splice( entries_.begin(), entries_, entry );
 
-         /// Increment cache lock just before return
-         ++lockCount_;
+         ++entry->lockCount_;
 
-         return plock;
+         return *entry;
       }
+
+      /// Another thread is reading it.  Look it up again once it's done, since it's gone if the read failed.
+      loadDone_.wait( lock );
    }
-   /// Get here if didn't find a match already in cache.
 
-   /// Find least recently used (LRU) packet buffer
-   unsigned oldestEntry = 0;
-   unsigned oldestUsed = entries_.at( 0 ).lastUsed_;
+   /// Get here if didn't find a match already in cache.  Reserve an entry so others wait for us instead of reading
+   /// the same packet, and read it without holding the lock.
+   auto entry = insertEntry( packetLogicalOffset );
 
-   for ( unsigned i = 0; i < entries_.size(); ++i )
+   lock.unlock();
+
+   unsigned packetLength = 0;
+
+   try
+   {
+      packetLength = readPacket( entry->buffer_.data(), packetLogicalOffset );
+   }
+   catch ( ... )
    {
-      const auto &entry = entries_[i];
+      lock.lock();
+
+      index_.erase( packetLogicalOffset );
+      entries_.erase( entry );
+
+      lock.unlock();
+      loadDone_.notify_all();
+
+      throw;
+   }
+
+   lock.lock();
+
+   entry->length_ = packetLength;
+   entry->loaded_ = true;
 
-      if ( entry.lastUsed_ < oldestUsed )
+   lock.unlock();
+   loadDone_.notify_all();
+
+   return *entry;
+}
+
+/// Add a locked entry for packetLogicalOffset at the front of the LRU list, recycling the buffer of the least recently
+/// used unlocked entry if the cache is full.  Called with mutex_ held.
+PacketReadCache::EntryList::iterator PacketReadCache::insertEntry( uint64_t packetLogicalOffset )
+{
+   auto victim = entries_.end();
+
+   if ( entries_.size() >= capacity_ )
+   {
+      for ( auto it = entries_.rbegin(); it != entries_.rend(); ++it )
       {
-         oldestEntry = i;
-         oldestUsed = entry.lastUsed_;
+         if ( it->lockCount_ == 0 )
+         {
+            victim = std::prev( it.base() );
+            break;
+         }
       }
    }
+
+   if ( victim != entries_.end() )
+   {
 #ifdef E57_MAX_VERBOSE
-   std::cout << "  Oldest entry=" << oldestEntry << " lastUsed=" << oldestUsed << std::endl;
+      std::cout << "  Reusing entry of packetLogicalOffset=" << victim->logicalOffset_ << std::endl;
 #endif
+      index_.erase( victim->logicalOffset_ );
+      entries_.splice( entries_.begin(), entries_, victim );
 
-   readPacket( oldestEntry, packetLogicalOffset );
+      victim->logicalOffset_ = packetLogicalOffset;
+      victim->length_ = 0;
+      victim->loaded_ = false;
+   }
+   else
+   {
+      /// Not full, or every entry is locked: go over budget until some are unlocked
+      entries_.emplace_front( packetLogicalOffset );
+   }
 
-   /// Publish buffer address to caller
-   pkt = entries_[oldestEntry].buffer_;
+   auto entry = entries_.begin();
 
-   /// Create lock so we are sure we will be unlocked when use is finished.
-   std::unique_ptr<PacketLock> plock( new PacketLock( this, oldestEntry ) );
+   entry->lockCount_ = 1;
 
-   /// Increment cache lock just before return
-   ++lockCount_;
+   index_[packetLogicalOffset] = entry;
 
-   return plock;
+   return entry;
 }
 
-void PacketReadCache::unlock( unsigned cacheIndex )
+/// Drop the least recently used unlocked entries until we are back within the budget.  Called with mutex_ held.
+void PacketReadCache::trim()
 {
-   //??? why lockedEntry not used?
-#ifdef E57_MAX_VERBOSE
-   std::cout << "PacketReadCache::unlock() called, cacheIndex=" << cacheIndex << std::endl;
-#endif
+   auto it = entries_.end();
 
-   if ( lockCount_ != 1 )
+   while ( ( entries_.size() > capacity_ ) && ( it != entries_.begin() ) )
    {
-      throw E57_EXCEPTION2( E57_ERROR_INTERNAL, "lockCount=" + toString( lockCount_ ) );
-   }
+      --it;
 
-   --lockCount_;
+      if ( it->lockCount_ == 0 )
+      {
+         index_.erase( it->logicalOffset_ );
+         it = entries_.erase( it );
+      }
+   }
 }
 
-void PacketReadCache::readPacket( unsigned oldestEntry, uint64_t packetLogicalOffset )
+void PacketReadCache::unlock( CacheEntry *entry )
 {
 #ifdef E57_MAX_VERBOSE
-   std::cout << "PacketReadCache::readPacket() called, oldestEntry=" << oldestEntry
-             << " packetLogicalOffset=" << packetLogicalOffset << std::endl;
+   std::cout << "PacketReadCache::unlock() called, packetLogicalOffset=" << entry->logicalOffset_ << std::endl;
 #endif
 
-   /// Read header of packet first to get length.  Use EmptyPacketHeader since
-   /// it has the commom fields to all packets.
-   EmptyPacketHeader header;
-
-   cFile_->seek( packetLogicalOffset, CheckedFile::Logical );
-   cFile_->read( reinterpret_cast<char *>( &header ), sizeof( header ) );
+   std::lock_guard<std::mutex> lock( mutex_ );
 
-   /// Can't verify packet header here, because it is not really an
-   /// EmptyPacketHeader.
-   unsigned packetLength = header.packetLogicalLengthMinus1 + 1;
-
-   /// Be paranoid about packetLength before read
-   if ( packetLength > DATA_PACKET_MAX )
+   if ( entry->lockCount_ == 0 )
    {
-      throw E57_EXCEPTION2( E57_ERROR_BAD_CV_PACKET, "packetLength=" + toString( packetLength ) );
+      throw E57_EXCEPTION2( E57_ERROR_INTERNAL, "lockCount=" + toString( entry->lockCount_ ) );
    }
 
-   auto &entry = entries_.at( oldestEntry );
+   --entry->lockCount_;
+
+   trim();
+}
+
+/// Read and verify the packet at packetLogicalOffset, return its length
+unsigned PacketReadCache::readPacket( char *buffer, uint64_t packetLogicalOffset )
+{
+#ifdef E57_MAX_VERBOSE
+   std::cout << "PacketReadCache::readPacket() called, packetLogicalOffset=" << packetLogicalOffset << std::endl;
+#endif
+
+   const unsigned packetLength = loadPacket( buffer, packetLogicalOffset );
 
-   /// Now read in whole packet into preallocated buffer_.  Note buffer is
-   cFile_->seek( packetLogicalOffset, CheckedFile::Logical );
-   cFile_->read( entry.buffer_, packetLength );
+   /// Use EmptyPacketHeader since it has the commom fields to all packets.
+   const auto &header = *reinterpret_cast<const EmptyPacketHeader *>( buffer );
 
    /// Verify that packet is good.
    switch ( header.packetType )
    {
       case DATA_PACKET:
       {
-         auto dpkt = reinterpret_cast<DataPacket *>( entry.buffer_ );
+         auto dpkt = reinterpret_cast<DataPacket *>( buffer );
 
          dpkt->verify( packetLength );
 #ifdef E57_MAX_VERBOSE
@@ -222,7 +273,7 @@ void PacketReadCache::readPacket( unsigned oldestEntry, uint64_t packetLogicalOf
       break;
       case INDEX_PACKET:
       {
-         auto ipkt = reinterpret_cast<IndexPacket *>( entry.buffer_ );
+         auto ipkt = reinterpret_cast<IndexPacket *>( buffer );
 
          ipkt->verify( packetLength );
 #ifdef E57_MAX_VERBOSE
@@ -233,7 +284,7 @@ void PacketReadCache::readPacket( unsigned oldestEntry, uint64_t packetLogicalOf
       break;
       case EMPTY_PACKET:
       {
-         auto hp = reinterpret_cast<EmptyPacketHeader *>( entry.buffer_ );
+         auto hp = reinterpret_cast<EmptyPacketHeader *>( buffer );
 
          hp->verify( packetLength );
 #ifdef E57_MAX_VERBOSE
@@ -246,62 +297,228 @@ void PacketReadCache::readPacket( unsigned oldestEntry, uint64_t packetLogicalOf
          throw E57_EXCEPTION2( E57_ERROR_INTERNAL, "packetType=" + toString( header.packetType ) );
    }
 
-   entry.logicalOffset_ = packetLogicalOffset;
+   return packetLength;
+}
+
+/// Read a whole packet from the file into buffer, return its length.  The packet is not verified.
+unsigned PacketReadCache::loadPacket( char *buffer, uint64_t packetLogicalOffset )
+{
+   /// We don't know the length of the packet before reading its header, so read as much as the longest packet can
+   /// take (or up to the end of the file) in one go.  Most data packets are close to that long anyway.  Always ask
+   /// for at least the header, so the read reports a packet starting past the end of the file.  Only the pages of
+   /// the packet are verified: what follows it may be unrelated data, whose errors aren't ours to report.
+   const uint64_t fileLength = cFile_->length( CheckedFile::Logical );
+   const uint64_t available = ( fileLength > packetLogicalOffset ) ? fileLength - packetLogicalOffset : 0;
+
+   const auto windowLength = static_cast<unsigned>(
+      std::max<uint64_t>( std::min<uint64_t>( DATA_PACKET_MAX, available ), sizeof( EmptyPacketHeader ) ) );
+
+   /// Can't verify packet header here, because it is not really an
+   /// EmptyPacketHeader.  Use it since it has the commom fields to all packets.
+   auto lengthOfPacket = []( const char *header ) {
+      const auto &packetHeader = *reinterpret_cast<const EmptyPacketHeader *>( header );
 
-   /// Mark entry with current useCount (keeps track of age of entry).
-   /// This is a cache, so a small hiccup when useCount_ overflows won't hurt.
-   entry.lastUsed_ = ++useCount_;
+      return static_cast<size_t>( packetHeader.packetLogicalLengthMinus1 ) + 1;
+   };
+
+   const auto packetLength = static_cast<unsigned>(
+      cFile_->readAt( packetLogicalOffset, buffer, windowLength, sizeof( EmptyPacketHeader ), lengthOfPacket ) );
+
+   /// Be paranoid about packetLength
+   if ( packetLength > DATA_PACKET_MAX )
+   {
+      throw E57_EXCEPTION2( E57_ERROR_BAD_CV_PACKET, "packetLength=" + toString( packetLength ) );
+   }
+
+   /// Window cut short by the end of the file: reading the rest fails, and reports where
+   if ( packetLength > windowLength )
+   {
+      cFile_->readAt( packetLogicalOffset + windowLength, buffer + windowLength, packetLength - windowLength );
+   }
+
+   /// Let the file know which packets are likely to come next.  Only renew the hint when we get past half of the
+   /// previous range, or jump outside of it.
+   const uint64_t packetEnd = packetLogicalOffset + packetLength;
+
+   std::lock_guard<std::mutex> lock( readAheadMutex_ );
+
+   if ( ( packetLogicalOffset < readAheadStart_ ) || ( packetEnd + ReadAheadSize / 2 > readAheadEnd_ ) )
+   {
+      cFile_->advise( packetEnd, ReadAheadSize, CheckedFile::WillNeed );
+
+      readAheadStart_ = packetLogicalOffset;
+      readAheadEnd_ = packetEnd + ReadAheadSize;
+   }
+
+   return packetLength;
 }
 
 #ifdef E57_DEBUG
 void PacketReadCache::dump( int indent, std::ostream &os )
 {
-   os << space( indent ) << "lockCount: " << lockCount_ << std::endl;
-   os << space( indent ) << "useCount:  " << useCount_ << std::endl;
+   std::lock_guard<std::mutex> lock( mutex_ );
+
+   os << space( indent ) << "capacity: " << capacity_ << std::endl;
    os << space( indent ) << "entries:" << std::endl;
-   for ( unsigned i = 0; i < entries_.size(); i++ )
+
+   unsigned i = 0;
+
+   for ( auto &entry : entries_ )
    {
-      os << space( indent ) << "entry[" << i << "]:" << std::endl;
-      os << space( indent + 4 ) << "logicalOffset:  " << entries_[i].logicalOffset_ << std::endl;
-      os << space( indent + 4 ) << "lastUsed:        " << entries_[i].lastUsed_ << std::endl;
-      if ( entries_[i].logicalOffset_ != 0 )
+      os << space( indent ) << "entry[" << i++ << "]:" << std::endl;
+      os << space( indent + 4 ) << "logicalOffset:  " << entry.logicalOffset_ << std::endl;
+      os << space( indent + 4 ) << "lockCount:      " << entry.lockCount_ << std::endl;
+      if ( entry.loaded_ )
       {
+         const auto packetType = reinterpret_cast<EmptyPacketHeader *>( entry.buffer_.data() )->packetType;
+
          os << space( indent + 4 ) << "packet:" << std::endl;
-         switch ( reinterpret_cast<EmptyPacketHeader *>( entries_.at( i ).buffer_ )->packetType )
+         switch ( packetType )
          {
             case DATA_PACKET:
             {
-               auto dpkt = reinterpret_cast<DataPacket *>( entries_.at( i ).buffer_ );
+               auto dpkt = reinterpret_cast<DataPacket *>( entry.buffer_.data() );
                dpkt->dump( indent + 6, os );
             }
             break;
             case INDEX_PACKET:
             {
-               auto ipkt = reinterpret_cast<IndexPacket *>( entries_.at( i ).buffer_ );
+               auto ipkt = reinterpret_cast<IndexPacket *>( entry.buffer_.data() );
                ipkt->dump( indent + 6, os );
             }
             break;
             case EMPTY_PACKET:
             {
-               auto hp = reinterpret_cast<EmptyPacketHeader *>( entries_.at( i ).buffer_ );
+               auto hp = reinterpret_cast<EmptyPacketHeader *>( entry.buffer_.data() );
                hp->dump( indent + 6, os );
             }
             break;
             default:
-               throw E57_EXCEPTION2(
-                  E57_ERROR_INTERNAL,
-                  "packetType=" +
-                     toString( reinterpret_cast<EmptyPacketHeader *>( entries_.at( i ).buffer_ )->packetType ) );
+               throw E57_EXCEPTION2( E57_ERROR_INTERNAL, "packetType=" + toString( packetType ) );
          }
       }
    }
 }
 #endif
 
+//=============================================================================
+// PacketPrefetcher
+
+PacketPrefetcher::PacketPrefetcher( PacketReadCache *cache, unsigned prefetchDepth ) :
+   cache_( cache ), prefetchDepth_( prefetchDepth )
+{
+   if ( prefetchDepth_ > 0 )
+   {
+      thread_ = std::thread( &PacketPrefetcher::run, this );
+   }
+}
+
+PacketPrefetcher::~PacketPrefetcher()
+{
+   if ( thread_.joinable() )
+   {
+      {
+         std::lock_guard<std::mutex> lock( mutex_ );
+         exit_ = true;
+      }
+
+      changed_.notify_all();
+      thread_.join();
+   }
+}
+
+void PacketPrefetcher::prefetch( uint64_t packetLogicalOffset, uint64_t endLogicalOffset )
+{
+   if ( prefetchDepth_ == 0 )
+   {
+      return;
+   }
+
+   {
+      std::lock_guard<std::mutex> lock( mutex_ );
+
+      /// Reader went past these
+      while ( !loaded_.empty() && ( loaded_.front() < packetLogicalOffset ) )
+      {
+         loaded_.pop_front();
+      }
+
+      /// Reader jumped somewhere else, start a new chain from there
+      if ( ( next_ != packetLogicalOffset ) && ( loaded_.empty() || ( loaded_.front() != packetLogicalOffset ) ) )
+      {
+         loaded_.clear();
+         next_ = packetLogicalOffset;
+      }
+
+      end_ = endLogicalOffset;
+   }
+
+   changed_.notify_all();
+}
+
+void PacketPrefetcher::stop()
+{
+   if ( prefetchDepth_ == 0 )
+   {
+      return;
+   }
+
+   std::unique_lock<std::mutex> lock( mutex_ );
+
+   end_ = 0;
+
+   changed_.wait( lock, [this] { return !loading_; } );
+}
+
+/// Body of the prefetch thread: keep the packets following the one being read in the cache
+void PacketPrefetcher::run()
+{
+   std::unique_lock<std::mutex> lock( mutex_ );
+
+   while ( true )
+   {
+      changed_.wait( lock, [this] { return exit_ || ( ( next_ < end_ ) && ( loaded_.size() < prefetchDepth_ ) ); } );
+
+      if ( exit_ )
+      {
+         return;
+      }
+
+      const uint64_t packetLogicalOffset = next_;
+
+      loading_ = true;
+
+      lock.unlock();
+
+      const unsigned packetLength = cache_->preload( packetLogicalOffset );
+
+      lock.lock();
+
+      loading_ = false;
+
+      if ( next_ == packetLogicalOffset )
+      {
+         if ( packetLength > 0 )
+         {
+            loaded_.push_back( packetLogicalOffset );
+
+            next_ = packetLogicalOffset + packetLength;
+         }
+         else
+         {
+            /// Leave it to the reader to run into the error and report it
+            end_ = 0;
+         }
+      }
+
+      changed_.notify_all();
+   }
+}
+
 //=============================================================================
 // PacketLock
 
-PacketLock::PacketLock( PacketReadCache *cache, unsigned cacheIndex ) : cache_( cache ), cacheIndex_( cacheIndex )
+PacketLock::PacketLock( PacketReadCache *cache, PacketReadCache::CacheEntry *entry ) : cache_( cache ), entry_( entry )
 {
 #ifdef E57_MAX_VERBOSE
    std::cout << "PacketLock() called" << std::endl;
@@ -316,7 +533,7 @@ PacketLock::~PacketLock()
    try
    {
       /// Note cache must live longer than lock, this is reasonable assumption.
-      cache_->unlock( cacheIndex_ );
+      cache_->unlock( entry_ );
    }
    catch ( ... )
    {
@@ -553,7 +770,7 @@ void IndexPacket::verify( unsigned bufferLength, uint64_t totalRecordCount, uint
 
    /// Check packetLength is at least large enough to hold header
    unsigned packetLength = packetLogicalLengthMinus1 + 1;
-   if ( packetLength < sizeof( *this ) )
+   if ( packetLength < HeaderSize )
    {
       throw E57_EXCEPTION2( E57_ERROR_BAD_CV_PACKET, "packetLength=" + toString( packetLength ) );
    }
@@ -609,7 +826,7 @@ void IndexPacket::verify( unsigned bufferLength, uint64_t totalRecordCount, uint
    }
 
    /// Check if entries will fit in space provided
-   unsigned neededLength = 16 + 8 * entryCount;
+   unsigned neededLength = HeaderSize + sizeof( IndexPacketEntry ) * entryCount;
    if ( packetLength < neededLength )
    {
       throw E57_EXCEPTION2( E57_ERROR_BAD_CV_PACKET,
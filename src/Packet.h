@@ -27,7 +27,13 @@
 
 #pragma once
 
+#include <condition_variable>
 #include <cstdint>
+#include <deque>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
 #include "Common.h"
@@ -48,37 +54,103 @@ namespace e57
    /// maximum size of CompressedVector binary data packet
    constexpr int DATA_PACKET_MAX = ( 64 * 1024 );
 
+   /// Data packets of one ImageFile that were read and verified, shared by all its readers.  Packets are found by
+   /// their logical offset and the least recently used ones are dropped once the cache holds more than its byte
+   /// budget.  All functions can be called from any thread.
    class PacketReadCache
    {
    public:
-      PacketReadCache( CheckedFile *cFile, unsigned packetCount );
+      PacketReadCache( CheckedFile *cFile, uint64_t byteBudget );
+      ~PacketReadCache() = default;
 
       std::unique_ptr<PacketLock> lock( uint64_t packetLogicalOffset,
                                         char *&pkt ); //??? pkt could be const
 
+      /// Load the packet at packetLogicalOffset if it isn't cached yet, without locking it.  Returns its length, or 0
+      /// if it can't be read.
+      unsigned preload( uint64_t packetLogicalOffset );
+
 #ifdef E57_DEBUG
       void dump( int indent = 0, std::ostream &os = std::cout );
 #endif
 
    protected:
-      /// Only PacketLock can unlock the cache
-      friend class PacketLock;
-      void unlock( unsigned cacheIndex );
-
-      void readPacket( unsigned oldestEntry, uint64_t packetLogicalOffset );
-
       struct CacheEntry
       {
+         explicit CacheEntry( uint64_t logicalOffset ) : logicalOffset_( logicalOffset )
+         {
+         }
+
          uint64_t logicalOffset_ = 0;
-         char buffer_[DATA_PACKET_MAX]; //! No need to init since it's a data buffer
-         unsigned lastUsed_ = 0;
+         unsigned length_ = 0;
+         unsigned lockCount_ = 0; ///< can't be dropped while locked
+         bool loaded_ = false;    ///< false while a thread reads and verifies it
+         std::vector<char> buffer_ = std::vector<char>( DATA_PACKET_MAX ); //! No need to init since it's a data buffer
       };
 
-      unsigned lockCount_ = 0;
-      unsigned useCount_ = 0;
+      using EntryList = std::list<CacheEntry>;
+
+      /// Only PacketLock can unlock the cache
+      friend class PacketLock;
+      void unlock( CacheEntry *entry );
+
+      CacheEntry &acquire( uint64_t packetLogicalOffset );
+      EntryList::iterator insertEntry( uint64_t packetLogicalOffset );
+      void trim();
+
+      unsigned readPacket( char *buffer, uint64_t packetLogicalOffset );
+      unsigned loadPacket( char *buffer, uint64_t packetLogicalOffset );
+
+      /// How far past the packet just read we ask the OS to read ahead
+      static constexpr uint64_t ReadAheadSize = 8 * DATA_PACKET_MAX;
+
       CheckedFile *cFile_ = nullptr;
 
-      std::vector<CacheEntry> entries_;
+      /// Number of unlocked packets kept, from the byte budget
+      size_t capacity_ = 0;
+
+      std::mutex mutex_;                 ///< guards everything below except the file
+      std::condition_variable loadDone_; ///< signaled when a packet has been loaded (or failed to)
+
+      EntryList entries_; ///< most recently used first
+      std::unordered_map<uint64_t, EntryList::iterator> index_;
+
+      /// Logical range of the file we last asked the OS to load ahead of us (guarded by readAheadMutex_).  Packets
+      /// themselves are read with positioned reads, so several can be loaded at once.
+      std::mutex readAheadMutex_;
+      uint64_t readAheadStart_ = 0;
+      uint64_t readAheadEnd_ = 0;
+   };
+
+   /// Loads the packets following the one a reader is decoding into the cache on a background thread
+   class PacketPrefetcher
+   {
+   public:
+      PacketPrefetcher( PacketReadCache *cache, unsigned prefetchDepth );
+      ~PacketPrefetcher();
+
+      /// Start loading the packets from packetLogicalOffset up to endLogicalOffset, at most prefetchDepth of them ahead
+      /// of the last packet passed here.
+      void prefetch( uint64_t packetLogicalOffset, uint64_t endLogicalOffset );
+
+      /// Stop prefetching and wait until the prefetch thread no longer uses the file.  Must be called before anybody
+      /// reads the file without going through the cache.
+      void stop();
+
+   private:
+      void run();
+
+      PacketReadCache *cache_ = nullptr;
+      unsigned prefetchDepth_ = 0;
+
+      std::mutex mutex_;
+      std::condition_variable changed_;
+      std::deque<uint64_t> loaded_; ///< packets loaded ahead of the reader, in file order
+      uint64_t next_ = 0;           ///< next packet for the prefetch thread to load
+      uint64_t end_ = 0;            ///< prefetch thread is stopped when next_ >= end_
+      bool loading_ = false;
+      bool exit_ = false;
+      std::thread thread_;
    };
 
    class PacketLock
@@ -94,10 +166,10 @@ namespace e57
    protected:
       friend class PacketReadCache;
       /// Only PacketReadCache can construct
-      PacketLock( PacketReadCache *cache, unsigned cacheIndex );
+      PacketLock( PacketReadCache *cache, PacketReadCache::CacheEntry *entry );
 
       PacketReadCache *cache_ = nullptr;
-      unsigned int cacheIndex_ = 0;
+      PacketReadCache::CacheEntry *entry_ = nullptr;
    };
 
    class DataPacketHeader
@@ -138,4 +210,32 @@ namespace e57
 
       uint8_t payload[PayloadSize]; //! No need to init since it's a data buffer
    };
+
+   struct IndexPacket
+   {
+      static constexpr unsigned MAX_ENTRIES = 2048;
+
+      /// Size of the fixed part of the packet, before the entries
+      static constexpr unsigned HeaderSize = 16;
+
+      const uint8_t packetType = INDEX_PACKET;
+
+      uint8_t packetFlags = 0; // flag bitfields
+      uint16_t packetLogicalLengthMinus1 = 0;
+      uint16_t entryCount = 0;
+      uint8_t indexLevel = 0;
+      uint8_t reserved1[9] = {}; // must be zero
+
+      struct IndexPacketEntry
+      {
+         uint64_t chunkRecordNumber = 0;
+         uint64_t chunkPhysicalOffset = 0;
+      } entries[MAX_ENTRIES];
+
+      void verify( unsigned bufferLength = 0, uint64_t totalRecordCount = 0, uint64_t fileSize = 0 ) const;
+
+#ifdef E57_DEBUG
+      void dump( int indent = 0, std::ostream &os = std::cout ) const;
+#endif
+   };
 }
@@ -0,0 +1,14 @@
+// SPDX-License-Identifier: MIT
+
+#include "ImageFileImpl.h"
+#include "ParsedPathNameImpl.h"
+
+using namespace e57;
+
+ParsedPathNameImpl::ParsedPathNameImpl( ImageFileImplSharedPtr imf, const ustring &pathName ) :
+   pathName_( pathName ), isRelative_( true )
+{
+   imf->checkImageFileOpen( __FILE__, __LINE__, static_cast<const char *>( __FUNCTION__ ) );
+
+   imf->pathNameParse( pathName, isRelative_, fields_ ); // throws if bad pathName
+}
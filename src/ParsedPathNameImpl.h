@@ -0,0 +1,18 @@
+#pragma once
+// SPDX-License-Identifier: MIT
+
+#include "Common.h"
+
+namespace e57
+{
+   /// Path name split into element names once, see ParsedPathName
+   class ParsedPathNameImpl
+   {
+   public:
+      ParsedPathNameImpl( ImageFileImplSharedPtr imf, const ustring &pathName );
+
+      ustring pathName_; ///< as given, for error messages
+      bool isRelative_;
+      StringList fields_;
+   };
+}
@@ -0,0 +1,322 @@
+// SPDX-License-Identifier: MIT
+
+#include <cfloat>
+#include <cmath>
+
+#include "CpuFeatures.h"
+#include "ScaleOffset.h"
+
+#if defined( __x86_64__ ) || defined( _M_X64 )
+#define E57_SCALEOFFSET_X86
+#include <immintrin.h>
+#if defined( _MSC_VER )
+#define E57_TARGET_SSE41
+#define E57_TARGET_AVX2
+#else
+#define E57_TARGET_SSE41 __attribute__( ( target( "sse4.1" ) ) )
+#define E57_TARGET_AVX2 __attribute__( ( target( "avx2" ) ) )
+#endif
+#endif
+
+using namespace e57;
+
+namespace
+{
+   /// The SIMD kernels convert raw values with the int32 conversion instructions: ( raw ^ 0x80000000 ) is a signed
+   /// int32, and adding it to minimum + 2^31 gives back minimum + raw.  Both conversions and the sum are exact as long
+   /// as the result fits in the 53 bits of a double's mantissa, which is always the case when minimum does.
+   constexpr int64_t MaxExactMinimum = int64_t( 1 ) << 52;
+
+   /// Kernels get bias = minimum + 2^31 for the SIMD conversion, scalar ones use minimum
+   using ScaleDoubleFunction = void ( * )( const uint32_t *raw, int64_t minimum, double bias, double scale,
+                                           double offset, size_t count, double *out );
+   using ScaleFloatFunction = bool ( * )( const uint32_t *raw, int64_t minimum, double bias, double scale,
+                                          double offset, size_t count, float *out );
+   using UnscaleDoubleFunction = void ( * )( const double *in, double scale, double offset, size_t count,
+                                             double *out );
+   using UnscaleFloatFunction = void ( * )( const float *in, double scale, double offset, size_t count,
+                                            double *out );
+
+   inline double scaleValue( uint32_t raw, int64_t minimum, double scale, double offset )
+   {
+      return static_cast<double>( minimum + static_cast<int64_t>( raw ) ) * scale + offset;
+   }
+
+   void scaleDoubleScalar( const uint32_t *raw, int64_t minimum, double /*bias*/, double scale, double offset,
+                           size_t count, double *out )
+   {
+      for ( size_t i = 0; i < count; ++i )
+      {
+         out[i] = scaleValue( raw[i], minimum, scale, offset );
+      }
+   }
+
+   bool scaleFloatScalar( const uint32_t *raw, int64_t minimum, double /*bias*/, double scale, double offset,
+                          size_t count, float *out )
+   {
+      bool inRange = true;
+
+      for ( size_t i = 0; i < count; ++i )
+      {
+         const double value = scaleValue( raw[i], minimum, scale, offset );
+
+         inRange = inRange && !( value < -DBL_MAX || DBL_MAX < value );
+
+         out[i] = static_cast<float>( value );
+      }
+
+      return inRange;
+   }
+
+   template <typename T> void unscaleScalar( const T *in, double scale, double offset, size_t count, double *out )
+   {
+      for ( size_t i = 0; i < count; ++i )
+      {
+         out[i] = std::floor( ( in[i] - offset ) / scale + 0.5 );
+      }
+   }
+
+#ifdef E57_SCALEOFFSET_X86
+   E57_TARGET_SSE41 inline __m128d scaleSse41( const uint32_t *raw, __m128i flip, __m128d bias, __m128d scale,
+                                               __m128d offset )
+   {
+      const __m128i values = _mm_loadl_epi64( reinterpret_cast<const __m128i *>( raw ) );
+      const __m128d exact = _mm_add_pd( _mm_cvtepi32_pd( _mm_xor_si128( values, flip ) ), bias );
+
+      return _mm_add_pd( _mm_mul_pd( exact, scale ), offset );
+   }
+
+   E57_TARGET_SSE41 void scaleDoubleSse41( const uint32_t *raw, int64_t minimum, double bias, double scale,
+                                           double offset, size_t count, double *out )
+   {
+      const __m128i flipVector = _mm_set1_epi32( static_cast<int>( 0x80000000u ) );
+      const __m128d biasVector = _mm_set1_pd( bias );
+      const __m128d scaleVector = _mm_set1_pd( scale );
+      const __m128d offsetVector = _mm_set1_pd( offset );
+
+      size_t i = 0;
+
+      for ( ; i + 2 <= count; i += 2 )
+      {
+         _mm_storeu_pd( out + i, scaleSse41( raw + i, flipVector, biasVector, scaleVector, offsetVector ) );
+      }
+
+      scaleDoubleScalar( raw + i, minimum, bias, scale, offset, count - i, out + i );
+   }
+
+   E57_TARGET_SSE41 bool scaleFloatSse41( const uint32_t *raw, int64_t minimum, double bias, double scale,
+                                          double offset, size_t count, float *out )
+   {
+      const __m128i flipVector = _mm_set1_epi32( static_cast<int>( 0x80000000u ) );
+      const __m128d biasVector = _mm_set1_pd( bias );
+      const __m128d scaleVector = _mm_set1_pd( scale );
+      const __m128d offsetVector = _mm_set1_pd( offset );
+      const __m128d maxVector = _mm_set1_pd( DBL_MAX );
+      const __m128d absMask = _mm_castsi128_pd( _mm_set1_epi64x( 0x7FFFFFFFFFFFFFFFLL ) );
+
+      __m128d outOfRange = _mm_setzero_pd();
+
+      size_t i = 0;
+
+      for ( ; i + 4 <= count; i += 4 )
+      {
+         const __m128d low = scaleSse41( raw + i, flipVector, biasVector, scaleVector, offsetVector );
+         const __m128d high = scaleSse41( raw + i + 2, flipVector, biasVector, scaleVector, offsetVector );
+
+         /// |value| > DBL_MAX is false for NaN, just like the range check of setNextInt64()
+         outOfRange = _mm_or_pd( outOfRange, _mm_cmpgt_pd( _mm_and_pd( low, absMask ), maxVector ) );
+         outOfRange = _mm_or_pd( outOfRange, _mm_cmpgt_pd( _mm_and_pd( high, absMask ), maxVector ) );
+
+         _mm_storeu_ps( out + i, _mm_movelh_ps( _mm_cvtpd_ps( low ), _mm_cvtpd_ps( high ) ) );
+      }
+
+      const bool tailInRange = scaleFloatScalar( raw + i, minimum, bias, scale, offset, count - i, out + i );
+
+      return tailInRange && ( _mm_movemask_pd( outOfRange ) == 0 );
+   }
+
+   template <typename T>
+   E57_TARGET_SSE41 void unscaleSse41( const T *in, double scale, double offset, size_t count, double *out )
+   {
+      const __m128d scaleVector = _mm_set1_pd( scale );
+      const __m128d offsetVector = _mm_set1_pd( offset );
+      const __m128d half = _mm_set1_pd( 0.5 );
+
+      size_t i = 0;
+
+      for ( ; i + 2 <= count; i += 2 )
+      {
+         __m128d values;
+
+         if ( sizeof( T ) == sizeof( float ) )
+         {
+            values = _mm_cvtps_pd( _mm_castsi128_ps( _mm_loadl_epi64( reinterpret_cast<const __m128i *>( in + i ) ) ) );
+         }
+         else
+         {
+            values = _mm_loadu_pd( reinterpret_cast<const double *>( in + i ) );
+         }
+
+         values = _mm_div_pd( _mm_sub_pd( values, offsetVector ), scaleVector );
+
+         _mm_storeu_pd( out + i, _mm_floor_pd( _mm_add_pd( values, half ) ) );
+      }
+
+      unscaleScalar( in + i, scale, offset, count - i, out + i );
+   }
+
+   E57_TARGET_AVX2 inline __m256d scaleAvx2( const uint32_t *raw, __m128i flip, __m256d bias, __m256d scale,
+                                             __m256d offset )
+   {
+      const __m128i values = _mm_loadu_si128( reinterpret_cast<const __m128i *>( raw ) );
+      const __m256d exact = _mm256_add_pd( _mm256_cvtepi32_pd( _mm_xor_si128( values, flip ) ), bias );
+
+      return _mm256_add_pd( _mm256_mul_pd( exact, scale ), offset );
+   }
+
+   E57_TARGET_AVX2 void scaleDoubleAvx2( const uint32_t *raw, int64_t minimum, double bias, double scale,
+                                         double offset, size_t count, double *out )
+   {
+      const __m128i flipVector = _mm_set1_epi32( static_cast<int>( 0x80000000u ) );
+      const __m256d biasVector = _mm256_set1_pd( bias );
+      const __m256d scaleVector = _mm256_set1_pd( scale );
+      const __m256d offsetVector = _mm256_set1_pd( offset );
+
+      size_t i = 0;
+
+      for ( ; i + 4 <= count; i += 4 )
+      {
+         _mm256_storeu_pd( out + i, scaleAvx2( raw + i, flipVector, biasVector, scaleVector, offsetVector ) );
+      }
+
+      scaleDoubleScalar( raw + i, minimum, bias, scale, offset, count - i, out + i );
+   }
+
+   E57_TARGET_AVX2 bool scaleFloatAvx2( const uint32_t *raw, int64_t minimum, double bias, double scale,
+                                        double offset, size_t count, float *out )
+   {
+      const __m128i flipVector = _mm_set1_epi32( static_cast<int>( 0x80000000u ) );
+      const __m256d biasVector = _mm256_set1_pd( bias );
+      const __m256d scaleVector = _mm256_set1_pd( scale );
+      const __m256d offsetVector = _mm256_set1_pd( offset );
+      const __m256d maxVector = _mm256_set1_pd( DBL_MAX );
+      const __m256d absMask = _mm256_castsi256_pd( _mm256_set1_epi64x( 0x7FFFFFFFFFFFFFFFLL ) );
+
+      __m256d outOfRange = _mm256_setzero_pd();
+
+      size_t i = 0;
+
+      for ( ; i + 4 <= count; i += 4 )
+      {
+         const __m256d values = scaleAvx2( raw + i, flipVector, biasVector, scaleVector, offsetVector );
+
+         /// |value| > DBL_MAX is false for NaN, just like the range check of setNextInt64()
+         outOfRange = _mm256_or_pd( outOfRange, _mm256_cmp_pd( _mm256_and_pd( values, absMask ), maxVector,
+                                                               _CMP_GT_OQ ) );
+
+         _mm_storeu_ps( out + i, _mm256_cvtpd_ps( values ) );
+      }
+
+      const bool tailInRange = scaleFloatScalar( raw + i, minimum, bias, scale, offset, count - i, out + i );
+
+      return tailInRange && ( _mm256_movemask_pd( outOfRange ) == 0 );
+   }
+
+   template <typename T>
+   E57_TARGET_AVX2 void unscaleAvx2( const T *in, double scale, double offset, size_t count, double *out )
+   {
+      const __m256d scaleVector = _mm256_set1_pd( scale );
+      const __m256d offsetVector = _mm256_set1_pd( offset );
+      const __m256d half = _mm256_set1_pd( 0.5 );
+
+      size_t i = 0;
+
+      for ( ; i + 4 <= count; i += 4 )
+      {
+         __m256d values;
+
+         if ( sizeof( T ) == sizeof( float ) )
+         {
+            values = _mm256_cvtps_pd( _mm_loadu_ps( reinterpret_cast<const float *>( in + i ) ) );
+         }
+         else
+         {
+            values = _mm256_loadu_pd( reinterpret_cast<const double *>( in + i ) );
+         }
+
+         values = _mm256_div_pd( _mm256_sub_pd( values, offsetVector ), scaleVector );
+
+         _mm256_storeu_pd( out + i, _mm256_floor_pd( _mm256_add_pd( values, half ) ) );
+      }
+
+      unscaleScalar( in + i, scale, offset, count - i, out + i );
+   }
+#endif
+
+   struct Kernels
+   {
+      ScaleDoubleFunction scaleDouble;
+      ScaleFloatFunction scaleFloat;
+      UnscaleDoubleFunction unscaleDouble;
+      UnscaleFloatFunction unscaleFloat;
+   };
+
+   /// Pick the fastest kernels this CPU supports
+   Kernels selectKernels()
+   {
+#ifdef E57_SCALEOFFSET_X86
+      if ( cpuFeatures().avx2 )
+      {
+         return { scaleDoubleAvx2, scaleFloatAvx2, unscaleAvx2<double>, unscaleAvx2<float> };
+      }
+
+      if ( cpuFeatures().sse41 )
+      {
+         return { scaleDoubleSse41, scaleFloatSse41, unscaleSse41<double>, unscaleSse41<float> };
+      }
+#endif
+      return { scaleDoubleScalar, scaleFloatScalar, unscaleScalar<double>, unscaleScalar<float> };
+   }
+
+   const Kernels &kernels()
+   {
+      static const Kernels sKernels = selectKernels();
+
+      return sKernels;
+   }
+}
+
+void e57::scaleValues( const uint32_t *raw, int64_t minimum, double scale, double offset, size_t count, double *out )
+{
+   if ( minimum < -MaxExactMinimum || MaxExactMinimum < minimum )
+   {
+      scaleDoubleScalar( raw, minimum, 0.0, scale, offset, count, out );
+      return;
+   }
+
+   const double bias = static_cast<double>( minimum + 0x80000000LL );
+
+   kernels().scaleDouble( raw, minimum, bias, scale, offset, count, out );
+}
+
+bool e57::scaleValues( const uint32_t *raw, int64_t minimum, double scale, double offset, size_t count, float *out )
+{
+   if ( minimum < -MaxExactMinimum || MaxExactMinimum < minimum )
+   {
+      return scaleFloatScalar( raw, minimum, 0.0, scale, offset, count, out );
+   }
+
+   const double bias = static_cast<double>( minimum + 0x80000000LL );
+
+   return kernels().scaleFloat( raw, minimum, bias, scale, offset, count, out );
+}
+
+void e57::unscaleValues( const double *in, double scale, double offset, size_t count, double *out )
+{
+   kernels().unscaleDouble( in, scale, offset, count, out );
+}
+
+void e57::unscaleValues( const float *in, double scale, double offset, size_t count, double *out )
+{
+   kernels().unscaleFloat( in, scale, offset, count, out );
+}
@@ -0,0 +1,21 @@
+#pragma once
+// SPDX-License-Identifier: MIT
+
+#include <cstddef>
+#include <cstdint>
+
+namespace e57
+{
+   /// Scaled values of a block of records read from a ScaledIntegerNode: out[i] = ( minimum + raw[i] ) * scale +
+   /// offset, with the same result as converting each value on its own.
+   void scaleValues( const uint32_t *raw, int64_t minimum, double scale, double offset, size_t count, double *out );
+
+   /// Same as above, stored as floats.  Returns false if some scaled value is out of the range of a double (infinite),
+   /// in which case the contents of out are undefined.
+   bool scaleValues( const uint32_t *raw, int64_t minimum, double scale, double offset, size_t count, float *out );
+
+   /// Raw values of a block of records written to a ScaledIntegerNode, rounded to the nearest integer but kept as
+   /// doubles so the caller can check they are in range: out[i] = floor( ( in[i] - offset ) / scale + 0.5 ).
+   void unscaleValues( const double *in, double scale, double offset, size_t count, double *out );
+   void unscaleValues( const float *in, double scale, double offset, size_t count, double *out );
+}
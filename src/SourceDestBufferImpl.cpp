@@ -25,13 +25,158 @@
  * DEALINGS IN THE SOFTWARE.
  */
 
+#include <algorithm>
+#include <cfloat>
 #include <cmath>
+#include <cstring>
+#include <limits>
 
 #include "ImageFileImpl.h"
+#include "ScaleOffset.h"
 #include "SourceDestBufferImpl.h"
 
 using namespace e57;
 
+namespace
+{
+   /// Number of values getNextInt64Block() unscales at a time
+   constexpr size_t UnscaleBlockSize = 256;
+
+   /// Read count elements of type T, stride bytes apart, into values
+   template <typename T, typename ValueT>
+   void loadElements( const char *p, size_t stride, size_t count, ValueT *values )
+   {
+      if ( stride == sizeof( T ) )
+      {
+         if ( std::is_same<T, ValueT>::value )
+         {
+            memcpy( values, p, count * sizeof( T ) );
+            return;
+         }
+
+         auto elements = reinterpret_cast<const T *>( p );
+
+         for ( size_t i = 0; i < count; ++i )
+         {
+            values[i] = static_cast<ValueT>( elements[i] );
+         }
+         return;
+      }
+
+      for ( size_t i = 0; i < count; ++i )
+      {
+         values[i] = static_cast<ValueT>( *reinterpret_cast<const T *>( p + i * stride ) );
+      }
+   }
+
+   /// Write count values as elements of type T, stride bytes apart
+   template <typename T, typename ValueT>
+   void storeElements( char *p, size_t stride, size_t count, const ValueT *values )
+   {
+      if ( stride == sizeof( T ) )
+      {
+         if ( std::is_same<T, ValueT>::value )
+         {
+            memcpy( p, values, count * sizeof( T ) );
+            return;
+         }
+
+         auto elements = reinterpret_cast<T *>( p );
+
+         for ( size_t i = 0; i < count; ++i )
+         {
+            elements[i] = static_cast<T>( values[i] );
+         }
+         return;
+      }
+
+      for ( size_t i = 0; i < count; ++i )
+      {
+         *reinterpret_cast<T *>( p + i * stride ) = static_cast<T>( values[i] );
+      }
+   }
+
+   /// Check that all integers from lowest to highest can be stored in a T
+   template <typename T> bool fitsIn( int64_t lowest, int64_t highest )
+   {
+      return ( static_cast<int64_t>( std::numeric_limits<T>::min() ) <= lowest ) &&
+             ( highest <= static_cast<int64_t>( std::numeric_limits<T>::max() ) );
+   }
+
+   template <> bool fitsIn<float>( int64_t, int64_t )
+   {
+      return true;
+   }
+
+   template <> bool fitsIn<double>( int64_t, int64_t )
+   {
+      return true;
+   }
+
+   /// Write minimum + values[i] as elements of type T, stride bytes apart.  Returns false without writing anything if
+   /// some value doesn't fit in a T: lowest and highest are the smallest and largest of the values.
+   template <typename T>
+   bool storeOffsetElements( char *p, size_t stride, size_t count, const uint32_t *values, int64_t minimum,
+                             int64_t lowest, int64_t highest )
+   {
+      if ( !fitsIn<T>( lowest, highest ) )
+      {
+         return false;
+      }
+
+      if ( stride == sizeof( T ) )
+      {
+         auto elements = reinterpret_cast<T *>( p );
+
+         for ( size_t i = 0; i < count; ++i )
+         {
+            elements[i] = static_cast<T>( minimum + static_cast<int64_t>( values[i] ) );
+         }
+         return true;
+      }
+
+      for ( size_t i = 0; i < count; ++i )
+      {
+         *reinterpret_cast<T *>( p + i * stride ) = static_cast<T>( minimum + static_cast<int64_t>( values[i] ) );
+      }
+      return true;
+   }
+
+   /// Read count elements of an integer memory representation into values.  Returns false if memoryRepresentation
+   /// isn't an integer type.
+   template <typename ValueT>
+   bool loadIntegerElements( MemoryRepresentation memoryRepresentation, const char *p, size_t stride, size_t count,
+                             ValueT *values )
+   {
+      switch ( memoryRepresentation )
+      {
+         case E57_INT8:
+            loadElements<int8_t>( p, stride, count, values );
+            return true;
+         case E57_UINT8:
+            loadElements<uint8_t>( p, stride, count, values );
+            return true;
+         case E57_INT16:
+            loadElements<int16_t>( p, stride, count, values );
+            return true;
+         case E57_UINT16:
+            loadElements<uint16_t>( p, stride, count, values );
+            return true;
+         case E57_INT32:
+            loadElements<int32_t>( p, stride, count, values );
+            return true;
+         case E57_UINT32:
+            loadElements<uint32_t>( p, stride, count, values );
+            return true;
+         case E57_INT64:
+            loadElements<int64_t>( p, stride, count, values );
+            return true;
+         default:
+            return false;
+      }
+   }
+}
+
 SourceDestBufferImpl::SourceDestBufferImpl( ImageFileImplWeakPtr destImageFile, const ustring &pathName,
                                             const size_t capacity, bool doConversion, bool doScaling ) :
    destImageFile_( destImageFile ),
@@ -705,7 +850,7 @@ ustring SourceDestBufferImpl::getNextString()
    }
 
    /// Get ustring from vector
-   return ( ( *ustrings_ )[nextIndex_++] );
+   return ( ( *ustrings_ )[ustringsOffset_ + nextIndex_++] );
 }
 
 void SourceDestBufferImpl::setNextInt64( int64_t value )
@@ -953,10 +1098,368 @@ void SourceDestBufferImpl::setNextString( const ustring &value )
    }
 
    /// Assign to already initialized element in vector
-   ( *ustrings_ )[nextIndex_] = value;
+   ( *ustrings_ )[ustringsOffset_ + nextIndex_] = value;
    nextIndex_++;
 }
 
+void SourceDestBufferImpl::getNextInt64Block( int64_t *values, size_t count )
+{
+   /// don't checkImageFileOpen
+
+   /// Conversions from bool or floating point, and the errors, are left to
+   /// the per-record code
+   if ( count > capacity_ - nextIndex_ ||
+        !loadIntegerElements( memoryRepresentation_, &base_[nextIndex_ * stride_], stride_, count, values ) )
+   {
+      for ( size_t i = 0; i < count; ++i )
+      {
+         values[i] = getNextInt64();
+      }
+      return;
+   }
+
+   nextIndex_ += static_cast<unsigned>( count );
+}
+
+void SourceDestBufferImpl::getNextInt64Block( int64_t *values, size_t count, double scale, double offset )
+{
+   /// don't checkImageFileOpen
+
+   if ( !doScaling_ )
+   {
+      getNextInt64Block( values, count );
+      return;
+   }
+
+   const bool contiguousReal = ( memoryRepresentation_ == E57_REAL32 && stride_ == sizeof( float ) ) ||
+                               ( memoryRepresentation_ == E57_REAL64 && stride_ == sizeof( double ) );
+
+   /// Let the per-record code deal with everything else, including the errors
+   if ( !doConversion_ || !contiguousReal || scale == 0 || count > capacity_ - nextIndex_ )
+   {
+      for ( size_t i = 0; i < count; ++i )
+      {
+         values[i] = getNextInt64( scale, offset );
+      }
+      return;
+   }
+
+   double rawValues[UnscaleBlockSize];
+
+   for ( size_t done = 0; done < count; )
+   {
+      const size_t blockCount = std::min( count - done, UnscaleBlockSize );
+      const char *p = &base_[nextIndex_ * stride_];
+
+      /// Calc (x-offset)/scale rounded to nearest integer, but keep in
+      /// floating point until sure is in bounds
+      if ( memoryRepresentation_ == E57_REAL32 )
+      {
+         unscaleValues( reinterpret_cast<const float *>( p ), scale, offset, blockCount, rawValues );
+      }
+      else
+      {
+         unscaleValues( reinterpret_cast<const double *>( p ), scale, offset, blockCount, rawValues );
+      }
+
+      for ( size_t i = 0; i < blockCount; ++i )
+      {
+         /// Make sure that value is representable in an int64_t
+         if ( rawValues[i] < E57_INT64_MIN || E57_INT64_MAX < rawValues[i] )
+         {
+            nextIndex_ += static_cast<unsigned>( i );
+
+            throw E57_EXCEPTION2( E57_ERROR_SCALED_VALUE_NOT_REPRESENTABLE,
+                                  "pathName=" + pathName_ + " value=" + toString( rawValues[i] ) );
+         }
+
+         values[done + i] = static_cast<int64_t>( rawValues[i] );
+      }
+
+      nextIndex_ += static_cast<unsigned>( blockCount );
+      done += blockCount;
+   }
+}
+
+void SourceDestBufferImpl::getNextFloatBlock( float *values, size_t count )
+{
+   /// don't checkImageFileOpen
+
+   if ( count <= capacity_ - nextIndex_ )
+   {
+      const char *p = &base_[nextIndex_ * stride_];
+
+      if ( memoryRepresentation_ == E57_REAL32 )
+      {
+         loadElements<float>( p, stride_, count, values );
+
+         nextIndex_ += static_cast<unsigned>( count );
+         return;
+      }
+
+      if ( doConversion_ && loadIntegerElements( memoryRepresentation_, p, stride_, count, values ) )
+      {
+         nextIndex_ += static_cast<unsigned>( count );
+         return;
+      }
+   }
+
+   /// Doubles have to be range checked, leave them and the errors to the
+   /// per-record code
+   for ( size_t i = 0; i < count; ++i )
+   {
+      values[i] = getNextFloat();
+   }
+}
+
+void SourceDestBufferImpl::getNextDoubleBlock( double *values, size_t count )
+{
+   /// don't checkImageFileOpen
+
+   if ( count <= capacity_ - nextIndex_ )
+   {
+      const char *p = &base_[nextIndex_ * stride_];
+
+      if ( memoryRepresentation_ == E57_REAL64 )
+      {
+         loadElements<double>( p, stride_, count, values );
+
+         nextIndex_ += static_cast<unsigned>( count );
+         return;
+      }
+
+      if ( memoryRepresentation_ == E57_REAL32 )
+      {
+         loadElements<float>( p, stride_, count, values );
+
+         nextIndex_ += static_cast<unsigned>( count );
+         return;
+      }
+
+      if ( doConversion_ && loadIntegerElements( memoryRepresentation_, p, stride_, count, values ) )
+      {
+         nextIndex_ += static_cast<unsigned>( count );
+         return;
+      }
+   }
+
+   for ( size_t i = 0; i < count; ++i )
+   {
+      values[i] = getNextDouble();
+   }
+}
+
+void SourceDestBufferImpl::setNextInt64Block( const uint32_t *values, int64_t minimum, size_t count )
+{
+   /// don't checkImageFileOpen
+
+   if ( count <= capacity_ - nextIndex_ )
+   {
+      char *p = &base_[nextIndex_ * stride_];
+
+      /// Check the whole block fits in the user's buffer up front
+      uint32_t low = std::numeric_limits<uint32_t>::max();
+      uint32_t high = 0;
+
+      for ( size_t i = 0; i < count; ++i )
+      {
+         low = std::min( low, values[i] );
+         high = std::max( high, values[i] );
+      }
+
+      const int64_t lowest = minimum + static_cast<int64_t>( low );
+      const int64_t highest = minimum + static_cast<int64_t>( high );
+
+      bool stored = false;
+
+      switch ( memoryRepresentation_ )
+      {
+         case E57_INT8:
+            stored = storeOffsetElements<int8_t>( p, stride_, count, values, minimum, lowest, highest );
+            break;
+         case E57_UINT8:
+            stored = storeOffsetElements<uint8_t>( p, stride_, count, values, minimum, lowest, highest );
+            break;
+         case E57_INT16:
+            stored = storeOffsetElements<int16_t>( p, stride_, count, values, minimum, lowest, highest );
+            break;
+         case E57_UINT16:
+            stored = storeOffsetElements<uint16_t>( p, stride_, count, values, minimum, lowest, highest );
+            break;
+         case E57_INT32:
+            stored = storeOffsetElements<int32_t>( p, stride_, count, values, minimum, lowest, highest );
+            break;
+         case E57_UINT32:
+            stored = storeOffsetElements<uint32_t>( p, stride_, count, values, minimum, lowest, highest );
+            break;
+         case E57_INT64:
+            stored = storeOffsetElements<int64_t>( p, stride_, count, values, minimum, lowest, highest );
+            break;
+         case E57_REAL32:
+            stored = doConversion_ &&
+                     storeOffsetElements<float>( p, stride_, count, values, minimum, lowest, highest );
+            break;
+         case E57_REAL64:
+            stored = doConversion_ &&
+                     storeOffsetElements<double>( p, stride_, count, values, minimum, lowest, highest );
+            break;
+         default:
+            break;
+      }
+
+      if ( stored )
+      {
+         nextIndex_ += static_cast<unsigned>( count );
+         return;
+      }
+   }
+
+   /// Bools and the errors are left to the per-record code
+   for ( size_t i = 0; i < count; ++i )
+   {
+      setNextInt64( minimum + static_cast<int64_t>( values[i] ) );
+   }
+}
+
+void SourceDestBufferImpl::setNextInt64Block( const uint32_t *values, int64_t minimum, size_t count, double scale,
+                                              double offset )
+{
+   /// don't checkImageFileOpen
+
+   if ( !doScaling_ )
+   {
+      setNextInt64Block( values, minimum, count );
+      return;
+   }
+
+   if ( doConversion_ && ( count <= capacity_ - nextIndex_ ) )
+   {
+      char *p = &base_[nextIndex_ * stride_];
+
+      if ( memoryRepresentation_ == E57_REAL64 && stride_ == sizeof( double ) )
+      {
+         scaleValues( values, minimum, scale, offset, count, reinterpret_cast<double *>( p ) );
+
+         nextIndex_ += static_cast<unsigned>( count );
+         return;
+      }
+
+      /// If a value doesn't fit, go on to the per-record code, which throws for the right record
+      if ( memoryRepresentation_ == E57_REAL32 && stride_ == sizeof( float ) &&
+           scaleValues( values, minimum, scale, offset, count, reinterpret_cast<float *>( p ) ) )
+      {
+         nextIndex_ += static_cast<unsigned>( count );
+         return;
+      }
+   }
+
+   for ( size_t i = 0; i < count; ++i )
+   {
+      setNextInt64( minimum + static_cast<int64_t>( values[i] ), scale, offset );
+   }
+}
+
+void SourceDestBufferImpl::setNextFloatBlock( const float *values, size_t count )
+{
+   /// don't checkImageFileOpen
+
+   if ( count <= capacity_ - nextIndex_ )
+   {
+      char *p = &base_[nextIndex_ * stride_];
+
+      if ( memoryRepresentation_ == E57_REAL32 )
+      {
+         storeElements<float>( p, stride_, count, values );
+
+         nextIndex_ += static_cast<unsigned>( count );
+         return;
+      }
+
+      if ( memoryRepresentation_ == E57_REAL64 )
+      {
+         storeElements<double>( p, stride_, count, values );
+
+         nextIndex_ += static_cast<unsigned>( count );
+         return;
+      }
+   }
+
+   /// Integers have to be range checked, leave them and the errors to the
+   /// per-record code
+   for ( size_t i = 0; i < count; ++i )
+   {
+      setNextFloat( values[i] );
+   }
+}
+
+void SourceDestBufferImpl::setNextDoubleBlock( const double *values, size_t count )
+{
+   /// don't checkImageFileOpen
+
+   if ( count <= capacity_ - nextIndex_ )
+   {
+      char *p = &base_[nextIndex_ * stride_];
+
+      if ( memoryRepresentation_ == E57_REAL64 )
+      {
+         storeElements<double>( p, stride_, count, values );
+
+         nextIndex_ += static_cast<unsigned>( count );
+         return;
+      }
+
+      if ( memoryRepresentation_ == E57_REAL32 )
+      {
+         /// Only infinities are out of range for a float, see _setNextReal()
+         bool inRange = true;
+
+         for ( size_t i = 0; i < count; ++i )
+         {
+            inRange = inRange && !( values[i] < E57_DOUBLE_MIN || E57_DOUBLE_MAX < values[i] );
+         }
+
+         if ( inRange )
+         {
+            storeElements<float>( p, stride_, count, values );
+
+            nextIndex_ += static_cast<unsigned>( count );
+            return;
+         }
+      }
+   }
+
+   for ( size_t i = 0; i < count; ++i )
+   {
+      setNextDouble( values[i] );
+   }
+}
+
+std::shared_ptr<SourceDestBufferImpl> SourceDestBufferImpl::slice( size_t first, size_t count ) const
+{
+   if ( first + count > capacity_ )
+   {
+      throw E57_EXCEPTION2( E57_ERROR_INTERNAL, "pathName=" + pathName_ + " first=" + toString( first ) +
+                                                   " count=" + toString( count ) +
+                                                   " capacity=" + toString( capacity_ ) );
+   }
+
+   std::shared_ptr<SourceDestBufferImpl> sliced( new SourceDestBufferImpl( *this ) );
+
+   if ( memoryRepresentation_ == E57_USTRING )
+   {
+      sliced->ustringsOffset_ += first;
+   }
+   else
+   {
+      sliced->base_ += first * stride_;
+   }
+
+   sliced->capacity_ = count;
+   sliced->nextIndex_ = 0;
+
+   return sliced;
+}
+
 void SourceDestBufferImpl::checkCompatible( const std::shared_ptr<SourceDestBufferImpl> &newBuf ) const
 {
    if ( pathName_ != newBuf->pathName() )
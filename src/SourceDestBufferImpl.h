@@ -100,8 +100,25 @@ namespace e57
       void setNextDouble( double value );
       void setNextString( const ustring &value );
 
+      /// Block versions of the calls above for the bitpack codecs, with the same conversions and errors.  Each block
+      /// is converted with a loop specialized for the memory representation, or copied with memcpy() if the types
+      /// match and the elements are next to each other.  Scaling float or double buffers is done with the SIMD
+      /// kernels of ScaleOffset.h.  The values passed to setNextInt64Block() are minimum + values[i].
+      void getNextInt64Block( int64_t *values, size_t count );
+      void getNextInt64Block( int64_t *values, size_t count, double scale, double offset );
+      void getNextFloatBlock( float *values, size_t count );
+      void getNextDoubleBlock( double *values, size_t count );
+      void setNextInt64Block( const uint32_t *values, int64_t minimum, size_t count );
+      void setNextInt64Block( const uint32_t *values, int64_t minimum, size_t count, double scale, double offset );
+      void setNextFloatBlock( const float *values, size_t count );
+      void setNextDoubleBlock( const double *values, size_t count );
+
       void checkCompatible( const std::shared_ptr<SourceDestBufferImpl> &newBuf ) const;
 
+      /// A buffer of count elements of this one starting at element first, sharing its memory.  Used to fill separate
+      /// parts of a buffer from several threads.
+      std::shared_ptr<SourceDestBufferImpl> slice( size_t first, size_t count ) const;
+
 #ifdef E57_DEBUG
       void dump( int indent = 0, std::ostream &os = std::cout );
 #endif
@@ -128,5 +145,6 @@ namespace e57
                                                   /// buffer) or read (source buffer) since rewind().
       StringList *ustrings_ = nullptr;            /// Optional array of ustrings (used if
                                                   /// memoryRepresentation_==E57_USTRING) ???ownership
+      size_t ustringsOffset_ = 0;                 /// Index in ustrings_ of the first element, non-zero for slices
    };
 }
@@ -26,9 +26,11 @@
  */
 
 #include <climits>
+#include <mutex>
 
 #include "CheckedFile.h"
 #include "ImageFileImpl.h"
+#include "ParsedPathNameImpl.h"
 #include "StructureNodeImpl.h"
 
 using namespace e57;
@@ -80,11 +82,13 @@ bool StructureNodeImpl::isTypeEquivalent( NodeImplSharedPtr ni )
       {
          /// Children in different order, so lookup by name and check if equal
          /// to our child
-         if ( !si->isDefined( myChildsFieldName ) )
+         NodeImplSharedPtr siChild( si->findChild( myChildsFieldName ) );
+
+         if ( !siChild )
          {
             return ( false );
          }
-         if ( !children_.at( i )->isTypeEquivalent( si->lookup( myChildsFieldName ) ) )
+         if ( !children_.at( i )->isTypeEquivalent( siChild ) )
          {
             return ( false );
          }
@@ -117,12 +121,14 @@ void StructureNodeImpl::setAttachedRecursive()
 int64_t StructureNodeImpl::childCount() const
 {
    checkImageFileOpen( __FILE__, __LINE__, static_cast<const char *>( __FUNCTION__ ) );
+   materialize();
 
    return children_.size();
 }
 NodeImplSharedPtr StructureNodeImpl::get( int64_t index )
 {
    checkImageFileOpen( __FILE__, __LINE__, static_cast<const char *>( __FUNCTION__ ) );
+   materialize();
    if ( index < 0 || index >= static_cast<int64_t>( children_.size() ) )
    { // %%% Possible truncation on platforms where size_t = uint64
       throw E57_EXCEPTION2( E57_ERROR_CHILD_INDEX_OUT_OF_BOUNDS, "this->pathName=" + this->pathName() +
@@ -144,15 +150,40 @@ NodeImplSharedPtr StructureNodeImpl::get( const ustring &pathName )
    return ( ni );
 }
 
+NodeImplSharedPtr StructureNodeImpl::get( const ParsedPathNameImpl &path )
+{
+   checkImageFileOpen( __FILE__, __LINE__, static_cast<const char *>( __FUNCTION__ ) );
+   NodeImplSharedPtr ni( lookup( path.isRelative_, path.fields_ ) );
+
+   if ( !ni )
+   {
+      throw E57_EXCEPTION2( E57_ERROR_PATH_UNDEFINED,
+                            "this->pathName=" + this->pathName() + " pathName=" + path.pathName_ );
+   }
+   return ( ni );
+}
+
+bool StructureNodeImpl::isDefined( const ParsedPathNameImpl &path )
+{
+   checkImageFileOpen( __FILE__, __LINE__, static_cast<const char *>( __FUNCTION__ ) );
+   NodeImplSharedPtr ni( lookup( path.isRelative_, path.fields_ ) );
+   return ( ni != nullptr );
+}
+
 NodeImplSharedPtr StructureNodeImpl::lookup( const ustring &pathName )
 {
    /// don't checkImageFileOpen
-   //??? use lookup(fields, level) instead, for speed.
    bool isRelative;
    std::vector<ustring> fields;
    ImageFileImplSharedPtr imf( destImageFile_ );
    imf->pathNameParse( pathName, isRelative, fields ); // throws if bad pathName
 
+   return lookup( isRelative, fields );
+}
+
+NodeImplSharedPtr StructureNodeImpl::lookup( bool isRelative, const StringList &fields )
+{
+   /// don't checkImageFileOpen
    if ( isRelative || isRoot() )
    {
       if ( fields.empty() )
@@ -167,34 +198,8 @@ NodeImplSharedPtr StructureNodeImpl::lookup( const ustring &pathName )
             return ( root );
          }
       }
-      else
-      {
-         /// Find child with elementName that matches first field in path
-         unsigned i;
-         for ( i = 0; i < children_.size(); i++ )
-         {
-            if ( fields.at( 0 ) == children_.at( i )->elementName() )
-            {
-               break;
-            }
-         }
-         if ( i == children_.size() )
-         {
-            return NodeImplSharedPtr(); /// empty pointer
-         }
-
-         if ( fields.size() == 1 )
-         {
-            return ( children_.at( i ) );
-         }
-
-         //??? use level here rather than unparse
-         /// Remove first field in path
-         fields.erase( fields.begin() );
 
-         /// Call lookup on child object with remaining fields in path name
-         return children_.at( i )->lookup( imf->pathNameUnparse( true, fields ) );
-      }
+      return lookup( fields, 0 );
    }
    else
    { /// Absolute pathname and we aren't at the root
@@ -202,13 +207,70 @@ NodeImplSharedPtr StructureNodeImpl::lookup( const ustring &pathName )
       NodeImplSharedPtr root( getRoot() );
 
       /// Call lookup on root
-      return ( root->lookup( pathName ) );
+      return ( std::static_pointer_cast<StructureNodeImpl>( root )->lookup( isRelative, fields ) );
+   }
+}
+
+NodeImplSharedPtr StructureNodeImpl::lookup( const StringList &fields, unsigned level )
+{
+   /// don't checkImageFileOpen
+   materialize();
+
+   /// Find child with elementName that matches field at this level of the path
+   NodeImplSharedPtr child( findChild( fields.at( level ) ) );
+
+   if ( !child || ( level == fields.size() - 1 ) )
+   {
+      return ( child );
+   }
+
+   /// Call lookup on child object with remaining fields in path name
+   return child->lookup( fields, level + 1 );
+}
+
+NodeImplSharedPtr StructureNodeImpl::findChild( const ustring &elementName ) const
+{
+   if ( children_.size() >= ChildIndexThreshold )
+   {
+      auto found = childIndex_.find( elementName );
+
+      return ( found == childIndex_.end() ) ? NodeImplSharedPtr() : children_[found->second];
+   }
+
+   for ( auto &child : children_ )
+   {
+      if ( elementName == child->elementName_ )
+      {
+         return ( child );
+      }
+   }
+
+   return NodeImplSharedPtr(); /// empty pointer
+}
+
+void StructureNodeImpl::addChild( const ustring &elementName, NodeImplSharedPtr ni )
+{
+   ni->setParent( shared_from_this(), elementName );
+   children_.push_back( ni );
+
+   /// Index all the children once there are enough of them, then each new one
+   if ( children_.size() == ChildIndexThreshold )
+   {
+      for ( size_t i = 0; i < children_.size(); ++i )
+      {
+         childIndex_.emplace( children_[i]->elementName_, i );
+      }
+   }
+   else if ( children_.size() > ChildIndexThreshold )
+   {
+      childIndex_.emplace( elementName, children_.size() - 1 );
    }
 }
 
 void StructureNodeImpl::set( int64_t index64, NodeImplSharedPtr ni )
 {
    checkImageFileOpen( __FILE__, __LINE__, static_cast<const char *>( __FUNCTION__ ) );
+   materialize();
 
    auto index = static_cast<unsigned>( index64 );
 
@@ -246,8 +308,12 @@ void StructureNodeImpl::set( int64_t index64, NodeImplSharedPtr ni )
       throw E57_EXCEPTION2( E57_ERROR_HOMOGENEOUS_VIOLATION, "this->pathName=" + this->pathName() );
    }
 
-   ni->setParent( shared_from_this(), elementName.str() );
-   children_.push_back( ni );
+   addChild( elementName.str(), ni );
+}
+
+void StructureNodeImpl::appendUnchecked( const ustring &elementName, NodeImplSharedPtr ni )
+{
+   addChild( elementName, ni );
 }
 
 void StructureNodeImpl::set( const ustring &pathName, NodeImplSharedPtr ni, bool autoPathCreate )
@@ -294,6 +360,7 @@ void StructureNodeImpl::set( const std::vector<ustring> &fields, unsigned level,
 #endif
 
    checkImageFileOpen( __FILE__, __LINE__, static_cast<const char *>( __FUNCTION__ ) );
+   materialize();
    //??? check if field is numeric string (e.g. "17"), verify number is same as
    // index, else throw
    // bad_path
@@ -304,24 +371,23 @@ void StructureNodeImpl::set( const std::vector<ustring> &fields, unsigned level,
       throw E57_EXCEPTION2( E57_ERROR_SET_TWICE, "this->pathName=" + this->pathName() + " element=/" );
    }
 
-   /// Serial search for matching field name, if find match, have error since
+   /// Search for matching field name, if find match, have error since
    /// can't set twice
-   for ( auto &child : children_ )
+   NodeImplSharedPtr child( findChild( fields.at( level ) ) );
+
+   if ( child )
    {
-      if ( fields.at( level ) == child->elementName() )
+      if ( level == fields.size() - 1 )
       {
-         if ( level == fields.size() - 1 )
-         {
-            /// Enforce "set once" policy, don't allow reset
-            throw E57_EXCEPTION2( E57_ERROR_SET_TWICE,
-                                  "this->pathName=" + this->pathName() + " element=" + fields[level] );
-         }
+         /// Enforce "set once" policy, don't allow reset
+         throw E57_EXCEPTION2( E57_ERROR_SET_TWICE,
+                               "this->pathName=" + this->pathName() + " element=" + fields[level] );
+      }
 
-         /// Recurse on child
-         child->set( fields, level + 1, ni );
+      /// Recurse on child
+      child->set( fields, level + 1, ni );
 
-         return;
-      }
+      return;
    }
    /// Didn't find matching field name, so have a new child.
 
@@ -335,8 +401,7 @@ void StructureNodeImpl::set( const std::vector<ustring> &fields, unsigned level,
    if ( level == fields.size() - 1 )
    {
       /// At bottom, so append node at end of children
-      ni->setParent( shared_from_this(), fields.at( level ) );
-      children_.push_back( ni );
+      addChild( fields.at( level ), ni );
    }
    else
    {
@@ -369,10 +434,57 @@ void StructureNodeImpl::append( NodeImplSharedPtr ni )
    set( childCount(), ni );
 }
 
+void StructureNodeImpl::setLazyChildren( std::unique_ptr<LazyChildren> lazyChildren )
+{
+   lazyChildren_ = std::move( lazyChildren );
+   lazy_.store( lazyChildren_ != nullptr, std::memory_order_release );
+}
+
+void StructureNodeImpl::materialize() const
+{
+   if ( !lazy_.load( std::memory_order_acquire ) )
+   {
+      return;
+   }
+
+   /// Reading the children needs the file
+   checkImageFileOpen( __FILE__, __LINE__, static_cast<const char *>( __FUNCTION__ ) );
+
+   /// Nodes of a read mode file may be used from several threads, the first one to get here adds the children while
+   /// the others wait.  The lock is recursive because adding the children calls back here through set().
+   ImageFileImplSharedPtr imf( destImageFile_ );
+   std::lock_guard<std::recursive_mutex> lock( imf->lazyChildrenMutex() );
+
+   /// Already done while we waited, or being done by this thread
+   if ( !lazyChildren_ )
+   {
+      return;
+   }
+
+   std::unique_ptr<LazyChildren> lazyChildren( std::move( lazyChildren_ ) );
+   auto &self = const_cast<StructureNodeImpl &>( *this );
+
+   try
+   {
+      lazyChildren->materialize( self );
+   }
+   catch ( ... )
+   {
+      /// Leave things as they were, so the next use reports the error again
+      self.children_.clear();
+      self.childIndex_.clear();
+      lazyChildren_ = std::move( lazyChildren );
+      throw;
+   }
+
+   lazy_.store( false, std::memory_order_release );
+}
+
 //??? use visitor?
 void StructureNodeImpl::checkLeavesInSet( const StringSet &pathNames, NodeImplSharedPtr origin )
 {
    /// don't checkImageFileOpen
+   materialize();
 
    /// Not a leaf node, so check all our children
    for ( auto &child : children_ )
@@ -385,6 +497,7 @@ void StructureNodeImpl::checkLeavesInSet( const StringSet &pathNames, NodeImplSh
 void StructureNodeImpl::writeXml( ImageFileImplSharedPtr imf, CheckedFile &cf, int indent, const char *forcedFieldName )
 {
    /// don't checkImageFileOpen
+   materialize();
 
    ustring fieldName;
    if ( forcedFieldName != nullptr )
@@ -458,6 +571,7 @@ void StructureNodeImpl::writeXml( ImageFileImplSharedPtr imf, CheckedFile &cf, i
 void StructureNodeImpl::dump( int indent, std::ostream &os ) const
 {
    /// don't checkImageFileOpen
+   materialize();
    os << space( indent ) << "type:        Structure"
       << " (" << type() << ")" << std::endl;
    NodeImpl::dump( indent, os );
@@ -27,10 +27,27 @@
 
 #pragma once
 
+#include <atomic>
+#include <unordered_map>
+
 #include "NodeImpl.h"
 
 namespace e57
 {
+   class StructureNodeImpl;
+
+   /// Children of a StructureNodeImpl or VectorNodeImpl whose reading was put off until they are first used, see the
+   /// lazyMetadata argument of ImageFile.
+   class LazyChildren
+   {
+   public:
+      virtual ~LazyChildren() = default;
+
+      /// Add the children to container
+      virtual void materialize( StructureNodeImpl &container ) = 0;
+   };
+
+   class ParsedPathNameImpl;
 
    class StructureNodeImpl : public NodeImpl
    {
@@ -47,12 +64,20 @@ namespace e57
 
       virtual NodeImplSharedPtr get( int64_t index );
       NodeImplSharedPtr get( const ustring &pathName ) override;
+      NodeImplSharedPtr get( const ParsedPathNameImpl &path );
+      bool isDefined( const ParsedPathNameImpl &path );
 
       virtual void set( int64_t index, NodeImplSharedPtr ni );
       void set( const ustring &pathName, NodeImplSharedPtr ni, bool autoPathCreate = false ) override;
       void set( const StringList &fields, unsigned level, NodeImplSharedPtr ni, bool autoPathCreate = false ) override;
       virtual void append( NodeImplSharedPtr ni );
 
+      /// Add a child without the checks of set(), for trees rebuilt from a copy of a tree that passed them
+      void appendUnchecked( const ustring &elementName, NodeImplSharedPtr ni );
+
+      /// Have the children added by lazyChildren the first time they are used
+      void setLazyChildren( std::unique_ptr<LazyChildren> lazyChildren );
+
       void checkLeavesInSet( const StringSet &pathNames, NodeImplSharedPtr origin ) override;
 
       void writeXml( ImageFileImplSharedPtr imf, CheckedFile &cf, int indent,
@@ -65,7 +90,26 @@ namespace e57
    protected:
       friend class CompressedVectorReaderImpl;
       NodeImplSharedPtr lookup( const ustring &pathName ) override;
+      NodeImplSharedPtr lookup( bool isRelative, const StringList &fields );
+      NodeImplSharedPtr lookup( const StringList &fields, unsigned level ) override;
+
+      /// Child called elementName, or empty pointer.  Children must have been materialized.
+      NodeImplSharedPtr findChild( const ustring &elementName ) const;
+
+      /// Attach ni and add it at the end of children_, keeping childIndex_ up to date
+      void addChild( const ustring &elementName, NodeImplSharedPtr ni );
+
+      /// Add the children if that was put off.  Must be called before children_ is used, except to attach them.
+      void materialize() const;
 
       std::vector<NodeImplSharedPtr> children_;
+
+      /// Index in children_ of each element name, only kept once there are ChildIndexThreshold children, below that
+      /// a scan of children_ is faster.  Changed with children_, so it is as safe to share between threads.
+      static constexpr size_t ChildIndexThreshold = 16;
+      std::unordered_map<ustring, size_t> childIndex_;
+
+      mutable std::unique_ptr<LazyChildren> lazyChildren_;
+      mutable std::atomic<bool> lazy_{ false }; ///< lazyChildren_ is set or being materialized
    };
 }
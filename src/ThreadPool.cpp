@@ -0,0 +1,120 @@
+// SPDX-License-Identifier: MIT
+
+#include "ThreadPool.h"
+
+using namespace e57;
+
+ThreadPool::ThreadPool( unsigned threadCount )
+{
+   for ( unsigned i = 1; i < threadCount; ++i )
+   {
+      workers_.emplace_back( &ThreadPool::workerLoop, this );
+   }
+}
+
+ThreadPool::~ThreadPool()
+{
+   {
+      std::lock_guard<std::mutex> lock( mutex_ );
+      stopping_ = true;
+   }
+
+   workReady_.notify_all();
+
+   for ( auto &worker : workers_ )
+   {
+      worker.join();
+   }
+}
+
+void ThreadPool::run( size_t count, const std::function<void( size_t )> &task )
+{
+   /// Not worth waking anybody up
+   if ( workers_.empty() || count < 2 )
+   {
+      for ( size_t i = 0; i < count; ++i )
+      {
+         task( i );
+      }
+      return;
+   }
+
+   errors_.assign( count, nullptr );
+
+   {
+      std::lock_guard<std::mutex> lock( mutex_ );
+
+      task_ = &task;
+      taskCount_ = count;
+      nextTask_ = 0;
+      busyWorkers_ = static_cast<unsigned>( workers_.size() );
+      ++generation_;
+   }
+
+   workReady_.notify_all();
+
+   runTasks();
+
+   {
+      std::unique_lock<std::mutex> lock( mutex_ );
+
+      workDone_.wait( lock, [this] { return busyWorkers_ == 0; } );
+
+      task_ = nullptr;
+   }
+
+   for ( auto &error : errors_ )
+   {
+      if ( error )
+      {
+         std::rethrow_exception( error );
+      }
+   }
+}
+
+void ThreadPool::workerLoop()
+{
+   uint64_t lastGeneration = 0;
+
+   while ( true )
+   {
+      {
+         std::unique_lock<std::mutex> lock( mutex_ );
+
+         workReady_.wait( lock, [&] { return stopping_ || ( generation_ != lastGeneration ); } );
+
+         if ( stopping_ )
+         {
+            return;
+         }
+
+         lastGeneration = generation_;
+      }
+
+      runTasks();
+
+      {
+         std::lock_guard<std::mutex> lock( mutex_ );
+
+         if ( --busyWorkers_ == 0 )
+         {
+            workDone_.notify_one();
+         }
+      }
+   }
+}
+
+void ThreadPool::runTasks()
+{
+   for ( size_t i = nextTask_++; i < taskCount_; i = nextTask_++ )
+   {
+      try
+      {
+         ( *task_ )( i );
+      }
+      catch ( ... )
+      {
+         errors_[i] = std::current_exception();
+      }
+   }
+}
@@ -0,0 +1,57 @@
+#pragma once
+// SPDX-License-Identifier: MIT
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace e57
+{
+   /// Fixed set of worker threads that run the iterations of a loop in parallel.
+   ///
+   /// The calling thread takes part in each run(), so a pool of threadCount threads starts threadCount - 1 workers.
+   /// Threads take the next iteration from a shared counter as soon as they are done with the previous one, so a slow
+   /// iteration doesn't hold up the others.
+   class ThreadPool
+   {
+   public:
+      explicit ThreadPool( unsigned threadCount );
+      ~ThreadPool();
+
+      ThreadPool( const ThreadPool & ) = delete;
+      ThreadPool &operator=( const ThreadPool & ) = delete;
+
+      unsigned threadCount() const
+      {
+         return static_cast<unsigned>( workers_.size() ) + 1;
+      }
+
+      /// Call task(i) for every i in [0, count) and wait until all calls have returned.  If some calls throw, the
+      /// exception from the lowest i is rethrown, so errors don't depend on scheduling.
+      void run( size_t count, const std::function<void( size_t )> &task );
+
+   private:
+      void workerLoop();
+      void runTasks();
+
+      std::vector<std::thread> workers_;
+
+      std::mutex mutex_;
+      std::condition_variable workReady_;
+      std::condition_variable workDone_;
+      uint64_t generation_ = 0; ///< incremented for each run(), wakes the workers
+      unsigned busyWorkers_ = 0;
+      bool stopping_ = false;
+
+      const std::function<void( size_t )> *task_ = nullptr;
+      size_t taskCount_ = 0;
+      std::atomic<size_t> nextTask_{ 0 };
+      std::vector<std::exception_ptr> errors_; ///< [task index]
+   };
+}
@@ -0,0 +1,473 @@
+// SPDX-License-Identifier: MIT
+
+#include <iostream>
+#include <limits>
+#include <mutex>
+#include <vector>
+
+#include <xercesc/sax/InputSource.hpp>
+#include <xercesc/sax2/Attributes.hpp>
+#include <xercesc/sax2/DefaultHandler.hpp>
+#include <xercesc/sax2/SAX2XMLReader.hpp>
+#include <xercesc/sax2/XMLReaderFactory.hpp>
+
+#include <xercesc/util/BinInputStream.hpp>
+#include <xercesc/util/TransService.hpp>
+
+#include "CheckedFile.h"
+#include "E57XmlParser.h"
+#include "E57XmlReader.h"
+
+using namespace e57;
+using namespace XERCES_CPP_NAMESPACE;
+
+namespace
+{
+   ustring toUString( const XMLCh *const xml_str )
+   {
+      ustring u_str;
+      if ( xml_str && *xml_str )
+      {
+         TranscodeToStr UTF8Transcoder( xml_str, "UTF-8" );
+         u_str = ustring( reinterpret_cast<const char *>( UTF8Transcoder.str() ) );
+      }
+      return ( u_str );
+   }
+
+   /// Compare a string from Xerces with a plain ASCII one, without transcoding it
+   bool equalsAscii( const XMLCh *xml_str, const char *str )
+   {
+      for ( ; *str != '\0'; ++xml_str, ++str )
+      {
+         if ( *xml_str != static_cast<XMLCh>( static_cast<unsigned char>( *str ) ) )
+         {
+            return false;
+         }
+      }
+
+      return ( *xml_str == chNull );
+   }
+
+   //=============================================================================
+   // XercesLibrary
+
+   /// Xerces is initialized while anything uses it: parsers holding a reader, and the pool of readers kept for the
+   /// next parsers.  Once a file has been parsed the pool keeps Xerces initialized until the program exits, so
+   /// opening many files only pays for initializing Xerces and creating readers once.
+   ///
+   /// XMLPlatformUtils::Initialize() and Terminate() keep their own count, but aren't thread safe, and tearing
+   /// everything down after each file is what we want to avoid.
+   class XercesLibrary
+   {
+   public:
+      static XercesLibrary &instance()
+      {
+         static XercesLibrary sLibrary;
+
+         return sLibrary;
+      }
+
+      ~XercesLibrary()
+      {
+         for ( auto reader : readers_ )
+         {
+            delete reader;
+         }
+
+         if ( !readers_.empty() )
+         {
+            readers_.clear();
+
+            removeUser();
+         }
+      }
+
+      /// Reader from the pool, or a new one.  Its handlers and features must be set before use.
+      SAX2XMLReader *acquireReader()
+      {
+         std::lock_guard<std::mutex> lock( mutex_ );
+
+         addUser();
+
+         if ( !readers_.empty() )
+         {
+            SAX2XMLReader *reader = readers_.back();
+            readers_.pop_back();
+
+            if ( readers_.empty() )
+            {
+               removeUser();
+            }
+
+            return reader;
+         }
+
+         SAX2XMLReader *reader = nullptr;
+
+         try
+         {
+            reader = XMLReaderFactory::createXMLReader();
+         }
+         catch ( ... )
+         {
+            removeUser();
+            throw;
+         }
+
+         if ( reader == nullptr )
+         {
+            removeUser();
+
+            throw E57_EXCEPTION2( E57_ERROR_XML_PARSER_INIT, "could not create the xml reader" );
+         }
+
+         return reader;
+      }
+
+      /// Give back a reader from acquireReader().  It is only kept for reuse if it finished parsing, a reader left
+      /// in the middle of a document by an exception is deleted.
+      void releaseReader( SAX2XMLReader *reader, bool reusable )
+      {
+         std::lock_guard<std::mutex> lock( mutex_ );
+
+         if ( reusable && ( readers_.size() < MaxPooledReaders ) )
+         {
+            if ( readers_.empty() )
+            {
+               addUser();
+            }
+
+            readers_.push_back( reader );
+         }
+         else
+         {
+            delete reader;
+         }
+
+         removeUser();
+      }
+
+   private:
+      XercesLibrary() = default;
+
+      void addUser()
+      {
+         if ( users_ == 0 )
+         {
+            try
+            {
+               XMLPlatformUtils::Initialize();
+            }
+            catch ( const XMLException &ex )
+            {
+               /// Turn parser exception into E57Exception
+               throw E57_EXCEPTION2( E57_ERROR_XML_PARSER_INIT,
+                                     "parserMessage=" + ustring( XMLString::transcode( ex.getMessage() ) ) );
+            }
+         }
+
+         ++users_;
+      }
+
+      void removeUser()
+      {
+         if ( --users_ == 0 )
+         {
+            XMLPlatformUtils::Terminate();
+         }
+      }
+
+      /// Enough for a few threads opening files at the same time
+      static constexpr size_t MaxPooledReaders = 8;
+
+      std::mutex mutex_;
+      unsigned users_ = 0;                   ///< parsers holding a reader, plus one while the pool isn't empty
+      std::vector<SAX2XMLReader *> readers_; ///< ready to be reused
+   };
+
+   //=============================================================================
+   // E57FileInputStream
+
+   class E57FileInputStream : public BinInputStream
+   {
+   public:
+      E57FileInputStream( CheckedFile *cf, uint64_t logicalStart, uint64_t logicalLength );
+      ~E57FileInputStream() override = default;
+
+      E57FileInputStream( const E57FileInputStream & ) = delete;
+      E57FileInputStream &operator=( const E57FileInputStream & ) = delete;
+
+      XMLFilePos curPos() const override
+      {
+         return ( logicalPosition_ );
+      }
+      XMLSize_t readBytes( XMLByte *const toFill, const XMLSize_t maxToRead ) override;
+      const XMLCh *getContentType() const override
+      {
+         return nullptr;
+      }
+
+   private:
+      //??? lifetime of cf_ must be longer than this object!
+      CheckedFile *cf_;
+      uint64_t logicalStart_;
+      uint64_t logicalLength_;
+      uint64_t logicalPosition_;
+   };
+
+   E57FileInputStream::E57FileInputStream( CheckedFile *cf, uint64_t logicalStart, uint64_t logicalLength ) :
+      cf_( cf ), logicalStart_( logicalStart ), logicalLength_( logicalLength ), logicalPosition_( logicalStart )
+   {
+   }
+
+   XMLSize_t E57FileInputStream::readBytes( XMLByte *const toFill, const XMLSize_t maxToRead )
+   {
+      if ( logicalPosition_ > logicalStart_ + logicalLength_ )
+         return ( 0 );
+
+      int64_t available = logicalStart_ + logicalLength_ - logicalPosition_;
+      if ( available <= 0 )
+      {
+         return ( 0 );
+      }
+
+      /// size_t and XMLSize_t should be compatible, should get compiler warning
+      /// here if not
+      size_t maxToRead_size = maxToRead;
+
+      /// Be careful if size_t is smaller than int64_t
+      size_t available_size;
+      if ( sizeof( size_t ) >= sizeof( int64_t ) )
+      {
+         /// size_t is at least as big as int64_t
+         available_size = static_cast<size_t>( available );
+      }
+      else
+      {
+         /// size_t is smaller than int64_t, Calc max that size_t can hold
+         const int64_t size_max = std::numeric_limits<size_t>::max();
+
+         /// read smaller of size_max, available
+         ///??? redo
+         if ( size_max < available )
+         {
+            available_size = static_cast<size_t>( size_max );
+         }
+         else
+         {
+            available_size = static_cast<size_t>( available );
+         }
+      }
+
+      size_t readCount = std::min( maxToRead_size, available_size );
+
+      cf_->seek( logicalPosition_ );
+      cf_->read( reinterpret_cast<char *>( toFill ), readCount ); //??? cast ok?
+      logicalPosition_ += readCount;
+      return ( readCount );
+   }
+
+   //=============================================================================
+   // E57XmlFileInputSource
+
+   class E57XmlFileInputSource : public InputSource
+   {
+   public:
+      E57XmlFileInputSource( CheckedFile *cf, uint64_t logicalStart, uint64_t logicalLength );
+      ~E57XmlFileInputSource() override = default;
+
+      E57XmlFileInputSource( const E57XmlFileInputSource & ) = delete;
+      E57XmlFileInputSource &operator=( const E57XmlFileInputSource & ) = delete;
+
+      BinInputStream *makeStream() const override;
+
+   private:
+      //??? lifetime of cf_ must be longer than this object!
+      CheckedFile *cf_;
+      uint64_t logicalStart_;
+      uint64_t logicalLength_;
+   };
+
+   E57XmlFileInputSource::E57XmlFileInputSource( CheckedFile *cf, uint64_t logicalStart, uint64_t logicalLength ) :
+      InputSource( "E57File",
+                   XMLPlatformUtils::fgMemoryManager ), //??? what if want to use our own
+                                                        // memory
+                                                        // manager?, what bufid is good?
+      cf_( cf ), logicalStart_( logicalStart ), logicalLength_( logicalLength )
+   {
+   }
+
+   BinInputStream *E57XmlFileInputSource::makeStream() const
+   {
+      return new E57FileInputStream( cf_, logicalStart_, logicalLength_ );
+   }
+
+   //=============================================================================
+   // XercesAttributes
+
+   /// Attributes from Xerces, transcoded to UTF-8 when they are asked for
+   class XercesAttributes : public E57XmlParser::Attributes
+   {
+   public:
+      explicit XercesAttributes( const XERCES_CPP_NAMESPACE::Attributes &attributes ) : attributes_( attributes )
+      {
+      }
+
+      size_t length() const override
+      {
+         return attributes_.getLength();
+      }
+      ustring uri( size_t i ) const override
+      {
+         return toUString( attributes_.getURI( i ) );
+      }
+      ustring localName( size_t i ) const override
+      {
+         return toUString( attributes_.getLocalName( i ) );
+      }
+      ustring qName( size_t i ) const override
+      {
+         return toUString( attributes_.getQName( i ) );
+      }
+      ustring value( size_t i ) const override
+      {
+         return toUString( attributes_.getValue( i ) );
+      }
+
+      bool find( const char *qName, size_t &index ) const override
+      {
+         for ( XMLSize_t i = 0; i < attributes_.getLength(); ++i )
+         {
+            if ( equalsAscii( attributes_.getQName( i ), qName ) )
+            {
+               index = i;
+               return true;
+            }
+         }
+
+         return false;
+      }
+
+   private:
+      const XERCES_CPP_NAMESPACE::Attributes &attributes_;
+   };
+
+   //=============================================================================
+   // XercesXmlReader
+
+   class XercesXmlReader : public E57XmlReader, public DefaultHandler
+   {
+   public:
+      explicit XercesXmlReader( bool validate );
+      ~XercesXmlReader() override;
+
+      void parse( E57XmlParser &parser, CheckedFile *cf, uint64_t logicalStart, uint64_t logicalLength ) override;
+
+   private:
+      /// SAX interface
+      void startElement( const XMLCh *const uri, const XMLCh *const localName, const XMLCh *const qName,
+                         const Attributes &attributes ) override;
+      void endElement( const XMLCh *const uri, const XMLCh *const localName, const XMLCh *const qName ) override;
+      void characters( const XMLCh *const chars, const XMLSize_t length ) override;
+
+      /// SAX error interface
+      void warning( const SAXParseException &ex ) override;
+      void error( const SAXParseException &ex ) override;
+      void fatalError( const SAXParseException &ex ) override;
+
+      SAX2XMLReader *xmlReader_;
+      E57XmlParser *parser_ = nullptr; ///< while parsing
+      bool parsed_ = false;            ///< parse() finished, so xmlReader_ can be reused
+   };
+
+   XercesXmlReader::XercesXmlReader( bool validate ) : xmlReader_( XercesLibrary::instance().acquireReader() )
+   {
+      /// Pooled readers keep the features of their last parse, so set all of them
+      //??? check these are right
+      xmlReader_->setFeature( XMLUni::fgSAX2CoreValidation, validate );
+      xmlReader_->setFeature( XMLUni::fgXercesDynamic, validate );
+      xmlReader_->setFeature( XMLUni::fgSAX2CoreNameSpaces, true );
+      xmlReader_->setFeature( XMLUni::fgXercesSchema, validate );
+      xmlReader_->setFeature( XMLUni::fgXercesSchemaFullChecking, validate );
+      xmlReader_->setFeature( XMLUni::fgXercesLoadExternalDTD, validate );
+      xmlReader_->setFeature( XMLUni::fgSAX2CoreNameSpacePrefixes, true );
+
+      xmlReader_->setContentHandler( this );
+      xmlReader_->setErrorHandler( this );
+   }
+
+   XercesXmlReader::~XercesXmlReader()
+   {
+      xmlReader_->setContentHandler( nullptr );
+      xmlReader_->setErrorHandler( nullptr );
+
+      XercesLibrary::instance().releaseReader( xmlReader_, parsed_ );
+   }
+
+   void XercesXmlReader::parse( E57XmlParser &parser, CheckedFile *cf, uint64_t logicalStart,
+                                uint64_t logicalLength )
+   {
+      E57XmlFileInputSource xmlSection( cf, logicalStart, logicalLength );
+
+      parser_ = &parser;
+      parsed_ = false;
+
+      xmlReader_->parse( xmlSection );
+
+      parser_ = nullptr;
+      parsed_ = true;
+   }
+
+   void XercesXmlReader::startElement( const XMLCh *const uri, const XMLCh *const localName,
+                                       const XMLCh *const qName, const Attributes &attributes )
+   {
+      parser_->startElement( toUString( uri ), toUString( localName ), toUString( qName ),
+                             XercesAttributes( attributes ) );
+   }
+
+   void XercesXmlReader::endElement( const XMLCh *const uri, const XMLCh *const localName, const XMLCh *const qName )
+   {
+      parser_->endElement( toUString( uri ), toUString( localName ), toUString( qName ) );
+   }
+
+   void XercesXmlReader::characters( const XMLCh *const chars, const XMLSize_t length )
+   {
+      TranscodeToStr UTF8Transcoder( chars, length, "UTF-8" );
+
+      parser_->characters( reinterpret_cast<const char *>( UTF8Transcoder.str() ), UTF8Transcoder.length() );
+   }
+
+   void XercesXmlReader::error( const SAXParseException &ex )
+   {
+      throw E57_EXCEPTION2( E57_ERROR_XML_PARSER, "systemId=" + ustring( XMLString::transcode( ex.getSystemId() ) ) +
+                                                     " xmlLine=" + toString( ex.getLineNumber() ) +
+                                                     " xmlColumn=" + toString( ex.getColumnNumber() ) +
+                                                     " parserMessage=" +
+                                                     ustring( XMLString::transcode( ex.getMessage() ) ) );
+   }
+
+   void XercesXmlReader::fatalError( const SAXParseException &ex )
+   {
+      throw E57_EXCEPTION2( E57_ERROR_XML_PARSER, "systemId=" + ustring( XMLString::transcode( ex.getSystemId() ) ) +
+                                                     " xmlLine=" + toString( ex.getLineNumber() ) +
+                                                     " xmlColumn=" + toString( ex.getColumnNumber() ) +
+                                                     " parserMessage=" +
+                                                     ustring( XMLString::transcode( ex.getMessage() ) ) );
+   }
+
+   void XercesXmlReader::warning( const SAXParseException &ex )
+   {
+      /// Don't take any action on warning from parser, just report
+      std::cerr << "**** XML parser warning: " << ustring( XMLString::transcode( ex.getMessage() ) ) << std::endl;
+      std::cerr << "  Debug info:" << std::endl;
+      std::cerr << "    systemId=" << XMLString::transcode( ex.getSystemId() ) << std::endl;
+      std::cerr << ",   xmlLine=" << ex.getLineNumber() << std::endl;
+      std::cerr << ",   xmlColumn=" << ex.getColumnNumber() << std::endl;
+   }
+}
+
+/// SAX reports every element, so the whole tree is always built
+std::unique_ptr<E57XmlReader> E57XmlReader::create( bool validate, bool /*lazy*/ )
+{
+   return std::unique_ptr<E57XmlReader>( new XercesXmlReader( validate ) );
+}
@@ -0,0 +1,144 @@
+// SPDX-License-Identifier: MIT
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "E57Format.h"
+#include "TestHelpers.h"
+
+using namespace e57;
+
+namespace
+{
+   const int64_t RecordCount = 300000;
+
+   int64_t yOf( int64_t record )
+   {
+      return ( record * 7919 ) % 65536;
+   }
+
+   void writePoints( const std::string &fileName )
+   {
+      ImageFile imf( fileName, "w" );
+
+      StructureNode prototype( imf );
+      prototype.set( "x", IntegerNode( imf, 0, 0, RecordCount ) );
+      prototype.set( "y", IntegerNode( imf, 0, 0, 65535 ) );
+      prototype.set( "z", FloatNode( imf, 0.0, E57_DOUBLE ) );
+
+      VectorNode codecs( imf, true );
+      CompressedVectorNode points( imf, prototype, codecs );
+      imf.root().set( "points", points );
+
+      std::vector<int64_t> x( RecordCount );
+      std::vector<int64_t> y( RecordCount );
+      std::vector<double> z( RecordCount );
+
+      for ( int64_t i = 0; i < RecordCount; ++i )
+      {
+         x[i] = i;
+         y[i] = yOf( i );
+         z[i] = i * 0.5;
+      }
+
+      std::vector<SourceDestBuffer> buffers{ SourceDestBuffer( imf, "x", x.data(), RecordCount, true ),
+                                             SourceDestBuffer( imf, "y", y.data(), RecordCount, true ),
+                                             SourceDestBuffer( imf, "z", z.data(), RecordCount, true ) };
+
+      CompressedVectorWriter writer = points.writer( buffers );
+      writer.write( RecordCount );
+      writer.close();
+
+      imf.close();
+   }
+
+   /// Each thread has its own reader of the same node, starts at its own record and reads to the end, checking what
+   /// it reads.  Returns the number of threads that didn't read what was written.
+   int readOnThreads( ImageFile &imf, unsigned threadCount, unsigned decodeThreadCount )
+   {
+      CompressedVectorNode points( imf.root().get( "points" ) );
+
+      std::atomic<int> failures( 0 );
+      std::vector<std::thread> threads;
+
+      for ( unsigned t = 0; t < threadCount; ++t )
+      {
+         threads.emplace_back( [&, t]() {
+            try
+            {
+               const size_t bufferSize = 5000;
+               std::vector<int64_t> x( bufferSize );
+               std::vector<int64_t> y( bufferSize );
+               std::vector<double> z( bufferSize );
+
+               std::vector<SourceDestBuffer> buffers{ SourceDestBuffer( imf, "x", x.data(), bufferSize, true ),
+                                                      SourceDestBuffer( imf, "y", y.data(), bufferSize, true ),
+                                                      SourceDestBuffer( imf, "z", z.data(), bufferSize, true ) };
+
+               CompressedVectorReader::Options options;
+               options.threadCount = decodeThreadCount;
+
+               CompressedVectorReader reader = points.reader( buffers, options );
+
+               int64_t record = RecordCount * t / threadCount;
+               reader.seek( record );
+
+               while ( const unsigned count = reader.read() )
+               {
+                  for ( unsigned i = 0; i < count; ++i, ++record )
+                  {
+                     if ( ( x[i] != record ) || ( y[i] != yOf( record ) ) || ( z[i] != record * 0.5 ) )
+                     {
+                        ++failures;
+                        return;
+                     }
+                  }
+               }
+
+               if ( record != RecordCount )
+               {
+                  ++failures;
+               }
+
+               reader.close();
+            }
+            catch ( E57Exception & )
+            {
+               ++failures;
+            }
+         } );
+      }
+
+      for ( auto &thread : threads )
+      {
+         thread.join();
+      }
+
+      return failures;
+   }
+}
+
+/// A read-only ImageFile is shared by threads reading the same CompressedVectorNode from different records
+TEST( ConcurrentRead, SameFile )
+{
+   TemporaryFile file;
+
+   writePoints( file.name() );
+
+   ImageFile imf( file.name(), "r" );
+
+   for ( const unsigned threadCount : { 4u, 8u } )
+   {
+      for ( const unsigned decodeThreadCount : { 1u, 3u } )
+      {
+         SCOPED_TRACE( std::to_string( threadCount ) + " threads decoding on " + std::to_string( decodeThreadCount ) );
+
+         EXPECT_EQ( readOnThreads( imf, threadCount, decodeThreadCount ), 0 );
+      }
+   }
+
+   EXPECT_EQ( imf.readerCount(), 0 );
+
+   imf.close();
+}
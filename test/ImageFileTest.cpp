@@ -0,0 +1,114 @@
+// SPDX-License-Identifier: MIT
+
+#include <vector>
+
+#if defined( __linux__ ) || defined( __APPLE__ )
+#include <unistd.h>
+#endif
+
+#include "E57Format.h"
+#include "TestHelpers.h"
+
+using namespace e57;
+
+namespace
+{
+   const int64_t RecordCount = 100000;
+
+   void writePoints( const std::string &fileName )
+   {
+      ImageFile imf( fileName, "w" );
+
+      StructureNode prototype( imf );
+      prototype.set( "x", IntegerNode( imf, 0, 0, RecordCount ) );
+
+      VectorNode codecs( imf, true );
+      CompressedVectorNode points( imf, prototype, codecs );
+      imf.root().set( "points", points );
+
+      std::vector<int64_t> x( RecordCount );
+      for ( int64_t i = 0; i < RecordCount; ++i )
+      {
+         x[i] = i;
+      }
+
+      std::vector<SourceDestBuffer> buffers{ SourceDestBuffer( imf, "x", x.data(), RecordCount, true ) };
+
+      CompressedVectorWriter writer = points.writer( buffers );
+      writer.write( RecordCount );
+      writer.close();
+
+      imf.close();
+   }
+
+   /// Read all the records of points, check them, and return how many there were
+   int64_t readPoints( ImageFile &imf )
+   {
+      CompressedVectorNode points( imf.root().get( "points" ) );
+
+      std::vector<int64_t> x( 4096 );
+      std::vector<SourceDestBuffer> buffers{ SourceDestBuffer( imf, "x", x.data(), x.size(), true ) };
+
+      CompressedVectorReader reader = points.reader( buffers );
+
+      int64_t total = 0;
+      while ( const unsigned count = reader.read() )
+      {
+         for ( unsigned i = 0; i < count; ++i )
+         {
+            EXPECT_EQ( x[i], total + i );
+         }
+         total += count;
+      }
+
+      reader.close();
+
+      return total;
+   }
+}
+
+TEST( ImageFile, ReadWithAndWithoutMemoryMapping )
+{
+   TemporaryFile file;
+
+   writePoints( file.name() );
+
+   for ( const bool memoryMapped : { false, true } )
+   {
+      SCOPED_TRACE( memoryMapped ? "memory-mapped" : "read()" );
+
+      ImageFile::Options options;
+      options.memoryMapped = memoryMapped;
+
+      ImageFile imf( file.name(), "r", CHECKSUM_POLICY_ALL, options );
+      EXPECT_EQ( readPoints( imf ), RecordCount );
+      imf.close();
+   }
+}
+
+#if defined( __linux__ ) || defined( __APPLE__ )
+/// The default read path must report a file cut short while open as an error, not crash the way a mapping does
+TEST( ImageFile, TruncatedWhileOpen )
+{
+   TemporaryFile file;
+
+   writePoints( file.name() );
+
+   ImageFile imf( file.name(), "r" );
+
+   /// Keep the header and the first page, the data packets are gone
+   ASSERT_EQ( ::truncate( file.name().c_str(), 2048 ), 0 );
+
+   try
+   {
+      readPoints( imf );
+      FAIL() << "reading a truncated file didn't throw";
+   }
+   catch ( E57Exception &e )
+   {
+      EXPECT_EQ( e.errorCode(), E57_ERROR_READ_FAILED );
+   }
+
+   imf.close();
+}
+#endif
@@ -0,0 +1,369 @@
+// SPDX-License-Identifier: MIT
+
+/// The metadata cache is checked from outside: a hit leaves the entry file alone, a miss parses the XML and replaces
+/// the entry with a new file.  Entries are found and damaged through the file system, so these tests need POSIX.
+#if defined( __linux__ ) || defined( __APPLE__ )
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <thread>
+#include <vector>
+
+#include "E57Format.h"
+#include "TestHelpers.h"
+
+using namespace e57;
+
+namespace
+{
+   /// Empty directory in the temporary directory of the tests, removed with what it holds when the object goes away
+   class TemporaryDirectory
+   {
+   public:
+      TemporaryDirectory()
+      {
+         const ::testing::TestInfo *test = ::testing::UnitTest::GetInstance()->current_test_info();
+
+         std::string pattern =
+            ::testing::TempDir() + "E57-" + test->test_suite_name() + "-" + test->name() + "-XXXXXX";
+
+         if ( mkdtemp( &pattern[0] ) != nullptr )
+         {
+            name_ = pattern;
+         }
+      }
+
+      ~TemporaryDirectory()
+      {
+         if ( name_.empty() )
+         {
+            return;
+         }
+
+         for ( const auto &file : files() )
+         {
+            std::remove( file.c_str() );
+         }
+         ::rmdir( name_.c_str() );
+      }
+
+      TemporaryDirectory( const TemporaryDirectory & ) = delete;
+      TemporaryDirectory &operator=( const TemporaryDirectory & ) = delete;
+
+      const std::string &name() const
+      {
+         return name_;
+      }
+
+      /// Full names of the files in the directory
+      std::vector<std::string> files() const
+      {
+         std::vector<std::string> names;
+
+         if ( DIR *dir = ::opendir( name_.c_str() ) )
+         {
+            while ( const dirent *entry = ::readdir( dir ) )
+            {
+               const std::string name = entry->d_name;
+
+               if ( ( name != "." ) && ( name != ".." ) )
+               {
+                  names.push_back( name_ + "/" + name );
+               }
+            }
+            ::closedir( dir );
+         }
+
+         return names;
+      }
+
+   private:
+      std::string name_;
+   };
+
+   /// A file whose metadata is a few nodes, with label as the value of a string
+   void writeFile( const std::string &fileName, const std::string &label )
+   {
+      ImageFile imf( fileName, "w" );
+      StructureNode root = imf.root();
+
+      root.set( "formatName", StringNode( imf, "ASTM E57 3D Imaging Data File" ) );
+      root.set( "label", StringNode( imf, label ) );
+
+      VectorNode data3D( imf, true );
+      root.set( "data3D", data3D );
+
+      for ( int i = 0; i < 10; ++i )
+      {
+         StructureNode scan( imf );
+         scan.set( "index", IntegerNode( imf, i, 0, 100 ) );
+         scan.set( "scale", FloatNode( imf, i * 0.25 ) );
+         data3D.append( scan );
+      }
+
+      imf.close();
+   }
+
+   /// Open fileName with the cache in directory, and return the value of its label after checking the rest
+   std::string readLabel( const std::string &fileName, const std::string &directory )
+   {
+      ImageFile::Options options;
+      options.metadataCacheDirectory = directory;
+
+      ImageFile imf( fileName, "r", CHECKSUM_POLICY_ALL, options );
+
+      const StructureNode root = imf.root();
+      const VectorNode data3D( root.get( "data3D" ) );
+
+      EXPECT_EQ( data3D.childCount(), 10 );
+      for ( int64_t i = 0; i < data3D.childCount(); ++i )
+      {
+         const StructureNode scan( data3D.get( i ) );
+
+         EXPECT_EQ( IntegerNode( scan.get( "index" ) ).value(), i );
+         EXPECT_EQ( FloatNode( scan.get( "scale" ) ).value(), i * 0.25 );
+      }
+
+      const std::string label = StringNode( root.get( "label" ) ).value();
+
+      imf.close();
+
+      return label;
+   }
+
+   /// Name of the only file in the cache directory, empty if there isn't exactly one
+   std::string entryName( const TemporaryDirectory &directory )
+   {
+      const std::vector<std::string> files = directory.files();
+
+      return ( files.size() == 1 ) ? files[0] : std::string();
+   }
+
+   std::vector<char> readBytes( const std::string &fileName )
+   {
+      std::ifstream in( fileName, std::ios::binary );
+
+      return std::vector<char>( std::istreambuf_iterator<char>( in ), std::istreambuf_iterator<char>() );
+   }
+
+   void writeBytes( const std::string &fileName, const std::vector<char> &bytes )
+   {
+      std::ofstream out( fileName, std::ios::binary | std::ios::trunc );
+
+      out.write( bytes.data(), static_cast<std::streamsize>( bytes.size() ) );
+   }
+
+   ino_t inodeOf( const std::string &fileName )
+   {
+      struct stat st;
+
+      return ( ::stat( fileName.c_str(), &st ) == 0 ) ? st.st_ino : 0;
+   }
+
+   /// Fixture with a file, its cache directory, and the entry made by opening the file once
+   class MetadataCache : public ::testing::Test
+   {
+   protected:
+      void SetUp() override
+      {
+         ASSERT_FALSE( directory_.name().empty() );
+
+         writeFile( file_.name(), "first" );
+
+         ASSERT_EQ( readLabel( file_.name(), directory_.name() ), "first" );
+
+         entry_ = entryName( directory_ );
+         ASSERT_FALSE( entry_.empty() );
+
+         entryBytes_ = readBytes( entry_ );
+      }
+
+      /// The file was opened, and the entry parsed from the XML again and replaced by a good one
+      void expectEntryReplaced( ino_t damagedInode )
+      {
+         EXPECT_EQ( entryName( directory_ ), entry_ );
+         EXPECT_NE( inodeOf( entry_ ), damagedInode );
+         EXPECT_EQ( readBytes( entry_ ), entryBytes_ );
+      }
+
+      TemporaryFile file_;
+      TemporaryDirectory directory_;
+      std::string entry_;
+      std::vector<char> entryBytes_;
+   };
+}
+
+TEST_F( MetadataCache, HitLeavesEntry )
+{
+   const ino_t inode = inodeOf( entry_ );
+
+   EXPECT_EQ( readLabel( file_.name(), directory_.name() ), "first" );
+
+   EXPECT_EQ( inodeOf( entry_ ), inode );
+   EXPECT_EQ( readBytes( entry_ ), entryBytes_ );
+}
+
+TEST_F( MetadataCache, TruncatedEntry )
+{
+   for ( const size_t length : { entryBytes_.size() - 1, entryBytes_.size() / 2, size_t( 10 ), size_t( 0 ) } )
+   {
+      SCOPED_TRACE( "length=" + std::to_string( length ) );
+
+      ASSERT_EQ( ::truncate( entry_.c_str(), static_cast<off_t>( length ) ), 0 );
+      const ino_t inode = inodeOf( entry_ );
+
+      EXPECT_EQ( readLabel( file_.name(), directory_.name() ), "first" );
+      expectEntryReplaced( inode );
+   }
+}
+
+TEST_F( MetadataCache, EntryWithTrailingBytes )
+{
+   std::vector<char> longer = entryBytes_;
+   longer.push_back( 0 );
+   writeBytes( entry_, longer );
+
+   const ino_t inode = inodeOf( entry_ );
+
+   EXPECT_EQ( readLabel( file_.name(), directory_.name() ), "first" );
+   expectEntryReplaced( inode );
+}
+
+/// Every byte of the entry counts: a change in the header, the key or the payload makes it a miss
+TEST_F( MetadataCache, FlippedByte )
+{
+   for ( size_t offset = 0; offset < entryBytes_.size(); ++offset )
+   {
+      SCOPED_TRACE( "offset=" + std::to_string( offset ) );
+
+      std::vector<char> damaged = entryBytes_;
+      damaged[offset] ^= 0x10;
+      writeBytes( entry_, damaged );
+
+      const ino_t inode = inodeOf( entry_ );
+
+      ASSERT_EQ( readLabel( file_.name(), directory_.name() ), "first" );
+      expectEntryReplaced( inode );
+   }
+}
+
+/// Rewriting the file in place with the same size and modification time leaves only the checksum of its XML section
+/// to tell it from the one cached
+TEST_F( MetadataCache, SameSizeRewrite )
+{
+   struct stat before;
+   ASSERT_EQ( ::stat( file_.name().c_str(), &before ), 0 );
+
+   writeFile( file_.name(), "other" );
+
+   struct stat after;
+   ASSERT_EQ( ::stat( file_.name().c_str(), &after ), 0 );
+   ASSERT_EQ( after.st_size, before.st_size );
+   ASSERT_EQ( after.st_ino, before.st_ino );
+
+#if defined( __APPLE__ )
+   const struct timespec times[2] = { before.st_atimespec, before.st_mtimespec };
+#else
+   const struct timespec times[2] = { before.st_atim, before.st_mtim };
+#endif
+   ASSERT_EQ( ::utimensat( AT_FDCWD, file_.name().c_str(), times, 0 ), 0 );
+
+   EXPECT_EQ( readLabel( file_.name(), directory_.name() ), "other" );
+
+   /// The new entry is then used
+   const ino_t inode = inodeOf( entry_ );
+   EXPECT_EQ( readLabel( file_.name(), directory_.name() ), "other" );
+   EXPECT_EQ( inodeOf( entry_ ), inode );
+}
+
+/// Processes and threads opening the file at once all store the entry, one of them ends up in the cache whole and
+/// no temporary file is left
+TEST_F( MetadataCache, ConcurrentWriters )
+{
+   const int rounds = 10;
+
+   for ( int round = 0; round < rounds; ++round )
+   {
+      std::remove( entry_.c_str() );
+
+      std::vector<pid_t> children;
+
+      for ( int child = 0; child < 4; ++child )
+      {
+         const pid_t pid = ::fork();
+         ASSERT_GE( pid, 0 );
+
+         if ( pid == 0 )
+         {
+            bool ok = true;
+
+            try
+            {
+               ok = ( readLabel( file_.name(), directory_.name() ) == "first" );
+            }
+            catch ( E57Exception & )
+            {
+               ok = false;
+            }
+
+            ::_exit( ok ? 0 : 1 );
+         }
+
+         children.push_back( pid );
+      }
+
+      std::atomic<int> failures( 0 );
+      std::vector<std::thread> threads;
+
+      for ( int thread = 0; thread < 4; ++thread )
+      {
+         threads.emplace_back( [&]() {
+            try
+            {
+               if ( readLabel( file_.name(), directory_.name() ) != "first" )
+               {
+                  ++failures;
+               }
+            }
+            catch ( E57Exception & )
+            {
+               ++failures;
+            }
+         } );
+      }
+
+      for ( auto &thread : threads )
+      {
+         thread.join();
+      }
+
+      for ( const pid_t pid : children )
+      {
+         int status = 0;
+
+         ASSERT_EQ( ::waitpid( pid, &status, 0 ), pid );
+         EXPECT_TRUE( WIFEXITED( status ) && ( WEXITSTATUS( status ) == 0 ) );
+      }
+
+      EXPECT_EQ( failures, 0 );
+
+      EXPECT_EQ( entryName( directory_ ), entry_ );
+      EXPECT_EQ( readBytes( entry_ ), entryBytes_ );
+   }
+
+   /// The entry left is used by the next open
+   const ino_t inode = inodeOf( entry_ );
+   EXPECT_EQ( readLabel( file_.name(), directory_.name() ), "first" );
+   EXPECT_EQ( inodeOf( entry_ ), inode );
+}
+
+#endif
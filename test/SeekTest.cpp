@@ -0,0 +1,153 @@
+// SPDX-License-Identifier: MIT
+
+#include <vector>
+
+#include "E57Format.h"
+#include "TestHelpers.h"
+
+using namespace e57;
+
+namespace
+{
+   const int64_t RecordCount = 200000;
+
+   /// x counts the records, y is a scaled integer read raw, and rowIndex and returnCount have minimum == maximum, so
+   /// their bytestreams stay empty.  Seeking mustn't wait for those to reach a byte.
+   void writePoints( const std::string &fileName )
+   {
+      ImageFile imf( fileName, "w" );
+
+      StructureNode prototype( imf );
+      prototype.set( "x", IntegerNode( imf, 0, 0, RecordCount ) );
+      prototype.set( "y", ScaledIntegerNode( imf, 0, -1000000, 1000000, 0.001, 0.0 ) );
+      prototype.set( "rowIndex", IntegerNode( imf, 7, 7, 7 ) );
+      prototype.set( "returnCount", IntegerNode( imf, 1, 1, 1 ) );
+
+      VectorNode codecs( imf, true );
+      CompressedVectorNode points( imf, prototype, codecs );
+      imf.root().set( "points", points );
+
+      std::vector<int64_t> x( RecordCount );
+      std::vector<int64_t> y( RecordCount );
+      std::vector<int64_t> rowIndex( RecordCount, 7 );
+      std::vector<int64_t> returnCount( RecordCount, 1 );
+
+      for ( int64_t i = 0; i < RecordCount; ++i )
+      {
+         x[i] = i;
+         y[i] = ( i * 7919 ) % 2000001 - 1000000;
+      }
+
+      std::vector<SourceDestBuffer> buffers;
+      buffers.emplace_back( imf, "x", x.data(), RecordCount, true );
+      buffers.emplace_back( imf, "y", y.data(), RecordCount, true );
+      buffers.emplace_back( imf, "rowIndex", rowIndex.data(), RecordCount, true );
+      buffers.emplace_back( imf, "returnCount", returnCount.data(), RecordCount, true );
+
+      CompressedVectorWriter writer = points.writer( buffers );
+      writer.write( RecordCount );
+      writer.close();
+
+      imf.close();
+   }
+
+   /// Seek to each record of targets and check the next records read
+   void checkSeeks( const std::string &fileName, const std::vector<int64_t> &targets )
+   {
+      ImageFile imf( fileName, "r" );
+      CompressedVectorNode points( imf.root().get( "points" ) );
+
+      const size_t bufferSize = 1000;
+      std::vector<int64_t> x( bufferSize );
+      std::vector<int64_t> y( bufferSize );
+      std::vector<int64_t> rowIndex( bufferSize );
+      std::vector<int64_t> returnCount( bufferSize );
+
+      std::vector<SourceDestBuffer> buffers;
+      buffers.emplace_back( imf, "x", x.data(), bufferSize, true );
+      buffers.emplace_back( imf, "y", y.data(), bufferSize, true );
+      buffers.emplace_back( imf, "rowIndex", rowIndex.data(), bufferSize, true );
+      buffers.emplace_back( imf, "returnCount", returnCount.data(), bufferSize, true );
+
+      CompressedVectorReader reader = points.reader( buffers );
+
+      for ( const int64_t target : targets )
+      {
+         SCOPED_TRACE( "target=" + std::to_string( target ) );
+
+         reader.seek( target );
+
+         const unsigned count = reader.read();
+
+         ASSERT_EQ( count, static_cast<unsigned>( std::min<int64_t>( bufferSize, RecordCount - target ) ) );
+
+         for ( unsigned i = 0; i < count; ++i )
+         {
+            const int64_t record = target + i;
+
+            ASSERT_EQ( x[i], record );
+            ASSERT_EQ( y[i], ( record * 7919 ) % 2000001 - 1000000 );
+            ASSERT_EQ( rowIndex[i], 7 );
+            ASSERT_EQ( returnCount[i], 1 );
+         }
+      }
+
+      reader.close();
+      imf.close();
+   }
+
+   std::vector<int64_t> seekTargets()
+   {
+      /// Near the start, as a viewer paging through the file does, then jumps both ways, the last record and the end
+      std::vector<int64_t> targets;
+
+      for ( int64_t target = 0; target < 20000; target += 997 )
+      {
+         targets.push_back( target );
+      }
+
+      for ( const int64_t target : { RecordCount / 2, int64_t( 123457 ), int64_t( 5 ), RecordCount - 1000,
+                                     int64_t( 65536 ), RecordCount - 1, RecordCount } )
+      {
+         targets.push_back( target );
+      }
+
+      return targets;
+   }
+}
+
+TEST( Seek, VariableAndConstantFields )
+{
+   TemporaryFile file;
+
+   writePoints( file.name() );
+   checkSeeks( file.name(), seekTargets() );
+}
+
+TEST( Seek, BadRecordNumber )
+{
+   TemporaryFile file;
+
+   writePoints( file.name() );
+
+   ImageFile imf( file.name(), "r" );
+   CompressedVectorNode points( imf.root().get( "points" ) );
+
+   std::vector<int64_t> x( 10 );
+   std::vector<SourceDestBuffer> buffers{ SourceDestBuffer( imf, "x", x.data(), x.size(), true ) };
+
+   CompressedVectorReader reader = points.reader( buffers );
+
+   try
+   {
+      reader.seek( RecordCount + 1 );
+      FAIL() << "seek past the end didn't throw";
+   }
+   catch ( E57Exception &e )
+   {
+      EXPECT_EQ( e.errorCode(), E57_ERROR_BAD_API_ARGUMENT );
+   }
+
+   reader.close();
+   imf.close();
+}
@@ -0,0 +1,36 @@
+#pragma once
+// SPDX-License-Identifier: MIT
+
+#include <cstdio>
+#include <string>
+
+#include "gtest/gtest.h"
+
+/// Name of a file in the temporary directory of the tests, after the test using it so tests run in parallel by ctest
+/// don't share files.  The file is removed when the object goes away.
+class TemporaryFile
+{
+public:
+   explicit TemporaryFile( const std::string &suffix = ".e57" )
+   {
+      const ::testing::TestInfo *test = ::testing::UnitTest::GetInstance()->current_test_info();
+
+      name_ = ::testing::TempDir() + "E57-" + test->test_suite_name() + "-" + test->name() + suffix;
+   }
+
+   ~TemporaryFile()
+   {
+      std::remove( name_.c_str() );
+   }
+
+   TemporaryFile( const TemporaryFile & ) = delete;
+   TemporaryFile &operator=( const TemporaryFile & ) = delete;
+
+   const std::string &name() const
+   {
+      return name_;
+   }
+
+private:
+   std::string name_;
+};
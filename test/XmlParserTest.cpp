@@ -0,0 +1,283 @@
+// SPDX-License-Identifier: MIT
+
+#include <cstring>
+#include <vector>
+
+#include "E57Format.h"
+#include "TestHelpers.h"
+
+using namespace e57;
+
+namespace
+{
+   const size_t PhysicalPageSize = 1024;
+   const size_t LogicalPageSize = PhysicalPageSize - sizeof( uint32_t );
+
+   /// CRC-32C of the E57 standard, bit by bit
+   uint32_t crc32c( const char *data, size_t size )
+   {
+      uint32_t crc = 0xFFFFFFFF;
+
+      for ( size_t i = 0; i < size; ++i )
+      {
+         crc ^= static_cast<uint8_t>( data[i] );
+
+         for ( int bit = 0; bit < 8; ++bit )
+         {
+            crc = ( crc >> 1 ) ^ ( ( crc & 1 ) ? 0x82F63B78 : 0 );
+         }
+      }
+
+      return ~crc;
+   }
+
+   void putLittleEndian( char *p, uint64_t value, size_t size )
+   {
+      for ( size_t i = 0; i < size; ++i )
+      {
+         p[i] = static_cast<char>( value >> ( 8 * i ) );
+      }
+   }
+
+   /// An E57 file in memory whose XML section is xml, just after the header
+   std::vector<char> fileWithXml( const std::string &xml )
+   {
+      const size_t headerSize = 48;
+
+      std::vector<char> logical( headerSize );
+      logical.insert( logical.end(), xml.begin(), xml.end() );
+
+      const size_t pageCount = ( logical.size() + LogicalPageSize - 1 ) / LogicalPageSize;
+      logical.resize( pageCount * LogicalPageSize, ' ' );
+
+      memcpy( logical.data(), "ASTM-E57", 8 );
+      putLittleEndian( &logical[8], 1, 4 );                             // majorVersion
+      putLittleEndian( &logical[12], 0, 4 );                            // minorVersion
+      putLittleEndian( &logical[16], pageCount * PhysicalPageSize, 8 ); // filePhysicalLength
+      putLittleEndian( &logical[24], headerSize, 8 );                   // xmlPhysicalOffset
+      putLittleEndian( &logical[32], xml.size(), 8 );                   // xmlLogicalLength
+      putLittleEndian( &logical[40], PhysicalPageSize, 8 );             // pageSize
+
+      /// Each page ends with the checksum of the page, most significant byte first
+      std::vector<char> file;
+
+      for ( size_t page = 0; page < pageCount; ++page )
+      {
+         const char *data = &logical[page * LogicalPageSize];
+         const uint32_t checksum = crc32c( data, LogicalPageSize );
+
+         file.insert( file.end(), data, data + LogicalPageSize );
+         for ( int shift = 24; shift >= 0; shift -= 8 )
+         {
+            file.push_back( static_cast<char>( checksum >> shift ) );
+         }
+      }
+
+      return file;
+   }
+
+   /// XML section with children as the content of the root
+   std::string document( const std::string &children, const std::string &rootAttributes = "" )
+   {
+      return "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+             "<e57Root type=\"Structure\" xmlns=\"http://www.astm.org/COMMIT/E57/2010-e57-v1.0\"" +
+             rootAttributes + ">\n" + children + "\n</e57Root>\n";
+   }
+
+   /// Open a file made by fileWithXml(), which must outlive the ImageFile
+   ImageFile openFile( const std::vector<char> &file, bool lazyMetadata = false )
+   {
+      ImageFile::Options options;
+      options.lazyMetadata = lazyMetadata;
+
+      return ImageFile( file.data(), file.size(), CHECKSUM_POLICY_ALL, options );
+   }
+
+   ustring stringValue( const ImageFile &imf, const ustring &path )
+   {
+      return StringNode( imf.root().get( path ) ).value();
+   }
+
+   /// Error code of the exception thrown by opening a file whose XML section is xml, or E57_SUCCESS
+   ErrorCode openError( const std::string &xml, ustring *context = nullptr )
+   {
+      const std::vector<char> file = fileWithXml( xml );
+
+      try
+      {
+         ImageFile imf = openFile( file );
+         imf.close();
+      }
+      catch ( E57Exception &e )
+      {
+         if ( context != nullptr )
+         {
+            *context = e.context();
+         }
+         return e.errorCode();
+      }
+
+      return E57_SUCCESS;
+   }
+}
+
+TEST( XmlParser, PlainDocument )
+{
+   const std::vector<char> file = fileWithXml( document( "<name type=\"String\">scan</name>" ) );
+
+   ImageFile imf = openFile( file );
+   EXPECT_EQ( stringValue( imf, "name" ), "scan" );
+   imf.close();
+}
+
+TEST( XmlParser, EntityAndCharacterReferences )
+{
+   const std::vector<char> file =
+      fileWithXml( document( "<text type=\"String\">&lt;&gt;&amp;&quot;&apos; &#65;&#x42;&#x20AC;&#x1F600;</text>\n"
+                             "<count type=\"Integer\" minimum=\"&#49;\" maximum=\"1&#x30;\">&#55;</count>" ) );
+
+   ImageFile imf = openFile( file );
+
+   EXPECT_EQ( stringValue( imf, "text" ), "<>&\"' AB\xE2\x82\xAC\xF0\x9F\x98\x80" );
+
+   const IntegerNode count( imf.root().get( "count" ) );
+   EXPECT_EQ( count.minimum(), 1 );
+   EXPECT_EQ( count.maximum(), 10 );
+   EXPECT_EQ( count.value(), 7 );
+
+   imf.close();
+}
+
+TEST( XmlParser, CData )
+{
+   const std::vector<char> file =
+      fileWithXml( document( "<a type=\"String\"><![CDATA[<&>]]></a>\n"
+                             "<b type=\"String\">x<![CDATA[ &amp; ]]>y&amp;<![CDATA[]]>z</b>\n"
+                             "<c type=\"String\"><![CDATA[]]]]><![CDATA[>]]></c>" ) );
+
+   ImageFile imf = openFile( file );
+
+   EXPECT_EQ( stringValue( imf, "a" ), "<&>" );
+   EXPECT_EQ( stringValue( imf, "b" ), "x &amp; y&z" );
+   EXPECT_EQ( stringValue( imf, "c" ), "]]>" );
+
+   imf.close();
+}
+
+TEST( XmlParser, NamespaceScoping )
+{
+   /// The extension declared on the root is in scope everywhere, one declared on a child only inside it
+   const std::string extension = " xmlns:ext=\"http://example.com/ext\"";
+
+   {
+      const std::vector<char> file = fileWithXml(
+         document( "<ext:a type=\"Integer\">1</ext:a>\n"
+                   "<s type=\"Structure\"><ext:b type=\"Integer\">2</ext:b></s>",
+                   extension ) );
+
+      ImageFile imf = openFile( file );
+
+      ustring uri;
+      EXPECT_TRUE( imf.extensionsLookupPrefix( "ext", uri ) );
+      EXPECT_EQ( uri, "http://example.com/ext" );
+      EXPECT_EQ( IntegerNode( imf.root().get( "ext:a" ) ).value(), 1 );
+      EXPECT_EQ( IntegerNode( imf.root().get( "/s/ext:b" ) ).value(), 2 );
+
+      imf.close();
+   }
+
+   EXPECT_EQ( openError( document( "<s type=\"Structure\" xmlns:in=\"http://example.com/in\"></s>\n"
+                                   "<in:a type=\"Integer\">1</in:a>" ) ),
+              E57_ERROR_XML_PARSER );
+
+   EXPECT_EQ( openError( document( "<undeclared:a type=\"Integer\">1</undeclared:a>" ) ), E57_ERROR_XML_PARSER );
+}
+
+TEST( XmlParser, LineBreakNormalization )
+{
+   /// CR LF and lone CR are read as LF, a character reference to CR is kept
+   const std::vector<char> file =
+      fileWithXml( document( "<a type=\"String\">one\r\ntwo\rthree\nfour</a>\r\n"
+                             "<b type=\"String\"><![CDATA[one\r\ntwo\rthree]]></b>\r"
+                             "<c type=\"String\">one&#13;&#10;two&#xD;</c>" ) );
+
+   ImageFile imf = openFile( file );
+
+   EXPECT_EQ( stringValue( imf, "a" ), "one\ntwo\nthree\nfour" );
+   EXPECT_EQ( stringValue( imf, "b" ), "one\ntwo\nthree" );
+   EXPECT_EQ( stringValue( imf, "c" ), "one\r\ntwo\r" );
+
+   imf.close();
+}
+
+TEST( XmlParser, MalformedXml )
+{
+   const char *const malformed[] = {
+      "<a type=\"Integer\">1</b>",                          // end tag doesn't match
+      "<a type=\"Integer\">1",                              // element not closed
+      "<a type=\"String\">&unknown;</a>",                   // undefined entity
+      "<a type=\"String\">&#0;</a>",                        // reference to a character not allowed in XML
+      "<a type=\"String\">&#xZZ;</a>",                      // bad character reference
+      "<a type=\"String\">&amp</a>",                        // reference without ';'
+      "<a type=\"Integer\" minimum=\"0\" minimum=\"1\">1</a>", // attribute given twice
+      "<a type=\"String\" note=\"<\"></a>",                 // '<' in an attribute value
+      "<a type=\"Integer>1</a>",                            // unterminated attribute value
+      "<a type=Integer>1</a>",                              // unquoted attribute value
+      "<a type=\"String\"><![CDATA[text</a>",               // unterminated CDATA section
+      "<!-- comment <a type=\"Integer\">1</a>",             // unterminated comment
+      "<1a type=\"Integer\">1</1a>",                        // name starting with a digit
+   };
+
+   for ( const char *children : malformed )
+   {
+      SCOPED_TRACE( children );
+
+      EXPECT_EQ( openError( document( children ) ), E57_ERROR_XML_PARSER );
+   }
+
+   EXPECT_EQ( openError( document( "" ) + "<a/>" ), E57_ERROR_XML_PARSER ); // second root element
+   EXPECT_EQ( openError( document( "" ) + "text" ), E57_ERROR_XML_PARSER ); // text after the root
+   EXPECT_EQ( openError( "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n" ), E57_ERROR_XML_PARSER ); // no root
+}
+
+#ifdef E57_BUILTIN_XML_PARSER
+/// Errors are located by line and column in bytes, and by byte offset in the XML section for children whose reading
+/// was put off
+TEST( XmlParser, ErrorPosition )
+{
+   ustring context;
+
+   EXPECT_EQ( openError( document( "<a type=\"Integer\">1</a>\n  <b type=\"Integer\">2</c>" ), &context ),
+              E57_ERROR_XML_PARSER );
+   EXPECT_NE( context.find( "xmlLine=4 xmlColumn=22 " ), ustring::npos ) << context;
+
+   /// A deferred Structure long enough to be put off, with a bad entity near its end
+   std::string children = "<s type=\"Structure\">";
+   for ( int i = 0; i < 20; ++i )
+   {
+      children += "<v" + std::to_string( i ) + " type=\"Integer\">" + std::to_string( i ) + "</v" +
+                  std::to_string( i ) + ">";
+   }
+   children += "<bad type=\"String\">&nope;</bad></s>";
+
+   const std::string xml = document( children );
+   const size_t badOffset = xml.find( "&nope;" );
+
+   const std::vector<char> file = fileWithXml( xml );
+   ImageFile imf = openFile( file, true );
+
+   try
+   {
+      StructureNode( imf.root().get( "s" ) ).childCount();
+      FAIL() << "the error in the deferred children wasn't reported";
+   }
+   catch ( E57Exception &e )
+   {
+      EXPECT_EQ( e.errorCode(), E57_ERROR_XML_PARSER );
+      EXPECT_NE( e.context().find( "xmlOffset=" + std::to_string( badOffset ) + " " ), ustring::npos )
+         << e.context();
+   }
+
+   imf.close();
+}
+#endif